@@ -0,0 +1,331 @@
+#include "async.hpp"
+
+#ifdef STEGASAUR_HAS_COROUTINES
+#include <chrono>
+#include <thread>
+#include "handler.hpp"
+#include "fileio.hpp"
+#include "bufferpool.hpp"
+#include "memorybudget.hpp"
+#include "resultcache.hpp"
+#include "logger.hpp"
+
+//fire-and-forget coroutine used by spawn(), frees itself when it finishes
+struct DetachedTask{
+    struct promise_type{
+        DetachedTask get_return_object(){ return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void(){}
+        void unhandled_exception(){ std::terminate(); }
+    };
+};
+
+//suspends until FileIo completes, then resumes on pool
+//nothing touches the awaiter after the resume is submitted, it may already be gone
+struct FileReadAwaiter{
+    ThreadPool &pool;
+    std::string path;
+    std::vector<unsigned char> &out;
+    bool success = false;
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle){
+        FileIo::instance().readFile(path, [this, handle](bool ok, std::vector<unsigned char> &data){
+            success = ok;
+            out.swap(data);
+            ThreadPool &resume_pool = pool;
+            resume_pool.submit([handle](){ handle.resume(); });
+        });
+    }
+    bool await_resume() const noexcept { return success; }
+};
+
+struct FileWriteAwaiter{
+    ThreadPool &pool;
+    std::string path;
+    std::vector<unsigned char> data;
+    bool success = false;
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle){
+        FileIo::instance().writeFile(path, std::move(data), [this, handle](bool ok){
+            success = ok;
+            ThreadPool &resume_pool = pool;
+            resume_pool.submit([handle](){ handle.resume(); });
+        });
+    }
+    bool await_resume() const noexcept { return success; }
+};
+
+//suspends until MemoryBudget admits bytes, then resumes on pool; the job gives them back with release()
+struct BudgetAwaiter{
+    ThreadPool &pool;
+    size_t bytes;
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle){
+        ThreadPool &resume_pool = pool;
+        MemoryBudget::instance().acquire(bytes, [&resume_pool, handle](){
+            resume_pool.submit([handle](){ handle.resume(); });
+        });
+    }
+    void await_resume() const noexcept {}
+};
+
+static unsigned int computeWorkers(unsigned int workers){
+    if (workers != 0) return workers;
+    unsigned int hardware = std::thread::hardware_concurrency();
+    return hardware == 0 ? 1 : hardware;
+}
+
+static unsigned int ioWorkers(unsigned int workers){
+    //blocking reads/writes mostly wait, so more threads than cores is fine here
+    if (workers != 0) return workers;
+    return computeWorkers(0) * 2;
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point &since){
+    auto now = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(now - since).count();
+    since = now;
+    return seconds;
+}
+
+AsyncRuntime::AsyncRuntime(unsigned int compute_workers, unsigned int io_workers)
+    :   compute_pool(computeWorkers(compute_workers)),
+        io_pool(ioWorkers(io_workers))
+{
+}
+
+AsyncRuntime::~AsyncRuntime(){
+    //both pools must stay alive while a spawned job can still hop between them
+    std::unique_lock<std::mutex> guard(in_flight_lock);
+    in_flight_done.wait(guard, [this](){ return in_flight == 0; });
+}
+
+ResumeOn AsyncRuntime::onCompute(){
+    return ResumeOn{compute_pool};
+}
+
+ResumeOn AsyncRuntime::onIo(){
+    return ResumeOn{io_pool};
+}
+
+//----------STAGES----------//
+//png/jpeg decoding happens inside the read stage, so reads go to the io pool
+//and everything CPU-bound after that to the compute pool
+
+Task<bool> AsyncRuntime::openFiles(Encoder &encoder){
+    co_await onIo();
+    co_return encoder.openFiles();
+}
+
+Task<bool> AsyncRuntime::embed(Encoder &encoder){
+    co_await onCompute();
+    co_return encoder.embed();
+}
+
+Task<bool> AsyncRuntime::write(Encoder &encoder, std::string newFile){
+    co_await onIo();
+    co_return encoder.write(newFile);
+}
+
+Task<bool> AsyncRuntime::openEncodedFile(Decoder &decoder){
+    co_await onIo();
+    co_return decoder.openEncodedFile();
+}
+
+Task<bool> AsyncRuntime::extract(Decoder &decoder){
+    co_await onCompute();
+    co_return decoder.extract();
+}
+
+Task<bool> AsyncRuntime::write(Decoder &decoder, std::string newFile){
+    co_await onIo();
+    co_return decoder.write(newFile);
+}
+
+Task<bool> AsyncRuntime::readFile(const std::string path, std::vector<unsigned char> &out){
+    //named, gcc 12 destroys aggregate temporaries in a co_await twice
+    FileReadAwaiter read{compute_pool, Handler::systemPath(path), out};
+    bool success = co_await read;
+    if (!success) LOG_ERROR("Error: Could not read " << path);
+    co_return success;
+}
+
+Task<bool> AsyncRuntime::writeFile(const std::string path, std::vector<unsigned char> data){
+    FileWriteAwaiter write{compute_pool, Handler::systemPath(path), std::move(data)};
+    bool success = co_await write;
+    if (!success) LOG_ERROR("Error: Failed to write to " << path);
+    co_return success;
+}
+
+//----------JOBS----------//
+//files move through FileIo, the encoder/decoder only ever sees memory
+//job.context is checked inside the encoder/decoder stages and between them, as Engine does:
+//a job stopped before a stage doesn't start it, and one stopped before its write leaves no output
+
+static bool stopping(const EngineJob &job){
+    return job.context && job.context->cancelled();
+}
+
+//a job that failed because its context stopped it reports why, like Engine::finish
+static void noteStopped(const EngineJob &job, EngineResult &result){
+    if (result.success || !stopping(job)) return;
+    result.error = JobError::STOPPED;
+    result.stopped = job.context->reason();
+}
+
+Task<EngineResult> AsyncRuntime::runEncode(EngineJob job, EngineResult result){
+    auto start = std::chrono::steady_clock::now();
+    auto stage_start = start;
+
+    //looked up by the inputs' contents first like Engine, a hit is copied to the output and never decoded
+    //hashing reads both inputs, so it runs on the io pool; outputs to a descriptor are never cached
+    ResultCache &cache = ResultCache::instance();
+    ResultKey key;
+    if (!stopping(job) && cache.enabled() && result.output.rfind("fd:", 0) != 0){
+        co_await onIo();
+        key = cache.keyFor(job.secret, job.carrier, resultSettings(job, result.format), result.format);
+        if (cache.fetch(key, result.output)){
+            LOG_INFO("Console: " << result.output << " served from the result cache");
+            result.success = true;
+            result.cached = true;
+            result.read_seconds = secondsSince(stage_start);
+            result.total_seconds = result.read_seconds;
+            co_return result;
+        }
+    }
+
+    std::vector<unsigned char> secret_bytes, carrier_bytes, output_bytes;
+    bool success = !stopping(job);
+    if (success) success = co_await readFile(job.secret, secret_bytes);
+    if (success) success = co_await readFile(job.carrier, carrier_bytes);
+    Encoder encoder(job.secret, secret_bytes.data(), secret_bytes.size(), job.carrier, carrier_bytes.data(), carrier_bytes.size(),
+                    CarrierCodecs::byExtension(result.format));
+    encoder.setMemoryOutput(&output_bytes);
+    encoder.setPipelined(job.pipelined);
+    encoder.setNativePng(job.native_png);
+    encoder.setWriteProfile(job.profile);
+    encoder.setDeterministic(job.deterministic || cache.enabled());
+    encoder.setScatterKey(job.scatter_key);
+    encoder.setJobContext(job.context);
+    if (success) success = !stopping(job) && encoder.openFiles();
+    result.read_seconds = secondsSince(stage_start);
+    if (success){
+        success = !stopping(job) && encoder.embed();
+        result.embed_seconds = secondsSince(stage_start);
+    }
+    if (success){
+        success = !stopping(job) && encoder.write(result.output);
+        result.profile = encoder.getProfileReport();
+        if (success) success = !stopping(job);
+        if (success) success = co_await writeFile(result.output, std::move(output_bytes));
+        if (success && key.valid){
+            co_await onIo();
+            cache.store(key, result.output);
+        }
+        result.write_seconds = secondsSince(stage_start);
+    }
+    BufferPool::give(secret_bytes);
+    BufferPool::give(carrier_bytes);
+    result.success = success;
+    noteStopped(job, result);
+    result.total_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    co_return result;
+}
+
+Task<EngineResult> AsyncRuntime::runDecode(EngineJob job, EngineResult result){
+    auto start = std::chrono::steady_clock::now();
+    auto stage_start = start;
+
+    std::vector<unsigned char> encoded_bytes, output_bytes;
+    bool success = !stopping(job);
+    if (success) success = co_await readFile(job.encoded, encoded_bytes);
+    Decoder decoder(job.encoded, encoded_bytes.data(), encoded_bytes.size(), CarrierCodecs::byExtension(result.format));
+    decoder.setMemoryOutput(&output_bytes);
+    decoder.setWriteProfile(job.profile);
+    if (job.type == JobType::PROBE) decoder.setNativePng(job.native_png);
+    decoder.setScatterKey(job.scatter_key);
+    decoder.setJobContext(job.context);
+    if (success) success = !stopping(job) && decoder.openEncodedFile();
+    result.read_seconds = secondsSince(stage_start);
+    if (success && job.type == JobType::PROBE){
+        result.capacity = decoder.getCapacity();
+    }
+    else if (success){
+        success = !stopping(job) && decoder.extract();
+        result.embed_seconds = secondsSince(stage_start);
+        if (success) success = !stopping(job) && decoder.write(job.output);
+        result.profile = decoder.getProfileReport();
+        if (success) success = !stopping(job);
+        result.output = job.output + decoder.getSecretExt();
+        if (success) success = co_await writeFile(result.output, std::move(output_bytes));
+        result.write_seconds = secondsSince(stage_start);
+    }
+    BufferPool::give(encoded_bytes);
+    result.success = success;
+    noteStopped(job, result);
+    result.total_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    co_return result;
+}
+
+Task<EngineResult> AsyncRuntime::run(const EngineJob job){
+    //admitted through MemoryBudget like Engine's jobs, with the footprint estimated from the carrier header
+    //files are always read whole here, so an oversized job waits for room rather than switching to a streaming path
+    MemoryBudget &budget = MemoryBudget::instance();
+    const std::string &carrier_name = job.type == JobType::ENCODE ? job.carrier : job.encoded;
+    CarrierShape shape;
+    bool peeked = false;
+    //decodes always read png natively, see Engine::readStage
+    if (budget.limited()) peeked = Handler::peekCarrier(carrier_name, job.type == JobType::DECODE || job.native_png, shape);
+    //the carrier is sniffed once, by the peek when there was one, and the encoder/decoder reuse its format
+    Handler carrier(carrier_name, shape.codec);
+    EngineResult result;
+    result.type = job.type;
+    result.format = carrier.getExt();
+    result.output = job.type == JobType::ENCODE ? carrier.outputPath(job.output) : job.output;
+    size_t estimated = budget.limited() ? estimateJobBytes(job, result.format, shape, peeked) : 0;
+    auto submitted = std::chrono::steady_clock::now();
+    BudgetAwaiter admitted{compute_pool, estimated};
+    co_await admitted;
+    double queued = secondsSince(submitted);
+    try {
+        if (job.type == JobType::ENCODE) result = co_await runEncode(job, result);
+        else result = co_await runDecode(job, result);
+    }
+    catch (...){
+        budget.release(estimated);
+        throw;
+    }
+    budget.release(estimated);
+    result.estimated_bytes = estimated;
+    result.queued_seconds = queued;
+    co_return result;
+}
+
+void AsyncRuntime::finished(){
+    std::lock_guard<std::mutex> guard(in_flight_lock);
+    in_flight--;
+    in_flight_done.notify_all();
+}
+
+void AsyncRuntime::spawn(const EngineJob job, std::function<void(const EngineResult&)> callback){
+    {
+        std::lock_guard<std::mutex> guard(in_flight_lock);
+        in_flight++;
+    }
+    auto detached = [](AsyncRuntime* runtime, Task<EngineResult> task, std::function<void(const EngineResult&)> callback) -> DetachedTask{
+        EngineResult result;
+        try {
+            result = co_await task;
+        }
+        catch (const std::exception &e){
+            LOG_ERROR("Error: Async job failed: " << e.what());
+            result.success = false;
+        }
+        if (callback) callback(result);
+        runtime->finished();
+    };
+    detached(this, run(job), std::move(callback));
+}
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef ASYNC_H
+#define ASYNC_H
+
+//coroutine API, needs -std=c++20 (the stegasaur_async target); compiles to nothing on older standards
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#define STEGASAUR_HAS_COROUTINES 1
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <utility>
+#include <mutex>
+#include <condition_variable>
+#include "threadpool.hpp"
+#include "engine.hpp"
+#include "encoder.hpp"
+#include "decoder.hpp"
+
+//lazy coroutine returning a T, started when awaited
+//the awaiting coroutine resumes on whichever thread finishes the task
+template <typename T>
+class Task{
+    public:
+        struct promise_type{
+            T value{};
+            std::exception_ptr error;
+            std::coroutine_handle<> continuation;
+            Task get_return_object(){ return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            auto final_suspend() noexcept{
+                struct FinalAwaiter{
+                    bool await_ready() noexcept { return false; }
+                    std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept{
+                        std::coroutine_handle<> next = handle.promise().continuation;
+                        return next ? next : std::noop_coroutine();
+                    }
+                    void await_resume() noexcept {}
+                };
+                return FinalAwaiter{};
+            }
+            void return_value(T result){ value = std::move(result); }
+            void unhandled_exception(){ error = std::current_exception(); }
+        };
+
+        Task(Task &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+        Task(const Task&) = delete;
+        Task& operator=(const Task&) = delete;
+        ~Task(){ if (handle) handle.destroy(); }
+
+        bool await_ready() const noexcept { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting){
+            handle.promise().continuation = awaiting;
+            return handle;
+        }
+        T await_resume(){
+            if (handle.promise().error) std::rethrow_exception(handle.promise().error);
+            return std::move(handle.promise().value);
+        }
+    private:
+        explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+        std::coroutine_handle<promise_type> handle;
+};
+
+//co_await resumeOn(pool) moves the rest of the coroutine onto that pool
+struct ResumeOn{
+    ThreadPool &pool;
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle){ pool.submit([handle](){ handle.resume(); }); }
+    void await_resume() const noexcept {}
+};
+
+//runs encode/decode/probe jobs as coroutines
+//jobs suspend on FileIo while their files are read/written and do libpng/libjpeg work and embedding
+//on the compute pool, so a coroutine waiting on disk holds no thread at all
+//jobs are admitted through MemoryBudget and encodes go through ResultCache like Engine's, see Engine
+//the stage awaitables below work on file-backed encoders/decoders and use the io pool for that
+class AsyncRuntime{
+    public:
+        AsyncRuntime(unsigned int compute_workers = 0, unsigned int io_workers = 0);
+        ~AsyncRuntime(); //waits for every spawned job
+        AsyncRuntime(const AsyncRuntime&) = delete;
+        AsyncRuntime& operator=(const AsyncRuntime&) = delete;
+
+        ResumeOn onCompute();
+        ResumeOn onIo();
+
+        //awaitable stages, the encoder/decoder must outlive the await
+        Task<bool> openFiles(Encoder &encoder);
+        Task<bool> embed(Encoder &encoder);
+        Task<bool> write(Encoder &encoder, std::string newFile);
+        Task<bool> openEncodedFile(Decoder &decoder);
+        Task<bool> extract(Decoder &decoder);
+        Task<bool> write(Decoder &decoder, std::string newFile);
+
+        //whole-file io through FileIo, resumes on the compute pool
+        Task<bool> readFile(const std::string path, std::vector<unsigned char> &out);
+        Task<bool> writeFile(const std::string path, std::vector<unsigned char> data);
+
+        //whole job as one coroutine
+        Task<EngineResult> run(const EngineJob job);
+        //start a job without awaiting it, e.g. from an event loop callback
+        void spawn(const EngineJob job, std::function<void(const EngineResult&)> callback);
+    private:
+        ThreadPool compute_pool;
+        ThreadPool io_pool;
+        std::mutex in_flight_lock;
+        std::condition_variable in_flight_done;
+        size_t in_flight = 0;
+        //result comes with its type, format and (encode) output filled in by run(), which sniffed the carrier
+        Task<EngineResult> runEncode(EngineJob job, EngineResult result);
+        Task<EngineResult> runDecode(EngineJob job, EngineResult result);
+        void finished();
+};
+
+#endif
+#endif
@@ -0,0 +1,249 @@
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "batch.hpp"
+#include "logger.hpp"
+
+Batch::Batch(const std::string manifest_name, unsigned int workers){
+    this->manifest_name = manifest_name;
+    this->workers = workers == 0 ? 1 : workers;
+}
+
+static std::string trim(const std::string &s){
+    size_t start = s.find_first_not_of(" \t\r\n");
+    if (start == std::string::npos) return "";
+    size_t end = s.find_last_not_of(" \t\r\n");
+    return s.substr(start, end - start + 1);
+}
+
+bool Batch::loadManifest(){
+    std::ifstream manifest(manifest_name);
+    if (!manifest.is_open()){
+        LOG_ERROR("Error: Could not open manifest " << manifest_name);
+        return false;
+    }
+    //manifest is jsonl if the name says so, otherwise csv
+    std::string lower = manifest_name;
+    for (char &c : lower) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    bool jsonl = lower.find(".jsonl") != std::string::npos || lower.find(".json") != std::string::npos;
+
+    std::string line;
+    size_t line_number = 0;
+    while (std::getline(manifest, line)){
+        line_number++;
+        line = trim(line);
+        //skip blank lines and comments
+        if (line.empty() || line[0] == '#') continue;
+        BatchJob job;
+        job.line = line_number;
+        bool parsed = jsonl ? parseJsonLine(line, job) : parseCsvLine(line, job);
+        if (!parsed){
+            //a csv header row is not an error
+            if (!jsonl && jobs.empty() && (line.rfind("secret", 0) == 0 || line.rfind("encoded", 0) == 0)) continue;
+            LOG_ERROR("Error: " << manifest_name << ":" << line_number << " is not a valid job");
+            return false;
+        }
+        //Engine::submit names an encode's output once it has sniffed the carrier, see EngineResult::output
+        jobs.push_back(job);
+    }
+    if (jobs.empty()){
+        LOG_ERROR("Error: Manifest " << manifest_name << " has no jobs");
+        return false;
+    }
+    LOG_INFO("Console: Loaded " << jobs.size() << " jobs from " << manifest_name);
+    return true;
+}
+
+bool Batch::parseCsvLine(const std::string line, BatchJob &job){
+    //secret,carrier,output for encoding
+    //encoded,output for decoding
+    //fields may be quoted to allow commas in paths
+    std::vector<std::string> fields;
+    std::string field;
+    bool quoted = false;
+    for (size_t i = 0; i < line.size(); ++i){
+        char c = line[i];
+        if (quoted){
+            if (c == '"' && i + 1 < line.size() && line[i + 1] == '"'){ field += '"'; i++; }
+            else if (c == '"'){ quoted = false; }
+            else { field += c; }
+        }
+        else if (c == '"'){ quoted = true; }
+        else if (c == ','){ fields.push_back(trim(field)); field.clear(); }
+        else { field += c; }
+    }
+    fields.push_back(trim(field));
+
+    if (fields.size() == 3){
+        job.encode = true;
+        job.secret = fields[0];
+        job.carrier = fields[1];
+        job.output = fields[2];
+    }
+    else if (fields.size() == 2){
+        job.encode = false;
+        job.encoded = fields[0];
+        job.output = fields[1];
+    }
+    else {
+        return false;
+    }
+    //header rows name the columns instead of files
+    if (job.secret == "secret" || job.encoded == "encoded") return false;
+    for (const std::string &f : fields){
+        if (f.empty()) return false;
+    }
+    return true;
+}
+
+bool Batch::parseJsonLine(const std::string line, BatchJob &job){
+    //only flat objects with string values are supported, e.g.
+    //{"secret": "a.txt", "carrier": "b.png", "output": "c"}
+    size_t i = 0;
+    auto skipSpace = [&](){ while (i < line.size() && (line[i] == ' ' || line[i] == '\t')) i++; };
+    auto readString = [&](std::string &out) -> bool{
+        skipSpace();
+        if (i >= line.size() || line[i] != '"') return false;
+        i++;
+        out.clear();
+        while (i < line.size() && line[i] != '"'){
+            if (line[i] == '\\' && i + 1 < line.size()){
+                i++;
+                switch (line[i]){
+                    case 'n': out += '\n'; break;
+                    case 't': out += '\t'; break;
+                    default: out += line[i]; break; //covers \" \\ and \/
+                }
+            }
+            else {
+                out += line[i];
+            }
+            i++;
+        }
+        if (i >= line.size()) return false;
+        i++; //closing quote
+        return true;
+    };
+
+    skipSpace();
+    if (i >= line.size() || line[i] != '{') return false;
+    i++;
+    while (true){
+        skipSpace();
+        if (i < line.size() && line[i] == '}') break;
+        std::string key, value;
+        if (!readString(key)) return false;
+        skipSpace();
+        if (i >= line.size() || line[i] != ':') return false;
+        i++;
+        if (!readString(value)) return false;
+        if (key == "secret") job.secret = value;
+        else if (key == "carrier") job.carrier = value;
+        else if (key == "encoded") job.encoded = value;
+        else if (key == "output") job.output = value;
+        skipSpace();
+        if (i < line.size() && line[i] == ','){ i++; continue; }
+        if (i < line.size() && line[i] == '}') break;
+        return false;
+    }
+
+    if (job.output.empty()) return false;
+    if (!job.encoded.empty()){
+        job.encode = false;
+        return job.secret.empty() && job.carrier.empty();
+    }
+    job.encode = true;
+    return !job.secret.empty() && !job.carrier.empty();
+}
+
+EngineJob Batch::toEngineJob(const BatchJob &job) const{
+    EngineJob engine_job;
+    engine_job.type = job.encode ? JobType::ENCODE : JobType::DECODE;
+    engine_job.secret = job.secret;
+    engine_job.carrier = job.carrier;
+    engine_job.encoded = job.encoded;
+    engine_job.output = job.output;
+    engine_job.pipelined = pipelined;
+    engine_job.native_png = native_png;
+    engine_job.deterministic = deterministic;
+    engine_job.scatter_key = scatter_key;
+    engine_job.profile = profile;
+    if (timeout > 0){
+        engine_job.context = std::make_shared<JobContext>();
+        engine_job.context->setTimeout(timeout);
+    }
+    return engine_job;
+}
+
+void Batch::report(size_t index){
+    //one line per job, the logger keeps lines from different workers whole
+    const BatchJob &job = jobs[index];
+    const EngineResult &result = results[index];
+    std::string budget_note;
+    if (result.streamed) budget_note += " streamed";
+    if (result.cached) budget_note += " cached";
+    if (result.queued_seconds >= 0.001) budget_note += " after " + std::to_string((long)(result.queued_seconds * 1000.0)) + " ms queued";
+    if (!result.stopped.empty()) budget_note += " " + result.stopped;
+    else if (!result.success) budget_note += " " + jobErrorName(result.error) + (result.error_message.empty() ? "" : ": " + result.error_message);
+    LOG_INFO("Batch: [" << (index + 1) << "/" << jobs.size() << "] "
+             << (result.success ? "OK   " : "FAIL ")
+             << (job.encode ? "encode " + job.carrier : "decode " + job.encoded)
+             << " -> " << result.output
+             << " (" << result.total_seconds * 1000.0 << " ms: read " << result.read_seconds * 1000.0
+             << ", embed " << result.embed_seconds * 1000.0 << ", write " << result.write_seconds * 1000.0 << ")"
+             << (result.profile.empty() ? "" : " [" + result.profile + "]") << budget_note);
+}
+
+bool Batch::run(){
+    results.assign(jobs.size(), EngineResult());
+    unsigned int thread_count = workers;
+    if (thread_count > jobs.size()) thread_count = static_cast<unsigned int>(jobs.size());
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        //leaving this scope waits for every job the engine was given
+        Engine engine(thread_count);
+        for (size_t i = 0; i < jobs.size(); ++i){
+            engine.submit(toEngineJob(jobs[i]), [this, i](const EngineResult &result){
+                results[i] = result;
+                report(i);
+            });
+        }
+    }
+    double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t failed = 0;
+    for (const EngineResult &result : results){
+        if (!result.success) failed++;
+    }
+    LOG_INFO("Batch: " << (jobs.size() - failed) << " succeeded, " << failed << " failed, "
+             << thread_count << " workers, " << total << " s total");
+    return failed == 0;
+}
+
+size_t Batch::getJobCount() const{
+    return jobs.size();
+}
+
+void Batch::setPipelined(bool enabled){
+    pipelined = enabled;
+}
+
+void Batch::setNativePng(bool enabled){
+    native_png = enabled;
+}
+void Batch::setDeterministic(bool enabled){
+    deterministic = enabled;
+}
+void Batch::setScatterKey(const std::string key){
+    scatter_key = key;
+}
+
+void Batch::setWriteProfile(WriteProfile profile){
+    this->profile = profile;
+}
+
+void Batch::setTimeout(double seconds){
+    timeout = seconds;
+}
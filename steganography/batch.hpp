@@ -0,0 +1,46 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <string>
+#include <vector>
+#include "engine.hpp"
+
+//one line of a batch manifest
+//encode jobs use secret + carrier + output, decode jobs use encoded + output
+struct BatchJob{
+    bool encode = true;
+    std::string secret, carrier, encoded, output;
+    size_t line = 0;
+};
+
+class Batch{
+    public:
+        Batch(const std::string manifest_name, unsigned int workers);
+        bool loadManifest();
+        bool run(); //returns false if any job failed
+        size_t getJobCount() const;
+        void setPipelined(bool enabled); //see EngineJob::pipelined
+        void setNativePng(bool enabled); //see EngineJob::native_png
+        void setDeterministic(bool enabled); //see EngineJob::deterministic
+        void setScatterKey(const std::string key); //see EngineJob::scatter_key
+        void setWriteProfile(WriteProfile profile);
+        //deadline for each job, counted from when run() submits it; 0 (the default) is none
+        void setTimeout(double seconds);
+    private:
+        std::string manifest_name;
+        unsigned int workers = 1;
+        bool pipelined = false;
+        bool native_png = false;
+        bool deterministic = false;
+        std::string scatter_key;
+        WriteProfile profile = WriteProfile::SMALLEST;
+        double timeout = 0.0;
+        std::vector<BatchJob> jobs;
+        std::vector<EngineResult> results;
+        bool parseCsvLine(const std::string line, BatchJob &job);
+        bool parseJsonLine(const std::string line, BatchJob &job);
+        EngineJob toEngineJob(const BatchJob &job) const;
+        void report(size_t index);
+};
+
+#endif
@@ -0,0 +1,493 @@
+/*
+ * benchmark executable: generates a deterministic carrier/secret corpus and times every encode/decode phase
+ * built by the bench target in CMakeLists.txt, e.g.
+ *   cmake -S . -B build && cmake --build build --target bench
+ * results are jsonl, one line per (carrier, secret, op, phase); --compare diffs two result files
+ */
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <zlib.h>
+#include <jpeglib.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include "encoder.hpp"
+#include "decoder.hpp"
+#include "pngwriter.hpp"
+#include "writeprofile.hpp"
+#include "fileio.hpp"
+#include "logger.hpp"
+
+static void printUsage(){
+    std::cout << "Usage:" << std::endl
+              << "\t bench [--corpus DIR] [--seed N] [--max-mp N] [--max-wav-mb N] [--repeat N]" << std::endl
+              << "\t       [--profile P] [--native] [--only SUBSTR] [--out FILE] [--generate-only]" << std::endl
+              << "\t bench --compare <old.jsonl> <new.jsonl> [--threshold PCT]" << std::endl
+              << "\t --max-mp caps png/jpeg carriers (1, 4, 16, 64, 200 megapixels; default 4)" << std::endl
+              << "\t --max-wav-mb caps wav carriers (8, 64, 512, 4000 MB; default 64)" << std::endl
+              << "\t --only runs carriers whose file name contains SUBSTR" << std::endl
+              << "\t --compare exits 1 if any phase got slower than the threshold (default 10%)" << std::endl;
+}
+
+//----------CORPUS-----------
+//every file is a pure function of the seed and its name, so corpora from the same seed are byte identical
+//and a file that's already there is kept
+struct Rng{
+    uint64_t state;
+    uint64_t next(){
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+};
+//seeded from the file name only, not the corpus directory
+static Rng rngFor(uint64_t seed, const std::string &path){
+    std::string name = path.substr(path.find_last_of('/') + 1);
+    uint64_t hash = 1469598103934665603ULL;
+    for (unsigned char c : name) hash = (hash ^ c) * 1099511628211ULL;
+    Rng rng{hash ^ (seed * 0x9E3779B97F4A7C15ULL)};
+    if (rng.state == 0) rng.state = 1;
+    return rng;
+}
+
+static bool fileExists(const std::string &path){
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 && info.st_size > 0;
+}
+static uint64_t fileSize(const std::string &path){
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 ? (uint64_t)info.st_size : 0;
+}
+
+//photo-like rows: smooth gradients and bands plus a little noise, so filters and deflate behave realistically
+static void fillRow(unsigned char* row, int width, int height, int y, int channels, int bytes_per_sample, Rng &rng){
+    for (int x = 0; x < width; ++x){
+        for (int c = 0; c < channels; ++c){
+            int value = (x * 200 / width + y * 55 / height + c * 40 + ((x / 16 + y / 16) % 4) * 6) & 0xFF;
+            if (c == 3) value = 255 - (y * 64 / height); //alpha fades slowly
+            else value = std::clamp(value + (int)(rng.next() % 9) - 4, 0, 255);
+            unsigned char* sample = row + ((size_t)x * channels + c) * bytes_per_sample;
+            sample[0] = (unsigned char)value;
+            if (bytes_per_sample == 2) sample[1] = (unsigned char)(rng.next() & 0xFF);
+        }
+    }
+}
+
+static void dimensionsFor(int megapixels, int &width, int &height){
+    width = (int)std::lround(std::sqrt(megapixels * 1e6 * 4.0 / 3.0));
+    height = (int)std::lround(megapixels * 1e6 / width);
+}
+
+static bool generatePng(const std::string &path, uint64_t seed, int megapixels, int channels, int bit_depth){
+    if (fileExists(path)) return true;
+    int width, height;
+    dimensionsFor(megapixels, width, height);
+    Rng rng = rngFor(seed, path);
+    size_t row_bytes = (size_t)width * channels * (bit_depth / 8);
+    std::vector<unsigned char> pixels(row_bytes * height);
+    for (int y = 0; y < height; ++y) fillRow(&pixels[y * row_bytes], width, height, y, channels, bit_depth / 8, rng);
+    FILE* output = fopen(path.c_str(), "wb");
+    if (!output) return false;
+    PngWriter writer(width, height, channels, bit_depth);
+    writer.setCompression(6, Z_FILTERED);
+    writer.setFilter(PngFilter::ADAPTIVE);
+    bool written = writer.write(output, pixels.data(), pixels.size());
+    return fclose(output) == 0 && written;
+}
+
+static bool generateJpeg(const std::string &path, uint64_t seed, int megapixels, int quality){
+    if (fileExists(path)) return true;
+    int width, height;
+    dimensionsFor(megapixels, width, height);
+    Rng rng = rngFor(seed, path);
+    FILE* output = fopen(path.c_str(), "wb");
+    if (!output) return false;
+    struct jpeg_compress_struct compress_info;
+    struct jpeg_error_mgr jpeg_err;
+    compress_info.err = jpeg_std_error(&jpeg_err);
+    jpeg_create_compress(&compress_info);
+    jpeg_stdio_dest(&compress_info, output);
+    compress_info.image_width = width;
+    compress_info.image_height = height;
+    compress_info.input_components = 3;
+    compress_info.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&compress_info);
+    jpeg_set_quality(&compress_info, quality, TRUE);
+    jpeg_start_compress(&compress_info, TRUE);
+    std::vector<unsigned char> row((size_t)width * 3);
+    while (compress_info.next_scanline < compress_info.image_height){
+        fillRow(row.data(), width, height, compress_info.next_scanline, 3, 1, rng);
+        unsigned char* row_ptr = row.data();
+        jpeg_write_scanlines(&compress_info, &row_ptr, 1);
+    }
+    jpeg_finish_compress(&compress_info);
+    jpeg_destroy_compress(&compress_info);
+    return fclose(output) == 0;
+}
+
+static void putLe(unsigned char* out, uint32_t value, int bytes){
+    for (int i = 0; i < bytes; ++i) out[i] = (unsigned char)(value >> (8 * i));
+}
+
+//stereo 44.1 kHz pcm, a slow sweep plus noise, streamed out so multi-GB files never sit in memory
+static bool generateWav(const std::string &path, uint64_t seed, uint64_t megabytes, int bits){
+    if (fileExists(path)) return true;
+    Rng rng = rngFor(seed, path);
+    int sample_bytes = bits / 8, channels = 2, rate = 44100;
+    uint64_t frames = (megabytes << 20) / (sample_bytes * channels);
+    uint32_t data_size = (uint32_t)(frames * sample_bytes * channels);
+    unsigned char header[44];
+    memcpy(header, "RIFF", 4);
+    putLe(header + 4, 36 + data_size, 4);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    putLe(header + 16, 16, 4);
+    putLe(header + 20, 1, 2); //pcm
+    putLe(header + 22, channels, 2);
+    putLe(header + 24, rate, 4);
+    putLe(header + 28, rate * channels * sample_bytes, 4);
+    putLe(header + 32, channels * sample_bytes, 2);
+    putLe(header + 34, bits, 2);
+    memcpy(header + 36, "data", 4);
+    putLe(header + 40, data_size, 4);
+    FILE* output = fopen(path.c_str(), "wb");
+    if (!output) return false;
+    bool written = fwrite(header, 1, sizeof(header), output) == sizeof(header);
+    std::vector<unsigned char> chunk;
+    const uint64_t chunk_frames = 1 << 16;
+    double phase = 0.0;
+    for (uint64_t frame = 0; frame < frames && written; frame += chunk_frames){
+        uint64_t count = std::min(chunk_frames, frames - frame);
+        chunk.resize(count * channels * sample_bytes);
+        for (uint64_t i = 0; i < count; ++i){
+            phase += 2.0 * M_PI * (220.0 + (double)((frame + i) % (rate * 10)) / 50.0) / rate;
+            double level = 0.4 * std::sin(phase);
+            for (int c = 0; c < channels; ++c){
+                double noise = ((double)(rng.next() % 2001) - 1000.0) / 1000.0 * 0.01;
+                int32_t sample = (int32_t)((level + noise) * ((1 << (bits - 1)) - 1));
+                putLe(&chunk[(i * channels + c) * sample_bytes], (uint32_t)sample, sample_bytes);
+            }
+        }
+        written = fwrite(chunk.data(), 1, chunk.size(), output) == chunk.size();
+    }
+    return fclose(output) == 0 && written;
+}
+
+//zeros: one repeated byte, text: words, random: incompressible
+static bool generateSecret(const std::string &path, uint64_t seed, const std::string &kind, size_t size){
+    if (fileExists(path)) return true;
+    static const char* words[] = {"stegasaur ", "carrier ", "payload ", "pixel ", "the ", "of ", "hidden ",
+                                  "message ", "lsb ", "and ", "jpeg ", "sample ", "bit ", "a ", "secret\n"};
+    Rng rng = rngFor(seed, path);
+    std::string data;
+    data.reserve(size + 16);
+    if (kind == "zeros") data.assign(size, '0');
+    else if (kind == "text"){
+        while (data.size() < size) data += words[rng.next() % (sizeof(words) / sizeof(words[0]))];
+    }
+    else {
+        while (data.size() < size) data.push_back((char)(rng.next() >> 56));
+    }
+    data.resize(size);
+    std::ofstream output(path, std::ios::binary);
+    output.write(data.data(), (std::streamsize)data.size());
+    return (bool)output;
+}
+
+struct Carrier{
+    std::string path, name;
+    int megapixels = 0; //0 for wav
+};
+
+static std::vector<Carrier> generateCorpus(const std::string &dir, uint64_t seed, int max_mp, uint64_t max_wav_mb){
+    std::vector<Carrier> carriers;
+    auto add = [&](bool generated, const std::string &name, int megapixels){
+        if (!generated){
+            std::cerr << "Error: Could not generate " << dir << "/" << name << std::endl;
+            return;
+        }
+        carriers.push_back(Carrier{dir + "/" + name, name, megapixels});
+    };
+    struct PngType{ const char* name; int channels, bit_depth; };
+    static const PngType png_types[] = {{"gray8", 1, 8}, {"graya8", 2, 8}, {"rgb8", 3, 8}, {"rgba8", 4, 8}, {"rgb16", 3, 16}};
+    for (int mp : {1, 4, 16, 64, 200}){
+        if (mp > max_mp) break;
+        for (const PngType &type : png_types){
+            //every color type at the smallest size, the common carriers above that
+            if (mp > 1 && type.channels < 3) continue;
+            if (mp > 4 && type.bit_depth == 16) continue;
+            std::string name = "png_" + std::string(type.name) + "_" + std::to_string(mp) + "mp.png";
+            std::cout << "Bench: generating " << name << std::endl;
+            add(generatePng(dir + "/" + name, seed, mp, type.channels, type.bit_depth), name, mp);
+        }
+    }
+    for (int mp : {1, 4, 16}){
+        if (mp > max_mp) break;
+        for (int quality : {50, 75, 90, 95}){
+            std::string name = "jpeg_q" + std::to_string(quality) + "_" + std::to_string(mp) + "mp.jpg";
+            std::cout << "Bench: generating " << name << std::endl;
+            add(generateJpeg(dir + "/" + name, seed, mp, quality), name, mp);
+        }
+    }
+    for (uint64_t mb : {8, 64, 512, 4000}){
+        if (mb > max_wav_mb) break;
+        for (int bits : {16, 24}){
+            std::string name = "wav_" + std::to_string(bits) + "bit_" + std::to_string(mb) + "mb.wav";
+            std::cout << "Bench: generating " << name << std::endl;
+            add(generateWav(dir + "/" + name, seed, mb, bits), name, 0);
+        }
+    }
+    return carriers;
+}
+
+//----------MEASURING-----------
+//Encoder/Decoder narrate through the logger, only their errors get through while a case runs
+struct QuietLog{
+    LogLevel saved;
+    QuietLog(){ saved = Logger::instance().getLevel(); Logger::instance().setLevel(LogLevel::ERROR); }
+    ~QuietLog(){ Logger::instance().setLevel(saved); }
+};
+
+//peak rss is per phase: the high water mark is reset through clear_refs where the kernel allows it,
+//otherwise it's the process peak so far
+static void resetPeakRss(){
+    std::ofstream clear("/proc/self/clear_refs");
+    if (clear) clear << "5";
+}
+static long peakRssKb(){
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)){
+        if (line.rfind("VmHWM:", 0) == 0) return std::atol(line.c_str() + 6);
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+struct Phase{
+    std::string op, name;
+    std::vector<double> seconds;
+    long peak_rss_kb = 0;
+    bool ok = true;
+    Phase(const std::string op, const std::string name) : op(op), name(name) {}
+};
+
+static void timePhase(Phase &phase, std::function<bool()> run){
+    resetPeakRss();
+    auto start = std::chrono::steady_clock::now();
+    bool ok = run();
+    phase.seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    phase.peak_rss_kb = std::max(phase.peak_rss_kb, peakRssKb());
+    phase.ok = phase.ok && ok;
+}
+
+static double median(std::vector<double> values){
+    std::sort(values.begin(), values.end());
+    return values.empty() ? 0.0 : values[values.size() / 2];
+}
+
+static std::vector<unsigned char> readBytes(const std::string &path){
+    std::ifstream input(path, std::ios::binary);
+    return std::vector<unsigned char>((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+}
+
+struct Settings{
+    std::string corpus = "bench_corpus", out = "bench_results.jsonl", only;
+    uint64_t seed = 1;
+    int max_mp = 4, repeat = 3;
+    uint64_t max_wav_mb = 64;
+    WriteProfile profile = WriteProfile::SMALLEST;
+    bool native = false, generate_only = false;
+};
+
+//a quarter of what the carrier holds, so every secret fits whatever the carrier
+static size_t secretSizeFor(const Carrier &carrier, const Settings &settings){
+    QuietLog quiet;
+    Decoder probe(carrier.path);
+    probe.setNativePng(settings.native);
+    if (!probe.openEncodedFile()) return 0;
+    size_t size = probe.getCapacity() / 4;
+    return std::min<size_t>(size, (size_t)64 << 20);
+}
+
+static std::string carrierExt(const std::string &path){
+    return path.substr(path.find_last_of('.'));
+}
+
+//one carrier and secret: encode read/embed/write then decode read/extract/write, both into memory
+static bool runCase(const Carrier &carrier, const std::string &kind, const std::string &secret_path,
+                    const Settings &settings, std::ostream &results){
+    std::vector<Phase> phases = {{"encode", "read"}, {"encode", "embed"}, {"encode", "write"},
+                                 {"decode", "read"}, {"decode", "extract"}, {"decode", "write"}};
+    std::vector<unsigned char> secret = readBytes(secret_path);
+    std::string encoded_name = "bench_encoded" + carrierExt(carrier.path);
+    size_t encoded_size = 0;
+    bool verified = true;
+    for (int r = 0; r < settings.repeat; ++r){
+        QuietLog quiet;
+        std::vector<unsigned char> encoded, decoded;
+        {
+            Encoder encoder(secret_path, carrier.path);
+            encoder.setNativePng(settings.native);
+            encoder.setWriteProfile(settings.profile);
+            encoder.setMemoryOutput(&encoded);
+            timePhase(phases[0], [&](){ return encoder.openFiles(); });
+            timePhase(phases[1], [&](){ return encoder.embed(); });
+            timePhase(phases[2], [&](){ return encoder.write(encoded_name); });
+        }
+        encoded_size = encoded.size();
+        Decoder decoder(encoded_name, encoded.data(), encoded.size());
+        decoder.setMemoryOutput(&decoded);
+        timePhase(phases[3], [&](){ return decoder.openEncodedFile(); });
+        timePhase(phases[4], [&](){ return decoder.extract(); });
+        timePhase(phases[5], [&](){ return decoder.write("bench_secret"); });
+        verified = verified && decoded == secret;
+    }
+    uint64_t carrier_bytes = fileSize(carrier.path);
+    bool ok = verified;
+    for (const Phase &phase : phases){
+        double best = *std::min_element(phase.seconds.begin(), phase.seconds.end());
+        ok = ok && phase.ok;
+        results << "{\"type\":\"result\",\"carrier\":\"" << carrier.name << "\",\"secret\":\"" << kind
+                << "\",\"op\":\"" << phase.op << "\",\"phase\":\"" << phase.name
+                << "\",\"ok\":" << (phase.ok && verified ? "true" : "false")
+                << ",\"carrier_bytes\":" << carrier_bytes << ",\"secret_bytes\":" << secret.size()
+                << ",\"encoded_bytes\":" << encoded_size << ",\"megapixels\":" << carrier.megapixels
+                << ",\"best_seconds\":" << best << ",\"median_seconds\":" << median(phase.seconds)
+                << ",\"mb_per_s\":" << (best > 0 ? carrier_bytes / best / 1e6 : 0.0)
+                << ",\"peak_rss_kb\":" << phase.peak_rss_kb << "}" << std::endl;
+        std::cout << "Bench: " << carrier.name << " " << kind << " " << phase.op << "/" << phase.name
+                  << " " << best * 1000.0 << " ms, peak " << phase.peak_rss_kb / 1024 << " MiB"
+                  << (phase.ok ? "" : " FAILED") << std::endl;
+    }
+    if (!verified) std::cerr << "Error: " << carrier.name << " " << kind << " did not round trip" << std::endl;
+    return ok;
+}
+
+static int runBench(const Settings &settings){
+    mkdir(settings.corpus.c_str(), 0755);
+    std::vector<Carrier> carriers = generateCorpus(settings.corpus, settings.seed, settings.max_mp, settings.max_wav_mb);
+    if (settings.generate_only) return 0;
+    std::ofstream results(settings.out);
+    if (!results){
+        std::cerr << "Error: Could not open " << settings.out << std::endl;
+        return 1;
+    }
+    results.precision(9);
+    results << "{\"type\":\"meta\",\"seed\":" << settings.seed << ",\"repeat\":" << settings.repeat
+            << ",\"profile\":\"" << profileName(settings.profile) << "\",\"native\":" << (settings.native ? "true" : "false")
+            << ",\"threads\":" << std::thread::hardware_concurrency() << ",\"io\":\"" << FileIo::instance().getBackend()
+            << "\",\"time\":" << (long long)time(NULL) << "}" << std::endl;
+    size_t failed = 0, cases = 0;
+    for (const Carrier &carrier : carriers){
+        if (!settings.only.empty() && carrier.name.find(settings.only) == std::string::npos) continue;
+        size_t secret_size = secretSizeFor(carrier, settings);
+        if (secret_size == 0){
+            std::cerr << "Error: " << carrier.name << " has no usable capacity" << std::endl;
+            failed++;
+            continue;
+        }
+        for (const std::string kind : {"zeros", "text", "random"}){
+            std::string secret_path = settings.corpus + "/secret_" + kind + "_" + std::to_string(secret_size) + ".txt";
+            cases++;
+            if (!generateSecret(secret_path, settings.seed, kind, secret_size) || !runCase(carrier, kind, secret_path, settings, results)){
+                failed++;
+            }
+        }
+    }
+    std::cout << "Bench: " << cases - failed << " of " << cases << " cases ok, results in " << settings.out << std::endl;
+    return failed == 0 ? 0 : 1;
+}
+
+//----------COMPARING-----------
+//just enough json for the lines runBench writes: a string or number value after "key":
+static std::string jsonField(const std::string &line, const std::string &key){
+    size_t at = line.find("\"" + key + "\":");
+    if (at == std::string::npos) return "";
+    at += key.size() + 3;
+    if (at < line.size() && line[at] == '"'){
+        size_t end = line.find('"', at + 1);
+        return end == std::string::npos ? "" : line.substr(at + 1, end - at - 1);
+    }
+    size_t end = line.find_first_of(",}", at);
+    return line.substr(at, end == std::string::npos ? std::string::npos : end - at);
+}
+
+static bool loadResults(const std::string &path, std::map<std::string, double> &best){
+    std::ifstream input(path);
+    if (!input){
+        std::cerr << "Error: Could not open " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(input, line)){
+        if (jsonField(line, "type") != "result") continue;
+        std::string key = jsonField(line, "carrier") + " " + jsonField(line, "secret") + " " +
+                          jsonField(line, "op") + "/" + jsonField(line, "phase");
+        best[key] = std::atof(jsonField(line, "best_seconds").c_str());
+    }
+    return true;
+}
+
+static int runCompare(const std::string &old_path, const std::string &new_path, double threshold){
+    std::map<std::string, double> before, after;
+    if (!loadResults(old_path, before) || !loadResults(new_path, after)) return 1;
+    size_t regressions = 0;
+    for (const auto &entry : after){
+        auto previous = before.find(entry.first);
+        if (previous == before.end() || previous->second <= 0) continue;
+        double change = (entry.second / previous->second - 1.0) * 100.0;
+        //sub-millisecond phases are all noise
+        bool regressed = change > threshold && entry.second - previous->second > 0.001;
+        if (regressed) regressions++;
+        std::cout << "Bench: " << entry.first << " " << previous->second * 1000.0 << " -> " << entry.second * 1000.0
+                  << " ms (" << (change >= 0 ? "+" : "") << change << "%)" << (regressed ? " REGRESSION" : "") << std::endl;
+    }
+    std::cout << "Bench: " << regressions << " regressions over " << threshold << "%" << std::endl;
+    return regressions == 0 ? 0 : 1;
+}
+
+int main(int argc, char* argv[]){
+    Settings settings;
+    std::vector<std::string> args(argv + 1, argv + argc);
+    if (!args.empty() && args[0] == "--compare"){
+        if (args.size() != 3 && !(args.size() == 5 && args[3] == "--threshold")){ printUsage(); return 1; }
+        double threshold = args.size() == 5 ? std::atof(args[4].c_str()) : 10.0;
+        return runCompare(args[1], args[2], threshold);
+    }
+    for (size_t i = 0; i < args.size(); ++i){
+        const std::string &arg = args[i];
+        bool has_value = i + 1 < args.size();
+        try {
+            if (arg == "--corpus" && has_value){ settings.corpus = args[++i]; }
+            else if (arg == "--out" && has_value){ settings.out = args[++i]; }
+            else if (arg == "--only" && has_value){ settings.only = args[++i]; }
+            else if (arg == "--seed" && has_value){ settings.seed = std::stoull(args[++i]); }
+            else if (arg == "--max-mp" && has_value){ settings.max_mp = std::stoi(args[++i]); }
+            else if (arg == "--max-wav-mb" && has_value){ settings.max_wav_mb = std::stoull(args[++i]); }
+            else if (arg == "--repeat" && has_value){ settings.repeat = std::max(1, std::stoi(args[++i])); }
+            else if (arg == "--profile" && has_value){
+                if (!parseWriteProfile(args[++i], settings.profile)){ printUsage(); return 1; }
+            }
+            else if (arg == "--native"){ settings.native = true; }
+            else if (arg == "--generate-only"){ settings.generate_only = true; }
+            else { printUsage(); return 1; }
+        }
+        catch (...) { printUsage(); return 1; }
+    }
+    return runBench(settings);
+}
@@ -0,0 +1,153 @@
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <cstdlib>
+#include <cstdint>
+#include <sys/mman.h>
+#include "bufferpool.hpp"
+
+//buffers below 64 KiB are cheap for malloc and not worth holding on to
+static const int MIN_SHIFT = 16;
+static const int MAX_SHIFT = 31;
+static const int CLASS_COUNT = MAX_SHIFT - MIN_SHIFT + 1;
+static const size_t CACHE_BYTES = (size_t)1 << 30;
+static const size_t HUGE_PAGE_SIZE = (size_t)2 << 20;
+
+static bool pooled(size_t capacity){
+    return capacity >= ((size_t)1 << MIN_SHIFT) && capacity < ((size_t)2 << MAX_SHIFT);
+}
+//class k holds capacities in [2^(k+MIN_SHIFT), 2^(k+MIN_SHIFT+1))
+static int sizeClass(size_t size){
+    int shift = 0;
+    while (shift < MAX_SHIFT && ((size_t)2 << shift) <= size) ++shift;
+    return shift < MIN_SHIFT ? 0 : shift - MIN_SHIFT;
+}
+
+struct FreeLists{
+    std::vector<std::vector<unsigned char>> classes[CLASS_COUNT];
+    size_t bytes = 0;
+    //only looks one class up, so a small request never pins a huge buffer
+    bool pop(size_t size, std::vector<unsigned char> &out){
+        int first = sizeClass(size);
+        for (int c = first; c <= first + 1 && c < CLASS_COUNT; ++c){
+            std::vector<std::vector<unsigned char>> &list = classes[c];
+            for (size_t i = list.size(); i-- > 0;){
+                if (list[i].capacity() < size) continue;
+                out.swap(list[i]);
+                list[i].swap(list.back());
+                list.pop_back();
+                bytes -= out.capacity();
+                return true;
+            }
+        }
+        return false;
+    }
+    //freed buffers are moved into out so the caller can release them after unlocking
+    void trim(size_t limit, std::vector<std::vector<unsigned char>> &out){
+        for (int c = CLASS_COUNT - 1; c >= 0 && bytes > limit; --c){
+            std::vector<std::vector<unsigned char>> &list = classes[c];
+            while (!list.empty() && bytes > limit){
+                bytes -= list.back().capacity();
+                out.push_back(std::move(list.back()));
+                list.pop_back();
+            }
+        }
+    }
+    bool push(std::vector<unsigned char> &buffer, size_t limit){
+        size_t capacity = buffer.capacity();
+        if (bytes + capacity > limit) return false;
+        std::vector<std::vector<unsigned char>> &list = classes[sizeClass(capacity)];
+        list.emplace_back();
+        list.back().swap(buffer);
+        bytes += capacity;
+        return true;
+    }
+};
+
+//one list for the whole process: buffers usually change threads (read on the io thread, freed on
+//a worker) and only a handful do per job, so a per-thread cache would miss and the lock never contends
+//never destroyed, FileIo requests can still hand buffers back during static destruction
+struct SharedLists{
+    std::mutex lock;
+    FreeLists lists;
+};
+static SharedLists& shared(){
+    static SharedLists* lists = new SharedLists();
+    return *lists;
+}
+
+static std::atomic<int> huge_pages{-1};
+static bool hugePages(){
+    int enabled = huge_pages.load(std::memory_order_relaxed);
+    if (enabled < 0){
+        const char* setting = getenv("STEGASAUR_HUGEPAGES");
+        enabled = setting && std::string(setting) == "1";
+        huge_pages.store(enabled, std::memory_order_relaxed);
+    }
+    return enabled == 1;
+}
+
+//advice has to come before the first touch, so this runs between reserve() and resize()
+static void adviseHugePages(std::vector<unsigned char> &buffer){
+#ifdef MADV_HUGEPAGE
+    if (!hugePages() || buffer.capacity() < HUGE_PAGE_SIZE) return;
+    uintptr_t start = ((uintptr_t)buffer.data() + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+    uintptr_t end = ((uintptr_t)buffer.data() + buffer.capacity()) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+    if (end > start) madvise((void*)start, end - start, MADV_HUGEPAGE);
+#else
+    (void)buffer;
+#endif
+}
+
+std::vector<unsigned char> BufferPool::take(size_t size){
+    if (!pooled(size)) return std::vector<unsigned char>(size);
+    std::vector<unsigned char> buffer;
+    bool found;
+    {
+        SharedLists &pool = shared();
+        std::lock_guard<std::mutex> guard(pool.lock);
+        found = pool.lists.pop(size, buffer);
+    }
+    if (!found){
+        buffer.reserve(size);
+        adviseHugePages(buffer);
+    }
+    //recycled buffers keep their old length, shrinking to size writes nothing
+    buffer.resize(size);
+    return buffer;
+}
+
+void BufferPool::give(std::vector<unsigned char> &buffer){
+    if (pooled(buffer.capacity())){
+        SharedLists &pool = shared();
+        std::lock_guard<std::mutex> guard(pool.lock);
+        if (pool.lists.push(buffer, CACHE_BYTES)) return;
+    }
+    std::vector<unsigned char>().swap(buffer);
+}
+
+void BufferPool::resize(std::vector<unsigned char> &buffer, size_t size){
+    if (buffer.capacity() >= size){
+        buffer.resize(size);
+        return;
+    }
+    give(buffer);
+    buffer = take(size);
+}
+
+void BufferPool::setHugePages(bool enabled){
+    huge_pages.store(enabled ? 1 : 0, std::memory_order_relaxed);
+}
+
+size_t BufferPool::getCachedBytes(){
+    SharedLists &pool = shared();
+    std::lock_guard<std::mutex> guard(pool.lock);
+    return pool.lists.bytes;
+}
+
+void BufferPool::trim(size_t max_bytes){
+    std::vector<std::vector<unsigned char>> freed;
+    SharedLists &pool = shared();
+    std::lock_guard<std::mutex> guard(pool.lock);
+    pool.lists.trim(max_bytes, freed);
+}
@@ -0,0 +1,27 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <vector>
+#include <cstddef>
+
+//size-classed pool of carrier-sized byte buffers that are recycled instead of freed
+//a job's buffers (file bytes, pixel data, payload, output) go back here when its Handler/Encoder/Decoder
+//and FileIo requests are destroyed, so the next job on the worker reuses already faulted-in memory
+//up to 1 GiB is kept, anything past that is freed
+//with STEGASAUR_HUGEPAGES=1 (or setHugePages) new large buffers are backed by transparent huge pages
+class BufferPool{
+    public:
+        //buffer of exactly size bytes; recycled contents are whatever the last user left
+        static std::vector<unsigned char> take(size_t size);
+        //hands buffer's memory back, leaves buffer empty
+        static void give(std::vector<unsigned char> &buffer);
+        //for buffers about to be overwritten: resize(size) that swaps in a pooled buffer when the
+        //capacity is too small, the old contents are not kept in that case
+        static void resize(std::vector<unsigned char> &buffer, size_t size);
+        static void setHugePages(bool enabled);
+        static size_t getCachedBytes();
+        //frees idle buffers, largest first, until at most max_bytes are held; see MemoryBudget
+        static void trim(size_t max_bytes);
+};
+
+#endif
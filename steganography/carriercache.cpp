@@ -0,0 +1,107 @@
+#include <string>
+#include <cstdlib>
+#include <sys/stat.h>
+#include "carriercache.hpp"
+#include "bufferpool.hpp"
+
+static const size_t DEFAULT_BUDGET = (size_t)256 << 20;
+
+DecodedCarrier::~DecodedCarrier(){
+    BufferPool::give(data);
+}
+size_t DecodedCarrier::bytes() const{
+    return data.size() + header.size();
+}
+
+CarrierCache::CarrierCache(){
+    budget = DEFAULT_BUDGET;
+    const char* setting = getenv("STEGASAUR_CARRIER_CACHE");
+    if (setting){
+        char* end = nullptr;
+        unsigned long long mib = strtoull(setting, &end, 10);
+        if (end != setting && *end == '\0') budget = (size_t)mib << 20;
+    }
+}
+
+CarrierCache& CarrierCache::instance(){
+    static CarrierCache shared;
+    return shared;
+}
+
+CarrierKey CarrierCache::keyFor(const std::string path){
+    CarrierKey key;
+    key.path = path;
+    struct stat info;
+    if (path.rfind("fd:", 0) == 0 || stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) return key;
+    key.size = (uint64_t)info.st_size;
+    key.mtime_ns = (int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+    key.valid = true;
+    return key;
+}
+
+static std::string entryName(const CarrierKey &key, CarrierKind kind){
+    return std::to_string((int)kind) + ":" + key.path;
+}
+
+std::shared_ptr<const DecodedCarrier> CarrierCache::find(const CarrierKey &key, CarrierKind kind){
+    if (!key.valid) return nullptr;
+    std::lock_guard<std::mutex> guard(lock);
+    auto found = index.find(entryName(key, kind));
+    if (found == index.end()) return nullptr;
+    std::list<Entry>::iterator entry = found->second;
+    if (entry->key.size != key.size || entry->key.mtime_ns != key.mtime_ns){
+        cached_bytes -= entry->carrier->bytes();
+        index.erase(found);
+        entries.erase(entry);
+        return nullptr;
+    }
+    entries.splice(entries.begin(), entries, entry);
+    return entry->carrier;
+}
+
+void CarrierCache::insert(const CarrierKey &key, CarrierKind kind, std::shared_ptr<const DecodedCarrier> carrier){
+    if (!key.valid || !carrier) return;
+    std::lock_guard<std::mutex> guard(lock);
+    if (carrier->bytes() > budget) return;
+    std::string name = entryName(key, kind);
+    auto found = index.find(name);
+    if (found != index.end()){
+        cached_bytes -= found->second->carrier->bytes();
+        entries.erase(found->second);
+        index.erase(found);
+    }
+    evict(budget - carrier->bytes());
+    entries.push_front(Entry{name, key, carrier});
+    index[name] = entries.begin();
+    cached_bytes += carrier->bytes();
+}
+
+//least recently used go first until at most limit bytes are left, caller holds lock
+void CarrierCache::evict(size_t limit){
+    while (cached_bytes > limit && !entries.empty()){
+        cached_bytes -= entries.back().carrier->bytes();
+        index.erase(entries.back().name);
+        entries.pop_back();
+    }
+}
+
+bool CarrierCache::enabled() const{
+    std::lock_guard<std::mutex> guard(lock);
+    return budget > 0;
+}
+
+void CarrierCache::setBudget(size_t bytes){
+    std::lock_guard<std::mutex> guard(lock);
+    budget = bytes;
+    evict(budget);
+}
+
+size_t CarrierCache::getBudget() const{
+    std::lock_guard<std::mutex> guard(lock);
+    return budget;
+}
+
+size_t CarrierCache::getCachedBytes() const{
+    std::lock_guard<std::mutex> guard(lock);
+    return cached_bytes;
+}
@@ -0,0 +1,69 @@
+#ifndef CARRIERCACHE_H
+#define CARRIERCACHE_H
+
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+//what a carrier was decoded into, png carriers decode differently with Handler::setNativePng
+enum class CarrierKind{ PNG_RGBA, PNG_NATIVE, WAV, JPEG_COEFFICIENTS };
+
+//identity of a carrier file: same path, size and modification time is taken to mean same contents
+struct CarrierKey{
+    std::string path;
+    uint64_t size = 0;
+    int64_t mtime_ns = 0;
+    bool valid = false; //false when the file couldn't be stat'ed, nothing is cached for it
+};
+
+//a decoded carrier, shared read-only by every job that hits it
+struct DecodedCarrier{
+    std::vector<unsigned char> data; //png pixels, the whole wav file, or jpeg coefficient blocks row by row
+    std::vector<unsigned char> header; //jpeg only: the file up to the end of its first SOS segment
+    int width = 0, height = 0, channels = 4, bit_depth = 8;
+    size_t wav_data_offset = 0;
+    uint32_t wav_data_size = 0;
+    ~DecodedCarrier(); //hands data back to BufferPool
+    size_t bytes() const;
+};
+
+//in-process LRU cache of decoded carriers, so a template carrier reused for many secrets is decoded once
+//bounded by a byte budget: 256 MiB unless STEGASAUR_CARRIER_CACHE=<MiB> says otherwise, 0 turns it off
+//evicted entries stay alive for jobs still holding them
+class CarrierCache{
+    public:
+        CarrierCache(const CarrierCache&) = delete;
+        CarrierCache& operator=(const CarrierCache&) = delete;
+        static CarrierCache& instance();
+        //stats path, fd:<n> names are never cached since the descriptor may be a pipe
+        static CarrierKey keyFor(const std::string path);
+
+        //null on a miss, a stale entry (file changed since) is dropped on the way
+        std::shared_ptr<const DecodedCarrier> find(const CarrierKey &key, CarrierKind kind);
+        //replaces any entry for the same path and kind, ignored if it alone is over budget
+        void insert(const CarrierKey &key, CarrierKind kind, std::shared_ptr<const DecodedCarrier> carrier);
+        bool enabled() const;
+        void setBudget(size_t bytes); //evicts down to the new budget
+        size_t getBudget() const;
+        size_t getCachedBytes() const;
+    private:
+        CarrierCache();
+        struct Entry{
+            std::string name; //path and kind
+            CarrierKey key;
+            std::shared_ptr<const DecodedCarrier> carrier;
+        };
+        mutable std::mutex lock;
+        std::list<Entry> entries; //most recently used first
+        std::unordered_map<std::string, std::list<Entry>::iterator> index;
+        size_t cached_bytes = 0;
+        size_t budget;
+        void evict(size_t limit);
+};
+
+#endif
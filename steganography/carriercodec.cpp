@@ -0,0 +1,209 @@
+#include <deque>
+#include <cstring>
+#include <cstdint>
+#include <cctype>
+#include <algorithm>
+#include <cstdio>
+#include <jpeglib.h>
+#include "carriercodec.hpp"
+#include "handler.hpp"
+
+static uint32_t bigEndian32(const unsigned char* bytes){
+    return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+}
+
+static const unsigned char PNG_SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+static bool sniffPng(const unsigned char* head, size_t size){
+    return size >= 8 && memcmp(head, PNG_SIGNATURE, 8) == 0;
+}
+//SOI followed by the start of the next marker
+static bool sniffJpeg(const unsigned char* head, size_t size){
+    return size >= 3 && head[0] == 0xFF && head[1] == 0xD8 && head[2] == 0xFF;
+}
+static bool sniffWav(const unsigned char* head, size_t size){
+    return size >= 12 && memcmp(head, "RIFF", 4) == 0 && memcmp(head + 8, "WAVE", 4) == 0;
+}
+static bool sniffBmp(const unsigned char* head, size_t size){
+    return size >= 2 && head[0] == 'B' && head[1] == 'M';
+}
+//binary pgm (P5) or ppm (P6), the magic is followed by whitespace
+static bool sniffPnm(const unsigned char* head, size_t size){
+    return size >= 3 && head[0] == 'P' && (head[1] == '5' || head[1] == '6') && std::isspace(head[2]);
+}
+
+//IHDR plus any tRNS ahead of the first IDAT, channels as readPng would leave them
+static bool pngShape(const unsigned char* data, size_t size, bool native_png, CarrierShape &shape){
+    if (size < 33 || !sniffPng(data, size) || memcmp(data + 12, "IHDR", 4) != 0) return false;
+    shape.width = (int)bigEndian32(data + 16);
+    shape.height = (int)bigEndian32(data + 20);
+    int bit_depth = data[24], color_type = data[25];
+    bool transparency = false;
+    for (size_t pos = 33; pos + 8 <= size; ){
+        uint32_t length = bigEndian32(data + pos);
+        if (memcmp(data + pos + 4, "IDAT", 4) == 0) break;
+        if (memcmp(data + pos + 4, "tRNS", 4) == 0) transparency = true;
+        pos += (size_t)length + 12;
+    }
+    static const int color_channels[7] = {1, 0, 3, 3, 2, 0, 4}; //palettes expand to rgb
+    if (color_type > 6 || color_channels[color_type] == 0) return false;
+    shape.channels = native_png ? color_channels[color_type] + (transparency ? 1 : 0) : 4;
+    shape.bit_depth = native_png && bit_depth == 16 ? 16 : 8;
+    shape.decoded_bytes = (size_t)shape.width * shape.height * shape.channels * (shape.bit_depth / 8);
+    return true;
+}
+//frame header of a baseline/progressive jpeg, coefficient blocks per component as libjpeg sizes them
+static bool jpegShape(const unsigned char* data, size_t size, CarrierShape &shape){
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) return false;
+    size_t pos = 2;
+    while (pos + 4 <= size){
+        if (data[pos] != 0xFF) return false;
+        unsigned char marker = data[pos + 1];
+        if (marker == 0xFF){ ++pos; continue; }
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)){ pos += 2; continue; }
+        size_t length = ((size_t)data[pos + 2] << 8) | data[pos + 3];
+        bool frame = marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+        if (!frame){
+            if (marker == 0xDA) return false; //scan data before any frame header
+            pos += 2 + length;
+            continue;
+        }
+        const unsigned char* frame_header = data + pos + 4;
+        if (pos + 2 + length > size || length < 8) return false;
+        shape.height = (frame_header[1] << 8) | frame_header[2];
+        shape.width = (frame_header[3] << 8) | frame_header[4];
+        shape.channels = frame_header[5];
+        shape.bit_depth = frame_header[0];
+        if (length < 8 + (size_t)shape.channels * 3 || shape.channels == 0) return false;
+        int max_h = 1, max_v = 1;
+        for (int c = 0; c < shape.channels; ++c){
+            max_h = std::max(max_h, frame_header[7 + c * 3] >> 4);
+            max_v = std::max(max_v, frame_header[7 + c * 3] & 15);
+        }
+        shape.decoded_bytes = 0;
+        for (int c = 0; c < shape.channels; ++c){
+            int h = frame_header[7 + c * 3] >> 4, v = frame_header[7 + c * 3] & 15;
+            size_t width_in_blocks = ((size_t)shape.width * h + max_h * 8 - 1) / (max_h * 8);
+            size_t height_in_blocks = ((size_t)shape.height * v + max_v * 8 - 1) / (max_v * 8);
+            shape.decoded_bytes += width_in_blocks * height_in_blocks * sizeof(JBLOCK);
+        }
+        return true;
+    }
+    return false;
+}
+
+//one payload bit per sample, 16-bit samples only give up their low byte
+static size_t pngCapacity(const CarrierShape &shape){
+    return shape.decoded_bytes / (shape.bit_depth == 16 ? 2 : 1) / 8;
+}
+//every coefficient counted, the ones that are 0 or 1 and get skipped are only known once decoded
+static size_t jpegCapacity(const CarrierShape &shape){
+    return shape.decoded_bytes / sizeof(JBLOCK) * DCTSIZE2 / 8;
+}
+//headers counted as samples, so a little over
+static size_t fileCapacity(const CarrierShape &shape){
+    return shape.decoded_bytes / 8;
+}
+
+static std::deque<CarrierCodec> builtinCodecs(){
+    std::deque<CarrierCodec> codecs;
+    CarrierCodec png;
+    png.name = "PNG";
+    png.ext = ".png";
+    png.sniff = sniffPng;
+    png.pipelined = true;
+    png.read = [](Handler &handler){ return handler.readPng(); };
+    png.write = [](Handler &handler, const std::string name){ return handler.writePng(name); };
+    png.take = [](Handler &handler){ return handler.takeLsbBytes(); };
+    png.put = [](Handler &handler, std::vector<unsigned char> bytes){ handler.setLsbBytes(std::move(bytes)); };
+    png.shape = pngShape;
+    png.capacity = pngCapacity;
+    codecs.push_back(png);
+
+    //only the coefficients are read and written, pixels are never decoded
+    CarrierCodec jpeg;
+    jpeg.name = "JPEG";
+    jpeg.ext = ".jpeg";
+    jpeg.aliases = {".jpg"};
+    jpeg.sniff = sniffJpeg;
+    jpeg.method = EmbedMethod::DCT;
+    jpeg.read = [](Handler &handler){ return handler.readJpegCoefficients(); };
+    jpeg.write = [](Handler &handler, const std::string name){ return handler.writeJpegCoefficients(name); };
+    jpeg.shape = [](const unsigned char* head, size_t size, bool, CarrierShape &shape){ return jpegShape(head, size, shape); };
+    jpeg.capacity = jpegCapacity;
+    codecs.push_back(jpeg);
+
+    //the data chunk's samples are copied out and spliced back into the file
+    CarrierCodec wav;
+    wav.name = "WAV";
+    wav.ext = ".wav";
+    wav.sniff = sniffWav;
+    wav.streamed = true;
+    wav.read = [](Handler &handler){ return handler.readWav(); };
+    wav.write = [](Handler &handler, const std::string name){ return handler.writeWav(name); };
+    wav.take = [](Handler &handler){ return handler.getWavSampleData(); };
+    wav.put = [](Handler &handler, std::vector<unsigned char> bytes){ handler.setWavSampleData(std::move(bytes)); };
+    wav.capacity = fileCapacity;
+    codecs.push_back(wav);
+
+    //uncompressed formats are embedded in place, see Handler::readRaw
+    CarrierCodec raw;
+    raw.streamed = true;
+    raw.read = [](Handler &handler){ return handler.readRaw(); };
+    raw.write = [](Handler &handler, const std::string name){ return handler.writeRaw(name); };
+    raw.capacity = fileCapacity;
+    CarrierCodec bmp = raw;
+    bmp.name = "BMP";
+    bmp.ext = ".bmp";
+    bmp.sniff = sniffBmp;
+    codecs.push_back(bmp);
+    CarrierCodec pnm = raw;
+    pnm.name = "PNM";
+    pnm.ext = ".ppm";
+    pnm.aliases = {".pgm"};
+    pnm.sniff = sniffPnm;
+    codecs.push_back(pnm);
+    CarrierCodec pcm = raw;
+    pcm.name = "PCM";
+    pcm.ext = ".pcm";
+    pcm.aliases = {".raw"};
+    codecs.push_back(pcm);
+    return codecs;
+}
+
+static std::deque<CarrierCodec>& registry(){
+    static std::deque<CarrierCodec> codecs = builtinCodecs();
+    return codecs;
+}
+
+void CarrierCodecs::add(const CarrierCodec codec){
+    registry().push_back(codec);
+}
+
+const CarrierCodec* CarrierCodecs::byExtension(const std::string ext){
+    if (ext.empty()) return nullptr;
+    for (const CarrierCodec &codec : registry()){
+        if (codec.ext == ext) return &codec;
+        for (const std::string &alias : codec.aliases){
+            if (alias == ext) return &codec;
+        }
+    }
+    return nullptr;
+}
+
+const CarrierCodec* CarrierCodecs::sniff(const unsigned char* head, size_t size){
+    if (!head || size == 0) return nullptr;
+    for (const CarrierCodec &codec : registry()){
+        if (codec.sniff && codec.sniff(head, size)) return &codec;
+    }
+    return nullptr;
+}
+
+std::string CarrierCodecs::extensionOf(const std::string name){
+    size_t dot = name.find_last_of('.');
+    size_t sep = name.find_last_of("\\/");
+    if (dot == std::string::npos || (sep != std::string::npos && dot < sep)) return "";
+    std::string ext = name.substr(dot);
+    for (char &c : ext) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    return ext;
+}
@@ -0,0 +1,56 @@
+#ifndef CARRIERCODEC_H
+#define CARRIERCODEC_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <functional>
+
+class Handler;
+struct CarrierShape;
+
+//LSB: payload bit i replaces the lsb of carrier byte i (pixels, samples)
+//DCT: payload bits replace the lsbs of the jpeg coefficients that aren't 0 or 1 (JSteg)
+enum class EmbedMethod{ LSB, DCT };
+
+//one carrier format: how it's recognized and how Encoder/Decoder move a payload through it
+//built in: png, jpeg, wav, bmp, ppm/pgm and headerless pcm; CarrierCodecs::add plugs in more
+struct CarrierCodec{
+    std::string name; //for messages, e.g. "PNG"
+    std::string ext; //canonical extension, e.g. ".jpeg"
+    std::vector<std::string> aliases; //other spellings of the extension, e.g. ".jpg"
+    //true when a file's first bytes (at most CarrierCodecs::SNIFF_BYTES) are this format
+    //empty for headerless formats, those are only ever known by their extension
+    std::function<bool(const unsigned char* head, size_t size)> sniff;
+    EmbedMethod method = EmbedMethod::LSB;
+    bool pipelined = false; //can decode, embed and encode row by row, see Handler::pipelinePng
+    bool streamed = false; //sample bytes can be copied through a chunk at a time, see Handler::streamSamples
+    std::function<bool(Handler &handler)> read;
+    std::function<bool(Handler &handler, const std::string name)> write;
+    //LSB carriers: moves the bytes carrying the payload out of the handler after read and back before write
+    //empty for carriers embedded in place, see Handler::getRawSamples
+    std::function<std::vector<unsigned char>(Handler &handler)> take;
+    std::function<void(Handler &handler, std::vector<unsigned char> bytes)> put;
+    //fills in what the carrier decodes to from its first bytes, see Handler::peekCarrier
+    //empty when it decodes to the file itself
+    std::function<bool(const unsigned char* head, size_t size, bool native_png, CarrierShape &shape)> shape;
+    //payload bytes (header included) a carrier of this shape can hold at most
+    std::function<size_t(const CarrierShape &shape)> capacity;
+};
+
+//registry of carrier codecs, looked up by content first and extension second
+class CarrierCodecs{
+    public:
+        static const size_t SNIFF_BYTES = 16; //enough for every built-in signature
+        //adds a format; call before any job starts, lookups don't lock
+        //codecs are kept for the life of the process, pointers to them stay valid
+        static void add(const CarrierCodec codec);
+        //the codec whose extension or alias is ext (lowercase, with the dot), null if none
+        static const CarrierCodec* byExtension(const std::string ext);
+        //the first codec whose signature matches, null if none does
+        static const CarrierCodec* sniff(const unsigned char* head, size_t size);
+        //lowercased last extension of a path ("x.png.bak" -> ".bak"), empty if it has none
+        static std::string extensionOf(const std::string name);
+};
+
+#endif
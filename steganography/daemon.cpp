@@ -0,0 +1,436 @@
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <exception>
+#include <csignal>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "daemon.hpp"
+#include "logger.hpp"
+
+//frames larger than this are rejected, requests only carry paths
+static const uint32_t MAX_FRAME_SIZE = 1 << 16;
+static const size_t MAX_PASSED_FDS = 8;
+
+static volatile std::sig_atomic_t stop_signal = 0;
+static void onStopSignal(int){
+    stop_signal = 1;
+}
+
+//----------FRAMING----------//
+
+static bool writeAll(int fd, const char* data, size_t size){
+    while (size > 0){
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent < 0){
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += sent;
+        size -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+static bool readAll(int fd, char* data, size_t size){
+    while (size > 0){
+        ssize_t got = recv(fd, data, size, 0);
+        if (got < 0){
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (got == 0) return false; //peer closed
+        data += got;
+        size -= static_cast<size_t>(got);
+    }
+    return true;
+}
+
+static bool sendFrame(int fd, const std::vector<std::string> &fields, const std::vector<int> &fds){
+    std::string payload;
+    for (size_t i = 0; i < fields.size(); ++i){
+        if (i > 0) payload += '\0';
+        payload += fields[i];
+    }
+    if (payload.size() > MAX_FRAME_SIZE || fds.size() > MAX_PASSED_FDS) return false;
+    uint32_t length = static_cast<uint32_t>(payload.size());
+    unsigned char header[4] = {
+        static_cast<unsigned char>(length), static_cast<unsigned char>(length >> 8),
+        static_cast<unsigned char>(length >> 16), static_cast<unsigned char>(length >> 24)
+    };
+    if (fds.empty()){
+        return writeAll(fd, reinterpret_cast<const char*>(header), sizeof(header)) && writeAll(fd, payload.data(), payload.size());
+    }
+    //descriptors travel with the frame header
+    struct iovec iov;
+    iov.iov_base = header;
+    iov.iov_len = sizeof(header);
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * fds.size()), 0);
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.data();
+    message.msg_controllen = control.size();
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+    ssize_t sent;
+    do { sent = sendmsg(fd, &message, MSG_NOSIGNAL); } while (sent < 0 && errno == EINTR);
+    if (sent < 0) return false;
+    size_t header_sent = static_cast<size_t>(sent);
+    return writeAll(fd, reinterpret_cast<const char*>(header) + header_sent, sizeof(header) - header_sent) &&
+           writeAll(fd, payload.data(), payload.size());
+}
+
+static bool recvFrame(int fd, std::vector<std::string> &fields, std::vector<int> &fds){
+    unsigned char header[4];
+    struct iovec iov;
+    iov.iov_base = header;
+    iov.iov_len = sizeof(header);
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * MAX_PASSED_FDS), 0);
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.data();
+    message.msg_controllen = control.size();
+    ssize_t got;
+    do { got = recvmsg(fd, &message, MSG_CMSG_CLOEXEC); } while (got < 0 && errno == EINTR);
+    if (got <= 0) return false;
+
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg)){
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS){
+            size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (size_t i = 0; i < count; ++i){
+                int passed;
+                memcpy(&passed, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                fds.push_back(passed);
+            }
+        }
+    }
+    if (message.msg_flags & MSG_CTRUNC){
+        LOG_ERROR("Error: Too many descriptors passed with one request");
+        return false;
+    }
+    if (got < static_cast<ssize_t>(sizeof(header)) &&
+        !readAll(fd, reinterpret_cast<char*>(header) + got, sizeof(header) - static_cast<size_t>(got))){
+        return false;
+    }
+    uint32_t length = header[0] | (header[1] << 8) | (header[2] << 16) | (static_cast<uint32_t>(header[3]) << 24);
+    if (length > MAX_FRAME_SIZE){
+        LOG_ERROR("Error: Daemon frame of " << length << " bytes is too large");
+        return false;
+    }
+    std::string payload(length, '\0');
+    if (length > 0 && !readAll(fd, &payload[0], length)) return false;
+
+    fields.clear();
+    size_t start = 0;
+    while (true){
+        size_t end = payload.find('\0', start);
+        fields.push_back(payload.substr(start, end == std::string::npos ? std::string::npos : end - start));
+        if (end == std::string::npos) break;
+        start = end + 1;
+    }
+    return true;
+}
+
+static void closeAll(const std::vector<int> &fds){
+    for (int fd : fds) close(fd);
+}
+
+static bool fillAddress(const std::string &socket_path, struct sockaddr_un &address){
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)){
+        LOG_ERROR("Error: Socket path " << socket_path << " is too long");
+        return false;
+    }
+    strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+    return true;
+}
+
+//----------SERVER----------//
+
+struct Daemon::Connection{
+    int fd;
+    std::mutex write_lock;
+    //parent of every job on this connection, cancelled when the client goes away
+    std::shared_ptr<JobContext> context = std::make_shared<JobContext>();
+    Connection(int fd) : fd(fd) {}
+    ~Connection(){ close(fd); }
+    void reply(const std::vector<std::string> &fields){
+        //replies from different workers can finish in any order, ids tell them apart
+        std::lock_guard<std::mutex> guard(write_lock);
+        sendFrame(fd, fields, std::vector<int>());
+    }
+};
+
+Daemon::Daemon(const std::string socket_path, unsigned int workers)
+    :   engine(workers)
+{
+    this->socket_path = socket_path;
+}
+
+Daemon::~Daemon(){
+    stop();
+    if (listen_fd >= 0){
+        close(listen_fd);
+        unlink(socket_path.c_str());
+    }
+}
+
+bool Daemon::start(){
+    struct sockaddr_un address;
+    if (!fillAddress(socket_path, address)) return false;
+    //a socket left behind by a previous daemon would make bind fail
+    struct stat existing;
+    if (stat(socket_path.c_str(), &existing) == 0 && S_ISSOCK(existing.st_mode)){
+        unlink(socket_path.c_str());
+    }
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0){
+        LOG_ERROR("Error: Could not create socket: " << strerror(errno));
+        return false;
+    }
+    if (bind(listen_fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) < 0){
+        LOG_ERROR("Error: Could not bind " << socket_path << ": " << strerror(errno));
+        close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+    //only the owner may submit jobs
+    chmod(socket_path.c_str(), S_IRUSR | S_IWUSR);
+    if (listen(listen_fd, 64) < 0){
+        LOG_ERROR("Error: Could not listen on " << socket_path << ": " << strerror(errno));
+        return false;
+    }
+    running = true;
+    LOG_INFO("Console: StegaSaur daemon listening on " << socket_path << " with "
+             << engine.getWorkerCount() << " workers");
+    return true;
+}
+
+void Daemon::serve(){
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onStopSignal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    while (running && !stop_signal){
+        //poll with a timeout so shutdown requests and signals are noticed
+        struct pollfd listener;
+        listener.fd = listen_fd;
+        listener.events = POLLIN;
+        listener.revents = 0;
+        int ready = poll(&listener, 1, 200);
+        if (ready <= 0) continue;
+        int client_fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (client_fd < 0) continue;
+        std::lock_guard<std::mutex> guard(connections_lock);
+        connection_fds.push_back(client_fd);
+        active_connections++;
+        std::thread(&Daemon::handleConnection, this, client_fd).detach();
+    }
+    LOG_INFO("Console: StegaSaur daemon shutting down");
+    stop();
+}
+
+void Daemon::stop(){
+    running = false;
+    //wake up connection threads blocked in recv and wait for them to leave
+    std::unique_lock<std::mutex> guard(connections_lock);
+    for (int fd : connection_fds) shutdown(fd, SHUT_RDWR);
+    connections_done.wait(guard, [this](){ return active_connections == 0; });
+}
+
+void Daemon::setJobTimeout(double seconds){
+    job_timeout = seconds;
+}
+
+void Daemon::handleConnection(int client_fd){
+    std::shared_ptr<Connection> connection = std::make_shared<Connection>(client_fd);
+    std::vector<std::string> fields;
+    std::vector<int> fds;
+    while (running){
+        fds.clear();
+        if (!recvFrame(client_fd, fields, fds)){
+            closeAll(fds);
+            //nobody is left to read the replies, unless stop() shut the socket to let the jobs finish
+            if (running) connection->context->cancel();
+            break;
+        }
+        //one bad request must not take the daemon (and every other connection's jobs) down with it
+        bool keep_going = true;
+        try {
+            keep_going = handleRequest(connection, fields, fds);
+        }
+        catch (const std::exception &error){
+            LOG_ERROR("Error: Daemon request failed: " << error.what());
+            connection->reply({fields.empty() ? "" : fields[0], "error", "", "", "0", "0", jobErrorName(JobError::INTERNAL), "Error: Malformed request"});
+            closeAll(fds);
+        }
+        if (!keep_going){
+            closeAll(fds);
+            break;
+        }
+    }
+    //the socket itself closes once the last in-flight job has replied
+    std::lock_guard<std::mutex> guard(connections_lock);
+    for (size_t i = 0; i < connection_fds.size(); ++i){
+        if (connection_fds[i] == client_fd){
+            connection_fds.erase(connection_fds.begin() + i);
+            break;
+        }
+    }
+    active_connections--;
+    connections_done.notify_all();
+}
+
+bool Daemon::handleRequest(std::shared_ptr<Connection> connection, const std::vector<std::string> &fields, std::vector<int> &fds){
+    if (fields.size() < 2){
+        LOG_ERROR("Error: Malformed daemon request");
+        return false;
+    }
+    const std::string &id = fields[0];
+    const std::string &op = fields[1];
+    if (op == "shutdown"){
+        connection->reply({id, "ok", "", "", "0", "0"});
+        running = false;
+        return false;
+    }
+
+    //"fd:<index>:<name>" refers to the index-th passed descriptor
+    bool valid = true;
+    auto mapFile = [&](const std::string &field) -> std::string{
+        if (field.rfind("fd:", 0) != 0) return field;
+        size_t sep = field.find(':', 3);
+        std::string index = field.substr(3, sep == std::string::npos ? std::string::npos : sep - 3);
+        //strtoull saturates instead of throwing on a digit string too long for it
+        errno = 0;
+        unsigned long long position = index.empty() ? 0 : strtoull(index.c_str(), nullptr, 10);
+        if (index.empty() || index.find_first_not_of("0123456789") != std::string::npos || errno == ERANGE || position >= fds.size()){
+            valid = false;
+            return field;
+        }
+        std::string name = sep == std::string::npos ? "" : field.substr(sep);
+        return "fd:" + std::to_string(fds[(size_t)position]) + name;
+    };
+
+    EngineJob job;
+    if (op == "encode" && fields.size() == 5){
+        job.type = JobType::ENCODE;
+        job.secret = mapFile(fields[2]);
+        job.carrier = mapFile(fields[3]);
+        job.output = mapFile(fields[4]);
+    }
+    else if (op == "decode" && fields.size() == 4){
+        job.type = JobType::DECODE;
+        job.encoded = mapFile(fields[2]);
+        job.output = mapFile(fields[3]);
+    }
+    else if (op == "probe" && fields.size() == 3){
+        job.type = JobType::PROBE;
+        job.encoded = mapFile(fields[2]);
+    }
+    else {
+        valid = false;
+    }
+    if (!valid){
+        connection->reply({id, "error", "", "", "0", "0", jobErrorName(JobError::READ), "Error: Malformed request"});
+        closeAll(fds);
+        fds.clear();
+        return true;
+    }
+
+    job.context = std::make_shared<JobContext>(connection->context);
+    job.context->setTimeout(job_timeout);
+
+    //the job owns the passed descriptors until it finishes
+    std::vector<int> job_fds;
+    job_fds.swap(fds);
+    engine.submit(job, [connection, id, job_fds](const EngineResult &result){
+        closeAll(job_fds);
+        connection->reply({id, result.success ? "ok" : "error", result.output, result.format,
+                           std::to_string(result.capacity), std::to_string(result.total_seconds * 1000.0),
+                           jobErrorName(result.error), result.error_message});
+    });
+    return true;
+}
+
+//----------CLIENT----------//
+
+DaemonClient::DaemonClient(const std::string socket_path){
+    this->socket_path = socket_path;
+}
+
+DaemonClient::~DaemonClient(){
+    if (socket_fd >= 0) close(socket_fd);
+}
+
+bool DaemonClient::connectSocket(){
+    struct sockaddr_un address;
+    if (!fillAddress(socket_path, address)) return false;
+    socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (socket_fd < 0){
+        LOG_ERROR("Error: Could not create socket: " << strerror(errno));
+        return false;
+    }
+    if (connect(socket_fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) < 0){
+        LOG_ERROR("Error: Could not connect to " << socket_path << ": " << strerror(errno));
+        close(socket_fd);
+        socket_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+bool DaemonClient::request(const EngineJob job, DaemonReply &reply, const std::vector<int> fds){
+    if (socket_fd < 0 && !connectSocket()) return false;
+    std::string id = std::to_string(next_id++);
+    std::vector<std::string> fields;
+    if (job.type == JobType::ENCODE) fields = {id, "encode", job.secret, job.carrier, job.output};
+    else if (job.type == JobType::DECODE) fields = {id, "decode", job.encoded, job.output};
+    else fields = {id, "probe", job.encoded};
+    if (!sendFrame(socket_fd, fields, fds)){
+        LOG_ERROR("Error: Failed to send request to " << socket_path);
+        return false;
+    }
+    std::vector<std::string> answer;
+    std::vector<int> unused;
+    if (!recvFrame(socket_fd, answer, unused) || (answer.size() != 6 && answer.size() != 8) || answer[0] != id){
+        closeAll(unused);
+        LOG_ERROR("Error: Bad reply from " << socket_path);
+        return false;
+    }
+    reply.success = answer[1] == "ok";
+    reply.output = answer[2];
+    reply.format = answer[3];
+    reply.capacity = static_cast<size_t>(std::stoull(answer[4]));
+    reply.total_ms = std::stod(answer[5]);
+    if (answer.size() >= 8){
+        reply.error = answer[6];
+        reply.error_message = answer[7];
+    }
+    return true;
+}
+
+bool DaemonClient::shutdownDaemon(){
+    if (socket_fd < 0 && !connectSocket()) return false;
+    std::vector<std::string> answer;
+    std::vector<int> unused;
+    if (!sendFrame(socket_fd, {"0", "shutdown"}, std::vector<int>())) return false;
+    bool replied = recvFrame(socket_fd, answer, unused);
+    closeAll(unused);
+    return replied && answer.size() >= 2 && answer[1] == "ok";
+}
@@ -0,0 +1,67 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "engine.hpp"
+
+//wire format, both directions: 4 byte little-endian length + NUL separated fields
+//request: id, "encode" | "decode" | "probe" | "shutdown", then the job's files
+//  encode: secret, carrier, output    decode: encoded, output    probe: encoded
+//  open descriptors may ride along (SCM_RIGHTS); a file field of "fd:<i>:<name>" uses the i-th one
+//reply:   id, "ok" | "error", output, format, capacity, total ms, error kind, error message
+//  error kind is jobErrorName(), "none" on success
+
+struct DaemonReply{
+    bool success = false;
+    std::string output, format;
+    size_t capacity = 0;
+    double total_ms = 0.0;
+    std::string error, error_message; //see EngineResult, empty from a daemon that doesn't send them
+};
+
+//long-running server: keeps the Engine's worker threads warm between requests
+class Daemon{
+    public:
+        Daemon(const std::string socket_path, unsigned int workers);
+        ~Daemon();
+        bool start();
+        void serve(); //blocks until a shutdown request, SIGINT or SIGTERM
+        void stop();
+        //deadline for each job, counted from when its request arrives; 0 (the default) is none
+        //a client that hangs up has its unfinished jobs cancelled either way
+        void setJobTimeout(double seconds);
+    private:
+        struct Connection;
+        std::string socket_path;
+        int listen_fd = -1;
+        std::atomic<bool> running{false};
+        double job_timeout = 0.0;
+        Engine engine;
+        std::mutex connections_lock;
+        std::condition_variable connections_done;
+        std::vector<int> connection_fds; //sockets of connections still being read
+        size_t active_connections = 0;
+        void handleConnection(int client_fd);
+        bool handleRequest(std::shared_ptr<Connection> connection, const std::vector<std::string> &fields, std::vector<int> &fds);
+};
+
+class DaemonClient{
+    public:
+        DaemonClient(const std::string socket_path);
+        ~DaemonClient();
+        bool connectSocket();
+        //fds are passed to the daemon and referenced from job fields as "fd:<index>:<name>"
+        bool request(const EngineJob job, DaemonReply &reply, const std::vector<int> fds = std::vector<int>());
+        bool shutdownDaemon();
+    private:
+        std::string socket_path;
+        int socket_fd = -1;
+        unsigned int next_id = 1;
+};
+
+#endif
@@ -1,373 +1,434 @@
-#include <iostream>
 #include <vector>
 #include "decoder.hpp"
+#include "bufferpool.hpp"
 #include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include <memory>
 #include "handler.hpp"
+#include "metrics.hpp"
+#include "logger.hpp"
+#include "jobcontext.hpp"
+#include "scatter.hpp"
 
-Decoder::Decoder(std::string fileName)
-    :   encodedFile(fileName)
+static const size_t EXTRACT_CHUNK = 64 * 1024; //payload bytes extracted between job context checks
+
+Decoder::Decoder(std::string fileName, const CarrierCodec* codec)
+    :   encodedFile(fileName, codec)
+{
+    this->encoded_name = fileName;
+    encodedFile.setNativePng(true);
+    LOG_INFO("Console: Initializing decoder...");
+}
+Decoder::~Decoder(){
+    BufferPool::give(file_data);
+    BufferPool::give(extracted_data);
+    BufferPool::give(sample_chunk);
+}
+Decoder::Decoder(std::string fileName, const unsigned char* data, size_t size, const CarrierCodec* codec)
+    :   encodedFile(fileName, data, size, codec)
 {
     this->encoded_name = fileName;
-    std::cout << "Console: Initializing decoder..." << std::endl;
+    encodedFile.setNativePng(true);
+}
+void Decoder::setMemoryOutput(std::vector<unsigned char>* output){
+    memory_output = output != nullptr;
+    encodedFile.setMemoryOutput(output);
+}
+void Decoder::setWriteProfile(WriteProfile profile){
+    encodedFile.setWriteProfile(profile);
+}
+void Decoder::setNativePng(bool enabled){
+    encodedFile.setNativePng(enabled);
+}
+void Decoder::setJobContext(std::shared_ptr<JobContext> context){
+    job_context = context;
+    encodedFile.setJobContext(context);
+}
+bool Decoder::checkpoint(uint64_t done, uint64_t total){
+    return !job_context || job_context->checkpoint(MetricPhase::EXTRACT, done, total);
+}
+std::string Decoder::getProfileReport() const{
+    return encodedFile.getProfileReport();
+}
+void Decoder::setScatterKey(const std::string key){
+    scatter_key = key;
+}
+void Decoder::setStreamed(bool enabled){
+    streamed = enabled;
+}
+std::string Decoder::getSecretExt() const{
+    return secret_ext;
 }
 
 bool Decoder::openEncodedFile(){
-    if (encodedFile.getExt() == ".txt") {
+    const CarrierCodec* codec = encodedFile.getCodec();
+    streaming_samples = streamed && scatter_key.empty() && encodedFile.canStreamSamples();
+    if (streaming_samples){
+        //only the header is read here, the samples as extractPayload asks for them
+        file_check = encodedFile.openSamples();
+    }
+    else if (encodedFile.getExt() == ".txt") {
         file_check = encodedFile.readFile();
         file_data = encodedFile.getFileData();
     }
-    else if (encodedFile.getExt() == ".png"){
-        file_check = encodedFile.readPng();
-        file_data = encodedFile.getPixelData();
-    }
-    else if (encodedFile.getExt() == ".wav"){
-        file_check = encodedFile.readWav();
-        file_data = encodedFile.getWavSampleData();
-    }
-    else if (encodedFile.getExt() == ".jpeg" or encodedFile.getExt() == ".jpg"){
-        //must do actual checking in decoding method
-        file_check = true;
+    else if (codec){
+        //DCT carriers keep the payload in the coefficients, pixels are never decoded
+        file_check = codec->read(encodedFile);
+        //raw carriers are read where they sit, see lsbData()
+        if (file_check && codec->method == EmbedMethod::LSB && codec->take){
+            file_data = codec->take(encodedFile);
+        }
     }
     if (file_check == false){
-        std::cerr << "Error: Encoded file failed to open" << std::endl;
+        //stopped by the job context rather than a bad file, the engine reports why
+        if (!encodedFile.cancelled()) LOG_ERROR("Error: Encoded file failed to open");
         return false;
     }
     return true;
 }
+bool Decoder::rawCarrier() const{
+    return encodedFile.getCodec() && encodedFile.getCodec()->method == EmbedMethod::LSB && !encodedFile.getCodec()->take;
+}
+const unsigned char* Decoder::lsbData(){
+    return rawCarrier() ? encodedFile.getRawSamples() : file_data.data();
+}
+size_t Decoder::lsbSize() const{
+    if (streaming_samples) return encodedFile.getSampleSize();
+    return rawCarrier() ? encodedFile.getRawSampleSize() : file_data.size();
+}
+bool Decoder::dctCarrier() const{
+    return encodedFile.getCodec() && encodedFile.getCodec()->method == EmbedMethod::DCT;
+}
 bool Decoder::checksumCheck(uint16_t checksum){
     if (checksum % 13 == 0){return true;}
     return false;
 }
-bool Decoder::pngDecode(std::string newFile){
-    std::streamsize offset = 0;
-    uint8_t ext_len = 0;
-    uint16_t checksum = 0;
-    unsigned char extracted_byte = 0;
-    int height = 0, width = 0;
-
-    //get checksum and check it
-    unsigned char* checksum_bytes = reinterpret_cast<unsigned char*>(&checksum);
-    for (size_t i = 0; i < sizeof(checksum); ++i){
-        for (int j = 0; j < 8; ++j){
-            unsigned char bit = file_data[offset] & 1;
-            extracted_byte |= (bit << j);
-            offset++;
+size_t Decoder::getCapacity(){
+    if (dctCarrier()){
+        JpegCoefficients* jpeg = encodedFile.getJpegCoefficients();
+        if (!jpeg) return 0;
+        //count coefficients JSteg is allowed to use
+        size_t usable = 0;
+        for (int comp_i = 0; comp_i < jpeg->decompress_info.num_components; ++comp_i){
+            for (JDIMENSION block_y = 0; block_y < jpeg->decompress_info.comp_info[comp_i].height_in_blocks; ++block_y){
+                JBLOCKARRAY block_array = jpeg->blockRow(comp_i, block_y, false);
+                for (JDIMENSION block_x = 0; block_x < jpeg->decompress_info.comp_info[comp_i].width_in_blocks; ++block_x){
+                    for (int i = 0; i < DCTSIZE2; ++i){
+                        JCOEF coef_val = block_array[0][block_x][i];
+                        if (coef_val != 0 && coef_val != 1) usable++;
+                    }
+                }
+            }
         }
-        checksum_bytes[i] = extracted_byte;
-        extracted_byte = 0;
+        return usable / 8;
     }
-    std::cout << checksum;
-    checksum = extracted_byte;
-    if(!checksumCheck(checksum)){
-        std::cerr << "Error: Checksum has been tampered with or invalid." << "\n The file does not contained encoded data, has not been encoded with StegaSaur, or encoded data has been tampered with." << std::endl;
+    return lsbSize() / 8;
+}
+bool Decoder::extract(){
+    if (file_check == false){
+        LOG_ERROR("Error: Encoded file failed to open");
         return false;
     }
-    else{
-        std::cout << "Console: Checksum verified. Continuing extraction." << std::endl;
+    return extractPayload(nullptr);
+}
+//the secret's extension comes from the payload, stdout ("-") takes it as is
+static std::string secretPath(const std::string newFile, const std::string ext){
+    return Handler::isStdio(newFile) ? newFile : newFile + ext;
+}
+bool Decoder::extractTo(std::string newFile){
+    if (file_check == false){
+        LOG_ERROR("Error: Encoded file failed to open");
+        return false;
     }
-    extracted_byte = 0;
-    //next, get ext_len
-    for (int i = 0; i < 8; ++i){
-        unsigned char bit = file_data[offset] & 1;
-        extracted_byte |= (bit << i);
-        offset++;
-    }
-    ext_len = extracted_byte;
-    if(ext_len == 0){
-        std::cerr << "Error: Could not read extension length" << std::endl;
+    if (!extractPayload(&newFile)) return false;
+    //image secrets are re-encoded, so they were collected whole and are written now
+    if (extracted) return write(newFile);
+    logExtracted(secretPath(newFile, secret_ext));
+    return true;
+}
+//the name only supplies the extension when the secret goes to memory, nothing is at that path
+void Decoder::logExtracted(const std::string newFile) const{
+    if (memory_output) LOG_INFO("Console: Successfully extracted the " << secret_ext << " secret into memory");
+    else LOG_INFO("Console: Successfully extracted to " << newFile);
+}
+bool Decoder::pngDecode(std::string newFile){
+    return extractTo(newFile);
+}
+bool Decoder::jpegDecode(std::string newFile){
+    //older callers may skip openEncodedFile for jpegs
+    if (!encodedFile.getJpegCoefficients() && !openEncodedFile()){
         return false;
     }
-    extracted_byte = 0; //clear extracted byte
+    return extractTo(newFile);
+}
 
-    //then extract file ext chars
-    std::string file_ext = "";
-    for (int i = 0; i < ext_len; ++i){
-        for (int j = 0; j < 8; ++j){
-            unsigned char bit = file_data[offset] & 1;
-            extracted_byte |= (bit << j);
-            offset++;
+static const uint64_t SCATTER_CHECK = 64 * 1024; //scattered coefficients visited between job context checks
+
+//walks the coefficients JSteg uses (not 0 or 1) in embedding order: component, block row, block, coefficient
+//only one block row is held at a time, and the job context is checked at every new one
+struct CoefficientCursor{
+    JpegCoefficients* jpeg;
+    const JobContext* context;
+    int comp_i = 0;
+    JDIMENSION block_y = 0, block_x = 0;
+    int coef_i = 0;
+    JBLOCKARRAY block_array = nullptr;
+    uint64_t carrier_bytes = 0; //block rows (or scattered coefficients) visited, for metrics
+
+    std::unique_ptr<ScatterOrder> order = nullptr; //set: the usable coefficients in ScatterOrder's walk instead
+    uint64_t position = 0;
+
+    bool nextBit(int &bit){
+        if (order) return nextScattered(bit);
+        while (comp_i < jpeg->decompress_info.num_components){
+            const jpeg_component_info &component = jpeg->decompress_info.comp_info[comp_i];
+            if (block_y >= component.height_in_blocks){
+                ++comp_i;
+                block_y = 0;
+                continue;
+            }
+            if (!block_array){
+                if (context && context->cancelled()) return false;
+                block_array = jpeg->blockRow(comp_i, block_y, false);
+                carrier_bytes += (uint64_t)component.width_in_blocks * sizeof(JBLOCK);
+                block_x = 0;
+                coef_i = 0;
+            }
+            for (; block_x < component.width_in_blocks; ++block_x, coef_i = 0){
+                while (coef_i < DCTSIZE2){
+                    JCOEF coef_val = block_array[0][block_x][coef_i++];
+                    if (coef_val != 0 && coef_val != 1){
+                        bit = coef_val & 1;
+                        return true;
+                    }
+                }
+            }
+            block_array = nullptr;
+            ++block_y;
         }
-        file_ext += static_cast<char>(extracted_byte);
-        extracted_byte = 0;
-    }
-    std::cout << "Console: Succesfully extracted file extension: " << file_ext << std::endl;
-    if (file_ext != ".txt" and file_ext != ".png" and file_ext != ".jpeg" and file_ext != ".jpg"){
-        std::cerr << "CRITICAL ERROR: Extracted file extension is not valid. Aborting." << std::endl;
         return false;
     }
-
-    //extract image dimensions if extracted extension is a supported image
-    if (file_ext == ".png" or file_ext == ".jpeg" or file_ext == ".jpg"){
-        std::cout << "Console: Image detected. Extracting dimensions." << std::endl;
-        unsigned char* height_bytes = reinterpret_cast<unsigned char*>(&height);
-        //changed int to size_t for sizeof compatibility
-            for (size_t i = 0; i < sizeof(height); ++i){
-            for (int j = 0; j < 8; ++j){
-                unsigned char bit = file_data[offset] & 1;
-                extracted_byte |= (bit << j);
-                offset++;
+    //positions are mapped one at a time, only as far as the payload reaches
+    bool nextScattered(int &bit){
+        while (position < order->size()){
+            if (position % SCATTER_CHECK == 0 && context && context->cancelled()) return false;
+            JCOEF coef_val = *jpeg->coefficient(order->at(position++), false);
+            carrier_bytes += sizeof(JCOEF);
+            if (coef_val != 0 && coef_val != 1){
+                bit = coef_val & 1;
+                return true;
             }
-            height_bytes[i] = extracted_byte;
-            extracted_byte = 0;
         }
-        std::cout << "Console: Extracted height: " << height << std::endl;
-
-        unsigned char* width_bytes = reinterpret_cast<unsigned char*>(&width);
-        //changed int to size_t for sizeof compatibility
-        for (size_t i = 0; i < sizeof(width); ++i){
+        return false;
+    }
+    bool read(unsigned char* bytes, size_t count){
+        for (size_t i = 0; i < count; ++i){
+            unsigned char byte = 0;
             for (int j = 0; j < 8; ++j){
-                unsigned char bit = file_data[offset] & 1;
-                extracted_byte |= (bit << j);
-                offset++;
+                int bit = 0;
+                if (!nextBit(bit)) return false;
+                byte |= bit << j;
             }
-            width_bytes[i] = extracted_byte;
-            extracted_byte = 0;
+            bytes[i] = byte;
         }
-        std::cout << "Console: Extracted width: " << width << std::endl;
+        return true;
     }
-    //extract data size
-    uint32_t data_size = 0;
-    unsigned char* size_bytes = reinterpret_cast<unsigned char*>(&data_size);
-    //using data size of data_size for for loop
-    //changed int to size_t for sizeof compatibility
-    for (size_t i = 0; i < sizeof(data_size); ++i){
-        for (size_t j = 0; j < 8; ++j){
-            unsigned char bit = file_data[offset] & 1;
-            extracted_byte |= (bit << j);
-            offset++;
+};
+
+bool Decoder::extractPayload(const std::string* stream_to){
+    STEGA_METRIC(MetricScope metric(MetricPhase::EXTRACT));
+    //payload bytes in embedding order, false once the carrier runs out
+    std::function<bool(unsigned char*, size_t)> read;
+    size_t capacity = 0; //most payload bytes the carrier could hold, header included
+    size_t offset = 0;
+    std::unique_ptr<CoefficientCursor> cursor;
+    if (dctCarrier()){
+        JpegCoefficients* jpeg = encodedFile.getJpegCoefficients();
+        if (!jpeg){
+            LOG_ERROR("Error: Failed to read " << encoded_name << " DCT coefficients.");
+            return false;
         }
-        size_bytes[i] = extracted_byte;
-        extracted_byte = 0;
+        //every coefficient counted, the ones that are 0 or 1 are only skipped as they're reached
+        for (int comp_i = 0; comp_i < jpeg->decompress_info.num_components; ++comp_i){
+            capacity += (size_t)jpeg->decompress_info.comp_info[comp_i].height_in_blocks *
+                        jpeg->decompress_info.comp_info[comp_i].width_in_blocks * DCTSIZE2 / 8;
+        }
+        cursor.reset(new CoefficientCursor{jpeg, job_context.get()});
+        if (!scatter_key.empty()) cursor->order.reset(new ScatterOrder(scatter_key, jpeg->coefficientCount()));
+        read = [&](unsigned char* bytes, size_t count){ return cursor->read(bytes, count); };
     }
-    if (data_size == 0){
-        std::cerr << "Error: Could not read data size" << std::endl;
-        return false;
+    else if (streaming_samples){
+        //same bytes as below, the sample bytes arrive in order from the file a chunk at a time
+        capacity = lsbSize() / 8;
+        sample_chunk = BufferPool::take(Handler::SINK_BYTES);
+        read = [&](unsigned char* bytes, size_t count){
+            while (count > 0){
+                size_t part = std::min(count, sample_chunk.size() / 8);
+                if (encodedFile.readSamples(sample_chunk.data(), part * 8) != part * 8) return false;
+                for (size_t i = 0; i < part; ++i){
+                    unsigned char extracted_byte = 0;
+                    for (int j = 0; j < 8; ++j) extracted_byte |= (sample_chunk[i * 8 + j] & 1) << j;
+                    bytes[i] = extracted_byte;
+                }
+                bytes += part;
+                count -= part;
+                offset += part * 8;
+            }
+            return true;
+        };
     }
     else{
-        std::cout << "Console: Succesfully extracted data size: " << data_size << std::endl;
+        //byte i of the payload is the lsbs of carrier bytes i*8 .. i*8+7, or of at(i*8) .. at(i*8+7) with a scatter key
+        const unsigned char* samples = lsbData();
+        size_t sample_count = lsbSize();
+        capacity = sample_count / 8;
+        std::shared_ptr<ScatterOrder> order;
+        if (!scatter_key.empty()) order = std::make_shared<ScatterOrder>(scatter_key, sample_count);
+        read = [&, samples, sample_count, order](unsigned char* bytes, size_t count){
+            if (offset + count * 8 > sample_count) return false;
+            auto readBytes = [&](){
+                for (size_t i = 0; i < count; ++i){
+                    unsigned char extracted_byte = 0;
+                    for (int j = 0; j < 8; ++j, ++offset) extracted_byte |= (samples[order ? order->at(offset) : offset] & 1) << j;
+                    bytes[i] = extracted_byte;
+                }
+            };
+            //raw carriers may be a mapped file, see Handler::guardRawAccess
+            return encodedFile.guardRawAccess(readBytes);
+        };
     }
+    auto readFailed = [&](const char* message){
+        //stopped by the job context rather than a bad file, the engine reports why
+        if (!encodedFile.cancelled()) LOG_ERROR(message);
+        return false;
+    };
 
-    //extract file data based on data_size
-    extracted_data.reserve(data_size);
-    //changed int to uint32_t for data_size compatibility
-    for (uint32_t i = 0; i < data_size; ++i){
-        for (int j = 0; j < 8; ++j){
-            unsigned char bit = file_data[offset] & 1;
-            extracted_byte |= (bit << j);
-            offset++;
-        }
-        extracted_data.push_back(extracted_byte);
-        extracted_byte = 0;
-    }
-    //reusing the encodedFile obj
-    if (file_ext == ".txt"){
-        encodedFile.setBinaryFileData(extracted_data);
-        newFile = newFile + file_ext;
-        if(!encodedFile.writeFile(newFile)){
-            std::cerr << "Error: Failed to write to " << newFile << std::endl;
-            return false;
-        }
+    //get checksum and check it
+    uint16_t checksum = 0;
+    if (!read(reinterpret_cast<unsigned char*>(&checksum), sizeof(checksum))){
+        return readFailed("Error: Carrier is too small to hold encoded data");
     }
-    else if (file_ext == ".png"){
-        encodedFile.setPngPixelData(extracted_data);
-        encodedFile.setImageDimensions(0, height);
-        encodedFile.setImageDimensions(1, width);
-        newFile = newFile + file_ext;
-        if (!encodedFile.writePng(newFile)){
-            std::cerr << "Error: Failed to write to " << newFile << std::endl;
-            return false;
-        }
+    LOG_DEBUG("Console: Extracted checksum: " << checksum);
+    if(!checksumCheck(checksum)){
+        LOG_ERROR("Error: Checksum has been tampered with or invalid." << "\n The file does not contained encoded data, has not been encoded with StegaSaur, or encoded data has been tampered with.");
+        return false;
     }
-    else if (file_ext == ".wav"){
-        encodedFile.setBinaryFileData(extracted_data);
-        newFile = newFile + file_ext;
-        if(!encodedFile.writeFile(newFile)){
-            std::cerr << "Error: Failed to write to " << newFile << std::endl;
-            return false;
-        }
+    else{
+        LOG_INFO("Console: Checksum verified. Continuing extraction.");
     }
-    else if (file_ext == ".jpeg" or file_ext == ".jpg"){
-        encodedFile.setPngPixelData(extracted_data);
-        encodedFile.setImageDimensions(0, height);
-        encodedFile.setImageDimensions(1, width);
-        newFile = newFile + file_ext;
-        if (!encodedFile.writeJpeg(newFile)){
-            std::cerr << "Error: Failed to write to " << newFile << std::endl;
-            return false;
-        }
+    //next, get ext_len
+    uint8_t ext_len = 0;
+    if (!read(&ext_len, sizeof(ext_len)) || ext_len == 0){
+        return readFailed("Error: Could not read extension length");
     }
 
-    return true;
-}
-bool Decoder::jpegDecode(std::string newFile){
-    //setup decompression
-    struct jpeg_decompress_struct decompress_info;
-    struct jpeg_error_mgr jpeg_error;
-    decompress_info.err = jpeg_std_error(&jpeg_error);
-
-    //open encoded file
-    FILE* encoded = fopen(encoded_name.c_str(), "rb");
-    if (!encoded){
-        std::cerr << "Error: Failed to open " << encoded_name << std::endl;
-        return false;
+    //then extract file ext chars
+    std::string file_ext(ext_len, '\0');
+    if (!read(reinterpret_cast<unsigned char*>(&file_ext[0]), ext_len)){
+        return readFailed("Error: Could not read file extension");
     }
-    jpeg_create_decompress(&decompress_info);
-    jpeg_stdio_src(&decompress_info, encoded);
-    jpeg_read_header(&decompress_info, TRUE);
-
-    //read DCT coefficients
-    jvirt_barray_ptr* coeffcients = jpeg_read_coefficients(&decompress_info);
-    if (!coeffcients){
-        std::cerr << "Error: Failed to read " << encoded_name << " DCT coefficients." << std::endl;
+    LOG_INFO("Console: Succesfully extracted file extension: " << file_ext);
+    if (file_ext != ".txt" and file_ext != ".png" and file_ext != ".jpeg" and file_ext != ".jpg"){
+        LOG_ERROR("CRITICAL ERROR: Extracted file extension is not valid. Aborting.");
         return false;
     }
 
-    //setup for extraction
-    unsigned char current_byte = 0;
-    int bit_counter = 0;
-
-    //things we need to extract
-    uint16_t checksum = 0;
-    uint8_t ext_len = 0;
-    uint32_t file_size = 0;
-    size_t total_size = 0;
+    //extract image dimensions if extracted extension is a supported image
     int height = 0, width = 0;
-    bool parsed = false; //once we have enough data mark as true to stop iterating
-
-//JSTEG extraction logic
-    for (int comp_i = 0; comp_i < decompress_info.num_components; ++comp_i){
-        for (JDIMENSION block_y = 0; block_y < decompress_info.comp_info[comp_i].height_in_blocks; ++block_y) {
-            JBLOCKARRAY block_array = (decompress_info.mem->access_virt_barray)((j_common_ptr)&decompress_info, coeffcients[comp_i], block_y, 1, FALSE);
-            for (JDIMENSION block_x = 0; block_x < decompress_info.comp_info[comp_i].width_in_blocks; ++block_x) {
-                for (int i = 0; i < DCTSIZE2; ++i) {
-                    JCOEF coef_val = block_array[0][block_x][i];
-
-                    //JSTEG Rule: Only extract from coefficients that are not 0 or 1
-                    if (coef_val != 0 && coef_val != 1) {
-                        // Extract LSB and add it to our byte
-                        int bit = coef_val & 1;
-                        current_byte |= (bit << bit_counter);
-                        bit_counter++;
-                        
-                        if (bit_counter == 8){
-                            extracted_data.push_back(current_byte);
-                            current_byte = 0;
-                            bit_counter = 0;
-                            if (!parsed) {
-                                //define sizes, these are minimum sizes that will be extracted
-                                //extracting currently has no verification, will be done later
-                                const size_t CHECKSUM_SIZE = sizeof(uint16_t); // 2
-                                const size_t EXT_LEN_SIZE = sizeof(uint8_t);  // 1
-                                const size_t FILE_SIZE_SIZE = sizeof(uint32_t); // 4
-                                const size_t IMG_DIMS_SIZE = sizeof(int) * 2; // 8
-
-                                //check if we have the minimal header (checksum + ext_len)
-                                if (extracted_data.size() >= CHECKSUM_SIZE + EXT_LEN_SIZE){
-                                    ext_len = extracted_data[CHECKSUM_SIZE];
-                                    size_t base_header_size = CHECKSUM_SIZE + EXT_LEN_SIZE + ext_len;
-
-                                    //check if we have the base header (checksum + ext_len + ext)
-                                    if (extracted_data.size() >= base_header_size){
-                                        //we must read the extension now to check it
-                                        std::string temp_ext(extracted_data.begin() + CHECKSUM_SIZE + EXT_LEN_SIZE,
-                                                             extracted_data.begin() + base_header_size);
-                                        
-                                        size_t total_header_size = base_header_size;
-                                        if (temp_ext == ".png" || temp_ext == ".jpeg" || temp_ext == ".jpg"){
-                                            total_header_size += IMG_DIMS_SIZE;
-                                        }
-
-                                        //check if we have the full header (all metadata)
-                                        if (extracted_data.size() >= total_header_size + FILE_SIZE_SIZE){
-                                            //read the file size
-                                            memcpy(&file_size, &extracted_data[total_header_size], FILE_SIZE_SIZE);
-                                            
-                                            //calculate total size and set the flag
-                                            total_size = total_header_size + FILE_SIZE_SIZE + file_size;
-                                            parsed = true;
-                                        }
-                                    }
-                                }
-                            }
-                        }
-
-                        //if we have extracted the entire package, stop
-                        if (parsed && extracted_data.size() == total_size){
-                            goto end_extraction;
-                        }
-                    }
-                }
-            }
+    size_t header_size = sizeof(checksum) + sizeof(ext_len) + ext_len + sizeof(uint32_t);
+    if (file_ext == ".png" or file_ext == ".jpeg" or file_ext == ".jpg"){
+        LOG_INFO("Console: Image detected. Extracting dimensions.");
+        if (!read(reinterpret_cast<unsigned char*>(&height), sizeof(height)) ||
+            !read(reinterpret_cast<unsigned char*>(&width), sizeof(width))){
+            return readFailed("Error: Could not read image dimensions");
         }
+        header_size += sizeof(height) + sizeof(width);
+        LOG_INFO("Console: Extracted height: " << height);
+        LOG_INFO("Console: Extracted width: " << width);
     }
-    end_extraction:; //jump to this label when conditions met
-
-    //cleanup
-    jpeg_finish_decompress(&decompress_info);
-    jpeg_destroy_decompress(&decompress_info);
-    fclose(encoded);
-
-    if (!parsed or extracted_data.size() != total_size){
-        std::cerr << "Error: Failed to extract complete package or file was not encoded using StegaSaur." << std::endl;
+    //extract data size
+    uint32_t data_size = 0;
+    if (!read(reinterpret_cast<unsigned char*>(&data_size), sizeof(data_size)) || data_size == 0){
+        return readFailed("Error: Could not read data size");
+    }
+    else{
+        LOG_INFO("Console: Succesfully extracted data size: " << data_size);
+    }
+    if (header_size + data_size > capacity){
+        LOG_ERROR("Error: Data size is larger than the carrier can hold");
         return false;
     }
 
-    //parse extracted data to write file
-    size_t offset = 0;
-    current_byte = 0;
-    //get checksum
-    memcpy(&checksum, &extracted_data[offset], sizeof(uint16_t));
-    //check checksum
-    if(!checksumCheck(checksum)){
-        std::cerr << "Error: Checksum has been tampered with or invalid." << "\n The file does not contained encoded data, has not been encoded with StegaSaur, or encoded data has been tampered with." << std::endl;
-        return false;
+    //text secrets go to the sink as they're extracted, images are collected for re-encoding
+    bool stream = stream_to && file_ext == ".txt";
+    std::vector<unsigned char> chunk;
+    if (stream){
+        if (!encodedFile.openSink(secretPath(*stream_to, file_ext))) return false;
+        chunk = BufferPool::take(std::min<size_t>(EXTRACT_CHUNK, data_size));
     }
     else{
-        std::cout << "Console: Checksum verified. Continuing extraction." << std::endl;
-    }
-    offset += sizeof(checksum);
-    //get file extension
-    ext_len = extracted_data[offset];
-    offset += sizeof(ext_len);
-    std::string file_ext = "";
-    file_ext.assign(extracted_data.begin() + offset, extracted_data.begin() + offset + ext_len);
-    offset += ext_len;
-    if (file_ext == ".png" or file_ext == ".jpeg" or file_ext == ".jpg"){
-        std::cout << "Console: Image detected. Extracting dimensions." << std::endl;
-        memcpy(&height, &extracted_data[offset], sizeof(int));
-        offset += sizeof(height);
-        std::cout << "Console: Extracted height: " << height << std::endl;
-        memcpy(&width, &extracted_data[offset], sizeof(int));
-        offset += sizeof(width);
-        std::cout << "Console: Extracted width: " << width << std::endl;
-    }
-    //get file size
-    memcpy(&file_size, &extracted_data[offset], sizeof(uint32_t));
-    offset += sizeof(file_size);
-    //get file data
-    file_data.insert(file_data.begin(), extracted_data.begin() + offset, extracted_data.end());
-
-    //write file
-    if (file_ext == ".txt"){
-        newFile = newFile+file_ext;
-        encodedFile.setBinaryFileData(file_data);
-        if(!encodedFile.writeFile(newFile)){
-            return false;
-        }
-        std::cout << "Console: Successfully extracted to " << newFile << std::endl;
-        return true;
+        BufferPool::resize(extracted_data, data_size);
     }
-    else if (file_ext == ".png"){
-        encodedFile.setPngPixelData(file_data);
-        encodedFile.setImageDimensions(0, height);
-        encodedFile.setImageDimensions(1, width);
-        newFile = newFile + file_ext;
-        if (!encodedFile.writePng(newFile)){
-            std::cerr << "Error: Failed to write to " << newFile << std::endl;
-            return false;
+    auto abandon = [&](){
+        if (stream) encodedFile.discardSink();
+        BufferPool::give(chunk);
+        BufferPool::give(extracted_data);
+        return false;
+    };
+    for (size_t done = 0; done < data_size; done += EXTRACT_CHUNK){
+        size_t count = std::min(EXTRACT_CHUNK, data_size - done);
+        unsigned char* into = stream ? chunk.data() : extracted_data.data() + done;
+        if (!checkpoint(done, data_size)) return abandon();
+        if (!read(into, count)){
+            abandon();
+            return readFailed("Error: Failed to extract complete package or file was not encoded using StegaSaur.");
         }
-        std::cout << "Console: Successfully extracted to " << newFile << std::endl;
-        return true;
+        if (stream && !encodedFile.sinkWrite(into, count)) return abandon();
     }
-    return false;
-}
\ No newline at end of file
+    STEGA_METRIC(metric.addBytes(data_size));
+    STEGA_METRIC(metric.addCarrierBytes(cursor ? cursor->carrier_bytes : offset));
+    STEGA_METRIC(metric.noteBuffer(stream ? chunk.size() + Handler::SINK_BYTES : extracted_data.capacity()));
+    BufferPool::give(chunk);
+    BufferPool::give(sample_chunk);
+    encodedFile.closeSamples();
+    if (stream && !encodedFile.closeSink()) return false;
+
+    secret_ext = file_ext;
+    secret_height = height;
+    secret_width = width;
+    extracted = !stream;
+    return true;
+}
+bool Decoder::write(std::string newFile){
+    if (!extracted){
+        LOG_ERROR("Error: Nothing has been extracted yet");
+        return false;
+    }
+    //reusing the encodedFile obj
+    newFile = secretPath(newFile, secret_ext);
+    bool written = false;
+    if (secret_ext == ".txt" or secret_ext == ".wav"){
+        encodedFile.setBinaryFileData(std::move(extracted_data));
+        written = encodedFile.writeFile(newFile);
+    }
+    else if (secret_ext == ".png"){
+        encodedFile.setPngPixelData(std::move(extracted_data));
+        encodedFile.setImageDimensions(0, secret_height);
+        encodedFile.setImageDimensions(1, secret_width);
+        written = encodedFile.writePng(newFile);
+    }
+    else if (secret_ext == ".jpeg" or secret_ext == ".jpg"){
+        encodedFile.setPngPixelData(std::move(extracted_data));
+        encodedFile.setImageDimensions(0, secret_height);
+        encodedFile.setImageDimensions(1, secret_width);
+        written = encodedFile.writeJpeg(newFile);
+    }
+    if (!written){
+        LOG_ERROR("Error: Failed to write to " << newFile);
+        return false;
+    }
+    logExtracted(newFile);
+    return true;
+}
@@ -7,16 +7,62 @@
 
 class Decoder{
     public:
-        Decoder(std::string fileName);
+        //codec: the file's format if it has been sniffed already, see Handler::Handler
+        Decoder(std::string fileName, const CarrierCodec* codec = nullptr);
+        //in-memory encoded file, the name only supplies the extension
+        Decoder(std::string fileName, const unsigned char* data, size_t size, const CarrierCodec* codec = nullptr);
+        ~Decoder(); //hands its buffers back to BufferPool
+        //write the extracted secret into output instead of a file
+        void setMemoryOutput(std::vector<unsigned char>* output);
+        //png/jpeg secrets are re-encoded on write, see Handler::setWriteProfile
+        void setWriteProfile(WriteProfile profile);
+        std::string getProfileReport() const;
+        //on by default: an rgba8 png reads the same either way, so native covers both encoder modes
+        //only getCapacity() differs, turn it off to probe for a non-native encode
+        void setNativePng(bool enabled);
+        //checked by every stage, see Handler::setJobContext; extraction checks it every 64 KiB of payload or block row
+        void setJobContext(std::shared_ptr<JobContext> context);
+        //the key the carrier was encoded with, see Encoder::setScatterKey; only the positions the payload
+        //needs are mapped, one at a time
+        void setScatterKey(const std::string key);
+        //wav/raw carriers are read a chunk at a time as the payload is extracted instead of whole,
+        //see Handler::openSamples; not with a scatter key, whose positions can be anywhere in the file
+        void setStreamed(bool enabled);
+        std::string getSecretExt() const;
         bool openEncodedFile();
+        //extractTo for either carrier, kept for older callers
         bool pngDecode(std::string newFile);
         bool jpegDecode(std::string newFile);
+        //the stages pngDecode/jpegDecode run, exposed so a scheduler can run them as separate tasks
+        //openEncodedFile() is the read stage
+        bool extract();
+        bool write(std::string newFile);
+        //extract and write in one pass: a text secret goes to newFile (plus its extension) through
+        //Handler's sink as it's extracted, so memory stays the same whatever its size
+        //image secrets are re-encoded on write, those are still collected first
+        bool extractTo(std::string newFile);
+        //payload bytes (header included) this carrier can hold, valid after openEncodedFile()
+        size_t getCapacity();
     private:
         std::vector<unsigned char> file_data, extracted_data;
+        std::vector<unsigned char> sample_chunk; //streamed samples, see setStreamed
         bool file_check = false;
+        bool extracted = false;
+        bool memory_output = false;
+        bool streamed = false, streaming_samples = false; //asked for, and openEncodedFile() could
         Handler encodedFile;
-        std::string encoded_name;
+        std::shared_ptr<JobContext> job_context;
+        bool checkpoint(uint64_t done, uint64_t total);
+        std::string encoded_name, secret_ext, scatter_key;
+        int secret_height = 0, secret_width = 0;
         bool checksumCheck(uint16_t checksum);
+        void logExtracted(const std::string newFile) const;
+        bool dctCarrier() const; //the encoded file's codec embeds in jpeg coefficients
+        bool rawCarrier() const; //embedded in place: the lsbs are read from the file, nothing is copied into file_data
+        const unsigned char* lsbData();
+        size_t lsbSize() const;
+        //both carriers share the header parsing, stream_to null collects the secret into extracted_data
+        bool extractPayload(const std::string* stream_to);
 };
 
 #endif
\ No newline at end of file
@@ -3,18 +3,247 @@
 #include "handler.hpp"
 #include "encoder.hpp"
 #include "decoder.hpp"
+#include "batch.hpp"
+#include "daemon.hpp"
+#include "bufferpool.hpp"
+#include "carriercache.hpp"
+#include "metrics.hpp"
+#include "logger.hpp"
+#include "memorybudget.hpp"
+#include "resultcache.hpp"
 #include <ctime>
+#include <cstdlib>
 #include <algorithm>
-#include <filesystem>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
 
-int main(){
+static void printUsage(){
+    std::cout << "Usage:" << std::endl
+              << "\t demo [--pipeline] [--native] [--profile P]    interactive mode" << std::endl
+              << "\t demo --batch <manifest> [--jobs N] [--pipeline] [--native] [--profile P]  run every job in a csv/jsonl manifest" << std::endl
+              << "\t demo --daemon <socket> [--jobs N]             serve jobs over a unix domain socket" << std::endl
+              << "\t demo --client <socket> [--pass-fds] encode <secret> <carrier> <output>" << std::endl
+              << "\t demo --client <socket> [--pass-fds] decode <encoded> <output>" << std::endl
+              << "\t demo --client <socket> [--pass-fds] probe <encoded>" << std::endl
+              << "\t demo --client <socket> shutdown" << std::endl
+              << "\t demo --encode <secret> <carrier> <output>      encode once without prompts" << std::endl
+              << "\t demo --decode <encoded> <output>               decode once without prompts" << std::endl
+              << "\t   \"-\" reads the secret or carrier from stdin and writes the output to stdout, e.g." << std::endl
+              << "\t   cat carrier.png | demo --encode secret.txt - - | demo --decode - - > secret.txt" << std::endl
+              << "\t --pipeline overlaps png decode, embed and encode of each carrier on separate threads," << std::endl
+              << "\t            streams wav/raw carriers through a chunk at a time, and decodes write text secrets as they're extracted" << std::endl
+              << "\t --native keeps png carriers' color type and bit depth instead of writing 8-bit rgba" << std::endl
+              << "\t --deterministic encodes the same secret and carrier to the same bytes every time" << std::endl
+              << "\t --key K spreads the payload over the whole carrier in an order derived from K, decode with the same K (or STEGASAUR_KEY)" << std::endl
+              << "\t --result-cache DIR reuses outputs of repeated batch/daemon encodes, implies --deterministic (or STEGASAUR_RESULT_CACHE)" << std::endl
+              << "\t --hugepages backs large buffers with transparent huge pages (or STEGASAUR_HUGEPAGES=1)" << std::endl
+              << "\t --carrier-cache MiB keeps decoded carriers for reuse, 0 disables (default 256, or STEGASAUR_CARRIER_CACHE)" << std::endl
+              << "\t --memory-budget MiB queues jobs whose estimated footprints would add up past it (or STEGASAUR_MEMORY_BUDGET)" << std::endl
+              << "\t --job-memory MiB pipelines png and wav/raw encodes and streams decodes estimated above it (or STEGASAUR_JOB_MEMORY)" << std::endl
+              << "\t --timeout SECONDS stops each batch/daemon job that runs longer, freeing what it held" << std::endl
+              << "\t --profile fast|balanced|smallest|auto picks output compression (default smallest)" << std::endl
+              << "\t --log-level debug|info|warn|error|off filters diagnostics (default info, or STEGASAUR_LOG)" << std::endl
+              << "\t --metrics FILE writes per-phase timings at exit, prometheus text for .prom/.txt, json lines otherwise" << std::endl;
+}
+
+//set by --metrics, written once the process is done whichever way it exits
+static std::string metrics_path;
+static void writeMetrics(){
+    if (!metrics_path.empty()) Metrics::writeFile(metrics_path);
+}
+
+static std::string baseName(const std::string &path){
+    size_t sep_pos = path.find_last_of("\\/");
+    return sep_pos == std::string::npos ? path : path.substr(sep_pos + 1);
+}
+
+//send one request to a running daemon
+//with --pass-fds the client opens the files itself and hands the descriptors over
+static int runClient(const std::vector<std::string> &args){
+    std::vector<std::string> rest(args.begin() + 2, args.end());
+    bool pass_fds = false;
+    if (!rest.empty() && rest[0] == "--pass-fds"){
+        pass_fds = true;
+        rest.erase(rest.begin());
+    }
+    if (rest.empty()){ printUsage(); return 1; }
+    DaemonClient client(args[1]);
+    if (rest[0] == "shutdown" && rest.size() == 1){
+        return client.shutdownDaemon() ? 0 : 1;
+    }
+
+    EngineJob job;
+    std::vector<int> fds;
+    bool opened = true;
+    auto passFile = [&](const std::string &path, int flags) -> std::string{
+        if (!pass_fds) return path;
+        int fd = open(path.c_str(), flags | O_CLOEXEC, 0644);
+        if (fd < 0){
+            std::cerr << "Error: Could not open " << path << std::endl;
+            opened = false;
+            return path;
+        }
+        fds.push_back(fd);
+        return "fd:" + std::to_string(fds.size() - 1) + ":" + baseName(path);
+    };
+    if (rest[0] == "encode" && rest.size() == 4){
+        job.type = JobType::ENCODE;
+        job.secret = passFile(rest[1], O_RDONLY);
+        job.carrier = passFile(rest[2], O_RDONLY);
+        job.output = passFile(Handler::resolveOutputPath(rest[2], rest[3]), O_WRONLY | O_CREAT | O_TRUNC);
+    }
+    else if (rest[0] == "decode" && rest.size() == 3){
+        //decoded output name depends on the payload, so it always goes by path
+        job.type = JobType::DECODE;
+        job.encoded = passFile(rest[1], O_RDONLY);
+        job.output = rest[2];
+    }
+    else if (rest[0] == "probe" && rest.size() == 2){
+        job.type = JobType::PROBE;
+        job.encoded = passFile(rest[1], O_RDONLY);
+    }
+    else { printUsage(); return 1; }
+
+    DaemonReply reply;
+    bool sent = opened && client.request(job, reply, fds);
+    for (int fd : fds) close(fd);
+    if (!sent) return 1;
+    std::cout << "Console: " << rest[0] << (reply.success ? " succeeded" : " failed")
+              << " [" << reply.format << "] " << reply.output;
+    if (job.type == JobType::PROBE) std::cout << " capacity " << reply.capacity << " bytes";
+    std::cout << " (" << reply.total_ms << " ms)";
+    if (!reply.success && !reply.error.empty()) std::cout << " " << reply.error << (reply.error_message.empty() ? "" : ": " + reply.error_message);
+    std::cout << std::endl;
+    return reply.success ? 0 : 1;
+}
+
+//one encode or decode without prompts, "-" is stdin as an input and stdout as an output
+//png carriers always take the pipelined path so a piped one is decoded, embedded and encoded as it streams,
+//and wav/raw files are copied through (or extracted from) a chunk at a time
+static int runPipe(const std::vector<std::string> &args, bool native_png, bool deterministic, const std::string scatter_key, WriteProfile profile){
+    bool encode = args[0] == "--encode";
+    if ((encode && args.size() != 4) || (!encode && args.size() != 3)){ printUsage(); return 1; }
+    if (encode && Handler::isStdio(args[1]) && Handler::isStdio(args[2])){
+        std::cerr << "Error: Only one of the secret and the carrier can come from stdin" << std::endl;
+        return 1;
+    }
+    //diagnostics would end up in the data otherwise
+    if (Handler::isStdio(args.back())) Logger::instance().setStderrOnly(true);
+    if (encode){
+        Encoder stega(args[1], args[2]);
+        stega.setPipelined(true);
+        stega.setNativePng(native_png);
+        stega.setWriteProfile(profile);
+        stega.setDeterministic(deterministic);
+        stega.setScatterKey(scatter_key);
+        if (!stega.openFiles() || !stega.embed()) return 1;
+        return stega.write(Handler::resolveOutputPath(args[2], args[3])) ? 0 : 1;
+    }
+    Decoder saur(args[1]);
+    saur.setWriteProfile(profile);
+    saur.setScatterKey(scatter_key);
+    saur.setStreamed(true);
+    if (!saur.openEncodedFile()) return 1;
+    return saur.extractTo(args[2]) ? 0 : 1;
+}
+
+int main(int argc, char* argv[]){
     std::string secret, carrier, new_file, encoded_file, mode;
+    std::vector<std::string> args;
+    unsigned int workers = std::thread::hardware_concurrency();
+    bool pipelined = false, native_png = false, deterministic = false;
+    double timeout = 0.0;
+    WriteProfile profile = WriteProfile::SMALLEST;
+    //the environment keeps the key out of the process list
+    const char* key_setting = getenv("STEGASAUR_KEY");
+    std::string scatter_key = key_setting ? key_setting : "";
+    for (int i = 1; i < argc; ++i){
+        std::string arg = argv[i];
+        if (arg == "--jobs" && i + 1 < argc){
+            try { workers = static_cast<unsigned int>(std::stoul(argv[++i])); }
+            catch (...) { printUsage(); return 1; }
+        }
+        else if (arg == "--pipeline"){ pipelined = true; }
+        else if (arg == "--native"){ native_png = true; }
+        else if (arg == "--deterministic"){ deterministic = true; }
+        else if (arg == "--key" && i + 1 < argc){ scatter_key = argv[++i]; }
+        else if (arg == "--result-cache" && i + 1 < argc){
+            if (!ResultCache::instance().setDirectory(argv[++i])) return 1;
+        }
+        else if (arg == "--hugepages"){ BufferPool::setHugePages(true); }
+        else if (arg == "--carrier-cache" && i + 1 < argc){
+            try { CarrierCache::instance().setBudget(static_cast<size_t>(std::stoul(argv[++i])) << 20); }
+            catch (...) { printUsage(); return 1; }
+        }
+        else if (arg == "--memory-budget" && i + 1 < argc){
+            try { MemoryBudget::instance().setProcessBudget(static_cast<size_t>(std::stoul(argv[++i])) << 20); }
+            catch (...) { printUsage(); return 1; }
+        }
+        else if (arg == "--job-memory" && i + 1 < argc){
+            try { MemoryBudget::instance().setJobBudget(static_cast<size_t>(std::stoul(argv[++i])) << 20); }
+            catch (...) { printUsage(); return 1; }
+        }
+        else if (arg == "--timeout" && i + 1 < argc){
+            try { timeout = std::stod(argv[++i]); }
+            catch (...) { printUsage(); return 1; }
+        }
+        else if (arg == "--profile" && i + 1 < argc){
+            if (!parseWriteProfile(argv[++i], profile)){ printUsage(); return 1; }
+        }
+        else if (arg == "--log-level" && i + 1 < argc){
+            LogLevel level;
+            if (!Logger::parseLevel(argv[++i], level)){ printUsage(); return 1; }
+            Logger::instance().setLevel(level);
+        }
+        else if (arg == "--metrics" && i + 1 < argc){
+            if (!Metrics::compiledIn()){
+                std::cerr << "Error: --metrics needs a build with -DSTEGASAUR_METRICS" << std::endl;
+                return 1;
+            }
+            if (metrics_path.empty()) std::atexit(writeMetrics);
+            metrics_path = argv[++i];
+        }
+        else { args.push_back(arg); }
+    }
+    //non-interactive modes
+    if (!args.empty()){
+        if (args[0] == "--batch" && args.size() == 2){
+            Batch batch(args[1], workers);
+            batch.setPipelined(pipelined);
+            batch.setNativePng(native_png);
+            batch.setDeterministic(deterministic);
+            batch.setScatterKey(scatter_key);
+            batch.setWriteProfile(profile);
+            batch.setTimeout(timeout);
+            if (!batch.loadManifest()) return 1;
+            return batch.run() ? 0 : 1;
+        }
+        else if (args[0] == "--daemon" && args.size() == 2){
+            Daemon daemon(args[1], workers);
+            daemon.setJobTimeout(timeout);
+            if (!daemon.start()) return 1;
+            daemon.serve();
+            return 0;
+        }
+        else if (args[0] == "--client" && args.size() >= 3){
+            return runClient(args);
+        }
+        else if (args[0] == "--encode" || args[0] == "--decode"){
+            return runPipe(args, native_png, deterministic, scatter_key, profile);
+        }
+        printUsage();
+        return 1;
+    }
     std::cout << "Welcome to the StegaSaur Steganography Command Line Interface!" << std::endl;
     while(1){
+        //encoder/decoder lines are written in the background, get them out before prompting
+        Logger::instance().flush();
         std::cout << "Select mode:" << std::endl << "\t [1] Encoding" << std::endl << "\t [2] Decoding" << std::endl << "\t [3] Exit" << std::endl;
         std::cin >> mode;
         if (mode != "1" and mode != "2" and mode != "3"){
-            std::cerr << "Error: Invalid mode. Select 1, 2, or 3." << std::endl;
+            LOG_ERROR("Error: Invalid mode. Select 1, 2, or 3.");
             mode = "0";
             continue;
         }
@@ -28,67 +257,26 @@ int main(){
             std::cin >> new_file;
 
             Encoder stega = Encoder(secret, carrier);
+            stega.setPipelined(pipelined);
+            stega.setNativePng(native_png);
+            stega.setDeterministic(deterministic);
+            stega.setScatterKey(scatter_key);
+            stega.setWriteProfile(profile);
             if (!stega.openFiles()){
-                std::cout << "Console: Aborting encoder." << std::endl;
+                LOG_INFO("Console: Aborting encoder.");
                 continue;
             }
-            // build output path inside the same directory as the carrier (if carrier had a path)
-            std::string out_base = new_file;
-            size_t sep_pos = carrier.find_last_of("\\/");
-            if (sep_pos != std::string::npos){
-                out_base = carrier.substr(0, sep_pos + 1) + new_file;
-            }
+            //output path and extension are decided before encoding, .jpg carriers keep .jpg
+            std::string out_path = Handler::resolveOutputPath(carrier, new_file);
 
-            if (carrier.find(".png") != std::string::npos){
-                std::string out_path = out_base + ".png";
-                std::cout << "Console: PNG Carrier detected. Beginning PNG LSB method." << std::endl;
-                if (!stega.pngLsb(out_path)){
-                    std::cout << "Console: Aborting encoder." << std::endl;
-                    continue;
-                }
-                std::cout << "Console: " << carrier << " successfully encoded and written to " << out_path << std::endl;
-            }
-            else if (carrier.find(".wav") != std::string::npos){
-                std::string out_path = out_base + ".wav";
-                std::cout << "Console: WAV Carrier detected. Beginning WAV LSB method." << std::endl;
-                if (!stega.pngLsb(out_path)){
-                    std::cout << "Console: Aborting encoder." << std::endl;
-                    continue;
-                }
-                std::cout << "Console: " << carrier << " successfully encoded and written to " << out_path << std::endl;
-            }
-            else if (carrier.find(".jpeg") != std::string::npos or carrier.find(".jpg") != std::string::npos){
-                std::cout << "Console: JPEG Carrier detected. Beginning JPEG DCT method." << std::endl;
-                // dctJpeg will append .jpeg internally; pass base path (no ext)
-                if (!stega.dctJpeg(out_base)){
-                    std::cout << "Console: Aborting encoder." << std::endl;
-                    continue;
-                }
-                // actual file created will be out_base + ".jpeg"
-                std::string created = out_base + ".jpeg";
-                std::string final_out = created;
-                // if carrier was .jpg prefer .jpg for Windows users
-                if (carrier.find(".jpg") != std::string::npos){
-                    std::string preferred = out_base + ".jpg";
-                    int r = std::rename(created.c_str(), preferred.c_str());
-                    if (r == 0){
-                        final_out = preferred;
-                    } else {
-                        // if rename failed, check whether the preferred file already exists (maybe created by OS or another process).
-                        if (std::filesystem::exists(preferred)){
-                            // preferred exists, consider it a success
-                            final_out = preferred;
-                        } else if (!std::filesystem::exists(created)){
-                            // neither created nor preferred exists, something went wrong
-                            std::cerr << "Warning: failed to rename " << created << " to " << preferred << "." << std::endl;
-                        } else {
-                            // created exists but rename failed for some reason; keep created and warn
-                            std::cerr << "Warning: failed to rename " << created << " to " << preferred << "." << std::endl;
-                        }
-                    }
-                }
-                std::cout << "Console: " << carrier << " successfully encoded and written to " << final_out << std::endl;
+            const CarrierCodec* codec = stega.getCarrierCodec();
+            const char* method = codec->method == EmbedMethod::DCT ? "DCT" : (codec->take ? "LSB" : "in-place LSB");
+            LOG_INFO("Console: " << codec->name << " Carrier detected. Beginning " << codec->name << " " << method << " method.");
+            if (!stega.embed() || !stega.write(out_path)){
+                LOG_INFO("Console: Aborting encoder.");
+                continue;
             }
+            LOG_INFO("Console: " << carrier << " successfully encoded and written to " << out_path);
         }
         else if (mode == "2"){
             std::cout << "Console: Enter Encoded file" << std::endl;
@@ -98,25 +286,21 @@ int main(){
             std::cin >> new_file;
 
             Decoder saur = Decoder(encoded_file);
+            saur.setWriteProfile(profile);
+            saur.setScatterKey(scatter_key);
+            saur.setStreamed(pipelined);
             if(!saur.openEncodedFile()){
-                std::cout << "Console: Aborting decoder." << std::endl;
+                LOG_INFO("Console: Aborting decoder.");
                 continue;
             }
-            if (encoded_file.find(".png") != std::string::npos || encoded_file.find(".wav") != std::string::npos){
-                if (!saur.pngDecode(new_file)){
-                    std::cout << "Console: Aborting decoder." << std::endl;
-                    continue;
-                }
-            }
-            else if (encoded_file.find(".jpeg") != std::string::npos or encoded_file.find(".jpg") != std::string::npos){
-                if (!saur.jpegDecode(new_file)){
-                    std::cout << "Console: Aborting decoder." << std::endl;
-                    continue;
-                }
+            //the carrier's codec picks LSB or DCT extraction, text secrets are written as they're extracted
+            if (!saur.extractTo(new_file)){
+                LOG_INFO("Console: Aborting decoder.");
+                continue;
             }
         }
         else if (mode == "3"){
-            std::cout << "Console: Exiting StegaSaur. Good bye!" << std::endl;
+            LOG_INFO("Console: Exiting StegaSaur. Good bye!");
             exit(0);
         }
 
@@ -1,4 +1,3 @@
-#include <iostream>
 #include <vector>
 #include "encoder.hpp"
 #include <cstdint>
@@ -6,15 +5,80 @@
 #include <jpeglib.h>
 #include <random>
 #include <chrono>
+#include <array>
+#include <algorithm>
+#include <memory>
+#include "bufferpool.hpp"
+#include "metrics.hpp"
+#include "logger.hpp"
+#include "jobcontext.hpp"
+#include "resultcache.hpp"
+#include "scatter.hpp"
 
-Encoder::Encoder(std::string secret, std::string carrier)
+static const size_t EMBED_CHUNK = 64 * 1024; //payload bytes embedded between job context checks
+
+Encoder::Encoder(std::string secret, std::string carrier, const CarrierCodec* carrier_codec)
 //constructor has an init list that create Handler object to handle input files
     :   secret_file(secret),
-        carrier_file(carrier)
+        carrier_file(carrier, carrier_codec)
 {
     this->secret_name = secret;
     this->carrier_name = carrier;
-    std::cout << "Console: Initializing Encoder..." << std::endl;
+    LOG_INFO("Console: Initializing Encoder...");
+}
+Encoder::~Encoder(){
+    BufferPool::give(secret_data);
+    BufferPool::give(carrier_data);
+    BufferPool::give(pending_payload);
+}
+Encoder::Encoder(std::string secret, const unsigned char* secret_bytes, size_t secret_size,
+                 std::string carrier, const unsigned char* carrier_bytes, size_t carrier_size, const CarrierCodec* carrier_codec)
+    :   secret_file(secret, secret_bytes, secret_size),
+        carrier_file(carrier, carrier_bytes, carrier_size, carrier_codec)
+{
+    this->secret_name = secret;
+    this->carrier_name = carrier;
+}
+void Encoder::setMemoryOutput(std::vector<unsigned char>* output){
+    carrier_file.setMemoryOutput(output);
+}
+void Encoder::setPipelined(bool enabled){
+    pipelined = enabled;
+}
+void Encoder::setWriteProfile(WriteProfile profile){
+    carrier_file.setWriteProfile(profile);
+}
+void Encoder::setNativePng(bool enabled){
+    carrier_file.setNativePng(enabled);
+}
+void Encoder::setCarrierCache(const CarrierKey key, std::shared_ptr<const DecodedCarrier> pinned){
+    carrier_file.setCarrierCache(key, pinned);
+}
+void Encoder::setJobContext(std::shared_ptr<JobContext> context){
+    job_context = context;
+    secret_file.setJobContext(context);
+    carrier_file.setJobContext(context);
+}
+void Encoder::setDeterministic(bool enabled){
+    deterministic = enabled;
+}
+void Encoder::setScatterKey(const std::string key){
+    scatter_key = key;
+}
+bool Encoder::checkpoint(uint64_t done, uint64_t total){
+    return !job_context || job_context->checkpoint(MetricPhase::EMBED, done, total);
+}
+std::string Encoder::getProfileReport() const{
+    return carrier_file.getProfileReport();
+}
+const CarrierCodec* Encoder::getCarrierCodec() const{
+    return carrier_file.getCodec();
+}
+bool Encoder::pipelinedPng(){
+    return pipelined && carrier_file.getCodec() && carrier_file.getCodec()->pipelined;
+}
+bool Encoder::streamedSamples(){
+    return pipelined && carrier_file.canStreamSamples();
 }
 bool Encoder::openFiles(){
     //open both files and get their data
@@ -31,40 +95,51 @@ bool Encoder::openFiles(){
         secret_check = secret_file.readJpeg();
         secret_data = secret_file.getPixelData();
     }
-    //only checks png, jpeg files; other files with a valid secret will still pass
-    if(carrier_file.getExt() == ".png"){
-        carrier_check = carrier_file.readPng();
-        carrier_data = carrier_file.getPixelData();
+    //the carrier's codec decides how it's read, see CarrierCodecs
+    const CarrierCodec* codec = carrier_file.getCodec();
+    if (!codec){
+        carrier_check = false;
     }
-    else if (carrier_file.getExt() == ".wav"){
-        carrier_check = carrier_file.readWav();
-        carrier_data = carrier_file.getWavSampleData();
+    else if(pipelinedPng() || streamedSamples()){
+        //carrier is streamed in write(), a bad one fails there
+        carrier_check = true;
     }
-    else if(carrier_file.getExt() == ".jpeg" or carrier_file.getExt() == ".jpg"){
-        // read JPEG pixel data so encoding methods that expect pixel bytes have data
-        carrier_check = carrier_file.readJpeg();
-        carrier_data = carrier_file.getPixelData();
+    else{
+        //carriers without take() (raw formats) are embedded in place, nothing is copied out
+        carrier_check = codec->read(carrier_file);
+        if (carrier_check && codec->take) carrier_data = codec->take(carrier_file);
     }
     if (secret_check == false or carrier_check == false){
+        //stopped by the job context rather than a bad file, the engine reports why
+        if (carrier_file.cancelled()) return false;
         if (secret_check == false and carrier_check == false){
-            std::cerr << "Error: Failed to open secret file and carrier file" << std::endl;
+            LOG_ERROR("Error: Failed to open secret file and carrier file");
             return false;
         }
         else if (secret_check == false){
-            std::cerr << "Error: Failed to open secret file" << std::endl;
+            LOG_ERROR("Error: Failed to open secret file");
             return false;
         }
         else if (carrier_check == false){
-            std::cerr << "Error: Failed to open carrier file" << std::endl;
+            LOG_ERROR("Error: Failed to open carrier file");
             return false;
         }
     }
-    std::cout << "Console: Encoder ready" << std::endl;
+    LOG_INFO("Console: Encoder ready");
     return true;
 }
 
 uint16_t Encoder::generateChecksum(){
     uint16_t checksum = 0;
+    if (deterministic){
+        //a nonzero multiple of 13 that fits in 16 bits, picked by the secret's contents and extension
+        std::string secret_ext = secret_file.getExt();
+        uint64_t seed = ResultCache::hash(secret_data.data(), secret_data.size(),
+                                          ResultCache::hash(reinterpret_cast<const unsigned char*>(secret_ext.data()), secret_ext.size()));
+        checksum = static_cast<uint16_t>(13 * (1 + seed % (UINT16_MAX / 13)));
+        LOG_DEBUG("Console: Checksum generated: " << checksum);
+        return checksum;
+    }
     //initialize random number generator and seed with device's time since epoch
     //default_random_engine to choose different engines based on platform
     std::default_random_engine random_numbers(std::chrono::high_resolution_clock::now().time_since_epoch().count());
@@ -79,153 +154,223 @@ uint16_t Encoder::generateChecksum(){
             break;
         }
     }
-    std::cout << "Console: Checksum generated: " << checksum << std::endl;
+    LOG_DEBUG("Console: Checksum generated: " << checksum);
     return checksum;
 }
 
-bool Encoder::pngLsb(std::string newFile){
+std::vector<unsigned char> Encoder::buildPayload(){
+    //build the payload: checksum + ext + size + file_data
+    //if its an image: checksum + ext + height + width + size + file_data
+    //same layout for every carrier so Decoder only has to parse one format
+    STEGA_METRIC(MetricScope metric(MetricPhase::PAYLOAD_BUILD));
+    std::vector<unsigned char> secret_payload;
     std::string secret_ext = secret_file.getExt();
-    int secret_height = 0, secret_width = 0;
-    if (secret_ext == ".png" or secret_ext == ".jpeg" or secret_ext == ".jpg"){
-        secret_height = secret_file.getImageDimensions(0);
-        secret_width = secret_file.getImageDimensions(1);
-        std::cout << "Secret Height: " << secret_height << std::endl << "Secret Width " << secret_width << std::endl;
-    } 
-    std::streamsize secret_size = secret_file.getFileSize();
-    //ext len + ext chars + datasize of the file size + actual file size (in bytes) -> times 8 bits
-    std::streamsize required_bytes = (1 + static_cast<std::streamsize>(secret_ext.length()) + static_cast<std::streamsize>(secret_size)) * 8;
-    // ensure carrier_data buffer has enough bytes to hold required bits
-    if (required_bytes > static_cast<std::streamsize>(carrier_data.size())){
-        std::cout << "Error: Secret file is too large." << std::endl;
-        return false;
-    }
-
-    std::streamsize offset = 0;
-    //encode the checksum first
+    std::uint8_t ext_len = static_cast<uint8_t>(secret_ext.length());
+    unsigned char* ext_len_bytes = reinterpret_cast<unsigned char*>(&ext_len);
+    uint32_t secret_size = secret_data.size();
+    unsigned char* size_bytes = reinterpret_cast<unsigned char*>(&secret_size);
     uint16_t checksum = generateChecksum();
-    //then encode the bytes of the checksum
     unsigned char* checksum_bytes = reinterpret_cast<unsigned char*>(&checksum);
-    for (size_t i = 0; i < sizeof(checksum); ++i){
-        for (int j = 0; j < 8; ++j){
-            unsigned char bit = (checksum_bytes[i] >> j) & 1;
-            carrier_data[offset] &= 0xFE;
-            carrier_data[offset] |= bit;
-            offset++;
-        }
-    }
+    bool image_secret = secret_ext == ".png" or secret_ext == ".jpeg" or secret_ext == ".jpg";
+    //sized up front so the inserts below never regrow it
+    size_t payload_size = sizeof(checksum) + sizeof(ext_len) + ext_len + (image_secret ? sizeof(int) * 2 : 0) + sizeof(secret_size) + secret_data.size();
+    secret_payload = BufferPool::take(payload_size);
+    secret_payload.clear();
 
-    //encode size of file ext
-    //i use 'j' for for loops nested in another for loop - td
-    uint8_t secret_ext_len = static_cast<uint8_t>(secret_ext.length());
-    for (int i = 0; i < 8; ++i){
-        unsigned char bit = (secret_ext_len >> i) & 1;
-        carrier_data[offset] &= 0xFE;
-        carrier_data[offset] |= bit;
-        offset++;
-    }
-    //encode secret file's ext for when we decode
-    for (char c : secret_ext){
-        for (int j = 0; j < 8; ++j){
-            c = static_cast<unsigned char>(c);
-            unsigned char bit = (c >> j) & 1;
-            carrier_data[offset] &= 0xFE;
-            carrier_data[offset] |= bit;
-            offset++;
-        }
-        
-    }
-    if (secret_ext == ".png" or secret_ext == ".jpeg" or secret_ext == ".jpg"){
-        //encode the image's dimensions
-        //height first
-        //width next
+    secret_payload.insert(secret_payload.end(), checksum_bytes, checksum_bytes + sizeof(checksum));
+    secret_payload.insert(secret_payload.end(), ext_len_bytes, ext_len_bytes + sizeof(ext_len));
+    secret_payload.insert(secret_payload.end(), secret_ext.begin(), secret_ext.end());
+    //while its unlikely an image will fit in a jpeg, (even if its a png/jpeg) it will still be implemented
+    if (image_secret){
+        int secret_height = secret_file.getImageDimensions(0);
+        int secret_width = secret_file.getImageDimensions(1);
+        LOG_DEBUG("Console: Secret height: " << secret_height << ", width: " << secret_width);
         unsigned char* secret_height_bytes = reinterpret_cast<unsigned char*>(&secret_height);
-        //changed std::streamsize to size_t for sizeof compatibility
-        for (size_t i = 0; i < sizeof(secret_height); ++i){
-            for (int j = 0; j < 8; ++j){
-                unsigned char bit = (secret_height_bytes[i] >> j) & 1;
-                carrier_data[offset] &= 0xFE;
-                carrier_data[offset] |= bit;
-                offset++;
-            }
-        }
-
         unsigned char* secret_width_bytes = reinterpret_cast<unsigned char*>(&secret_width);
-        //changed std::streamsize to size_t for sizeof compatibility
-        for (size_t i = 0; i < sizeof(secret_width); ++i){
-            for (int j = 0; j < 8; ++j){
-                unsigned char bit = (secret_width_bytes[i] >> j) & 1;
-                carrier_data[offset] &= 0xFE;
-                carrier_data[offset] |= bit;
-                offset++;
-            }
-        }
+
+        secret_payload.insert(secret_payload.end(), secret_height_bytes, secret_height_bytes + sizeof(secret_height));
+        secret_payload.insert(secret_payload.end(), secret_width_bytes, secret_width_bytes + sizeof(secret_width));
+    } 
+    secret_payload.insert(secret_payload.end(), size_bytes, size_bytes + sizeof(secret_size));
+    secret_payload.insert(secret_payload.end(), secret_data.begin(), secret_data.end());
+    STEGA_METRIC(metric.addBytes(secret_payload.size()));
+    STEGA_METRIC(metric.noteBuffer(secret_payload.capacity()));
+    return secret_payload;
+}
+
+bool Encoder::embed(){
+    if (carrier_check == false){
+        LOG_ERROR("Error: Carrier file not valid");
+        return false;
     }
-    //encode datasize of file next
-    unsigned char* secret_size_bytes = reinterpret_cast<unsigned char*>(&secret_size);
-    //changed std::streamsize to size_t for sizeof compatibility
-    for (size_t i = 0; i < sizeof(secret_size); ++i){
-        for (int j = 0; j < 8; ++j){
-            unsigned char bit = (secret_size_bytes[i] >> j) & 1;
-            carrier_data[offset] &= 0xFE;
-            carrier_data[offset] |= bit;
-            offset++;
-        }
+    if (carrier_file.getCodec()->method == EmbedMethod::DCT){
+        return embedDct();
     }
-    //now encode file data
-    for (unsigned char file_byte : secret_data){
-        for (int j = 0; j < 8; ++j){
-            unsigned char bit = (file_byte >> j) & 1;
-            carrier_data[offset] &= 0xFE;
-            carrier_data[offset] |= bit;
-            offset++;
-        }
+    if (pipelinedPng() || streamedSamples()){
+        //only the payload is ready here, the carrier rows or samples are embedded in write()
+        pending_payload = buildPayload();
+        embedded = true;
+        return true;
+    }
+    return embedLsb();
+}
+
+bool Encoder::write(std::string newFile){
+    if (!embedded){
+        LOG_ERROR("Error: Nothing has been embedded yet");
+        return false;
     }
     // update handler carrier file obj with encoded data and write new file
-    if (carrier_file.getExt() == ".png"){
-        carrier_file.setPngPixelData(carrier_data);
-        carrier_file.writePng(newFile);
+    if (pipelinedPng()){
+        return writePipelined(newFile);
     }
-    else if (carrier_file.getExt() == ".wav"){
-        // carrier_data currently contains the raw file bytes read by readFile(); need to replace the wav samples
-        carrier_file.setWavSampleData(carrier_data);
-        carrier_file.writeWav(newFile);
+    if (streamedSamples()){
+        return writeStreamed(newFile);
     }
-    return true;
+    const CarrierCodec* codec = carrier_file.getCodec();
+    //carrier_data holds only the bytes carrying the payload, put() splices them back into the carrier
+    if (codec->put) codec->put(carrier_file, std::move(carrier_data));
+    return codec->write(carrier_file, newFile);
 }
 
-bool Encoder::dctJpeg(std::string newFile){
-    //intercepting compression process midway
-    //file handling, reading and writing will have to be done here
-    //setup decompression
-    struct jpeg_decompress_struct decompress_info;
-    struct jpeg_error_mgr jpeg_error;
-    decompress_info.err = jpeg_std_error(&jpeg_error);
+bool Encoder::pngLsb(std::string newFile){
+    return embed() && write(newFile);
+}
 
-    if(carrier_check == false){
-        std::cerr << "Error: Carrier file not valid" << std::endl;
-        return false;
-    }
-    FILE* jpeg_file = fopen(carrier_name.c_str(), "rb");
-    if(!jpeg_file){
-        std::cerr << "Error: " << carrier_name << " failed to open" << std::endl;
-        return false;
-    }
+bool Encoder::writePipelined(std::string newFile){
+    //same bit layout as embedLsb, payload bit i goes into lsb byte i (or ScatterOrder's at(i)), row by row
+    //16-bit rows only carry bits in the low byte of each sample
+    const std::vector<unsigned char> &payload = pending_payload;
+    size_t payload_bits = payload.size() * 8;
+    size_t row_size = 0, stride = 1;
+    std::unique_ptr<ScatterOrder> order;
+    bool written = carrier_file.pipelinePng(newFile,
+        [&](int height, size_t row_bytes){
+            stride = carrier_file.getBitDepth() / 8;
+            row_size = row_bytes / stride;
+            if (payload_bits > (size_t)height * row_size){
+                LOG_ERROR("Error: Secret file is too large.");
+                return false;
+            }
+            if (!scatter_key.empty()) order.reset(new ScatterOrder(scatter_key, (uint64_t)height * row_size));
+            return true;
+        },
+        [&](unsigned char* row, int y){
+            if (order){
+                //each lsb byte asks which payload bit lands on it, so no row has to wait on the rest of the carrier
+                uint64_t position = (uint64_t)y * row_size;
+                for (size_t i = stride - 1; i < row_size * stride; i += stride, ++position){
+                    uint64_t bit = order->indexOf(position);
+                    if (bit < payload_bits) row[i] = (row[i] & 0xFE) | ((payload[bit >> 3] >> (bit & 7)) & 1);
+                }
+                return;
+            }
+            size_t bit = (size_t)y * row_size;
+            for (size_t i = stride - 1; i < row_size * stride && bit < payload_bits; i += stride, ++bit){
+                row[i] = (row[i] & 0xFE) | ((payload[bit >> 3] >> (bit & 7)) & 1);
+            }
+        });
+    BufferPool::give(pending_payload);
+    return written;
+}
 
-    jpeg_create_decompress(&decompress_info);
-    jpeg_stdio_src(&decompress_info, jpeg_file);
-    jpeg_read_header(&decompress_info, TRUE);
+//bit j of payload byte i goes into the lsb of carrier byte i*8+j
+//done a whole payload byte at a time: the table spreads its 8 bits over the lsbs of a 64-bit word
+static void embedBits(unsigned char* carrier, const unsigned char* payload, size_t size){
+    static const std::array<uint64_t, 256> spread = [](){
+        std::array<uint64_t, 256> table{};
+        for (int value = 0; value < 256; ++value){
+            unsigned char bits[8];
+            for (int j = 0; j < 8; ++j) bits[j] = (value >> j) & 1;
+            memcpy(&table[value], bits, sizeof(bits));
+        }
+        return table;
+    }();
+    const uint64_t lsbs = 0x0101010101010101ULL;
+    for (size_t i = 0; i < size; ++i){
+        uint64_t word;
+        memcpy(&word, carrier + i * 8, sizeof(word));
+        word = (word & ~lsbs) | spread[payload[i]];
+        memcpy(carrier + i * 8, &word, sizeof(word));
+    }
+}
 
-    //read coefficients for DCT
-    jvirt_barray_ptr* coefficients = jpeg_read_coefficients(&decompress_info);
-    if (!coefficients){
-        std::cerr << "Error: Failed to read JPEG coefficients." << std::endl;
+bool Encoder::embedLsb(){
+    std::vector<unsigned char> secret_payload = buildPayload();
+    STEGA_METRIC(MetricScope metric(MetricPhase::EMBED));
+    //raw carriers are embedded where they sit in the file, the others in carrier_data
+    bool raw = !carrier_file.getCodec()->take;
+    unsigned char* carrier = raw ? carrier_file.getRawSamples() : carrier_data.data();
+    size_t carrier_size = raw ? carrier_file.getRawSampleSize() : carrier_data.size();
+    //every payload bit takes the lsb of one carrier byte
+    if (secret_payload.size() * 8 > carrier_size){
+        LOG_ERROR("Error: Secret file is too large.");
         return false;
     }
+    std::unique_ptr<ScatterOrder> order;
+    if (!scatter_key.empty()) order.reset(new ScatterOrder(scatter_key, carrier_size));
+    for (size_t done = 0; done < secret_payload.size(); done += EMBED_CHUNK){
+        if (!checkpoint(done, secret_payload.size())){
+            BufferPool::give(secret_payload);
+            return false;
+        }
+        size_t count = std::min(EMBED_CHUNK, secret_payload.size() - done);
+        auto embedChunk = [&](){
+            if (!order){
+                embedBits(carrier + done * 8, secret_payload.data() + done, count);
+                return;
+            }
+            for (uint64_t bit = done * 8; bit < (done + count) * 8; ++bit){
+                unsigned char &byte = carrier[order->at(bit)];
+                byte = (byte & 0xFE) | ((secret_payload[bit >> 3] >> (bit & 7)) & 1);
+            }
+        };
+        //raw carriers may be a mapped file, see Handler::guardRawAccess
+        if (!carrier_file.guardRawAccess(embedChunk)){
+            BufferPool::give(secret_payload);
+            return false;
+        }
+    }
+    STEGA_METRIC(metric.addBytes(secret_payload.size()));
+    STEGA_METRIC(metric.addCarrierBytes(secret_payload.size() * 8));
+    STEGA_METRIC(metric.noteBuffer(carrier_size));
+    BufferPool::give(secret_payload);
+    embedded = true;
+    return true;
+}
 
-    //setup compression
-    struct jpeg_compress_struct compress_info;
-    compress_info.err = jpeg_std_error(&jpeg_error);
-    jpeg_create_compress(&compress_info);
+bool Encoder::writeStreamed(std::string newFile){
+    //same bit layout as embedLsb, payload bit i goes into sample byte i (or ScatterOrder's at(i)), chunk by chunk
+    const std::vector<unsigned char> &payload = pending_payload;
+    uint64_t payload_bits = (uint64_t)payload.size() * 8;
+    std::unique_ptr<ScatterOrder> order;
+    bool written = carrier_file.streamSamples(newFile,
+        [&](uint64_t sample_bytes){
+            if (payload_bits > sample_bytes){
+                LOG_ERROR("Error: Secret file is too large.");
+                return false;
+            }
+            if (!scatter_key.empty()) order.reset(new ScatterOrder(scatter_key, sample_bytes));
+            return true;
+        },
+        [&](unsigned char* samples, size_t size, uint64_t offset){
+            if (order){
+                //as in writePipelined, each sample byte asks which payload bit lands on it
+                for (size_t i = 0; i < size; ++i){
+                    uint64_t bit = order->indexOf(offset + i);
+                    if (bit < payload_bits) samples[i] = (samples[i] & 0xFE) | ((payload[bit >> 3] >> (bit & 7)) & 1);
+                }
+                return;
+            }
+            //chunks are SINK_BYTES, so every one but the last starts and ends on a payload byte
+            if (offset >= payload_bits) return;
+            embedBits(samples, payload.data() + offset / 8, std::min<uint64_t>(size / 8, payload.size() - offset / 8));
+        });
+    BufferPool::give(pending_payload);
+    return written;
+}
+
+bool Encoder::dctJpeg(std::string newFile){
     // if newFile already ends with .jpeg or .jpg, don't append
     if (!(newFile.size() >= 5 && (newFile.rfind(".jpeg") == newFile.size() - 5)) &&
         !(newFile.size() >= 4 && (newFile.rfind(".jpg") == newFile.size() - 4))) {
@@ -234,41 +379,30 @@ bool Encoder::dctJpeg(std::string newFile){
         if (carrier_file.getExt() == ".jpg") jpeg_ext = ".jpg";
         newFile = newFile + jpeg_ext;
     }
-    FILE* output_file = fopen(newFile.c_str(), "wb");
-    if (!output_file){
-        std::cerr << "Failed to open " << newFile << "for writing JPEG" << std::endl;
+    return embedDct() && write(newFile);
+}
+
+bool Encoder::embedDct(){
+    if(carrier_check == false){
+        LOG_ERROR("Error: Carrier file not valid");
         return false;
     }
-    jpeg_stdio_dest(&compress_info, output_file);
-    jpeg_copy_critical_parameters(&decompress_info, &compress_info);
-
-    //build the payload: checksum + ext + size + file_data
-    //if its an image: checksum + ext + height + width + size + file_data
-    std::vector<unsigned char> secret_payload;
-    std::string secret_ext = secret_file.getExt();
-    std::uint8_t ext_len = static_cast<uint8_t>(secret_ext.length());
-    unsigned char* ext_len_bytes = reinterpret_cast<unsigned char*>(&ext_len);
-    uint32_t secret_size = secret_data.size();
-    unsigned char* size_bytes = reinterpret_cast<unsigned char*>(&secret_size);
-    uint16_t checksum = generateChecksum();
-    unsigned char* checksum_bytes = reinterpret_cast<unsigned char*>(&checksum);
-
-    secret_payload.insert(secret_payload.end(), checksum_bytes, checksum_bytes + sizeof(checksum));
-    secret_payload.insert(secret_payload.end(), ext_len_bytes, ext_len_bytes + sizeof(ext_len));
-    secret_payload.insert(secret_payload.end(), secret_ext.begin(), secret_ext.end());
-    //while its unlikely an image will fit in a jpeg, (even if its a png/jpeg) it will still be implemented
-    if (secret_ext == ".png" or secret_ext == ".jpeg" or secret_ext == ".jpg"){
-        int secret_height = secret_file.getImageDimensions(0);
-        int secret_width = secret_file.getImageDimensions(1);
-        std::cout << "Secret Height: " << secret_height << std::endl << "Secret Width " << secret_width << std::endl;
-        unsigned char* secret_height_bytes = reinterpret_cast<unsigned char*>(&secret_height);
-        unsigned char* secret_width_bytes = reinterpret_cast<unsigned char*>(&secret_width);
+    JpegCoefficients* jpeg = carrier_file.getJpegCoefficients();
+    if (!jpeg){
+        LOG_ERROR("Error: Failed to read JPEG coefficients.");
+        return false;
+    }
+    std::vector<unsigned char> secret_payload = buildPayload();
+    STEGA_METRIC(MetricScope metric(MetricPhase::EMBED));
+    STEGA_METRIC(metric.addBytes(secret_payload.size()));
 
-        secret_payload.insert(secret_payload.end(), secret_height_bytes, secret_height_bytes + sizeof(secret_height));
-        secret_payload.insert(secret_payload.end(), secret_width_bytes, secret_width_bytes + sizeof(secret_width));
-    } 
-    secret_payload.insert(secret_payload.end(), size_bytes, size_bytes + sizeof(secret_size));
-    secret_payload.insert(secret_payload.end(), secret_data.begin(), secret_data.end());
+    if (!scatter_key.empty()){
+        bool scattered = embedDctScattered(jpeg, secret_payload);
+        BufferPool::give(secret_payload);
+        if (!scattered) return false;
+        embedded = true;
+        return true;
+    }
 
     //encoding logic
     size_t data_byte_index = 0;
@@ -276,10 +410,15 @@ bool Encoder::dctJpeg(std::string newFile){
     bool finished_enc = false;
 
     //iterate through jpeg components (Y, Cb, Cr), blocks and coefficients
-    for (int comp_i = 0; comp_i < decompress_info.num_components && !finished_enc; ++comp_i) {
-        for (JDIMENSION block_y = 0; block_y < decompress_info.comp_info[comp_i].height_in_blocks && !finished_enc; ++block_y) {
-            JBLOCKARRAY block_array = (decompress_info.mem->access_virt_barray)((j_common_ptr)&decompress_info, coefficients[comp_i], block_y, 1, FALSE);
-            for (JDIMENSION block_x = 0; block_x < decompress_info.comp_info[comp_i].width_in_blocks && !finished_enc; ++block_x) {
+    for (int comp_i = 0; comp_i < jpeg->decompress_info.num_components && !finished_enc; ++comp_i) {
+        for (JDIMENSION block_y = 0; block_y < jpeg->decompress_info.comp_info[comp_i].height_in_blocks && !finished_enc; ++block_y) {
+            if (!checkpoint(data_byte_index, secret_payload.size())){
+                BufferPool::give(secret_payload);
+                return false;
+            }
+            JBLOCKARRAY block_array = jpeg->blockRow(comp_i, block_y, true);
+            STEGA_METRIC(metric.addCarrierBytes((uint64_t)jpeg->decompress_info.comp_info[comp_i].width_in_blocks * sizeof(JBLOCK)));
+            for (JDIMENSION block_x = 0; block_x < jpeg->decompress_info.comp_info[comp_i].width_in_blocks && !finished_enc; ++block_x) {
                 //each block has 64 coefficients
                 for (int i = 0; i < DCTSIZE2; ++i) {
                     JCOEF* coef_ptr = &block_array[0][block_x][i];
@@ -309,27 +448,28 @@ bool Encoder::dctJpeg(std::string newFile){
         }
     }
     if(!finished_enc){
-        std::cerr << "Error: Secret file is too large." << std::endl;
-        jpeg_finish_compress(&compress_info);
-        jpeg_destroy_compress(&compress_info);
-        fclose(output_file);
-        remove(newFile.c_str());
-        jpeg_finish_decompress(&decompress_info);
-        jpeg_destroy_decompress(&decompress_info);
-        fclose(jpeg_file);
+        LOG_ERROR("Error: Secret file is too large.");
         return false;
     }
-    //write modified coefficients to output_file
-    jpeg_write_coefficients(&compress_info, coefficients);
-
-    //cleanup
-    jpeg_finish_compress(&compress_info);
-    jpeg_destroy_compress(&compress_info);
-    fclose(output_file);
-    jpeg_finish_decompress(&decompress_info);
-    jpeg_destroy_decompress(&decompress_info);
-    fclose(jpeg_file);
-
+    embedded = true;
     return true;
 }
 
+//payload bit i goes into the i-th usable coefficient met in ScatterOrder's walk over every coefficient
+//LSB embedding never turns a usable coefficient into 0 or 1 (or back), so the decoder's walk skips the same ones
+bool Encoder::embedDctScattered(JpegCoefficients* jpeg, const std::vector<unsigned char> &payload){
+    ScatterOrder order(scatter_key, jpeg->coefficientCount());
+    uint64_t payload_bits = (uint64_t)payload.size() * 8, position = 0;
+    for (uint64_t bit = 0; bit < payload_bits; ++position){
+        if (position == order.size()){
+            LOG_ERROR("Error: Secret file is too large.");
+            return false;
+        }
+        if (position % (EMBED_CHUNK * 8) == 0 && !checkpoint(bit / 8, payload.size())) return false;
+        JCOEF* coef_ptr = jpeg->coefficient(order.at(position), true);
+        if (*coef_ptr == 0 || *coef_ptr == 1) continue;
+        *coef_ptr = (*coef_ptr & ~1) | ((payload[bit >> 3] >> (bit & 7)) & 1);
+        ++bit;
+    }
+    return true;
+}
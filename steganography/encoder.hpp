@@ -8,16 +8,61 @@
 
 class Encoder{
     public:
-        Encoder(std::string secret, std::string carrier);
+        //carrier_codec: the carrier's format if it has been sniffed already, see Handler::Handler
+        Encoder(std::string secret, std::string carrier, const CarrierCodec* carrier_codec = nullptr);
+        //in-memory secret and carrier, the names only supply extensions
+        Encoder(std::string secret, const unsigned char* secret_bytes, size_t secret_size,
+                std::string carrier, const unsigned char* carrier_bytes, size_t carrier_size, const CarrierCodec* carrier_codec = nullptr);
+        ~Encoder(); //hands its buffers back to BufferPool
+        //write the encoded carrier into output instead of a file
+        void setMemoryOutput(std::vector<unsigned char>* output);
+        //png carriers are decoded, embedded and re-encoded row by row on three threads inside write()
+        //and wav/raw carriers copied through a chunk at a time (see Handler::streamSamples), straight to the output file
+        //lower latency and memory for one big carrier, openFiles() then only reads the secret
+        void setPipelined(bool enabled);
+        void setWriteProfile(WriteProfile profile);
+        //png carriers keep their color type and bit depth, see Handler::setNativePng
+        void setNativePng(bool enabled);
+        //look the carrier up in CarrierCache first, see Handler::setCarrierCache; pipelined png carriers never are
+        void setCarrierCache(const CarrierKey key, std::shared_ptr<const DecodedCarrier> pinned = nullptr);
+        //checked by every stage, see Handler::setJobContext; embedding checks it every 64 KiB of payload or block row
+        void setJobContext(std::shared_ptr<JobContext> context);
+        //the checksum comes from a hash of the secret instead of the clock, so the same secret, carrier
+        //and settings always encode to the same bytes (what ResultCache relies on)
+        void setDeterministic(bool enabled);
+        //payload bits are spread over the whole carrier in an order derived from key instead of filling it
+        //from the start, see ScatterOrder; the decoder needs the same key, empty (the default) is the sequential order
+        void setScatterKey(const std::string key);
+        std::string getProfileReport() const;
+        const CarrierCodec* getCarrierCodec() const; //null if the carrier isn't a supported format
         bool openFiles();
         bool pngLsb(std::string newFile);
         bool dctJpeg(std::string newFile);
+        //the three stages pngLsb/dctJpeg run, exposed so a scheduler can run them as separate tasks
+        //openFiles() is the read stage
+        bool embed();
+        bool write(std::string newFile);
     private:
         std::vector<unsigned char> secret_data, carrier_data;
-        bool secret_check, carrier_check = false;
+        bool secret_check = false, carrier_check = false;
+        bool embedded = false;
+        bool pipelined = false;
+        bool deterministic = false;
+        std::string scatter_key;
+        std::vector<unsigned char> pending_payload; //pipelined/streamed mode, embedded while the carrier streams through
         std::string secret_name, carrier_name;
         Handler secret_file, carrier_file;
+        std::shared_ptr<JobContext> job_context;
+        bool checkpoint(uint64_t done, uint64_t total);
         uint16_t generateChecksum();
+        std::vector<unsigned char> buildPayload();
+        bool embedLsb();
+        bool embedDct();
+        bool embedDctScattered(JpegCoefficients* jpeg, const std::vector<unsigned char> &payload);
+        bool pipelinedPng(); //pipelined and the carrier's codec can be streamed (png)
+        bool writePipelined(std::string newFile);
+        bool streamedSamples(); //pipelined and the carrier is a wav/raw file that can be streamed
+        bool writeStreamed(std::string newFile);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,482 @@
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <sys/stat.h>
+#include "engine.hpp"
+#include "handler.hpp"
+#include "fileio.hpp"
+#include "encoder.hpp"
+#include "decoder.hpp"
+#include "bufferpool.hpp"
+#include "carriercache.hpp"
+#include "memorybudget.hpp"
+#include "resultcache.hpp"
+#include "logger.hpp"
+
+struct Engine::JobState{
+    EngineJob job;
+    EngineResult result;
+    std::unique_ptr<Encoder> encoder;
+    std::unique_ptr<Decoder> decoder;
+    //whole input files and the encoded output, moved through FileIo so no worker waits on disk
+    std::vector<unsigned char> secret_bytes, carrier_bytes, output_bytes;
+    //encode only: the carrier's CarrierCache identity, and the decoded carrier if it was already cached
+    CarrierKey carrier_key;
+    std::shared_ptr<const DecodedCarrier> carrier_hit;
+    ResultKey result_key; //encode only, valid when ResultCache is enabled and both inputs could be hashed
+    const CarrierCodec* codec = nullptr; //the carrier's format, sniffed once in submit() and handed to every later Handler
+    std::atomic<int> reads_left{0};
+    std::atomic<bool> reads_ok{true};
+    std::function<void(const EngineResult&)> callback;
+    std::chrono::steady_clock::time_point submitted, start, stage_start;
+    double fetch_seconds = 0.0;
+    JobError stage_error = JobError::READ; //what a failure in the current stage means
+    std::atomic<bool> finished{false}; //finish() has run, a second call (e.g. from a stage's catch) does nothing
+    ~JobState(){
+        BufferPool::give(secret_bytes);
+        BufferPool::give(carrier_bytes);
+        BufferPool::give(output_bytes);
+    }
+};
+
+std::string jobErrorName(JobError error){
+    switch (error){
+        case JobError::NONE: return "none";
+        case JobError::READ: return "read";
+        case JobError::DECODE: return "decode";
+        case JobError::CAPACITY: return "capacity";
+        case JobError::NO_PAYLOAD: return "no_payload";
+        case JobError::WRITE: return "write";
+        case JobError::STOPPED: return "stopped";
+        case JobError::INTERNAL: return "internal";
+    }
+    return "none";
+}
+
+std::string resultSettings(const EngineJob &job, const std::string &format){
+    //a pipelined png is filtered as it streams, so it doesn't come out byte for byte like one encoded whole
+    std::string settings = CarrierCodecs::extensionOf(job.secret) + "|" + profileName(job.profile) +
+                           (job.native_png ? "|native" : "") + (job.pipelined && format == ".png" ? "|pipelined" : "");
+    if (!job.scatter_key.empty()){
+        settings += "|scatter:" + std::to_string(ResultCache::hash(reinterpret_cast<const unsigned char*>(job.scatter_key.data()), job.scatter_key.size()));
+    }
+    return settings;
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point &since){
+    auto now = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(now - since).count();
+    since = now;
+    return seconds;
+}
+
+static unsigned int defaultWorkers(unsigned int workers){
+    if (workers != 0) return workers;
+    unsigned int hardware = std::thread::hardware_concurrency();
+    return hardware == 0 ? 1 : hardware;
+}
+
+//peak bytes one job holds, sized from the carrier header before anything is read:
+//the files read whole, the decoded carrier, the payload, and what the write stage builds
+struct Footprint{
+    size_t in_memory = 0;
+    size_t streaming = 0; //pipelined png or wav/raw encode or streamed decode, 0 where there's no streaming path
+};
+static const size_t PIPELINE_ROWS = 64; //rows in flight in Handler::pipelinePng, decoded and encoded side
+
+//pipelined jobs whose carrier is read from its file as it streams instead of whole up front:
+//png and wav/raw encodes (see Encoder::setPipelined) and unkeyed wav/raw decodes (see Decoder::setStreamed)
+static bool streamsCarrier(const EngineJob &job, const std::string &format){
+    const CarrierCodec* codec = CarrierCodecs::byExtension(format);
+    if (!job.pipelined || !codec) return false;
+    if (job.type == JobType::ENCODE) return codec->pipelined || codec->streamed;
+    return job.type == JobType::DECODE && codec->streamed && job.scatter_key.empty();
+}
+
+static size_t fileBytes(const std::string &name){
+    struct stat info;
+    if (name.rfind("fd:", 0) == 0 || stat(name.c_str(), &info) != 0) return 0;
+    return (size_t)info.st_size;
+}
+
+//shape is the carrier as peeked by submit(), peeked false if its header couldn't be read
+static Footprint estimateFootprint(const EngineJob &job, const std::string &format, CarrierShape shape, bool peeked){
+    Footprint footprint;
+    const std::string &carrier = job.type == JobType::ENCODE ? job.carrier : job.encoded;
+    if (!peeked){
+        //no usable header, e.g. a pipe: assume it decodes to a few times its size
+        shape.file_bytes = fileBytes(carrier);
+        shape.decoded_bytes = shape.file_bytes * 4;
+    }
+    size_t file = shape.file_bytes, decoded = shape.decoded_bytes;
+    if (job.type == JobType::PROBE){
+        footprint.in_memory = file + decoded;
+        return footprint;
+    }
+    const CarrierCodec* codec = CarrierCodecs::byExtension(format);
+    bool samples = codec && codec->streamed; //wav/raw, copied through a few SINK_BYTES chunks at a time
+    if (job.type == JobType::DECODE){
+        //the extracted payload and the secret written from it are each at most an eighth of the carrier
+        footprint.in_memory = file + decoded + decoded / 4;
+        //streamed, a text secret never is in memory, an image secret is still collected once
+        //a wav/raw carrier is only ever a chunk at a time, unless the scatter key needs all of it
+        footprint.streaming = file + decoded + decoded / 8;
+        if (samples && job.scatter_key.empty()) footprint.streaming = decoded / 8 + Handler::SINK_BYTES * 3;
+        return footprint;
+    }
+    //secret file plus the payload built from it, and an output about the size of the carrier file
+    size_t secret = fileBytes(job.secret) * 2;
+    footprint.in_memory = secret + file + decoded + file;
+    if (format == ".png") footprint.in_memory += decoded; //PngWriter's filtered rows
+    if (format == ".wav") footprint.in_memory += file; //sample bytes copied out and spliced back
+    //streamed, the carrier is read from its file and the output written to its own as they go
+    if (format == ".png" && shape.height > 0){
+        footprint.streaming = secret + decoded / shape.height * PIPELINE_ROWS * 2;
+    }
+    if (samples) footprint.streaming = secret + Handler::SINK_BYTES * 3;
+    return footprint;
+}
+
+size_t estimateJobBytes(const EngineJob &job, const std::string &format, const CarrierShape &shape, bool peeked){
+    return estimateFootprint(job, format, shape, peeked).in_memory;
+}
+
+Engine::Engine(unsigned int workers)
+    :   pool(defaultWorkers(workers))
+{
+}
+
+Engine::~Engine(){
+    //jobs waiting on FileIo are not in the pool yet, so wait for those before the pool drains
+    std::unique_lock<std::mutex> guard(active_lock);
+    active_done.wait(guard, [this](){ return active_jobs == 0; });
+}
+
+std::future<EngineResult> Engine::submit(const EngineJob job){
+    std::shared_ptr<std::promise<EngineResult>> promise = std::make_shared<std::promise<EngineResult>>();
+    std::future<EngineResult> future = promise->get_future();
+    submit(job, [promise](const EngineResult &result){ promise->set_value(result); });
+    return future;
+}
+
+void Engine::submit(const EngineJob job, std::function<void(const EngineResult&)> callback){
+    std::shared_ptr<JobState> state = std::make_shared<JobState>();
+    state->job = job;
+    state->result.type = job.type;
+    state->callback = callback;
+    const std::string &carrier_name = job.type == JobType::ENCODE ? job.carrier : job.encoded;
+    MemoryBudget &budget = MemoryBudget::instance();
+    CarrierShape shape;
+    bool peeked = false;
+    if (budget.limited() || job.type == JobType::ENCODE){
+        //decodes always read png natively, see Engine::readStage
+        peeked = Handler::peekCarrier(carrier_name, job.type == JobType::DECODE || job.native_png, shape);
+    }
+    //the carrier is sniffed once per job: by the peek when there was one, else here
+    Handler carrier(carrier_name, shape.codec);
+    state->codec = carrier.getCodec();
+    //encode outputs are named up front so the write stage never renames anything
+    if (job.type == JobType::ENCODE) state->job.output = carrier.outputPath(job.output);
+    state->result.format = carrier.getExt();
+    state->result.output = state->job.output;
+    //the payload is at least the secret file, one too big for the carrier fails before anything is read
+    if (job.type == JobType::ENCODE && peeked && shape.capacity > 0 && fileBytes(job.secret) > shape.capacity){
+        Logger::ErrorCapture capture(&state->result.error_message);
+        LOG_ERROR("Error: Secret file is too large.");
+        state->result.error = JobError::CAPACITY;
+        if (callback) callback(state->result);
+        return;
+    }
+    if (budget.limited()){
+        Footprint footprint = estimateFootprint(state->job, state->result.format, shape, peeked);
+        bool stream = footprint.streaming > 0 && (state->job.pipelined || footprint.in_memory > budget.getJobLimit());
+        if (stream && !state->job.pipelined){
+            state->job.pipelined = true;
+            state->result.streamed = true;
+        }
+        state->result.estimated_bytes = stream ? footprint.streaming : footprint.in_memory;
+        LOG_DEBUG("Console: " << (state->job.type == JobType::ENCODE ? state->job.carrier : state->job.encoded) << " estimated at "
+                  << (state->result.estimated_bytes >> 10) << " KiB" << (stream ? " streaming" : " in memory"));
+    }
+    {
+        std::lock_guard<std::mutex> guard(active_lock);
+        active_jobs++;
+    }
+    //queued jobs count as active, so ~Engine waits for them too
+    state->submitted = std::chrono::steady_clock::now();
+    budget.acquire(state->result.estimated_bytes, [this, state](){ fetch(state); });
+}
+
+void Engine::fetch(std::shared_ptr<JobState> state){
+    state->start = std::chrono::steady_clock::now();
+    state->stage_start = state->start;
+    state->result.queued_seconds = std::chrono::duration<double>(state->start - state->submitted).count();
+    //cancelled or out of time while it queued for the budget, nothing has been read yet
+    if (stopping(state)){
+        finish(state, false);
+        return;
+    }
+    //hashing the inputs reads them once, so the lookup runs on the pool; outputs to a descriptor are never cached
+    if (state->job.type == JobType::ENCODE && ResultCache::instance().enabled() && state->job.output.rfind("fd:", 0) != 0){
+        schedule(&Engine::lookupStage, state);
+        return;
+    }
+    readInputs(state);
+}
+
+void Engine::lookupStage(std::shared_ptr<JobState> state){
+    if (stopping(state)){
+        finish(state, false);
+        return;
+    }
+    const EngineJob &job = state->job;
+    state->result_key = ResultCache::instance().keyFor(job.secret, job.carrier, resultSettings(job, state->result.format), state->result.format);
+    if (ResultCache::instance().fetch(state->result_key, job.output)){
+        state->result.cached = true;
+        state->result.read_seconds = secondsSince(state->stage_start);
+        LOG_INFO("Console: " << job.output << " served from the result cache");
+        finish(state, true);
+        return;
+    }
+    readInputs(state);
+}
+
+void Engine::readInputs(std::shared_ptr<JobState> state){
+    //the encoder or decoder opens the files itself, a streamed carrier is never read whole
+    if (streamsCarrier(state->job, state->result.format)){
+        state->fetch_seconds = secondsSince(state->stage_start);
+        schedule(&Engine::readStage, state);
+        return;
+    }
+    //both reads are in flight together, the second completion schedules the read stage
+    auto fetched = [this, state](std::vector<unsigned char> &into, bool success, std::vector<unsigned char> &data){
+        into.swap(data);
+        if (!success) state->reads_ok = false;
+        if (--state->reads_left == 0){
+            state->fetch_seconds = secondsSince(state->stage_start);
+            schedule(&Engine::readStage, state);
+        }
+    };
+    if (state->job.type == JobType::ENCODE){
+        //the carrier is stat'ed before it's read, a cached one isn't read at all
+        if (CarrierCache::instance().enabled()){
+            state->carrier_key = CarrierCache::keyFor(state->job.carrier);
+            Handler carrier(state->job.carrier, state->codec);
+            carrier.setNativePng(state->job.native_png);
+            state->carrier_hit = carrier.findCachedCarrier(state->carrier_key);
+        }
+        state->reads_left = state->carrier_hit ? 1 : 2;
+        FileIo::instance().readFile(Handler::systemPath(state->job.secret), [state, fetched](bool success, std::vector<unsigned char> &data){
+            fetched(state->secret_bytes, success, data);
+        });
+        if (!state->carrier_hit){
+            FileIo::instance().readFile(Handler::systemPath(state->job.carrier), [state, fetched](bool success, std::vector<unsigned char> &data){
+                fetched(state->carrier_bytes, success, data);
+            });
+        }
+    }
+    else {
+        state->reads_left = 1;
+        FileIo::instance().readFile(Handler::systemPath(state->job.encoded), [state, fetched](bool success, std::vector<unsigned char> &data){
+            fetched(state->carrier_bytes, success, data);
+        });
+    }
+}
+
+void Engine::schedule(void (Engine::*stage)(std::shared_ptr<JobState>), std::shared_ptr<JobState> state){
+    pool.submit([this, stage, state](){
+        //whatever the stage logs as an error first becomes the job's error_message
+        Logger::ErrorCapture capture(&state->result.error_message);
+        //a throwing stage (e.g. bad_alloc on a huge carrier) still completes the job
+        try {
+            (this->*stage)(state);
+        }
+        catch (const std::exception &e){
+            LOG_ERROR("Error: Job stage failed: " << e.what());
+            state->stage_error = JobError::INTERNAL;
+            finish(state, false);
+        }
+        //anything else would end in ThreadPool, leaving the job active and its budget held forever
+        catch (...){
+            LOG_ERROR("Error: Job stage failed");
+            state->stage_error = JobError::INTERNAL;
+            finish(state, false);
+        }
+    });
+}
+
+void Engine::readStage(std::shared_ptr<JobState> state){
+    //read time is fetch plus parse, time spent queued for a worker isn't counted
+    state->stage_start = std::chrono::steady_clock::now();
+    bool opened = false;
+    if (stopping(state)){
+        finish(state, false);
+        return;
+    }
+    state->stage_error = JobError::DECODE;
+    if (!state->reads_ok){
+        state->stage_error = JobError::READ;
+        LOG_ERROR("Error: Could not read input files for " << (state->job.type == JobType::ENCODE ? state->job.carrier : state->job.encoded));
+    }
+    else if (state->job.type == JobType::ENCODE){
+        //the files are already in memory, this stage only parses them; a streamed carrier is opened in the write stage
+        if (streamsCarrier(state->job, state->result.format)) state->encoder.reset(new Encoder(state->job.secret, state->job.carrier, state->codec));
+        else state->encoder.reset(new Encoder(state->job.secret, state->secret_bytes.data(), state->secret_bytes.size(),
+                                              state->job.carrier, state->carrier_bytes.data(), state->carrier_bytes.size(), state->codec));
+        state->encoder->setPipelined(state->job.pipelined);
+        state->encoder->setNativePng(state->job.native_png);
+        state->encoder->setDeterministic(state->job.deterministic || ResultCache::instance().enabled());
+        state->encoder->setScatterKey(state->job.scatter_key);
+        state->encoder->setCarrierCache(state->carrier_key, state->carrier_hit);
+        state->encoder->setJobContext(state->job.context);
+        opened = state->encoder->openFiles();
+        state->carrier_hit.reset();
+    }
+    else {
+        if (streamsCarrier(state->job, state->result.format)) state->decoder.reset(new Decoder(state->job.encoded, state->codec));
+        else state->decoder.reset(new Decoder(state->job.encoded, state->carrier_bytes.data(), state->carrier_bytes.size(), state->codec));
+        state->decoder->setStreamed(streamsCarrier(state->job, state->result.format));
+        //decoding reads natively either way, a probe reports capacity for the encode mode asked for
+        if (state->job.type == JobType::PROBE) state->decoder->setNativePng(state->job.native_png);
+        state->decoder->setScatterKey(state->job.scatter_key);
+        state->decoder->setJobContext(state->job.context);
+        opened = state->decoder->openEncodedFile();
+    }
+    state->result.read_seconds = state->fetch_seconds + secondsSince(state->stage_start);
+    if (!opened){
+        finish(state, false);
+        return;
+    }
+    if (state->job.type == JobType::PROBE){
+        state->result.capacity = state->decoder->getCapacity();
+        finish(state, true);
+        return;
+    }
+    schedule(&Engine::embedStage, state);
+}
+
+void Engine::embedStage(std::shared_ptr<JobState> state){
+    if (stopping(state)){
+        finish(state, false);
+        return;
+    }
+    state->stage_error = state->encoder ? JobError::CAPACITY : JobError::NO_PAYLOAD;
+    //a streamed decode writes its output as it extracts, there's nothing left for the write stage
+    bool streamed = state->decoder && state->job.pipelined;
+    bool embedded = false;
+    if (state->encoder) embedded = state->encoder->embed();
+    else if (streamed){
+        state->decoder->setWriteProfile(state->job.profile);
+        embedded = state->decoder->extractTo(state->job.output);
+        state->result.profile = state->decoder->getProfileReport();
+    }
+    else embedded = state->decoder->extract();
+    state->result.embed_seconds = secondsSince(state->stage_start);
+    if (!embedded || streamed){
+        finish(state, embedded);
+        return;
+    }
+    schedule(&Engine::writeStage, state);
+}
+
+void Engine::writeStage(std::shared_ptr<JobState> state){
+    //encode into memory here, the file write itself goes out through FileIo
+    std::string path = state->job.output;
+    bool written = false;
+    state->stage_error = JobError::WRITE;
+    if (stopping(state)){
+        finish(state, false);
+        return;
+    }
+    //a streamed carrier goes straight to the output as it's read, there's nothing to hand to FileIo
+    bool direct = state->encoder && streamsCarrier(state->job, state->result.format);
+    if (direct){
+        state->encoder->setWriteProfile(state->job.profile);
+        written = state->encoder->write(state->job.output);
+        state->result.profile = state->encoder->getProfileReport();
+    }
+    else if (state->encoder){
+        state->encoder->setMemoryOutput(&state->output_bytes);
+        state->encoder->setWriteProfile(state->job.profile);
+        written = state->encoder->write(state->job.output);
+        state->result.profile = state->encoder->getProfileReport();
+    }
+    else {
+        state->decoder->setMemoryOutput(&state->output_bytes);
+        state->decoder->setWriteProfile(state->job.profile);
+        written = state->decoder->write(state->job.output);
+        state->result.profile = state->decoder->getProfileReport();
+        //the secret's extension is only known once it's extracted, the result names the file actually written
+        path += state->decoder->getSecretExt();
+        state->result.output = path;
+    }
+    state->encoder.reset();
+    state->decoder.reset();
+    state->secret_bytes = std::vector<unsigned char>();
+    state->carrier_bytes = std::vector<unsigned char>();
+    if (direct){
+        if (written) ResultCache::instance().store(state->result_key, path);
+        state->result.write_seconds = secondsSince(state->stage_start);
+        finish(state, written);
+        return;
+    }
+    //stopped after the output was built, it isn't written out either
+    if (!written || stopping(state)){
+        state->result.write_seconds = secondsSince(state->stage_start);
+        finish(state, false);
+        return;
+    }
+    FileIo::instance().writeFile(Handler::systemPath(path), std::move(state->output_bytes), [this, state, path](bool success){
+        if (!success){
+            Logger::ErrorCapture capture(&state->result.error_message);
+            LOG_ERROR("Error: Failed to write to " << path);
+        }
+        //back onto the pool so the callback never runs on the io completion thread
+        pool.submit([this, state, success, path](){
+            if (success) ResultCache::instance().store(state->result_key, path);
+            state->result.write_seconds = secondsSince(state->stage_start);
+            finish(state, success);
+        });
+    });
+}
+
+//true once the job's context says to stop, the caller then finishes it unsuccessfully
+bool Engine::stopping(std::shared_ptr<JobState> state){
+    return state->job.context && state->job.context->cancelled();
+}
+
+void Engine::finish(std::shared_ptr<JobState> state, bool success){
+    if (state->finished.exchange(true)) return;
+    //release carrier buffers before the callback runs
+    state->encoder.reset();
+    state->decoder.reset();
+    state->secret_bytes = std::vector<unsigned char>();
+    state->carrier_bytes = std::vector<unsigned char>();
+    //whatever was waiting on this job's share of the budget can start now
+    MemoryBudget::instance().release(state->result.estimated_bytes);
+    state->result.success = success;
+    if (!success) state->result.error = state->stage_error;
+    if (!success && stopping(state)){
+        state->result.error = JobError::STOPPED;
+        state->result.stopped = state->job.context->reason();
+        LOG_INFO("Console: " << (state->job.type == JobType::ENCODE ? state->job.carrier : state->job.encoded) << " stopped: " << state->result.stopped);
+    }
+    state->result.total_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - state->start).count();
+    //a throwing callback is the caller's bug, it mustn't leave the job counted as active
+    try {
+        if (state->callback) state->callback(state->result);
+    }
+    catch (const std::exception &e){
+        LOG_ERROR("Error: Job callback failed: " << e.what());
+    }
+    catch (...){
+        LOG_ERROR("Error: Job callback failed");
+    }
+    std::lock_guard<std::mutex> guard(active_lock);
+    active_jobs--;
+    active_done.notify_all();
+}
+
+unsigned int Engine::getWorkerCount() const{
+    return pool.getWorkerCount();
+}
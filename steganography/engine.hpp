@@ -0,0 +1,101 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <string>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include "threadpool.hpp"
+#include "writeprofile.hpp"
+#include "jobcontext.hpp"
+
+enum class JobType{ ENCODE, DECODE, PROBE };
+//why a job failed, by the stage it failed in
+//READ: an input couldn't be read; DECODE: an input is corrupt or not a supported format;
+//CAPACITY: the secret doesn't fit; NO_PAYLOAD: nothing StegaSaur embedded was found; WRITE: the output couldn't be built or written;
+//STOPPED: cancelled or out of time; INTERNAL: a stage threw
+enum class JobError{ NONE, READ, DECODE, CAPACITY, NO_PAYLOAD, WRITE, STOPPED, INTERNAL };
+std::string jobErrorName(JobError error); //"none", "read", "decode", ...
+
+//encode uses secret + carrier + output
+//decode uses encoded + output (output is a base name, the extension comes from the payload)
+//probe uses encoded only
+struct EngineJob{
+    JobType type = JobType::ENCODE;
+    std::string secret, carrier, encoded, output;
+    //encode: overlap png decode, embed and encode, or copy a wav/raw carrier through a chunk at a time,
+    //reading the carrier from its file and writing the output to its own as they go, see Encoder::setPipelined
+    //decode: write the secret as it's extracted, see Decoder::extractTo; wav/raw carriers are read as it goes too
+    bool pipelined = false;
+    bool native_png = false; //keep png color type and bit depth, see Handler::setNativePng
+    //encode: same inputs and settings give the same output bytes, see Encoder::setDeterministic
+    //always on while ResultCache is enabled
+    bool deterministic = false;
+    //encode/decode: payload order keyed by this, see Encoder::setScatterKey; empty is sequential
+    std::string scatter_key;
+    WriteProfile profile = WriteProfile::SMALLEST;
+    //deadline, cancellation and progress, checked between and inside stages; null runs to completion
+    std::shared_ptr<JobContext> context;
+};
+
+struct EngineResult{
+    bool success = false;
+    JobType type = JobType::ENCODE;
+    std::string output;  //file written: encodes with the carrier's extension, decodes with the secret's
+    std::string format;  //carrier extension
+    size_t capacity = 0; //probe only: payload bytes (header included) the carrier can hold
+    std::string profile; //write profile used for png/jpeg output, e.g. "auto/paeth"
+    size_t estimated_bytes = 0; //footprint the job was admitted with, 0 without a MemoryBudget
+    bool streamed = false; //switched to the streaming path to stay under the job memory budget
+    double queued_seconds = 0.0; //waiting for MemoryBudget before it started, not part of total_seconds
+    std::string stopped; //failed because the context stopped it: "cancelled" or "deadline exceeded"
+    bool cached = false; //encode served from ResultCache, nothing was decoded
+    JobError error = JobError::NONE;
+    std::string error_message; //first error the job logged, e.g. libjpeg's reason for a corrupt file
+    double read_seconds = 0.0, embed_seconds = 0.0, write_seconds = 0.0, total_seconds = 0.0;
+};
+
+//MemoryBudget's estimate for a job that reads its files whole, from its carrier as Handler::peekCarrier saw it
+//(peeked false if it couldn't be read); format is the carrier extension
+struct CarrierShape;
+size_t estimateJobBytes(const EngineJob &job, const std::string &format, const CarrierShape &shape, bool peeked);
+
+//everything besides the secret's and carrier's contents an encode's output depends on, its ResultCache settings
+//format is the carrier extension
+std::string resultSettings(const EngineJob &job, const std::string &format);
+
+//reusable engine for embedding StegaSaur in other programs
+//read, embed/extract and write run as separate pool tasks so small jobs can overtake large ones
+//file reads and writes go through FileIo, so jobs waiting on disk don't hold a worker
+//jobs are admitted through MemoryBudget: each one's footprint is estimated from the carrier header,
+//over the job budget a png or wav/raw encode is pipelined (a decode streamed) instead, and over the process budget it waits
+//a job whose context is cancelled or runs out of time stops at its next row or block row and
+//finishes unsuccessfully with what it held already freed
+//with ResultCache enabled an encode is looked up by its inputs' contents first, a hit is copied to the output and never decoded
+class Engine{
+    public:
+        Engine(unsigned int workers = 0); //0 picks the hardware thread count
+        ~Engine(); //waits for every submitted job
+        std::future<EngineResult> submit(const EngineJob job);
+        void submit(const EngineJob job, std::function<void(const EngineResult&)> callback);
+        unsigned int getWorkerCount() const;
+    private:
+        struct JobState;
+        ThreadPool pool;
+        std::mutex active_lock;
+        std::condition_variable active_done;
+        size_t active_jobs = 0;
+        void fetch(std::shared_ptr<JobState> state);
+        void lookupStage(std::shared_ptr<JobState> state);
+        void readInputs(std::shared_ptr<JobState> state);
+        void schedule(void (Engine::*stage)(std::shared_ptr<JobState>), std::shared_ptr<JobState> state);
+        void readStage(std::shared_ptr<JobState> state);
+        void embedStage(std::shared_ptr<JobState> state);
+        void writeStage(std::shared_ptr<JobState> state);
+        void finish(std::shared_ptr<JobState> state, bool success);
+        bool stopping(std::shared_ptr<JobState> state);
+};
+
+#endif
@@ -0,0 +1,375 @@
+#include <iostream>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <future>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "fileio.hpp"
+#include "bufferpool.hpp"
+#include "metrics.hpp"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define STEGASAUR_HAS_IO_URING 1
+#endif
+#endif
+
+//large files are split so one request keeps several reads/writes in flight
+static const size_t CHUNK_SIZE = 4 << 20;
+static const unsigned int RING_ENTRIES = 128;
+
+struct FileIo::Request{
+    bool write = false;
+    std::string path;
+    int fd = -1;
+    std::vector<unsigned char> buffer; //read destination, or owned data for async writes
+    const unsigned char* data = nullptr; //write source
+    size_t size = 0;
+    size_t ops_left = 0;
+    bool failed = false;
+    std::function<void(bool, std::vector<unsigned char>&)> read_done;
+    std::function<void(bool)> write_done;
+    STEGA_METRIC(MetricScope metric{MetricPhase::FILE_READ}); //open to completion, queueing included
+
+    ~Request(){
+        //read buffers normally left with the caller, async write buffers are recycled here
+        BufferPool::give(buffer);
+    }
+    void complete(){
+        if (fd >= 0) {
+            if (close(fd) != 0 && write) failed = true;
+            fd = -1;
+        }
+        STEGA_METRIC(metric.setPhase(write ? MetricPhase::FILE_WRITE : MetricPhase::FILE_READ));
+        STEGA_METRIC(metric.addBytes(write ? size : buffer.size()));
+        STEGA_METRIC(metric.noteBuffer(write ? size : buffer.capacity()));
+        STEGA_METRIC(metric.end());
+        if (write){ if (write_done) write_done(!failed); }
+        else if (read_done) read_done(!failed, buffer);
+    }
+};
+
+#ifdef STEGASAUR_HAS_IO_URING
+
+//io_uring driven through the raw syscalls so there is no liburing dependency
+//callers fill sqes under the lock, a single reaper thread drains completions
+struct FileIo::Ring{
+    //one read or write of a request's byte range, user_data of its sqe
+    struct Op{
+        std::shared_ptr<FileIo::Request> request;
+        size_t offset, length;
+    };
+
+    int fd = -1;
+    unsigned int entries = 0;
+    void* sq_ring = MAP_FAILED;
+    void* cq_ring = MAP_FAILED;
+    size_t sq_ring_size = 0, cq_ring_size = 0;
+    io_uring_sqe* sqes = (io_uring_sqe*)MAP_FAILED;
+    unsigned *sq_tail = nullptr, *sq_mask = nullptr, *sq_array = nullptr;
+    unsigned *cq_head = nullptr, *cq_tail = nullptr, *cq_mask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+
+    std::mutex lock;
+    std::deque<Op*> waiting; //ops beyond the ring size wait here
+    unsigned int submitted = 0; //ops currently owned by the kernel
+    bool stopping = false;
+    std::thread reaper;
+
+    ~Ring(){
+        if (reaper.joinable()){
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                stopping = true;
+                pushLocked(nullptr); //nop wakes the reaper
+            }
+            reaper.join();
+        }
+        if (sqes != MAP_FAILED) munmap(sqes, entries * sizeof(io_uring_sqe));
+        if (cq_ring != MAP_FAILED && cq_ring != sq_ring) munmap(cq_ring, cq_ring_size);
+        if (sq_ring != MAP_FAILED) munmap(sq_ring, sq_ring_size);
+        if (fd >= 0) close(fd);
+    }
+
+    bool setup(unsigned int wanted){
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        fd = (int)syscall(__NR_io_uring_setup, wanted, &params);
+        if (fd < 0) return false; //old kernel or blocked by seccomp
+        //IORING_OP_READ/WRITE need 5.6, FAST_POLL arrived in 5.7 so it doubles as the version check
+        if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_FAST_POLL)) return false;
+        entries = params.sq_entries;
+
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (cq_ring_size > sq_ring_size) sq_ring_size = cq_ring_size;
+        cq_ring_size = sq_ring_size;
+        sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq_ring == MAP_FAILED) return false;
+        cq_ring = sq_ring;
+        sqes = (io_uring_sqe*)mmap(NULL, entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) return false;
+
+        char* sq = (char*)sq_ring;
+        sq_tail = (unsigned*)(sq + params.sq_off.tail);
+        sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+        sq_array = (unsigned*)(sq + params.sq_off.array);
+        char* cq = (char*)cq_ring;
+        cq_head = (unsigned*)(cq + params.cq_off.head);
+        cq_tail = (unsigned*)(cq + params.cq_off.tail);
+        cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+        reaper = std::thread(&Ring::reap, this);
+        return true;
+    }
+
+    void push(Op* op){
+        std::lock_guard<std::mutex> guard(lock);
+        pushLocked(op);
+    }
+
+    //nullptr submits a nop
+    void pushLocked(Op* op){
+        if (submitted >= entries){
+            waiting.push_back(op);
+            return;
+        }
+        unsigned tail = *sq_tail;
+        unsigned index = tail & *sq_mask;
+        io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        if (op){
+            FileIo::Request* request = op->request.get();
+            sqe->opcode = request->write ? IORING_OP_WRITE : IORING_OP_READ;
+            sqe->fd = request->fd;
+            sqe->addr = request->write ? (unsigned long long)(request->data + op->offset)
+                                       : (unsigned long long)(request->buffer.data() + op->offset);
+            sqe->len = (unsigned)op->length;
+            sqe->off = op->offset;
+        }
+        else {
+            sqe->opcode = IORING_OP_NOP;
+        }
+        sqe->user_data = (unsigned long long)op;
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        submitted++;
+        //without SQPOLL the kernel consumes the sqe inside this call, so the slot is free again afterwards
+        while (syscall(__NR_io_uring_enter, fd, 1, 0, 0, NULL, 0) < 0 && errno == EINTR) {}
+    }
+
+    void reap(){
+        while (true){
+            syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+            unsigned head = *cq_head;
+            unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+            while (head != tail){
+                io_uring_cqe* cqe = &cqes[head & *cq_mask];
+                Op* op = (Op*)cqe->user_data;
+                int res = cqe->res;
+                head++;
+                __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    submitted--;
+                }
+                if (op) handle(op, res);
+                std::lock_guard<std::mutex> guard(lock);
+                while (!waiting.empty() && submitted < entries){
+                    Op* next = waiting.front();
+                    waiting.pop_front();
+                    pushLocked(next);
+                }
+            }
+            std::lock_guard<std::mutex> guard(lock);
+            if (stopping && submitted == 0 && waiting.empty()) return;
+        }
+    }
+
+    void handle(Op* op, int res){
+        if (res == -EINTR || res == -EAGAIN){
+            push(op);
+            return;
+        }
+        FileIo::Request* request = op->request.get();
+        if (res <= 0 && op->length > 0){
+            //res == 0 means the file shrank under us
+            request->failed = true;
+        }
+        else if ((size_t)res < op->length){
+            //short read/write, queue the rest
+            op->offset += res;
+            op->length -= res;
+            push(op);
+            return;
+        }
+        std::shared_ptr<FileIo::Request> owner = op->request;
+        delete op;
+        if (--owner->ops_left == 0) owner->complete();
+    }
+};
+
+#else
+
+struct FileIo::Ring{};
+
+#endif
+
+FileIo::FileIo(bool use_uring, unsigned int fallback_workers)
+    :   fallback(fallback_workers == 0 ? 1 : fallback_workers)
+{
+#ifdef STEGASAUR_HAS_IO_URING
+    if (use_uring){
+        ring.reset(new Ring());
+        if (!ring->setup(RING_ENTRIES)) ring.reset();
+    }
+#else
+    (void)use_uring;
+#endif
+}
+
+FileIo::~FileIo(){
+    //ring destructor waits for its ops, fallback pool drains its queue
+    ring.reset();
+}
+
+FileIo& FileIo::instance(){
+    static FileIo shared([](){
+        const char* mode = getenv("STEGASAUR_IO");
+        return !(mode && std::string(mode) == "threads");
+    }());
+    return shared;
+}
+
+std::string FileIo::getBackend() const{
+    return ring ? "io_uring" : "threads";
+}
+
+void FileIo::runBlocking(std::shared_ptr<Request> request){
+    if (request->write){
+        size_t done = 0;
+        while (done < request->size){
+            ssize_t count = ::write(request->fd, request->data + done, request->size - done);
+            if (count < 0 && errno == EINTR) continue;
+            if (count <= 0){
+                request->failed = true;
+                break;
+            }
+            done += count;
+        }
+    }
+    else {
+        //size is only a hint here, pipes report 0
+        size_t done = 0;
+        BufferPool::resize(request->buffer, request->size > 0 ? request->size : 65536);
+        while (true){
+            if (done == request->buffer.size()) request->buffer.resize(request->buffer.size() * 2);
+            ssize_t count = ::read(request->fd, request->buffer.data() + done, request->buffer.size() - done);
+            if (count < 0 && errno == EINTR) continue;
+            if (count < 0){
+                request->failed = true;
+                break;
+            }
+            if (count == 0) break;
+            done += count;
+        }
+        request->buffer.resize(done);
+    }
+    request->complete();
+}
+
+void FileIo::submit(std::shared_ptr<Request> request){
+    struct stat info;
+    if (fstat(request->fd, &info) != 0){
+        request->failed = true;
+        request->complete();
+        return;
+    }
+    if (!request->write) request->size = S_ISREG(info.st_mode) ? (size_t)info.st_size : 0;
+    if (!ring || !S_ISREG(info.st_mode)){
+        fallback.submit([request](){ runBlocking(request); });
+        return;
+    }
+#ifdef STEGASAUR_HAS_IO_URING
+    if (request->size == 0){
+        request->complete();
+        return;
+    }
+    if (!request->write) BufferPool::resize(request->buffer, request->size);
+    request->ops_left = (request->size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    for (size_t offset = 0; offset < request->size; offset += CHUNK_SIZE){
+        size_t length = request->size - offset < CHUNK_SIZE ? request->size - offset : CHUNK_SIZE;
+        ring->push(new Ring::Op{request, offset, length});
+    }
+#endif
+}
+
+void FileIo::readFile(const std::string path, std::function<void(bool, std::vector<unsigned char>&)> done){
+    std::shared_ptr<Request> request = std::make_shared<Request>();
+    request->path = path;
+    request->read_done = std::move(done);
+    request->fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (request->fd < 0){
+        request->failed = true;
+        request->complete();
+        return;
+    }
+    submit(request);
+}
+
+void FileIo::writeFile(const std::string path, std::vector<unsigned char> data, std::function<void(bool)> done){
+    std::shared_ptr<Request> request = std::make_shared<Request>();
+    request->write = true;
+    request->path = path;
+    request->buffer = std::move(data);
+    request->data = request->buffer.data();
+    request->size = request->buffer.size();
+    request->write_done = std::move(done);
+    request->fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (request->fd < 0){
+        request->failed = true;
+        request->complete();
+        return;
+    }
+    submit(request);
+}
+
+bool FileIo::readFile(const std::string path, std::vector<unsigned char> &out){
+    std::promise<bool> promise;
+    std::future<bool> future = promise.get_future();
+    readFile(path, [&promise, &out](bool success, std::vector<unsigned char> &data){
+        out.swap(data);
+        promise.set_value(success);
+    });
+    return future.get();
+}
+
+bool FileIo::writeFile(const std::string path, const unsigned char* data, size_t size){
+    //caller waits, so the request can borrow its buffer instead of copying
+    std::shared_ptr<Request> request = std::make_shared<Request>();
+    std::promise<bool> promise;
+    std::future<bool> future = promise.get_future();
+    request->write = true;
+    request->path = path;
+    request->data = data;
+    request->size = size;
+    request->write_done = [&promise](bool success){ promise.set_value(success); };
+    request->fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (request->fd < 0){
+        request->failed = true;
+        request->complete();
+    }
+    else {
+        submit(request);
+    }
+    return future.get();
+}
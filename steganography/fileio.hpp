@@ -0,0 +1,40 @@
+#ifndef FILEIO_H
+#define FILEIO_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <memory>
+#include "threadpool.hpp"
+
+//whole-file reads and writes for Handler and the engines
+//uses io_uring when the kernel allows it so many reads/writes stay in flight without tying up threads,
+//otherwise (or with STEGASAUR_IO=threads) blocking calls on a small thread pool
+//pipes and other non-regular files always take the blocking path
+class FileIo{
+    public:
+        FileIo(bool use_uring = true, unsigned int fallback_workers = 4);
+        ~FileIo(); //waits for every submitted request
+        FileIo(const FileIo&) = delete;
+        FileIo& operator=(const FileIo&) = delete;
+        static FileIo& instance();
+
+        //asynchronous, done runs on the completion thread and should only hand work off
+        void readFile(const std::string path, std::function<void(bool, std::vector<unsigned char>&)> done);
+        void writeFile(const std::string path, std::vector<unsigned char> data, std::function<void(bool)> done);
+
+        //blocking helpers
+        bool readFile(const std::string path, std::vector<unsigned char> &out);
+        bool writeFile(const std::string path, const unsigned char* data, size_t size);
+
+        std::string getBackend() const;
+    private:
+        struct Ring;
+        struct Request;
+        std::unique_ptr<Ring> ring;
+        ThreadPool fallback;
+        void submit(std::shared_ptr<Request> request);
+        static void runBlocking(std::shared_ptr<Request> request);
+};
+
+#endif
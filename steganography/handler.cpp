@@ -1,76 +1,694 @@
-#include <iostream>
 #include <string>
 #include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <initializer_list>
 #include <png.h>
 #include <jpeglib.h>
 #include <zlib.h>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <csignal>
 #include "handler.hpp"
+#include "fileio.hpp"
+#include "rowqueue.hpp"
+#include "pngwriter.hpp"
+#include "pngreader.hpp"
+#include "writeprofile.hpp"
+#include "bufferpool.hpp"
+#include "metrics.hpp"
+#include "logger.hpp"
 
-Handler::Handler(std::string file_name){
+Handler::Handler(std::string file_name, const CarrierCodec* codec){
     this->file_name = file_name;
-    parseExt();
+    if (codec) useCodec(codec);
+    else parseExt();
+}
+Handler::~Handler(){
+    //carrier-sized buffers go back to the pool for the next job
+    BufferPool::give(image_pixel_data);
+    BufferPool::give(binary_file_data);
+    BufferPool::give(input_buffer);
+    if (sink_open) discardSink();
+    closeSamples();
+}
+Handler::Handler(const std::string file_name, const unsigned char* data, size_t size, const CarrierCodec* codec){
+    //in-memory file, file_name is only used for its extension and messages
+    this->file_name = file_name;
+    this->memory_data = data;
+    this->memory_size = size;
+    this->memory_input = true;
+    if (codec) useCodec(codec);
+    else parseExt();
+}
+//first bytes of a regular file (one pread), 0 if it can't be opened or isn't a regular file
+static size_t readHead(const std::string path, unsigned char* head, size_t size, size_t* file_bytes = nullptr){
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    struct stat info;
+    ssize_t got = 0;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode)){
+        if (file_bytes) *file_bytes = (size_t)info.st_size;
+        got = pread(fd, head, size, 0);
+    }
+    close(fd);
+    return got > 0 ? (size_t)got : 0;
+}
+//----------STDIO-----------
+//a pipe on stdin can only be read once: the bytes parseExt sniffs from it are kept here and handed back first
+static std::mutex stdin_lock;
+static std::vector<unsigned char> stdin_head;
+static bool stdin_peeked = false;
+static bool stdinIsPipe(){
+    struct stat info;
+    return fstat(STDIN_FILENO, &info) == 0 && !S_ISREG(info.st_mode);
+}
+static ssize_t readStdinSome(unsigned char* data, size_t size){
+    while (true){
+        ssize_t got = read(STDIN_FILENO, data, size);
+        if (got < 0 && errno == EINTR) continue;
+        return got;
+    }
+}
+//a regular file on stdin is read like any other file, a pipe gives up its first bytes once
+static size_t peekStdin(unsigned char* head, size_t size){
+    if (!stdinIsPipe()) return readHead("/dev/stdin", head, size);
+    std::lock_guard<std::mutex> guard(stdin_lock);
+    if (!stdin_peeked){
+        stdin_peeked = true;
+        stdin_head.resize(CarrierCodecs::SNIFF_BYTES);
+        size_t got = 0;
+        while (got < stdin_head.size()){
+            ssize_t more = readStdinSome(stdin_head.data() + got, stdin_head.size() - got);
+            if (more <= 0) break;
+            got += (size_t)more;
+        }
+        stdin_head.resize(got);
+    }
+    size_t got = std::min(size, stdin_head.size());
+    if (got > 0) memcpy(head, stdin_head.data(), got);
+    return got;
+}
+//read hook for openStream's stream: the sniffed bytes, then the pipe itself
+static ssize_t readStdinStream(void*, char* data, size_t size){
+    {
+        std::lock_guard<std::mutex> guard(stdin_lock);
+        if (!stdin_head.empty()){
+            size_t got = std::min(size, stdin_head.size());
+            memcpy(data, stdin_head.data(), got);
+            stdin_head.erase(stdin_head.begin(), stdin_head.begin() + got);
+            return (ssize_t)got;
+        }
+    }
+    return readStdinSome(reinterpret_cast<unsigned char*>(data), size);
+}
+bool Handler::isStdio(const std::string name){
+    return name == "-";
+}
+//a signature beats the extension (a .png that is really a jpeg is read as a jpeg), except for
+//headerless formats, which have none to check, and files with nothing to read yet
+static const CarrierCodec* detectCodec(const std::string ext, const unsigned char* head, size_t size){
+    const CarrierCodec* by_ext = CarrierCodecs::byExtension(ext);
+    if (by_ext && !by_ext->sniff) return by_ext;
+    const CarrierCodec* sniffed = CarrierCodecs::sniff(head, size);
+    return sniffed ? sniffed : by_ext;
 }
 void Handler::parseExt(){
-    //check file extentions of the file
-    //could not compile with .contains() so used .find() instead
-    //also made it case insensitive
-    std::string lower = file_name;
-    for (char &c : lower) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
-    if (lower.find(".txt") != std::string::npos) { file_ext = ".txt"; }
-    else if (lower.find(".wav") != std::string::npos) { file_ext = ".wav"; }
-    else if (lower.find(".png") != std::string::npos) { file_ext = ".png"; }
-    else if (lower.find(".jpeg") != std::string::npos) { file_ext = ".jpeg"; }
-    else if (lower.find(".jpg") != std::string::npos) { file_ext = ".jpg"; }
-    else { file_ext = "INVALID"; }
+    std::string ext = CarrierCodecs::extensionOf(file_name);
+    codec = nullptr;
+    //secrets are text by name, whatever their first bytes happen to be
+    if (ext == ".txt"){
+        file_ext = ".txt";
+        return;
+    }
+    unsigned char head[CarrierCodecs::SNIFF_BYTES];
+    size_t got = 0;
+    if (memory_input){
+        got = std::min(memory_size, sizeof(head));
+        if (got > 0) memcpy(head, memory_data, got);
+    }
+    else if (isStdio(file_name)){
+        got = peekStdin(head, sizeof(head));
+    }
+    else{
+        got = readHead(systemPath(file_name), head, sizeof(head));
+    }
+    useCodec(detectCodec(ext, head, got));
 }
-//----------READING-----------
-bool Handler::readFile(){
-    std::ifstream file(file_name, std::ios::binary | std::ios::ate);
-    if(!file.is_open()){
-        std::cerr << "Error: Could not open " << file_name << std::endl;
+void Handler::useCodec(const CarrierCodec* codec){
+    this->codec = codec;
+    //stdin has no name to say it's text, a secret piped in is text unless it has a signature
+    if (!codec && isStdio(file_name)){
+        file_ext = ".txt";
+        return;
+    }
+    if (!codec){
+        file_ext = "INVALID";
+        return;
+    }
+    //keep the file's own spelling (.jpg stays .jpg) when it names the format
+    std::string ext = CarrierCodecs::extensionOf(file_name);
+    file_ext = CarrierCodecs::byExtension(ext) == codec ? ext : codec->ext;
+}
+std::string Handler::systemPath(const std::string name){
+    //"fd:<n>:<name>" refers to an already open descriptor, e.g. one passed over the daemon socket
+    //the trailing name is only there so the extension can still be parsed
+    if (name.rfind("fd:", 0) != 0) return name;
+    size_t sep = name.find(':', 3);
+    std::string fd = name.substr(3, sep == std::string::npos ? std::string::npos : sep - 3);
+    if (fd.empty() || fd.find_first_not_of("0123456789") != std::string::npos) return name;
+    return "/dev/fd/" + fd;
+}
+std::string Handler::resolveOutputPath(const std::string carrier, const std::string new_file){
+    return Handler(carrier).outputPath(new_file);
+}
+std::string Handler::outputPath(const std::string new_file) const{
+    if (isStdio(new_file)) return new_file;
+    //place the output next to the carrier when only a bare name was given
+    std::string out_path = new_file;
+    size_t sep_pos = file_name.find_last_of("\\/");
+    if (sep_pos != std::string::npos && new_file.find_last_of("\\/") == std::string::npos &&
+        file_name.rfind("fd:", 0) != 0 && new_file.rfind("fd:", 0) != 0){
+        out_path = file_name.substr(0, sep_pos + 1) + new_file;
+    }
+    //keep the carrier's own extension spelling (.jpg stays .jpg) so nothing has to be renamed later
+    if (!codec) return out_path;
+    const std::string &ext = file_ext;
+    if (out_path.size() >= ext.size() && out_path.compare(out_path.size() - ext.size(), ext.size(), ext) == 0){
+        return out_path;
+    }
+    return out_path + ext;
+}
+//----------STREAMS-----------
+//every read/write goes through these so files, passed descriptors and memory buffers share one code path
+//files are read and written whole through FileIo, the codecs only ever see memory streams;
+//the streaming paths (openStream, openOutput's direct mode, the sink) go to the file itself
+bool Handler::readSource(std::vector<unsigned char> &into){
+    if (!isStdio(file_name)) return FileIo::instance().readFile(systemPath(file_name), into);
+    if (!stdinIsPipe()) return FileIo::instance().readFile("/dev/stdin", into);
+    std::lock_guard<std::mutex> guard(stdin_lock);
+    BufferPool::give(into);
+    into.swap(stdin_head);
+    size_t used = into.size();
+    while (true){
+        if (used == into.size()) into.resize(std::max(used * 2, (size_t)1 << 16));
+        ssize_t got = readStdinSome(into.data() + used, into.size() - used);
+        if (got < 0) return false;
+        if (got == 0) break;
+        used += (size_t)got;
+    }
+    into.resize(used);
+    return true;
+}
+FILE* Handler::openInput(){
+    if (!memory_input){
+        if (!readSource(input_buffer)) return NULL;
+        if (input_buffer.empty()) return NULL;
+        return fmemopen(input_buffer.data(), input_buffer.size(), "rb");
+    }
+    if (memory_size == 0) return NULL;
+    return fmemopen(const_cast<unsigned char*>(memory_data), memory_size, "rb");
+}
+//stdout is written in place, reopening it through FileIo would truncate a file it appends to
+bool Handler::writeTarget(const std::string name, const unsigned char* data, size_t size){
+    if (!isStdio(name)) return FileIo::instance().writeFile(systemPath(name), data, size);
+    size_t done = 0;
+    while (done < size){
+        ssize_t wrote = ::write(STDOUT_FILENO, data + done, size - done);
+        if (wrote < 0 && errno == EINTR) continue;
+        if (wrote <= 0) return false;
+        done += (size_t)wrote;
+    }
+    return true;
+}
+FILE* Handler::openStream(){
+    if (!memory_input && !isStdio(file_name)) return fopen(systemPath(file_name).c_str(), "rbe");
+    if (memory_input || !stdinIsPipe()) return openInput();
+    cookie_io_functions_t functions = {readStdinStream, NULL, NULL, NULL};
+    return fopencookie(NULL, "rb", functions);
+}
+//write hook for openOutput's stream, grows the buffer through the pool instead of open_memstream's realloc
+static ssize_t appendOutput(void* cookie, const char* data, size_t size){
+    std::vector<unsigned char> &buffer = *static_cast<std::vector<unsigned char>*>(cookie);
+    size_t used = buffer.size();
+    if (used + size > buffer.capacity()){
+        std::vector<unsigned char> grown = BufferPool::take(std::max(std::max(used + size, buffer.capacity() * 2), (size_t)1 << 16));
+        if (used > 0) memcpy(grown.data(), buffer.data(), used);
+        grown.resize(used);
+        BufferPool::give(buffer);
+        buffer.swap(grown);
+    }
+    buffer.insert(buffer.end(), data, data + size);
+    return (ssize_t)size;
+}
+//a name next to the target for output that replaces it whole once complete
+static std::string temporaryName(const std::string name){
+    static std::atomic<unsigned long> counter{0};
+    return name + ".tmp-" + std::to_string(getpid()) + "-" + std::to_string(counter++);
+}
+//a plain path, not stdout or a passed descriptor, so it can be written under a temporary name and renamed
+static bool renameable(const std::string name){
+    return !Handler::isStdio(name) && Handler::systemPath(name) == name;
+}
+bool Handler::writesOverInput(const std::string name) const{
+    struct stat input, output;
+    return !memory_input && !isStdio(file_name) && !isStdio(name) &&
+           stat(systemPath(file_name).c_str(), &input) == 0 && stat(systemPath(name).c_str(), &output) == 0 &&
+           input.st_dev == output.st_dev && input.st_ino == output.st_ino;
+}
+FILE* Handler::openOutput(const std::string name, bool direct){
+    output_name = name;
+    output_buffer.clear();
+    output_temporary.clear();
+    output_direct = false;
+    //stdout is written as the codec produces it, there's no file to replace whole
+    if (isStdio(name) && !memory_output){
+        int fd = dup(STDOUT_FILENO);
+        FILE* output_file = fd < 0 ? NULL : fdopen(fd, "wb");
+        if (!output_file && fd >= 0) close(fd);
+        return output_file;
+    }
+    if (direct && !memory_output){
+        //the input may still be streaming from this same file, so it's only replaced once complete
+        //a passed descriptor can't be renamed over, it's written in place
+        if (writesOverInput(name) && !renameable(name)){
+            LOG_ERROR("Error: Cannot stream " << file_name << " onto itself");
+            return NULL;
+        }
+        if (renameable(name)) output_temporary = temporaryName(name);
+        output_direct = true;
+        return fopen((renameable(name) ? output_temporary : systemPath(name)).c_str(), "wbe");
+    }
+    cookie_io_functions_t functions = {NULL, appendOutput, NULL, NULL};
+    return fopencookie(&output_buffer, "wb", functions);
+}
+bool Handler::closeOutput(FILE* output_file){
+    //the buffer is only final after fclose flushes the stream
+    bool closed = fclose(output_file) == 0;
+    if (output_direct){
+        if (closed && !output_temporary.empty()) closed = rename(output_temporary.c_str(), output_name.c_str()) == 0;
+        if (!closed){
+            if (!output_temporary.empty()) unlink(output_temporary.c_str());
+            LOG_ERROR("Error: Failed to write to " << output_name);
+        }
+        return closed;
+    }
+    if (isStdio(output_name) && !memory_output){
+        if (!closed) LOG_ERROR("Error: Failed to write to stdout");
+        return closed;
+    }
+    if (closed && memory_output){
+        BufferPool::give(*memory_output);
+        memory_output->swap(output_buffer);
+    }
+    else if (closed){
+        closed = writeTarget(output_name, output_buffer.data(), output_buffer.size());
+        if (!closed) LOG_ERROR("Error: Failed to write to " << output_name);
+    }
+    BufferPool::give(output_buffer);
+    return closed;
+}
+void Handler::discardOutput(FILE* output_file){
+    //failed write, nothing reaches the destination
+    fclose(output_file);
+    if (output_direct && !output_temporary.empty()) unlink(output_temporary.c_str());
+    BufferPool::give(output_buffer);
+}
+//the sink bypasses FileIo: the file is written piece by piece from the calling thread
+bool Handler::openSink(const std::string name){
+    if (sink_open) discardSink();
+    sink_name = name;
+    sink_temporary.clear();
+    sink_buffer.clear();
+    sink_buffer.reserve(SINK_BYTES);
+    if (memory_output){
+        BufferPool::give(*memory_output);
+    }
+    else{
+        //the input may be this same file, see openOutput
+        if (writesOverInput(name) && !renameable(name)){
+            LOG_ERROR("Error: Cannot stream " << file_name << " onto itself");
+            return false;
+        }
+        if (renameable(name)) sink_temporary = temporaryName(name);
+        if (isStdio(name)) sink_fd = dup(STDOUT_FILENO);
+        else sink_fd = open((renameable(name) ? sink_temporary : systemPath(name)).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (sink_fd < 0){
+            LOG_ERROR("Error: Failed to write to " << name);
+            return false;
+        }
+    }
+    sink_open = true;
+    return true;
+}
+bool Handler::flushSink(){
+    if (sink_buffer.empty()) return true;
+    if (memory_output){
+        memory_output->insert(memory_output->end(), sink_buffer.begin(), sink_buffer.end());
+        sink_buffer.clear();
+        return true;
+    }
+    STEGA_METRIC(MetricScope metric(MetricPhase::FILE_WRITE));
+    size_t done = 0;
+    while (done < sink_buffer.size()){
+        ssize_t wrote = ::write(sink_fd, sink_buffer.data() + done, sink_buffer.size() - done);
+        if (wrote < 0 && errno == EINTR) continue;
+        if (wrote <= 0){
+            LOG_ERROR("Error: Failed to write to " << sink_name);
+            return false;
+        }
+        done += (size_t)wrote;
+    }
+    STEGA_METRIC(metric.addBytes(done));
+    sink_buffer.clear();
+    return true;
+}
+bool Handler::sinkWrite(const unsigned char* data, size_t size){
+    if (!sink_open) return false;
+    while (size > 0){
+        size_t room = std::min(size, SINK_BYTES - sink_buffer.size());
+        sink_buffer.insert(sink_buffer.end(), data, data + room);
+        data += room;
+        size -= room;
+        if (sink_buffer.size() == SINK_BYTES && !flushSink()) return false;
+    }
+    return true;
+}
+bool Handler::closeSink(){
+    if (!sink_open) return false;
+    bool closed = flushSink();
+    if (sink_fd >= 0 && close(sink_fd) != 0 && closed){
+        LOG_ERROR("Error: Failed to write to " << sink_name);
+        closed = false;
+    }
+    sink_fd = -1;
+    sink_open = false;
+    std::vector<unsigned char>().swap(sink_buffer);
+    if (closed && !sink_temporary.empty() && rename(sink_temporary.c_str(), sink_name.c_str()) != 0){
+        LOG_ERROR("Error: Failed to write to " << sink_name);
+        closed = false;
+    }
+    if (!closed) removeSinkOutput();
+    return closed;
+}
+void Handler::discardSink(){
+    if (!sink_open) return;
+    if (sink_fd >= 0) close(sink_fd);
+    sink_fd = -1;
+    sink_open = false;
+    std::vector<unsigned char>().swap(sink_buffer);
+    removeSinkOutput();
+}
+void Handler::removeSinkOutput(){
+    //a partial file never stays behind; a passed descriptor or stdout isn't ours to remove
+    if (memory_output) BufferPool::give(*memory_output);
+    else if (!sink_temporary.empty()) unlink(sink_temporary.c_str());
+}
+bool Handler::readWhole(){
+    if (memory_input){
+        BufferPool::resize(binary_file_data, memory_size);
+        memcpy(binary_file_data.data(), memory_data, memory_size);
+        file_size = static_cast<std::streamsize>(memory_size);
+        return true;
+    }
+    if (!readSource(binary_file_data)){
+        LOG_ERROR("Error: Could not read " << file_name);
         return false;
     }
-
-    file_size = file.tellg();
-    file.seekg(0, std::ios::beg);
-    //this is a shortcut to get the filesize instead of incrementing a loop while reading
-    //open and move pos to end, check pos for filesize, then move to beg
-
-    binary_file_data.resize(file_size); //update buffer size based on file
-    if(!file.read(reinterpret_cast<char*>(binary_file_data.data()), file_size)){
-        std::cerr << "Error: Could not read " << file_name << std::endl;
+    file_size = static_cast<std::streamsize>(binary_file_data.size());
+    return true;
+}
+bool Handler::writeWhole(const std::string name){
+    const std::vector<unsigned char> &bytes = fileBytes();
+    if (memory_output){
+        BufferPool::resize(*memory_output, bytes.size());
+        memcpy(memory_output->data(), bytes.data(), bytes.size());
+        return true;
+    }
+    if (!writeTarget(name, bytes.data(), bytes.size())){
+        LOG_ERROR("Error: Failed to write to " << name);
         return false;
     }
-    file.close();
     return true;
 }
+void Handler::setMemoryOutput(std::vector<unsigned char>* output){
+    memory_output = output;
+}
+void Handler::setWriteProfile(WriteProfile profile){
+    write_profile = profile;
+}
+void Handler::setNativePng(bool enabled){
+    native_png = enabled;
+}
+std::string Handler::getProfileReport() const{
+    return profile_report;
+}
+void Handler::setJobContext(std::shared_ptr<JobContext> context){
+    job_context = context;
+}
+bool Handler::cancelled() const{
+    return job_context && job_context->cancelled();
+}
+bool Handler::checkpoint(MetricPhase phase, uint64_t done, uint64_t total){
+    return !job_context || job_context->checkpoint(phase, done, total);
+}
+//----------LIBRARY ERRORS-----------
+//libjpeg's default error_exit calls exit() and libpng's prints to stderr, so one corrupt file would end
+//a whole batch; here both come back to the call that failed with the library's message
+static void jumpOnJpegError(j_common_ptr info){
+    JpegErrors* errors = (JpegErrors*)info->err;
+    (*info->err->format_message)(info, errors->message);
+    if (!errors->jump) errors->default_exit(info);
+    longjmp(*errors->jump, 1);
+}
+static void logJpegWarning(j_common_ptr info){
+    char message[JMSG_LENGTH_MAX];
+    (*info->err->format_message)(info, message);
+    LOG_WARN("Warning: libjpeg: " << message);
+}
+static void watchJpegErrors(j_common_ptr info, JpegErrors &errors){
+    info->err = jpeg_std_error(&errors.manager);
+    errors.default_exit = errors.manager.error_exit;
+    errors.manager.error_exit = jumpOnJpegError;
+    errors.manager.output_message = logJpegWarning;
+}
+//runs call with every manager in errors armed, false if libjpeg gave up partway through it
+//call may own nothing that needs destroying while it's inside libjpeg, a longjmp skips its frame
+template<typename Call>
+static bool guardJpeg(std::initializer_list<JpegErrors*> errors, Call call){
+    jmp_buf jump;
+    for (JpegErrors* manager : errors) manager->jump = &jump;
+    if (setjmp(jump) != 0){
+        for (JpegErrors* manager : errors) manager->jump = nullptr;
+        return false;
+    }
+    call();
+    for (JpegErrors* manager : errors) manager->jump = nullptr;
+    return true;
+}
+//error_ptr of every libpng struct, message is what its last error was
+struct PngErrors{
+    char message[256] = {0};
+};
+static void jumpOnPngError(png_structp png, png_const_charp message){
+    PngErrors* errors = (PngErrors*)png_get_error_ptr(png);
+    if (errors) snprintf(errors->message, sizeof(errors->message), "%s", message);
+    png_longjmp(png, 1);
+}
+static void logPngWarning(png_structp, png_const_charp message){
+    LOG_WARN("Warning: libpng: " << message);
+}
+
+//libjpeg hook for the passes that run inside a single library call (coefficient read, coefficient write)
+//a cancellation jumps out of the call through the armed error manager, see guardJpeg
+struct JpegProgress{
+    struct jpeg_progress_mgr manager;
+    JobContext* context;
+    MetricPhase phase;
+    uint64_t total;
+};
+static void reportJpegProgress(j_common_ptr info){
+    JpegProgress* progress = (JpegProgress*)info->progress;
+    uint64_t passes = progress->manager.total_passes > 0 ? progress->manager.total_passes : 1;
+    uint64_t limit = progress->manager.pass_limit > 0 ? progress->manager.pass_limit : 1;
+    uint64_t steps = progress->manager.completed_passes * limit + progress->manager.pass_counter;
+    uint64_t done = progress->total * std::min(steps, passes * limit) / (passes * limit);
+    if (progress->context->checkpoint(progress->phase, done, progress->total)) return;
+    JpegErrors* errors = (JpegErrors*)info->err;
+    snprintf(errors->message, sizeof(errors->message), "%s", progress->context->reason().c_str());
+    if (errors->jump) longjmp(*errors->jump, 1);
+}
+static void watchJpegProgress(j_common_ptr info, JpegProgress &progress, JobContext* context, MetricPhase phase, uint64_t total){
+    if (!context) return;
+    progress.manager.progress_monitor = reportJpegProgress;
+    progress.context = context;
+    progress.phase = phase;
+    progress.total = total;
+    info->progress = &progress.manager;
+}
+//----------CARRIER CACHE-----------
+static std::vector<unsigned char> pooledCopy(const unsigned char* data, size_t size){
+    std::vector<unsigned char> copy = BufferPool::take(size);
+    if (size > 0) memcpy(copy.data(), data, size);
+    return copy;
+}
+void Handler::setCarrierCache(const CarrierKey key, std::shared_ptr<const DecodedCarrier> pinned){
+    cache_key = key;
+    cache_pinned = pinned;
+}
+std::shared_ptr<const DecodedCarrier> Handler::findCachedCarrier(const CarrierKey key) const{
+    CarrierKind kind;
+    if (!cacheKind(kind)) return nullptr;
+    return CarrierCache::instance().find(key, kind);
+}
+//jpeg carriers are only ever read as coefficients, so that's what gets cached for them
+bool Handler::cacheKind(CarrierKind &kind) const{
+    if (file_ext == ".png") kind = native_png ? CarrierKind::PNG_NATIVE : CarrierKind::PNG_RGBA;
+    else if (file_ext == ".wav") kind = CarrierKind::WAV;
+    else if (file_ext == ".jpeg" || file_ext == ".jpg") kind = CarrierKind::JPEG_COEFFICIENTS;
+    else return false;
+    return true;
+}
+bool Handler::caching(size_t bytes) const{
+    return cache_key.valid && bytes <= CarrierCache::instance().getBudget();
+}
+std::shared_ptr<const DecodedCarrier> Handler::cacheLookup(CarrierKind kind){
+    std::shared_ptr<const DecodedCarrier> cached;
+    cached.swap(cache_pinned);
+    if (!cached && cache_key.valid) cached = CarrierCache::instance().find(cache_key, kind);
+    return cached;
+}
+void Handler::cachePixels(CarrierKind kind){
+    if (!caching(image_pixel_data.size())) return;
+    std::shared_ptr<DecodedCarrier> carrier = std::make_shared<DecodedCarrier>();
+    carrier->data = pooledCopy(image_pixel_data.data(), image_pixel_data.size());
+    carrier->width = image_width;
+    carrier->height = image_height;
+    carrier->channels = image_channels;
+    carrier->bit_depth = image_bit_depth;
+    CarrierCache::instance().insert(cache_key, kind, carrier);
+}
+const std::vector<unsigned char>& Handler::pixelBytes() const{
+    return pixel_view ? pixel_view->data : image_pixel_data;
+}
+const std::vector<unsigned char>& Handler::fileBytes() const{
+    return file_view ? file_view->data : binary_file_data;
+}
+//copy on write: a setter about to change the cached bytes takes its own copy first
+void Handler::ownPixels(){
+    if (!pixel_view) return;
+    BufferPool::give(image_pixel_data);
+    image_pixel_data = pooledCopy(pixel_view->data.data(), pixel_view->data.size());
+    pixel_view.reset();
+}
+void Handler::ownFile(){
+    if (!file_view) return;
+    BufferPool::give(binary_file_data);
+    binary_file_data = pooledCopy(file_view->data.data(), file_view->data.size());
+    file_view.reset();
+}
+//----------READING-----------
+bool Handler::readFile(){
+    return readWhole();
+}
+//making sure png's color palette is rgb
+//native keeps gray/rgb and 16-bit samples, only palettes and packed gray are expanded
+static void setPngTransforms(png_structp png, png_infop png_info, bool native){
+    png_byte color_type = png_get_color_type(png, png_info);
+    png_byte bit_depth = png_get_bit_depth(png, png_info);
+    if(bit_depth == 16 && !native) png_set_strip_16(png);
+    if(color_type == PNG_COLOR_TYPE_PALETTE) png_set_palette_to_rgb(png);
+    if(color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8) png_set_expand_gray_1_2_4_to_8(png);
+    if(png_get_valid(png, png_info, PNG_INFO_tRNS)) png_set_tRNS_to_alpha(png);
+    if(native) return;
+    if(color_type == PNG_COLOR_TYPE_RGB || color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_PALETTE)
+        png_set_filler(png, 0xFF, PNG_FILLER_AFTER);
+    if(color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
+        png_set_gray_to_rgb(png);
+}
+static int pngColorType(int channels){
+    static const int color_types[] = {PNG_COLOR_TYPE_GRAY, PNG_COLOR_TYPE_GRAY_ALPHA, PNG_COLOR_TYPE_RGB, PNG_COLOR_TYPE_RGBA};
+    return color_types[channels - 1];
+}
 bool Handler::readPng(){
     if (file_ext != ".png"){
-        std::cerr << "File " << file_name << " is not png" << std::endl;
+        LOG_ERROR("File " << file_name << " is not png");
         return false; 
     }
-    FILE* image_file = fopen(file_name.c_str(), "rb"); //convert file_name to char
+    CarrierKind kind = native_png ? CarrierKind::PNG_NATIVE : CarrierKind::PNG_RGBA;
+    pixel_view = cacheLookup(kind);
+    if (pixel_view){
+        image_width = pixel_view->width;
+        image_height = pixel_view->height;
+        image_channels = pixel_view->channels;
+        image_bit_depth = pixel_view->bit_depth;
+        BufferPool::give(image_pixel_data);
+        file_size = pixel_view->data.size();
+        return true;
+    }
+    FILE* image_file = openInput();
     if (!image_file){
-        std::cerr << "Error: Could not open file " << file_name << std::endl;
+        LOG_ERROR("Error: Could not open file " << file_name);
         return false;
     }
+    //cache hits above aren't decodes and go unrecorded
+    STEGA_METRIC(MetricScope metric(MetricPhase::CODEC_DECODE));
+    STEGA_METRIC(metric.addBytes(memory_input ? memory_size : input_buffer.size()));
+    //8-bit rgb/rgba non-interlaced carriers skip libpng, see PngReader
+    //anything else, or a corrupt file, goes through libpng below
+    PngReader fast_reader;
+    fast_reader.setJobContext(job_context.get());
+    if (fast_reader.open(memory_input ? memory_data : input_buffer.data(), memory_input ? memory_size : input_buffer.size())){
+        image_height = fast_reader.getHeight();
+        image_width = fast_reader.getWidth();
+        image_channels = native_png ? fast_reader.getChannels() : 4;
+        image_bit_depth = 8;
+        BufferPool::resize(image_pixel_data, (size_t)image_width * image_height * image_channels);
+        if (fast_reader.read(image_pixel_data.data(), image_channels)){
+            file_size = image_pixel_data.size();
+            fclose(image_file);
+            STEGA_METRIC(metric.addCarrierBytes(image_pixel_data.size()));
+            STEGA_METRIC(metric.noteBuffer(image_pixel_data.capacity()));
+            STEGA_METRIC(metric.end());
+            cachePixels(kind);
+            return true;
+        }
+        //stopped by the job context, not a corrupt file, so there's nothing for libpng to retry
+        if (cancelled()){
+            BufferPool::give(image_pixel_data);
+            fclose(image_file);
+            return false;
+        }
+    }
     //init png structs
-    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    PngErrors errors;
+    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, &errors, jumpOnPngError, logPngWarning);
     if (!png){
-        std::cerr << "Error: libpng read struct failed to initialize" << std::endl;
+        LOG_ERROR("Error: libpng read struct failed to initialize");
         fclose(image_file);
         return false;
     }
     png_infop png_info = png_create_info_struct(png);
     if (!png_info){
         png_destroy_read_struct(&png, NULL, NULL);
-        std::cerr << "Error: libpng read info struct failed to initialize" << std::endl;
+        LOG_ERROR("Error: libpng read info struct failed to initialize");
         fclose(image_file);
         return false;
     }
-    //libpng's try catch for struct initialization
+    //libpng's try catch, anything that needs destroying is declared above it
+    std::vector<png_bytep> row_pointers;
     if (setjmp(png_jmpbuf(png))){
+        LOG_ERROR("Error: Corrupt png " << file_name << ": " << errors.message);
         png_destroy_read_struct(&png, &png_info, NULL);
+        BufferPool::give(image_pixel_data);
         fclose(image_file);
         return false;
     }
@@ -81,289 +699,1101 @@ bool Handler::readPng(){
     //read image info
     image_height = png_get_image_height(png, png_info);
     image_width = png_get_image_width(png, png_info);
-    png_byte color_type = png_get_color_type(png, png_info);
-    png_byte bit_depth = png_get_bit_depth(png, png_info);
-
-    //making sure png's color palette is rgb
-    if(bit_depth == 16) png_set_strip_16(png);
-    if(color_type == PNG_COLOR_TYPE_PALETTE) png_set_palette_to_rgb(png);
-    if(color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8) png_set_expand_gray_1_2_4_to_8(png);
-    if(png_get_valid(png, png_info, PNG_INFO_tRNS)) png_set_tRNS_to_alpha(png);
-    if(color_type == PNG_COLOR_TYPE_RGB || color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_PALETTE)
-        png_set_filler(png, 0xFF, PNG_FILLER_AFTER);
-    if(color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
-        png_set_gray_to_rgb(png);
 
+    setPngTransforms(png, png_info, native_png);
+    //read row by row instead of png_read_image so the job context is checked in between
+    int passes = png_set_interlace_handling(png);
     png_read_update_info(png, png_info);
+    image_channels = png_get_channels(png, png_info);
+    image_bit_depth = png_get_bit_depth(png, png_info);
 
     // read image data into image_pixel_data and close file
-    int row_bytes = png_get_rowbytes(png, png_info);
-    image_pixel_data.resize(row_bytes * image_height);
+    size_t row_bytes = png_get_rowbytes(png, png_info);
+    BufferPool::resize(image_pixel_data, (size_t)row_bytes * image_height);
 
-    std::vector<png_bytep> row_pointers(image_height);
+    row_pointers.resize(image_height);
     for (int i = 0; i < image_height; i++){
         row_pointers[i] = &image_pixel_data[i * row_bytes];
     }
     file_size = image_pixel_data.size();
-    png_read_image(png, row_pointers.data());
+    uint64_t total = (uint64_t)passes * image_pixel_data.size();
+    for (int pass = 0; pass < passes; ++pass){
+        for (int y = 0; y < image_height; ++y){
+            if (!checkpoint(MetricPhase::CODEC_DECODE, ((uint64_t)pass * image_height + y) * row_bytes, total)){
+                png_destroy_read_struct(&png, &png_info, NULL);
+                BufferPool::give(image_pixel_data);
+                fclose(image_file);
+                return false;
+            }
+            png_read_row(png, row_pointers[y], NULL);
+        }
+    }
     png_destroy_read_struct(&png, &png_info, NULL);
     fclose(image_file);
+    STEGA_METRIC(metric.addCarrierBytes(image_pixel_data.size()));
+    STEGA_METRIC(metric.noteBuffer(image_pixel_data.capacity()));
+    STEGA_METRIC(metric.end());
+    cachePixels(kind);
     return true;
 }
 bool Handler::readJpeg(){
     if(file_ext != ".jpeg" and file_ext != ".jpg"){
-        std::cerr << "Error: File " << file_name << " is not a jpeg/jpg" << std::endl;
+        LOG_ERROR("Error: File " << file_name << " is not a jpeg/jpg");
         return false;
     }
     //initialize jpeg decompression obj and error handling
     //these are from libjpeg.h
     struct jpeg_decompress_struct decompress_info;
-    struct jpeg_error_mgr jpeg_err;
+    JpegErrors errors;
 
-    decompress_info.err = jpeg_std_error(&jpeg_err);
+    watchJpegErrors((j_common_ptr)&decompress_info, errors);
     jpeg_create_decompress(&decompress_info);
 
     //open jpeg file
-    FILE* image_file = fopen(file_name.c_str(), "rb");
+    FILE* image_file = openInput();
     if(!image_file){
-        std::cerr << "Error: Could not open " << file_name << std::endl;
+        LOG_ERROR("Error: Could not open " << file_name);
         jpeg_destroy_decompress(&decompress_info);
         return false;
     }
-    jpeg_stdio_src(&decompress_info, image_file);
+    STEGA_METRIC(MetricScope metric(MetricPhase::CODEC_DECODE));
+    STEGA_METRIC(metric.addBytes(memory_input ? memory_size : input_buffer.size()));
+    bool stopped = false;
+    bool read = guardJpeg({&errors}, [&](){
+        jpeg_stdio_src(&decompress_info, image_file);
 
-    //read jpeg header to get image info
-    (void) jpeg_read_header(&decompress_info, TRUE);
-    //decompress image
-    (void) jpeg_start_decompress(&decompress_info);
+        //read jpeg header to get image info
+        (void) jpeg_read_header(&decompress_info, TRUE);
+        //decompress image
+        (void) jpeg_start_decompress(&decompress_info);
 
-    image_height = decompress_info.output_height;
-    image_width = decompress_info.output_width;
-    int c_channels = decompress_info.output_components; //3 for rgb
+        image_height = decompress_info.output_height;
+        image_width = decompress_info.output_width;
+        int c_channels = decompress_info.output_components; //3 for rgb
 
-    image_pixel_data.resize(image_height * image_width * c_channels);
+        BufferPool::resize(image_pixel_data, (size_t)image_height * image_width * c_channels);
 
-    //read image row by row (scanline by scanline)
-    while(decompress_info.output_scanline < decompress_info.image_height){
-        unsigned char* row_ptr = &image_pixel_data[decompress_info.output_scanline * image_width * c_channels];
-        jpeg_read_scanlines(&decompress_info, &row_ptr, 1);
+        //read image row by row (scanline by scanline)
+        size_t row_bytes = (size_t)image_width * c_channels;
+        while(decompress_info.output_scanline < decompress_info.image_height){
+            if (!checkpoint(MetricPhase::CODEC_DECODE, decompress_info.output_scanline * row_bytes, image_pixel_data.size())){
+                stopped = true;
+                return;
+            }
+            unsigned char* row_ptr = &image_pixel_data[decompress_info.output_scanline * row_bytes];
+            jpeg_read_scanlines(&decompress_info, &row_ptr, 1);
+        }
+        (void) jpeg_finish_decompress(&decompress_info);
+    });
+    //clean up structs, destroying also aborts a decompression that didn't finish
+    jpeg_destroy_decompress(&decompress_info);
+    fclose(image_file);
+    if (!read || stopped){
+        if (!read && !cancelled()) LOG_ERROR("Error: Corrupt jpeg " << file_name << ": " << errors.message);
+        BufferPool::give(image_pixel_data);
+        return false;
     }
+    STEGA_METRIC(metric.addCarrierBytes(image_pixel_data.size()));
+    STEGA_METRIC(metric.noteBuffer(image_pixel_data.capacity()));
+    return true;
+}
 
-    //clean up structs
-    (void) jpeg_finish_decompress(&decompress_info);
+JpegCoefficients::~JpegCoefficients(){
     jpeg_destroy_decompress(&decompress_info);
-    fclose(image_file);
+    if (source) fclose(source);
+}
+JBLOCKARRAY JpegCoefficients::blockRow(int component, JDIMENSION block_y, bool writable){
+    return (decompress_info.mem->access_virt_barray)((j_common_ptr)&decompress_info, coefficients[component], block_y, 1, writable ? TRUE : FALSE);
+}
+uint64_t JpegCoefficients::coefficientCount() const{
+    uint64_t count = 0;
+    for (int c = 0; c < decompress_info.num_components; ++c){
+        count += (uint64_t)decompress_info.comp_info[c].width_in_blocks * decompress_info.comp_info[c].height_in_blocks * DCTSIZE2;
+    }
+    return count;
+}
+JCOEF* JpegCoefficients::coefficient(uint64_t position, bool writable){
+    for (int c = 0; c < decompress_info.num_components; ++c){
+        const jpeg_component_info &component = decompress_info.comp_info[c];
+        uint64_t row = (uint64_t)component.width_in_blocks * DCTSIZE2;
+        uint64_t count = row * component.height_in_blocks;
+        if (position >= count){
+            position -= count;
+            continue;
+        }
+        JBLOCKARRAY block_array = blockRow(c, (JDIMENSION)(position / row), writable);
+        position %= row;
+        return &block_array[0][position / DCTSIZE2][position % DCTSIZE2];
+    }
+    return nullptr;
+}
+//bytes from SOI to the end of the first SOS segment, all jpeg_read_header needs; 0 if the markers don't parse
+static size_t jpegHeaderSize(const unsigned char* data, size_t size){
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) return 0;
+    size_t pos = 2;
+    while (pos + 4 <= size){
+        if (data[pos] != 0xFF) return 0;
+        unsigned char marker = data[pos + 1];
+        if (marker == 0xFF){ ++pos; continue; } //fill byte
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)){ pos += 2; continue; } //no length field
+        size_t end = pos + 2 + (((size_t)data[pos + 2] << 8) | data[pos + 3]);
+        if (end > size) return 0;
+        if (marker == 0xDA) return end;
+        pos = end;
+    }
+    return 0;
+}
+//coefficient blocks inside the image, component by component and row by row
+static size_t coefficientBytes(jpeg_decompress_struct &info){
+    size_t bytes = 0;
+    for (int c = 0; c < info.num_components; ++c){
+        bytes += (size_t)info.comp_info[c].width_in_blocks * info.comp_info[c].height_in_blocks * sizeof(JBLOCK);
+    }
+    return bytes;
+}
+static void saveCoefficients(JpegCoefficients &jpeg, unsigned char* out){
+    jpeg_decompress_struct &info = jpeg.decompress_info;
+    for (int c = 0; c < info.num_components; ++c){
+        size_t row_size = (size_t)info.comp_info[c].width_in_blocks * sizeof(JBLOCK);
+        for (JDIMENSION y = 0; y < info.comp_info[c].height_in_blocks; ++y, out += row_size){
+            memcpy(out, jpeg.blockRow(c, y, false)[0], row_size);
+        }
+    }
+}
+static void loadCoefficients(JpegCoefficients &jpeg, const unsigned char* in){
+    jpeg_decompress_struct &info = jpeg.decompress_info;
+    for (int c = 0; c < info.num_components; ++c){
+        size_t row_size = (size_t)info.comp_info[c].width_in_blocks * sizeof(JBLOCK);
+        for (JDIMENSION y = 0; y < info.comp_info[c].height_in_blocks; ++y, in += row_size){
+            memcpy(jpeg.blockRow(c, y, true)[0], in, row_size);
+        }
+    }
+}
+//rebuilds the decompressor from the saved header and fills fresh coefficient arrays from the cache
+//arrays are sized the way libjpeg's own coefficient reader sizes them, padded to whole MCUs
+static bool restoreCoefficients(JpegCoefficients &jpeg){
+    const DecodedCarrier &cached = *jpeg.cached;
+    jpeg_decompress_struct &info = jpeg.decompress_info;
+    jpeg.source = fmemopen(const_cast<unsigned char*>(cached.header.data()), cached.header.size(), "rb");
+    if (!jpeg.source) return false;
+    jpeg_stdio_src(&info, jpeg.source);
+    if (jpeg_read_header(&info, TRUE) != JPEG_HEADER_OK || coefficientBytes(info) != cached.data.size()) return false;
+    jpeg.coefficients = (jvirt_barray_ptr*)(*info.mem->alloc_small)((j_common_ptr)&info, JPOOL_IMAGE, sizeof(jvirt_barray_ptr) * info.num_components);
+    for (int c = 0; c < info.num_components; ++c){
+        jpeg_component_info &component = info.comp_info[c];
+        JDIMENSION width = (component.width_in_blocks + component.h_samp_factor - 1) / component.h_samp_factor * component.h_samp_factor;
+        JDIMENSION height = (component.height_in_blocks + component.v_samp_factor - 1) / component.v_samp_factor * component.v_samp_factor;
+        jpeg.coefficients[c] = (*info.mem->request_virt_barray)((j_common_ptr)&info, JPOOL_IMAGE, TRUE, width, height, component.v_samp_factor);
+    }
+    (*info.mem->realize_virt_arrays)((j_common_ptr)&info);
+    loadCoefficients(jpeg, cached.data.data());
+    return true;
+}
+bool Handler::readJpegCoefficients(){
+    if(file_ext != ".jpeg" and file_ext != ".jpg"){
+        LOG_ERROR("Error: File " << file_name << " is not a jpeg/jpg");
+        return false;
+    }
+    //intercepting the decompression midway, coefficients stay in libjpeg's virtual arrays
+    std::unique_ptr<JpegCoefficients> jpeg(new JpegCoefficients());
+    watchJpegErrors((j_common_ptr)&jpeg->decompress_info, jpeg->errors);
+    jpeg_create_decompress(&jpeg->decompress_info);
+
+    jpeg->cached = cacheLookup(CarrierKind::JPEG_COEFFICIENTS);
+    if (jpeg->cached){
+        bool restored = false;
+        if (!guardJpeg({&jpeg->errors}, [&](){ restored = restoreCoefficients(*jpeg); }) || !restored){
+            LOG_ERROR("Error: Cached coefficients for " << file_name << " don't match its header.");
+            return false;
+        }
+        image_height = jpeg->decompress_info.image_height;
+        image_width = jpeg->decompress_info.image_width;
+        jpeg_coefficients = std::move(jpeg);
+        return true;
+    }
+
+    jpeg->source = openInput();
+    if(!jpeg->source){
+        LOG_ERROR("Error: " << file_name << " failed to open");
+        return false;
+    }
+    STEGA_METRIC(MetricScope metric(MetricPhase::CODEC_DECODE));
+    STEGA_METRIC(metric.addBytes(memory_input ? memory_size : input_buffer.size()));
+    //a cancellation inside jpeg_read_coefficients leaves it through the error manager too
+    JpegProgress progress;
+    bool read = guardJpeg({&jpeg->errors}, [&](){
+        jpeg_stdio_src(&jpeg->decompress_info, jpeg->source);
+        jpeg_read_header(&jpeg->decompress_info, TRUE);
+        if (cancelled()) return;
+        watchJpegProgress((j_common_ptr)&jpeg->decompress_info, progress, job_context.get(),
+                          MetricPhase::CODEC_DECODE, coefficientBytes(jpeg->decompress_info));
+        jpeg->coefficients = jpeg_read_coefficients(&jpeg->decompress_info);
+    });
+    jpeg->decompress_info.progress = NULL;
+    if (cancelled()) return false;
+    if (!read){
+        LOG_ERROR("Error: Corrupt jpeg " << file_name << ": " << jpeg->errors.message);
+        return false;
+    }
+    if (!jpeg->coefficients){
+        LOG_ERROR("Error: Failed to read " << file_name << " DCT coefficients.");
+        return false;
+    }
+    image_height = jpeg->decompress_info.image_height;
+    image_width = jpeg->decompress_info.image_width;
+    //saved before embedding touches them
+    const unsigned char* input = memory_input ? memory_data : input_buffer.data();
+    size_t header_size = jpegHeaderSize(input, memory_input ? memory_size : input_buffer.size());
+    size_t coefficient_size = coefficientBytes(jpeg->decompress_info);
+    STEGA_METRIC(metric.addCarrierBytes(coefficient_size));
+    STEGA_METRIC(metric.end());
+    if (header_size > 0 && caching(header_size + coefficient_size)){
+        std::shared_ptr<DecodedCarrier> carrier = std::make_shared<DecodedCarrier>();
+        carrier->header.assign(input, input + header_size);
+        carrier->data = BufferPool::take(coefficient_size);
+        saveCoefficients(*jpeg, carrier->data.data());
+        carrier->width = image_width;
+        carrier->height = image_height;
+        CarrierCache::instance().insert(cache_key, CarrierKind::JPEG_COEFFICIENTS, carrier);
+    }
+    jpeg_coefficients = std::move(jpeg);
     return true;
 }
 
+static std::uint32_t readLe32(const unsigned char* bytes){
+    return (std::uint32_t)bytes[0] | ((std::uint32_t)bytes[1] << 8) | ((std::uint32_t)bytes[2] << 16) | ((std::uint32_t)bytes[3] << 24);
+}
+//data chunk of a wav whose first size bytes are in bytes, total bytes long, clamped to the file
+static bool findWavSamples(const unsigned char* bytes, size_t size, size_t total, size_t &offset, size_t &length){
+    for (size_t i = 0; i + 8 <= size; ++i){
+        if (bytes[i] == 'd' && bytes[i+1] == 'a' && bytes[i+2] == 't' && bytes[i+3] == 'a'){
+            offset = i + 8; // data starts after data + size field
+            length = std::min<size_t>(readLe32(bytes + i + 4), total - offset);
+            // some WAV files have a data chunk size of 0
+            // in that case, use the remaining bytes in the file as the data chunk size
+            if (length == 0) length = total - offset;
+            return true;
+        }
+    }
+    LOG_ERROR("Error: Could not find data chunk in wav file");
+    return false;
+}
+
 // read whole file into binary_file_data and locate data chunk
 bool Handler::readWav(){
     if (file_ext != ".wav"){
-        std::cerr << "File " << file_name << " is not wav" << std::endl;
+        LOG_ERROR("File " << file_name << " is not wav");
+        return false;
+    }
+    file_view = cacheLookup(CarrierKind::WAV);
+    if (file_view){
+        file_size = static_cast<std::streamsize>(file_view->data.size());
+        wav_data_offset = static_cast<std::streamsize>(file_view->wav_data_offset);
+        wav_data_size = file_view->wav_data_size;
+        return true;
+    }
+    if (!readWhole()) return false;
+    STEGA_METRIC(MetricScope metric(MetricPhase::CODEC_DECODE));
+    STEGA_METRIC(metric.addBytes(binary_file_data.size()));
+
+    // find data chunk in WAV file
+    size_t offset = 0, length = 0;
+    if (!findWavSamples(binary_file_data.data(), binary_file_data.size(), binary_file_data.size(), offset, length)) return false;
+    wav_data_offset = static_cast<std::streamsize>(offset);
+    wav_data_size = static_cast<std::uint32_t>(length);
+    STEGA_METRIC(metric.addCarrierBytes(wav_data_size));
+    STEGA_METRIC(metric.noteBuffer(binary_file_data.capacity()));
+    STEGA_METRIC(metric.end());
+    if (caching(binary_file_data.size())){
+        std::shared_ptr<DecodedCarrier> carrier = std::make_shared<DecodedCarrier>();
+        carrier->data = pooledCopy(binary_file_data.data(), binary_file_data.size());
+        carrier->wav_data_offset = static_cast<size_t>(wav_data_offset);
+        carrier->wav_data_size = wav_data_size;
+        CarrierCache::instance().insert(cache_key, CarrierKind::WAV, carrier);
+    }
+    return true;
+}
+//----------RAW CARRIERS-----------
+bool Handler::isRawFormat(const std::string ext){
+    return ext == ".bmp" || ext == ".ppm" || ext == ".pgm" || ext == ".pcm" || ext == ".raw";
+}
+RawMapping::~RawMapping(){
+    if (data) munmap(data, size);
+}
+//private writable mapping of a regular file, NULL if it can't be mapped (pipe, empty file, ...)
+static std::unique_ptr<RawMapping> mapFile(const std::string path){
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return nullptr;
+    struct stat info;
+    std::unique_ptr<RawMapping> mapping;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0){
+        void* data = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED){
+            madvise(data, (size_t)info.st_size, MADV_SEQUENTIAL);
+            mapping.reset(new RawMapping());
+            mapping->data = static_cast<unsigned char*>(data);
+            mapping->size = (size_t)info.st_size;
+            mapping->device = info.st_dev;
+            mapping->inode = info.st_ino;
+        }
+    }
+    close(fd);
+    return mapping;
+}
+//a mapped carrier that something else truncates raises SIGBUS at the next touch of a page past its new end
+//guardRawAccess arms this thread's jump, a fault anywhere else goes to whatever handled SIGBUS before
+//the handler is only installed while some thread is inside a guard, the host's own comes back after the last one
+static thread_local sigjmp_buf* sigbus_jump = nullptr;
+static std::mutex sigbus_lock;
+static size_t sigbus_guards = 0;
+static struct sigaction previous_sigbus;
+static void onSigbus(int sig, siginfo_t* info, void* context){
+    if (sigbus_jump) siglongjmp(*sigbus_jump, 1);
+    if ((previous_sigbus.sa_flags & SA_SIGINFO) && previous_sigbus.sa_sigaction){
+        previous_sigbus.sa_sigaction(sig, info, context);
+    }
+    else if (previous_sigbus.sa_handler != SIG_DFL && previous_sigbus.sa_handler != SIG_IGN){
+        previous_sigbus.sa_handler(sig);
+    }
+    else{
+        //the faulting access runs again on return and ends the process as it would have
+        signal(SIGBUS, SIG_DFL);
+    }
+}
+static void installSigbus(){
+    std::lock_guard<std::mutex> guard(sigbus_lock);
+    if (sigbus_guards++ > 0) return;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = onSigbus;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGBUS, &action, &previous_sigbus);
+}
+static void restoreSigbus(){
+    std::lock_guard<std::mutex> guard(sigbus_lock);
+    if (--sigbus_guards == 0) sigaction(SIGBUS, &previous_sigbus, nullptr);
+}
+bool Handler::guardRawAccess(const std::function<void()> &body) const{
+    //memory can't be truncated, only a mapped file needs the handler
+    if (!raw_mapping){
+        body();
+        return true;
+    }
+    installSigbus();
+    sigjmp_buf jump;
+    sigjmp_buf* outer = sigbus_jump;
+    if (sigsetjmp(jump, 1) != 0){
+        sigbus_jump = outer;
+        restoreSigbus();
+        LOG_ERROR("Error: Carrier file was truncated while it was in use");
+        return false;
+    }
+    sigbus_jump = &jump;
+    body();
+    sigbus_jump = outer;
+    restoreSigbus();
+    return true;
+}
+//the finders parse a header from the first size bytes of a file total bytes long
+//bmp pixel array, row padding included since nothing reads it
+static bool findBmpSamples(const unsigned char* bytes, size_t size, size_t total, size_t &offset, size_t &length){
+    if (size < 54 || bytes[0] != 'B' || bytes[1] != 'M' || readLe32(bytes + 14) < 40){
+        LOG_ERROR("Error: Not a bmp with a BITMAPINFOHEADER");
+        return false;
+    }
+    std::int32_t width = (std::int32_t)readLe32(bytes + 18), height = (std::int32_t)readLe32(bytes + 22);
+    int bits = bytes[28] | (bytes[29] << 8);
+    std::uint32_t compression = readLe32(bytes + 30);
+    //palette indices can't take an lsb, and compressed rows have no fixed place to put one
+    if ((bits != 24 && bits != 32) || (compression != 0 && compression != 3)){
+        LOG_ERROR("Error: Only uncompressed 24/32-bit bmp carriers are supported");
+        return false;
+    }
+    if (width <= 0 || height == 0){
+        LOG_ERROR("Error: Invalid bmp dimensions");
+        return false;
+    }
+    size_t row_stride = (((size_t)width * bits + 31) / 32) * 4;
+    offset = readLe32(bytes + 10);
+    length = row_stride * (size_t)(height < 0 ? -(std::int64_t)height : height);
+    if (offset > total || length > total - offset){
+        LOG_ERROR("Error: bmp pixel data is truncated");
+        return false;
+    }
+    return true;
+}
+//binary ppm (P6) / pgm (P5), header is whitespace separated with # comments
+static bool findPnmSamples(const unsigned char* bytes, size_t size, size_t total, size_t &offset, size_t &length){
+    if (size < 2 || bytes[0] != 'P' || (bytes[1] != '5' && bytes[1] != '6')){
+        LOG_ERROR("Error: Not a binary ppm/pgm");
+        return false;
+    }
+    size_t pos = 2;
+    size_t fields[3] = {0, 0, 0}; //width, height, maxval
+    for (size_t &field : fields){
+        while (pos < size && (std::isspace(bytes[pos]) || bytes[pos] == '#')){
+            if (bytes[pos] == '#') while (pos < size && bytes[pos] != '\n') pos++;
+            else pos++;
+        }
+        if (pos >= size || !std::isdigit(bytes[pos])) break;
+        while (pos < size && std::isdigit(bytes[pos]) && field < 100000000) field = field * 10 + (bytes[pos++] - '0');
+    }
+    //exactly one whitespace byte separates maxval from the samples
+    if (fields[0] == 0 || fields[1] == 0 || pos >= size || !std::isspace(bytes[pos])){
+        LOG_ERROR("Error: Invalid ppm/pgm header");
         return false;
     }
-    std::ifstream file(file_name, std::ios::binary | std::ios::ate);
-    if(!file.is_open()){
-        std::cerr << "Error: Could not open " << file_name << std::endl;
+    //with an odd 8-bit maxval setting the lsb can't push a sample past it
+    if (fields[2] > 255 || fields[2] % 2 == 0){
+        LOG_ERROR("Error: Only ppm/pgm carriers with an odd maxval up to 255 are supported");
         return false;
     }
-    file_size = file.tellg();
-    file.seekg(0, std::ios::beg);
-    binary_file_data.resize(file_size);
-    if(!file.read(reinterpret_cast<char*>(binary_file_data.data()), file_size)){
-        std::cerr << "Error: Could not read " << file_name << std::endl;
+    offset = pos + 1;
+    length = fields[0] * fields[1] * (bytes[1] == '6' ? 3 : 1);
+    if (offset > total || length > total - offset){
+        LOG_ERROR("Error: ppm/pgm sample data is truncated");
         return false;
     }
-    file.close();
+    return true;
+}
+bool Handler::readRaw(){
+    if (!isRawFormat(file_ext)){
+        LOG_ERROR("File " << file_name << " is not a raw carrier");
+        return false;
+    }
+    //copy-on-write mapping: only the pages the payload touches get copied, and nothing is decoded
+    raw_mapping.reset();
+    if (!memory_input && !isStdio(file_name)) raw_mapping = mapFile(systemPath(file_name));
+    if (!raw_mapping && !readWhole()) return false;
+    const unsigned char* bytes = raw_mapping ? raw_mapping->data : binary_file_data.data();
+    size_t size = raw_mapping ? raw_mapping->size : binary_file_data.size();
+    file_size = (std::streamsize)size;
 
-    // find data chunk in WAV file
-    wav_data_offset = 0;
-    wav_data_size = 0;
-    for (std::streamsize i = 0; i + 8 <= file_size; ++i){
-        if (binary_file_data[i] == 'd' && binary_file_data[i+1] == 'a' && binary_file_data[i+2] == 't' && binary_file_data[i+3] == 'a'){
-            std::uint32_t size = 0;
-            size |= static_cast<std::uint32_t>(binary_file_data[i+4]);
-            size |= static_cast<std::uint32_t>(binary_file_data[i+5]) << 8;
-            size |= static_cast<std::uint32_t>(binary_file_data[i+6]) << 16;
-            size |= static_cast<std::uint32_t>(binary_file_data[i+7]) << 24;
-            wav_data_size = size;
-            wav_data_offset = i + 8; // data starts after data + size field
-            // some WAV files have a data chunk size of 0
-            // in that case, use the remaining bytes in the file as the data chunk size
-            if (wav_data_size == 0) {
-                std::streamsize remaining = file_size - wav_data_offset;
-                if (remaining > 0) wav_data_size = static_cast<std::uint32_t>(remaining);
-            }
+    bool pcm = file_ext != ".bmp" && file_ext != ".ppm" && file_ext != ".pgm";
+    if (pcm && size == 0){
+        LOG_ERROR("Error: pcm file " << file_name << " is empty");
+        raw_data_size = 0;
+        return false;
+    }
+    //the header is read from the mapping too, see guardRawAccess
+    bool found = false;
+    bool intact = guardRawAccess([&](){
+        if (file_ext == ".bmp") found = findBmpSamples(bytes, size, size, raw_data_offset, raw_data_size);
+        else if (!pcm) found = findPnmSamples(bytes, size, size, raw_data_offset, raw_data_size);
+        else {
+            //headerless pcm, every byte is taken like the wav data chunk
+            raw_data_offset = 0;
+            raw_data_size = size;
+            found = true;
+        }
+    });
+    if (!intact || !found) raw_data_size = 0;
+    return intact && found;
+}
+//----------STREAMED SAMPLES-----------
+//wav and raw carriers are a header, sample bytes and maybe a trailer, so they can pass through a chunk at a time
+bool Handler::canStreamSamples() const{
+    struct stat info;
+    return codec && codec->streamed && !memory_input && !isStdio(file_name) &&
+           stat(systemPath(file_name).c_str(), &info) == 0 && S_ISREG(info.st_mode);
+}
+bool Handler::openSamples(){
+    closeSamples();
+    if (!codec || !codec->streamed){
+        LOG_ERROR("File " << file_name << " is not a wav or raw carrier");
+        return false;
+    }
+    struct stat info;
+    if (!memory_input && !isStdio(file_name)) sample_stream = fopen(systemPath(file_name).c_str(), "rbe");
+    if (!sample_stream || fstat(fileno(sample_stream), &info) != 0 || !S_ISREG(info.st_mode)){
+        LOG_ERROR("Error: Could not stream " << file_name << ", it isn't a regular file");
+        closeSamples();
+        return false;
+    }
+    size_t total = (size_t)info.st_size;
+    sample_head = BufferPool::take(total < SINK_BYTES ? total : SINK_BYTES);
+    size_t got = 0;
+    while (got < sample_head.size()){
+        size_t read = fread(sample_head.data() + got, 1, sample_head.size() - got, sample_stream);
+        if (read == 0) break;
+        got += read;
+    }
+    sample_head.resize(got);
+    size_t offset = 0, length = 0;
+    bool found = false;
+    if (file_ext == ".wav") found = findWavSamples(sample_head.data(), got, total, offset, length);
+    else if (file_ext == ".bmp") found = findBmpSamples(sample_head.data(), got, total, offset, length);
+    else if (file_ext == ".ppm" || file_ext == ".pgm") found = findPnmSamples(sample_head.data(), got, total, offset, length);
+    else if (total == 0) LOG_ERROR("Error: pcm file " << file_name << " is empty");
+    else {
+        //headerless pcm, every byte is a sample
+        length = total;
+        found = true;
+    }
+    if (!found){
+        closeSamples();
+        return false;
+    }
+    sample_head_used = 0;
+    sample_prefix = offset;
+    sample_size = length;
+    sample_position = 0;
+    file_size = (std::streamsize)total;
+    return true;
+}
+size_t Handler::readStream(unsigned char* into, size_t size){
+    size_t done = 0;
+    if (sample_head_used < sample_head.size()){
+        done = std::min(size, sample_head.size() - sample_head_used);
+        memcpy(into, sample_head.data() + sample_head_used, done);
+        sample_head_used += done;
+    }
+    while (done < size){
+        size_t read = fread(into + done, 1, size - done, sample_stream);
+        if (read == 0) break;
+        done += read;
+    }
+    sample_position += done;
+    return done;
+}
+size_t Handler::readSamples(unsigned char* into, size_t size){
+    if (!sample_stream || size == 0) return 0;
+    //whatever of the header is still ahead is skipped
+    while (sample_position < sample_prefix){
+        if (readStream(into, (size_t)std::min<uint64_t>(size, sample_prefix - sample_position)) == 0) return 0;
+    }
+    size = (size_t)std::min<uint64_t>(size, sample_prefix + sample_size - sample_position);
+    return readStream(into, size);
+}
+void Handler::closeSamples(){
+    if (sample_stream) fclose(sample_stream);
+    sample_stream = nullptr;
+    BufferPool::give(sample_head);
+    sample_head_used = 0;
+}
+uint64_t Handler::getSampleSize() const{
+    return sample_size;
+}
+bool Handler::streamSamples(const std::string name, std::function<bool(uint64_t sample_bytes)> begin,
+                            std::function<void(unsigned char* samples, size_t size, uint64_t offset)> transform){
+    if (!openSamples()) return false;
+    if (!begin(sample_size) || !openSink(name)){
+        closeSamples();
+        return false;
+    }
+    //read, transform and write all happen here, the whole copy counts as codec_encode
+    STEGA_METRIC(MetricScope metric(MetricPhase::CODEC_ENCODE));
+    std::vector<unsigned char> chunk = BufferPool::take(SINK_BYTES);
+    uint64_t samples_end = sample_prefix + sample_size;
+    bool copied = true;
+    while (copied){
+        if (!checkpoint(MetricPhase::CODEC_ENCODE, sample_position, (uint64_t)file_size)){
+            copied = false;
             break;
         }
+        //up to the first sample, then the samples, then whatever follows them to the end of the file
+        size_t want = SINK_BYTES;
+        if (sample_position < sample_prefix) want = (size_t)std::min<uint64_t>(want, sample_prefix - sample_position);
+        else if (sample_position < samples_end) want = (size_t)std::min<uint64_t>(want, samples_end - sample_position);
+        uint64_t at = sample_position;
+        size_t got = readStream(chunk.data(), want);
+        if (got == 0) break;
+        if (at >= sample_prefix && at < samples_end) transform(chunk.data(), got, at - sample_prefix);
+        copied = sinkWrite(chunk.data(), got);
     }
-    if (wav_data_offset == 0){
-        std::cerr << "Error: Could not find data chunk in wav file" << std::endl;
+    bool truncated = copied && (sample_position < samples_end || ferror(sample_stream));
+    if (truncated) LOG_ERROR("Error: Could not read all of " << file_name);
+    STEGA_METRIC(metric.addBytes(sample_position));
+    STEGA_METRIC(metric.addCarrierBytes(sample_size));
+    STEGA_METRIC(metric.noteBuffer(sample_head.capacity() + chunk.capacity() + SINK_BYTES));
+    STEGA_METRIC(metric.end());
+    BufferPool::give(chunk);
+    closeSamples();
+    if (!copied || truncated){
+        discardSink();
         return false;
     }
+    return closeSink();
+}
+//----------FOOTPRINT-----------
+bool Handler::peekCarrier(const std::string name, bool native_png, CarrierShape &shape){
+    //headers worth reading sit in front of the first image data, 64 KiB covers all but huge metadata blocks
+    //stdin can't be peeked without being consumed
+    if (isStdio(name)) return false;
+    std::vector<unsigned char> header((size_t)64 << 10);
+    size_t file_bytes = 0;
+    header.resize(readHead(systemPath(name), header.data(), header.size(), &file_bytes));
+    if (header.empty()) return false;
+    shape.file_bytes = file_bytes;
+    std::string ext = CarrierCodecs::extensionOf(name);
+    shape.codec = ext == ".txt" ? nullptr : detectCodec(ext, header.data(), header.size());
+    if (!shape.codec) return false;
+    if (shape.codec->shape){
+        if (!shape.codec->shape(header.data(), header.size(), native_png, shape)) return false;
+    }
+    else{
+        shape.decoded_bytes = shape.file_bytes;
+    }
+    shape.capacity = shape.codec->capacity ? shape.codec->capacity(shape) : 0;
     return true;
 }
 //----------WRITING----------
 bool Handler::writeFile(const std::string name){
-    std::ofstream file(name, std::ios::binary);
-    if(!file.is_open()){
-        std::cerr << "Error: Could not open " << name << std::endl;
+    return writeWhole(name);
+}
+static bool sameFile(const std::string path, const RawMapping &mapping){
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 && info.st_dev == mapping.device && info.st_ino == mapping.inode;
+}
+bool Handler::writeRaw(const std::string name){
+    if (raw_data_size == 0){
+        LOG_ERROR("Error: Raw carrier not initialized");
         return false;
     }
-
-    file.write(reinterpret_cast<const char*>(binary_file_data.data()), binary_file_data.size());
-
-    if(!file.good()){
-        std::cerr << "Error: Failed to write to " << name << std::endl;
+    const unsigned char* bytes = raw_mapping ? raw_mapping->data : binary_file_data.data();
+    size_t size = raw_mapping ? raw_mapping->size : binary_file_data.size();
+    if (memory_output){
+        BufferPool::resize(*memory_output, size);
+        std::vector<unsigned char> &output = *memory_output;
+        return guardRawAccess([&](){ memcpy(output.data(), bytes, size); });
+    }
+    bool written = false;
+    if (raw_mapping && renameable(name)){
+        //opening the output truncates it, and the output may be the mapped carrier itself:
+        //the bytes go to a temporary name next to it that then replaces it whole
+        std::string temporary = temporaryName(name);
+        written = writeTarget(temporary, bytes, size) && rename(temporary.c_str(), name.c_str()) == 0;
+        if (!written) unlink(temporary.c_str());
+    }
+    else if (raw_mapping && !isStdio(name) && sameFile(systemPath(name), *raw_mapping)){
+        //a passed descriptor can't be renamed over, the carrier is copied out before it's truncated
+        std::vector<unsigned char> copy = BufferPool::take(size);
+        written = guardRawAccess([&](){ memcpy(copy.data(), bytes, size); }) && writeTarget(name, copy.data(), size);
+        BufferPool::give(copy);
+    }
+    else {
+        written = writeTarget(name, bytes, size);
+    }
+    if (!written){
+        LOG_ERROR("Error: Failed to write to " << name);
         return false;
     }
-    file.close();
     return true;
 }
 //write wav replace data chunk bytes with sample_data in binary_file_data and write whole file
 bool Handler::writeWav(const std::string name){
-    if (file_ext != ".wav" && name.find(".wav") == std::string::npos){
-        std::cerr << "Error: Cannot write " << name << " to wav file" << std::endl;
+    if (file_ext != ".wav" && CarrierCodecs::extensionOf(name) != ".wav"){
+        LOG_ERROR("Error: Cannot write " << name << " to wav file");
         return false;
     }
     if (wav_data_offset == 0 || wav_data_size == 0){
-        std::cerr << "Error: WAV data chunk not initialized" << std::endl;
+        LOG_ERROR("Error: WAV data chunk not initialized");
         return false;
     }
     // write binary_file_data to file
-    std::ofstream file(name, std::ios::binary);
-    if (!file.is_open()){
-        std::cerr << "Error: Could not open " << name << " for writing" << std::endl;
-        return false;
-    }
-    file.write(reinterpret_cast<const char*>(binary_file_data.data()), binary_file_data.size());
-    file.close();
-    return true;
+    return writeWhole(name);
 }
 bool Handler::writePng(const std::string name){
-    //this function assumes image is in simple RGBA format
-    //find again because of earlier issue with .contains()
-    if (name.find(".png") == std::string::npos){
-        std::cerr << "Error: Cannot write " << name << " to png file" << std::endl;
+    //pixel data is rgba8 unless a native png was read, see getChannels()/getBitDepth()
+    if (!isStdio(name) && CarrierCodecs::extensionOf(name) != ".png"){
+        LOG_ERROR("Error: Cannot write " << name << " to png file");
         return false;
     }
-    FILE* image_file = fopen(name.c_str(), "wb");
+    //ensure image data aligns with image dimensions during read
+    size_t expected_size = (size_t)image_width * image_height * image_channels * (image_bit_depth / 8);
+    const std::vector<unsigned char> &pixels = pixelBytes();
+    if (pixels.size() != expected_size) {
+        LOG_ERROR("CRITICAL ERROR: Data size does not match dimensions!");
+        LOG_ERROR("Expected size: " << expected_size);
+        LOG_ERROR("Actual size:   " << pixels.size());
+        return false;
+    }
+    FILE* image_file = openOutput(name);
     if(!image_file){
-        std::cerr << "Error: Could not open " << name << " for writing" << std::endl;
+        LOG_ERROR("Error: Could not open " << name << " for writing");
         return false;
     }
+    //filtering and deflate are spread over every core, see PngWriter
+    STEGA_METRIC(MetricScope metric(MetricPhase::CODEC_ENCODE));
+    WriteSettings settings = writeSettings(write_profile);
+    PngWriter writer(image_width, image_height, image_channels, image_bit_depth);
+    writer.setCompression(settings.zlib_level, settings.zlib_strategy);
+    writer.setFilter(settings.png_filter);
+    writer.setJobContext(job_context.get());
+    if (!writer.write(image_file, pixels.data(), pixels.size())){
+        if (!cancelled()) LOG_ERROR("Error: Failed to write png " << name);
+        discardOutput(image_file);
+        return false;
+    }
+    profile_report = profileName(write_profile) + "/" + filterName(writer.getFilter());
+    //ended before closeOutput, the file write is FileIo's to record
+    STEGA_METRIC(metric.addBytes(pixels.size()));
+    STEGA_METRIC(metric.addCarrierBytes(pixels.size()));
+    STEGA_METRIC(metric.noteBuffer(output_buffer.capacity()));
+    STEGA_METRIC(metric.end());
+    return closeOutput(image_file);
+}
+//----------PIPELINE----------
+//decode, transform and encode of one png overlap on three threads
+//rows travel through a fixed ring of row buffers, so memory stays at PIPELINE_ROWS rows instead of the whole image
+static const size_t PIPELINE_ROWS = 64;
 
-    //init libpng write structs
-    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+struct PngPipeline{
+    png_structp read_png = NULL;
+    png_infop read_info = NULL;
+    FILE* output = NULL;
+    int height = 0, width = 0;
+    int channels = 4, bit_depth = 8;
+    size_t row_bytes = 0;
+    std::vector<std::vector<unsigned char>> rows;
+    //slot indices, -1 tells the next stage the previous one failed
+    RowQueue<int> free_rows{PIPELINE_ROWS}, decoded_rows{PIPELINE_ROWS}, transformed_rows{PIPELINE_ROWS};
+    std::atomic<bool> abort{false};
+    WriteSettings settings;
+    PngErrors read_errors, write_errors;
+};
+
+static bool pipelineDecode(PngPipeline &pipeline){
+    //the read struct's jump target moves to this thread for the rows
+    if (setjmp(png_jmpbuf(pipeline.read_png))){
+        pipeline.decoded_rows.push(-1, pipeline.abort);
+        return false;
+    }
+    for (int y = 0; y < pipeline.height; ++y){
+        int slot;
+        if (!pipeline.free_rows.pop(slot, pipeline.abort)) return false;
+        png_read_row(pipeline.read_png, pipeline.rows[slot].data(), NULL);
+        if (!pipeline.decoded_rows.push(slot, pipeline.abort)) return false;
+    }
+    png_read_end(pipeline.read_png, NULL);
+    return true;
+}
+
+static bool pipelineEncode(PngPipeline &pipeline){
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, &pipeline.write_errors, jumpOnPngError, logPngWarning);
     if (!png){
-        std::cerr << "Error: libpng write struct failed to initialize" << std::endl;
-        fclose(image_file);
+        LOG_ERROR("Error: libpng write struct failed to initialize");
         return false;
     }
     png_infop png_info = png_create_info_struct(png);
     if (!png_info){
         png_destroy_write_struct(&png, NULL);
-        std::cerr << "Error: libpng write info struct failed to initialize" << std::endl;
-        fclose(image_file);
+        LOG_ERROR("Error: libpng write info struct failed to initialize");
         return false;
     }
-    png_set_compression_level(png, Z_BEST_COMPRESSION);
-    //libpng's try catch for struct initialization
     if (setjmp(png_jmpbuf(png))){
         png_destroy_write_struct(&png, &png_info);
+        return false;
+    }
+    //rows arrive one at a time, so AUTO can't sample ahead and falls back to libpng's adaptive filtering
+    static const int filter_flags[] = {PNG_FILTER_NONE, PNG_FILTER_SUB, PNG_FILTER_UP, PNG_FILTER_AVG, PNG_FILTER_PAETH};
+    int filter = (int)pipeline.settings.png_filter;
+    png_set_filter(png, PNG_FILTER_TYPE_BASE, filter <= (int)PngFilter::PAETH ? filter_flags[filter] : PNG_ALL_FILTERS);
+    png_set_compression_level(png, pipeline.settings.zlib_level);
+    png_set_compression_strategy(png, pipeline.settings.zlib_strategy);
+    png_init_io(png, pipeline.output);
+    png_set_IHDR(png, png_info, pipeline.width, pipeline.height, pipeline.bit_depth, pngColorType(pipeline.channels),
+        PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png, png_info);
+    for (int y = 0; y < pipeline.height; ++y){
+        int slot;
+        //rows still queued behind a failure or cancellation aren't worth compressing
+        if (pipeline.abort || !pipeline.transformed_rows.pop(slot, pipeline.abort) || slot < 0){
+            png_destroy_write_struct(&png, &png_info);
+            return false;
+        }
+        png_write_row(png, pipeline.rows[slot].data());
+        pipeline.free_rows.push(slot, pipeline.abort);
+    }
+    png_write_end(png, NULL);
+    png_destroy_write_struct(&png, &png_info);
+    return true;
+}
+
+bool Handler::pipelinePng(const std::string name, std::function<bool(int height, size_t row_bytes)> begin,
+                          std::function<void(unsigned char* row, int y)> transform){
+    if (file_ext != ".png"){
+        LOG_ERROR("File " << file_name << " is not png");
+        return false;
+    }
+    if (!isStdio(name) && CarrierCodecs::extensionOf(name) != ".png"){
+        LOG_ERROR("Error: Cannot write " << name << " to png file");
+        return false;
+    }
+    FILE* image_file = openStream();
+    if (!image_file){
+        LOG_ERROR("Error: Could not open file " << file_name);
+        return false;
+    }
+    PngPipeline pipeline;
+    pipeline.settings = writeSettings(write_profile);
+    pipeline.read_png = png_create_read_struct(PNG_LIBPNG_VER_STRING, &pipeline.read_errors, jumpOnPngError, logPngWarning);
+    if (pipeline.read_png) pipeline.read_info = png_create_info_struct(pipeline.read_png);
+    if (!pipeline.read_info){
+        png_destroy_read_struct(&pipeline.read_png, NULL, NULL);
+        LOG_ERROR("Error: libpng read struct failed to initialize");
         fclose(image_file);
         return false;
     }
-    //ensure image data aligns with image dimensions during read
-    if (image_pixel_data.size() != (size_t)image_width * image_height * 4) {
-        std::cerr << "CRITICAL ERROR: Data size does not match dimensions!" << std::endl;
-        std::cerr << "Expected size: " << (size_t)image_width * image_height * 4 << std::endl;
-        std::cerr << "Actual size:   " << image_pixel_data.size() << std::endl;
-        png_destroy_write_struct(&png, &png_info);
+    if (setjmp(png_jmpbuf(pipeline.read_png))){
+        LOG_ERROR("Error: Corrupt png " << file_name << ": " << pipeline.read_errors.message);
+        png_destroy_read_struct(&pipeline.read_png, &pipeline.read_info, NULL);
         fclose(image_file);
         return false;
     }
-
-    png_init_io(png, image_file);
-    //write png headers
-    png_set_IHDR(png, png_info, image_width, image_height, 8, PNG_COLOR_TYPE_RGBA,
-        PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
-    png_write_info(png, png_info);
-
-    //write image data and close file
-    int row_bytes = image_width * 4;
-    std::vector<png_bytep> row_pointers(image_height);
-    for(int i = 0; i < image_height; ++i){
-        row_pointers[i] = const_cast<png_bytep>(&image_pixel_data[i * row_bytes]);
+    png_init_io(pipeline.read_png, image_file);
+    png_read_info(pipeline.read_png, pipeline.read_info);
+    if (png_get_interlace_type(pipeline.read_png, pipeline.read_info) != PNG_INTERLACE_NONE){
+        //interlaced rows aren't final until the last pass, run the stages one after another instead
+        //a piped stdin can't be opened again, so it finishes decoding here with every pass
+        if (isStdio(file_name) && !memory_input && stdinIsPipe()){
+            setPngTransforms(pipeline.read_png, pipeline.read_info, native_png);
+            int passes = png_set_interlace_handling(pipeline.read_png);
+            png_read_update_info(pipeline.read_png, pipeline.read_info);
+            image_channels = png_get_channels(pipeline.read_png, pipeline.read_info);
+            image_bit_depth = png_get_bit_depth(pipeline.read_png, pipeline.read_info);
+            image_height = png_get_image_height(pipeline.read_png, pipeline.read_info);
+            image_width = png_get_image_width(pipeline.read_png, pipeline.read_info);
+            size_t decoded_row = png_get_rowbytes(pipeline.read_png, pipeline.read_info);
+            BufferPool::resize(image_pixel_data, decoded_row * image_height);
+            for (int pass = 0; pass < passes; ++pass){
+                for (int y = 0; y < image_height; ++y) png_read_row(pipeline.read_png, &image_pixel_data[y * decoded_row], NULL);
+            }
+            png_read_end(pipeline.read_png, NULL);
+            file_size = image_pixel_data.size();
+            png_destroy_read_struct(&pipeline.read_png, &pipeline.read_info, NULL);
+            fclose(image_file);
+        }
+        else{
+            png_destroy_read_struct(&pipeline.read_png, &pipeline.read_info, NULL);
+            fclose(image_file);
+            if (!readPng()) return false;
+        }
+        size_t row_bytes = (size_t)image_width * image_channels * (image_bit_depth / 8);
+        if (!begin(image_height, row_bytes)) return false;
+        for (int y = 0; y < image_height; ++y) transform(&image_pixel_data[y * row_bytes], y);
+        return writePng(name);
     }
-    png_write_image(png, row_pointers.data());
-    png_write_end(png, NULL);
+    setPngTransforms(pipeline.read_png, pipeline.read_info, native_png);
+    png_read_update_info(pipeline.read_png, pipeline.read_info);
+    image_channels = pipeline.channels = png_get_channels(pipeline.read_png, pipeline.read_info);
+    image_bit_depth = pipeline.bit_depth = png_get_bit_depth(pipeline.read_png, pipeline.read_info);
+    image_height = pipeline.height = png_get_image_height(pipeline.read_png, pipeline.read_info);
+    image_width = pipeline.width = png_get_image_width(pipeline.read_png, pipeline.read_info);
+    pipeline.row_bytes = png_get_rowbytes(pipeline.read_png, pipeline.read_info);
+    if (!begin(pipeline.height, pipeline.row_bytes)){
+        png_destroy_read_struct(&pipeline.read_png, &pipeline.read_info, NULL);
+        fclose(image_file);
+        return false;
+    }
+    pipeline.output = openOutput(name, true);
+    if (!pipeline.output){
+        LOG_ERROR("Error: Could not open " << name << " for writing");
+        png_destroy_read_struct(&pipeline.read_png, &pipeline.read_info, NULL);
+        fclose(image_file);
+        return false;
+    }
+    //decode and transform overlap the encode here, the whole pipeline counts as codec_encode
+    STEGA_METRIC(MetricScope metric(MetricPhase::CODEC_ENCODE));
+    pipeline.rows.assign(PIPELINE_ROWS, std::vector<unsigned char>(pipeline.row_bytes));
+    for (size_t i = 0; i < PIPELINE_ROWS; ++i) pipeline.free_rows.tryPush((int)i);
 
-    png_destroy_write_struct(&png, &png_info);
+    bool decoded = false, encoded = false;
+    std::thread decoder([&](){
+        decoded = pipelineDecode(pipeline);
+        if (!decoded) pipeline.abort = true;
+    });
+    std::thread encoder([&](){
+        encoded = pipelineEncode(pipeline);
+        if (!encoded) pipeline.abort = true;
+    });
+    //transform runs on the calling thread, between the two queues
+    for (int y = 0; y < pipeline.height; ++y){
+        int slot;
+        if (!checkpoint(MetricPhase::CODEC_ENCODE, (uint64_t)y * pipeline.row_bytes, (uint64_t)pipeline.height * pipeline.row_bytes)){
+            pipeline.abort = true;
+            break;
+        }
+        if (!pipeline.decoded_rows.pop(slot, pipeline.abort)) break;
+        if (slot >= 0) transform(pipeline.rows[slot].data(), y);
+        if (!pipeline.transformed_rows.push(slot, pipeline.abort) || slot < 0) break;
+    }
+    decoder.join();
+    encoder.join();
+    png_destroy_read_struct(&pipeline.read_png, &pipeline.read_info, NULL);
+    STEGA_METRIC(metric.addBytes(std::max(ftell(image_file), 0L)));
     fclose(image_file);
-    return true;
+    if (!decoded || !encoded || cancelled()){
+        if (!cancelled()){
+            const char* reason = !decoded ? pipeline.read_errors.message : pipeline.write_errors.message;
+            LOG_ERROR("Error: Pipelined png encode of " << file_name << " failed" << (reason[0] ? ": " : "") << reason);
+        }
+        discardOutput(pipeline.output);
+        return false;
+    }
+    file_size = (std::streamsize)pipeline.row_bytes * pipeline.height;
+    PngFilter used = pipeline.settings.png_filter == PngFilter::AUTO ? PngFilter::ADAPTIVE : pipeline.settings.png_filter;
+    profile_report = profileName(write_profile) + "/" + filterName(used);
+    STEGA_METRIC(metric.addCarrierBytes(file_size));
+    STEGA_METRIC(metric.noteBuffer(pipeline.rows.size() * pipeline.row_bytes + output_buffer.capacity()));
+    STEGA_METRIC(metric.end());
+    return closeOutput(pipeline.output);
 }
+
 bool Handler::writeJpeg(const std::string name){
     // if(file_ext != ".jpeg" and file_ext != ".jpg"){
-    //     std::cerr << "Error: File " << file_name << " is not a jpeg/jpg" << std::endl;
+    //     LOG_ERROR("Error: File " << file_name << " is not a jpeg/jpg");
     //     return false;
     // }
     //init jpeg structs for compression
     struct jpeg_compress_struct compress_info;
-    struct jpeg_error_mgr jpeg_err;
+    JpegErrors errors;
 
-    compress_info.err = jpeg_std_error(&jpeg_err);
+    watchJpegErrors((j_common_ptr)&compress_info, errors);
     jpeg_create_compress(&compress_info);
 
     //create output file
-    FILE* image_file = fopen(name.c_str(), "wb");
+    FILE* image_file = openOutput(name);
     if(!image_file){
-        std::cerr << "Error: Cannot write " << name << " to jpeg file." << std::endl;
+        LOG_ERROR("Error: Cannot write " << name << " to jpeg file.");
         jpeg_destroy_compress(&compress_info);
         return false;
     }
-    jpeg_stdio_dest(&compress_info, image_file);
+    STEGA_METRIC(MetricScope metric(MetricPhase::CODEC_ENCODE));
+    bool optimize = writeSettings(write_profile).jpeg_optimize;
+    profile_report = profileName(write_profile);
+    bool stopped = false;
+    bool written = guardJpeg({&errors}, [&](){
+        jpeg_stdio_dest(&compress_info, image_file);
 
-    //set image properties
-    compress_info.image_height = image_height;
-    compress_info.image_width = image_width;
-    compress_info.input_components = 3; //RGB
-    compress_info.in_color_space = JCS_RGB;
+        //set image properties
+        compress_info.image_height = image_height;
+        compress_info.image_width = image_width;
+        compress_info.input_components = 3; //RGB
+        compress_info.in_color_space = JCS_RGB;
 
-    //set defaults and quality
-    jpeg_set_defaults(&compress_info);
-    jpeg_set_quality(&compress_info, 95, TRUE); //adjust quality here, KEEP CONSTANT, NOT ALLOW USER INPUT
+        //set defaults and quality
+        jpeg_set_defaults(&compress_info);
+        jpeg_set_quality(&compress_info, 95, TRUE); //adjust quality here, KEEP CONSTANT, NOT ALLOW USER INPUT
+        compress_info.optimize_coding = optimize ? TRUE : FALSE;
 
-    //compress image
-    jpeg_start_compress(&compress_info, TRUE);
-    //write pixel data row by row (scanline by scanline)
-    while (compress_info.next_scanline < compress_info.image_height){
-        const unsigned char* row_ptr = &image_pixel_data[compress_info.next_scanline * image_width * 3];
-        jpeg_write_scanlines(&compress_info, const_cast<JSAMPROW*>(&row_ptr), 1);
+        //compress image
+        jpeg_start_compress(&compress_info, TRUE);
+        //write pixel data row by row (scanline by scanline)
+        size_t row_bytes = (size_t)image_width * 3;
+        while (compress_info.next_scanline < compress_info.image_height){
+            if (!checkpoint(MetricPhase::CODEC_ENCODE, compress_info.next_scanline * row_bytes, image_pixel_data.size())){
+                stopped = true;
+                return;
+            }
+            const unsigned char* row_ptr = &image_pixel_data[compress_info.next_scanline * row_bytes];
+            jpeg_write_scanlines(&compress_info, const_cast<JSAMPROW*>(&row_ptr), 1);
+        }
+        jpeg_finish_compress(&compress_info);
+    });
+    //cleanup structs, destroying also aborts a compression that didn't finish
+    jpeg_destroy_compress(&compress_info);
+    if (!written || stopped){
+        if (!written && !cancelled()) LOG_ERROR("Error: Failed to write jpeg " << name << ": " << errors.message);
+        discardOutput(image_file);
+        return false;
     }
+    STEGA_METRIC(metric.addBytes(image_pixel_data.size()));
+    STEGA_METRIC(metric.addCarrierBytes(image_pixel_data.size()));
+    STEGA_METRIC(metric.noteBuffer(output_buffer.capacity()));
+    STEGA_METRIC(metric.end());
+    return closeOutput(image_file);
+}
 
-    //cleanup structs
-    jpeg_finish_compress(&compress_info);
-    jpeg_destroy_compress(&compress_info);
-    fclose(image_file);
+bool Handler::writeJpegCoefficients(const std::string name){
+    if (!jpeg_coefficients){
+        LOG_ERROR("Error: No JPEG coefficients loaded for " << file_name);
+        return false;
+    }
+    struct jpeg_compress_struct compress_info;
+    JpegErrors errors;
+    watchJpegErrors((j_common_ptr)&compress_info, errors);
+    jpeg_create_compress(&compress_info);
 
-    return true;
+    FILE* image_file = openOutput(name);
+    if (!image_file){
+        LOG_ERROR("Failed to open " << name << " for writing JPEG");
+        jpeg_destroy_compress(&compress_info);
+        return false;
+    }
+    STEGA_METRIC(MetricScope metric(MetricPhase::CODEC_ENCODE));
+    bool optimize = writeSettings(write_profile).jpeg_optimize;
+    profile_report = profileName(write_profile);
+    size_t coefficient_size = coefficientBytes(jpeg_coefficients->decompress_info);
+
+    //write modified coefficients, no requantization happens here
+    //the entropy coding itself runs inside jpeg_finish_compress, a cancellation jumps out of it
+    //the source decompressor is armed too, its virtual arrays are read from in there
+    JpegProgress progress;
+    bool written = !cancelled() && guardJpeg({&errors, &jpeg_coefficients->errors}, [&](){
+        jpeg_stdio_dest(&compress_info, image_file);
+        jpeg_copy_critical_parameters(&jpeg_coefficients->decompress_info, &compress_info);
+        //huffman tables only change the entropy coding, the embedded coefficients come out the same
+        compress_info.optimize_coding = optimize ? TRUE : FALSE;
+        watchJpegProgress((j_common_ptr)&compress_info, progress, job_context.get(), MetricPhase::CODEC_ENCODE, coefficient_size);
+        jpeg_write_coefficients(&compress_info, jpeg_coefficients->coefficients);
+        jpeg_finish_compress(&compress_info);
+        //a cache-restored decompressor never started reading scans, there's nothing to finish
+        if (!jpeg_coefficients->cached) jpeg_finish_decompress(&jpeg_coefficients->decompress_info);
+    });
+    //cleanup, coefficients are consumed after writing
+    jpeg_destroy_compress(&compress_info);
+    if (!written){
+        if (!cancelled()) LOG_ERROR("Error: Failed to write jpeg " << name << ": " << errors.message << jpeg_coefficients->errors.message);
+        discardOutput(image_file);
+        jpeg_coefficients.reset();
+        return false;
+    }
+    STEGA_METRIC(metric.addBytes(coefficient_size));
+    STEGA_METRIC(metric.addCarrierBytes(coefficient_size));
+    STEGA_METRIC(metric.noteBuffer(output_buffer.capacity()));
+    STEGA_METRIC(metric.end());
+    jpeg_coefficients.reset();
+    return closeOutput(image_file);
 }
 
 //----------SETTERS----------//
 
 void Handler::setPngPixelData(std::vector<unsigned char> pixel_data){
-    image_pixel_data = pixel_data;
+    //always rgba8, e.g. a png secret rebuilt by the decoder
+    pixel_view.reset();
+    BufferPool::give(image_pixel_data);
+    image_pixel_data = std::move(pixel_data);
+    image_channels = 4;
+    image_bit_depth = 8;
+}
+void Handler::setLsbBytes(std::vector<unsigned char> lsb_bytes){
+    if (image_bit_depth == 8){
+        pixel_view.reset();
+        BufferPool::give(image_pixel_data);
+        image_pixel_data = std::move(lsb_bytes);
+        return;
+    }
+    ownPixels();
+    for (size_t i = 0; i < lsb_bytes.size() && i * 2 + 1 < image_pixel_data.size(); ++i){
+        image_pixel_data[i * 2 + 1] = lsb_bytes[i];
+    }
+    BufferPool::give(lsb_bytes);
 }
 
 void Handler::setWavSampleData(std::vector<unsigned char> sample_data){
     if (wav_data_offset == 0 || wav_data_size == 0) return;
+    ownFile();
     for (std::uint32_t i = 0; i < wav_data_size && i < sample_data.size(); ++i){
         binary_file_data[wav_data_offset + i] = sample_data[i];
     }
+    BufferPool::give(sample_data);
 }
 void Handler::setBinaryFileData(std::vector<unsigned char> file_data){
-    binary_file_data = file_data;
+    file_view.reset();
+    BufferPool::give(binary_file_data);
+    binary_file_data = std::move(file_data);
 }
 void Handler::setImageDimensions(int selector, int dimension){
     if (selector == 0){image_height = dimension;}
@@ -371,19 +1801,23 @@ void Handler::setImageDimensions(int selector, int dimension){
 }
 
 //----------GETTERS----------//
+//getters hand out copies, taken from the pool so they recycle like everything else
 
 std::string Handler::getExt() const{
     return file_ext;
 }
+const CarrierCodec* Handler::getCodec() const{
+    return codec;
+}
 std::vector<unsigned char> Handler::getPixelData() const{
-    return image_pixel_data;
+    return pooledCopy(pixelBytes().data(), pixelBytes().size());
 }
 std::vector<unsigned char> Handler::getWavSampleData() const{
     if (wav_data_offset == 0 || wav_data_size == 0) return std::vector<unsigned char>();
-    return std::vector<unsigned char>(binary_file_data.begin() + wav_data_offset, binary_file_data.begin() + wav_data_offset + wav_data_size);
+    return pooledCopy(fileBytes().data() + wav_data_offset, wav_data_size);
 }
 std::vector<unsigned char> Handler::getFileData() const{
-    return binary_file_data;
+    return pooledCopy(fileBytes().data(), fileBytes().size());
 }
 std::streamsize Handler::getFileSize() const{
     return file_size;
@@ -392,4 +1826,39 @@ int Handler::getImageDimensions(int selector) const{
     if (selector == 0){return image_height;}
     else{return image_width;}
 }
+int Handler::getChannels() const{
+    return image_channels;
+}
+int Handler::getBitDepth() const{
+    return image_bit_depth;
+}
+std::vector<unsigned char> Handler::getLsbBytes() const{
+    const std::vector<unsigned char> &pixels = pixelBytes();
+    if (image_bit_depth == 8) return pooledCopy(pixels.data(), pixels.size());
+    //16-bit samples are big endian, the low byte is the second of each pair
+    std::vector<unsigned char> lsb_bytes = BufferPool::take(pixels.size() / 2);
+    for (size_t i = 0; i < lsb_bytes.size(); ++i) lsb_bytes[i] = pixels[i * 2 + 1];
+    return lsb_bytes;
+}
+std::vector<unsigned char> Handler::takeLsbBytes(){
+    if (image_bit_depth != 8) return getLsbBytes();
+    //a cached view can't be moved out, this is where it gets copied
+    if (pixel_view){
+        std::vector<unsigned char> lsb_bytes = getLsbBytes();
+        pixel_view.reset();
+        return lsb_bytes;
+    }
+    std::vector<unsigned char> lsb_bytes;
+    lsb_bytes.swap(image_pixel_data);
+    return lsb_bytes;
+}
+JpegCoefficients* Handler::getJpegCoefficients(){
+    return jpeg_coefficients.get();
+}
+unsigned char* Handler::getRawSamples(){
+    return (raw_mapping ? raw_mapping->data : binary_file_data.data()) + raw_data_offset;
+}
+size_t Handler::getRawSampleSize() const{
+    return raw_data_size;
+}
 
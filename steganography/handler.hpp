@@ -5,37 +5,181 @@
 #include <vector>
 #include <fstream>
 #include <cstdint>
+#include <cstdio>
+#include <csetjmp>
+#include <memory>
+#include <functional>
+#include <sys/types.h>
 #include <jpeglib.h>
+#include "writeprofile.hpp"
+#include "carriercache.hpp"
+#include "metrics.hpp"
+#include "jobcontext.hpp"
+#include "carriercodec.hpp"
+
+//libjpeg error manager that hands a fatal error back to the caller instead of calling exit()
+//armed around each libjpeg call (see guardJpeg in handler.cpp), unarmed it falls back to libjpeg's default
+struct JpegErrors{
+    struct jpeg_error_mgr manager; //first, libjpeg only ever sees this part
+    jmp_buf* jump = nullptr;
+    void (*default_exit)(j_common_ptr info) = nullptr;
+    char message[JMSG_LENGTH_MAX] = {0}; //what the last fatal error was
+};
+
+//jpeg DCT coefficients read without decoding to pixels
+//owns the libjpeg decompress object until the coefficients are written or discarded
+struct JpegCoefficients{
+    struct jpeg_decompress_struct decompress_info;
+    JpegErrors errors;
+    jvirt_barray_ptr* coefficients = nullptr;
+    FILE* source = nullptr;
+    //set when the coefficients came from CarrierCache: source is its saved header, nothing else was decoded
+    std::shared_ptr<const DecodedCarrier> cached;
+    ~JpegCoefficients();
+    JBLOCKARRAY blockRow(int component, JDIMENSION block_y, bool writable);
+    //every coefficient in embedding order (component, block row, block, coefficient), for ScatterOrder
+    uint64_t coefficientCount() const;
+    JCOEF* coefficient(uint64_t position, bool writable);
+};
+
+//bmp, ppm/pgm or raw pcm carrier file mapped copy-on-write
+//embedding writes straight into the mapping, the file on disk never changes
+struct RawMapping{
+    unsigned char* data = nullptr;
+    size_t size = 0;
+    dev_t device = 0; //the mapped file, so writing over it can be recognized
+    ino_t inode = 0;
+    ~RawMapping();
+};
+
+//what a carrier will decode to, read from its header alone, see Handler::peekCarrier
+struct CarrierShape{
+    const CarrierCodec* codec = nullptr;
+    size_t file_bytes = 0;
+    size_t decoded_bytes = 0; //png pixels, jpeg coefficient blocks, wav/raw: the file copied once
+    int width = 0, height = 0, channels = 0, bit_depth = 0; //png/jpeg only
+    size_t capacity = 0; //payload bytes (header included) it can hold at most, see CarrierCodec::capacity
+};
 
 class Handler{
     public:
-        Handler(const std::string file_name);
+        //codec: the format an earlier Handler or peekCarrier already sniffed from this file (see getCodec),
+        //so nothing is read to find it again; null sniffs it
+        Handler(const std::string file_name, const CarrierCodec* codec = nullptr);
+        Handler(const std::string file_name, const unsigned char* data, size_t size, const CarrierCodec* codec = nullptr); //in-memory file
+        ~Handler();
+        //picks the format from the file's first bytes (one small read), the extension only decides
+        //for .txt, headerless formats and files that can't be read yet; see CarrierCodecs
         void parseExt();
+        //builds the full output path for an encoded carrier before any work is done
+        //sniffs the carrier, a job that has a Handler for it already should use outputPath
+        static std::string resolveOutputPath(const std::string carrier, const std::string new_file);
+        //same for this carrier: next to it unless new_file has a directory, with its extension appended
+        std::string outputPath(const std::string new_file) const;
+        //path to hand to FileIo/open(), maps "fd:<n>:<name>" onto the open descriptor
+        static std::string systemPath(const std::string name);
+        //"-": stdin as an input, stdout as an output; the format is sniffed (text if nothing matches),
+        //and a piped stdin is read as it arrives where the codec can stream (pipelinePng, see openStream)
+        static bool isStdio(const std::string name);
         bool readFile(); //DO NOT USE THIS FOR IMAGES
         bool writeFile(const std::string name);
         bool readPng();
         bool readWav();
         bool readJpeg();
+        bool readJpegCoefficients();
+        //uncompressed carriers, no codec: the sample bytes are found in place and embedded there
+        //bmp (24/32-bit), binary ppm/pgm (8-bit samples) and headerless pcm (.pcm/.raw, every byte is a sample)
+        bool readRaw();
+        static bool isRawFormat(const std::string ext);
+        //sizes a carrier from its first few KiB without decoding it, false if the header doesn't parse
+        //png decodes to rgba8 unless native_png, pipes can't be peeked
+        static bool peekCarrier(const std::string name, bool native_png, CarrierShape &shape);
         bool writePng(const std::string name);
         bool writeWav(const std::string name);
         bool writeJpeg(const std::string name);
+        bool writeJpegCoefficients(const std::string name);
+        bool writeRaw(const std::string name); //the whole file, header included, as embedded
+        //reads this png and writes name with decode, transform and encode overlapping on separate threads
+        //begin sees the decoded size and can refuse, transform gets every row in order (rgba8, or native, see setNativePng)
+        bool pipelinePng(const std::string name, std::function<bool(int height, size_t row_bytes)> begin,
+                         std::function<void(unsigned char* row, int y)> transform);
+        //streamed output for data too large to hold whole: appended SINK_BYTES at a time straight to
+        //the file (or the memory output) as it's produced; a sink that fails or is discarded leaves nothing behind
+        //a file is written under a temporary name and renamed over the target once complete
+        static const size_t SINK_BYTES = 64 * 1024;
+        bool openSink(const std::string name);
+        bool sinkWrite(const unsigned char* data, size_t size);
+        bool closeSink();
+        void discardSink();
+        //wav/raw carriers read a chunk at a time instead of whole: openSamples parses the header from the
+        //first SINK_BYTES, readSamples then hands out the sample bytes in order (short only at their end)
+        //needs a regular file, canStreamSamples says whether this one is
+        bool canStreamSamples() const;
+        bool openSamples();
+        size_t readSamples(unsigned char* into, size_t size);
+        void closeSamples();
+        uint64_t getSampleSize() const; //valid after openSamples()
+        //copies this wav/raw carrier to name (or the memory output) through the sink, transform sees each run
+        //of sample bytes (offset is the first one's index) before it's written; begin sees their count and can refuse
+        bool streamSamples(const std::string name, std::function<bool(uint64_t sample_bytes)> begin,
+                           std::function<void(unsigned char* samples, size_t size, uint64_t offset)> transform);
+        //send every write into output instead of a file, the name is still used for its extension
+        void setMemoryOutput(std::vector<unsigned char>* output);
+        //compression settings for png/jpeg writes, see writeprofile.hpp
+        void setWriteProfile(WriteProfile profile);
+        //profile the last png/jpeg write used, png adds the filter e.g. "auto/paeth"; empty before any
+        std::string getProfileReport() const;
+        //png reads keep the source color type and bit depth instead of converting to 8-bit rgba
+        //palettes still expand to rgb(a) and 1/2/4-bit gray to 8-bit, 16-bit samples stay big endian
+        void setNativePng(bool enabled);
+        //carrier reads (readPng, readWav, readJpegCoefficients) try CarrierCache under key first and add what they decode
+        //a hit is a shared read-only view, copied the first time something writes to it
+        //pinned is a hit the caller already found with findCachedCarrier, used even if it has been evicted since
+        void setCarrierCache(const CarrierKey key, std::shared_ptr<const DecodedCarrier> pinned = nullptr);
+        //what the next carrier read of this file would hit, null on a miss
+        std::shared_ptr<const DecodedCarrier> findCachedCarrier(const CarrierKey key) const;
+        //png/jpeg reads and writes check context every row and report their progress to it
+        //a cancelled stage frees its buffers and output and fails without logging an error
+        void setJobContext(std::shared_ptr<JobContext> context);
+        bool cancelled() const;
 
         //setters
         void setPngPixelData(std::vector<unsigned char> pixel_data);
         void setWavSampleData(std::vector<unsigned char> sample_data);
         void setBinaryFileData(std::vector<unsigned char> file_data);
         void setImageDimensions(int selector, int dimension);
+        //puts bytes from getLsbBytes() back into the pixel data
+        void setLsbBytes(std::vector<unsigned char> lsb_bytes);
 
         //getters
+        //".png", ".jpg", ... as the file spells it when that names its format, else the format's own extension
+        //".txt" for text, "INVALID" for anything else
         std::string getExt() const;
+        const CarrierCodec* getCodec() const; //null unless the file is a supported carrier
         std::vector<unsigned char> getPixelData() const;
         std::vector<unsigned char> getWavSampleData() const;
         std::vector<unsigned char> getFileData() const;
         std::streamsize getFileSize() const;
         int getImageDimensions(int selector) const;
+        int getChannels() const;  //of the pixel data, 4 unless a native png was read
+        int getBitDepth() const;  //8 or 16
+        //the pixel bytes that carry an lsb: every byte at 8-bit, the low byte of each sample at 16-bit
+        std::vector<unsigned char> getLsbBytes() const;
+        //same bytes, but 8-bit pixel data is moved out instead of copied; hand it back with setLsbBytes()
+        std::vector<unsigned char> takeLsbBytes();
+        JpegCoefficients* getJpegCoefficients();
+        //sample bytes of a raw carrier inside the mapped (or in-memory) file, valid after readRaw()
+        unsigned char* getRawSamples();
+        size_t getRawSampleSize() const;
+        //runs body, which touches getRawSamples(), false if the mapped file was truncated under it (SIGBUS)
+        //instead of ending the process; body may own nothing that needs destroying, see guardJpeg
+        //the SIGBUS handler is installed only around a mapped file's access and the previous one restored
+        //after, samples in memory (e.g. through the C ABI) just run body
+        bool guardRawAccess(const std::function<void()> &body) const;
         
     private:
         std::string file_name, file_ext;
+        const CarrierCodec* codec = nullptr;
         std::vector<unsigned char> binary_file_data; //NOT TO BE USED FOR IMAGES!!!
         std::vector<unsigned char> image_pixel_data;
         // WAV specific: offset into binary_file_data where sample bytes start and size
@@ -43,6 +187,63 @@ class Handler{
         std::uint32_t wav_data_size = 0;
         std::streamsize file_size;
         int image_width, image_height = 0;
+        int image_channels = 4, image_bit_depth = 8;
+        bool native_png = false;
+        std::vector<unsigned char> input_buffer; //whole compressed file behind openInput(), outlives the jpeg source stream
+        std::unique_ptr<JpegCoefficients> jpeg_coefficients;
+        //raw carriers: the mapped file, or binary_file_data when the input is in memory or can't be mapped
+        std::unique_ptr<RawMapping> raw_mapping;
+        size_t raw_data_offset = 0, raw_data_size = 0;
+        //in-memory source and sink
+        const unsigned char* memory_data = nullptr;
+        size_t memory_size = 0;
+        bool memory_input = false;
+        std::vector<unsigned char>* memory_output = nullptr;
+        std::vector<unsigned char> output_buffer; //everything written to openOutput(), grown through BufferPool
+        std::string output_name;
+        std::string output_temporary; //streamed openOutput: the file renamed over output_name by closeOutput
+        bool output_direct = false;
+        //streamed output, see openSink
+        bool sink_open = false;
+        int sink_fd = -1;
+        std::vector<unsigned char> sink_buffer;
+        std::string sink_name, sink_temporary;
+        //streamed samples, see openSamples
+        FILE* sample_stream = nullptr;
+        std::vector<unsigned char> sample_head; //the first SINK_BYTES, header and all, handed out before the stream
+        size_t sample_head_used = 0;
+        uint64_t sample_prefix = 0, sample_size = 0, sample_position = 0; //position: bytes of the file handed out
+        //carrier cache, pixel_view/file_view stand in for image_pixel_data/binary_file_data after a hit
+        CarrierKey cache_key;
+        std::shared_ptr<const DecodedCarrier> cache_pinned, pixel_view, file_view;
+        WriteProfile write_profile = WriteProfile::SMALLEST;
+        std::string profile_report;
+        std::shared_ptr<JobContext> job_context;
+        bool checkpoint(MetricPhase phase, uint64_t done, uint64_t total);
+        void useCodec(const CarrierCodec* codec); //sets codec and file_ext once the format is known
+        FILE* openInput();
+        //openInput, except a file or piped stdin is read as the codec asks for it instead of whole
+        FILE* openStream();
+        size_t readStream(unsigned char* into, size_t size); //openSamples' stream
+        bool readSource(std::vector<unsigned char> &into); //the whole input file, through FileIo or from stdin
+        static bool writeTarget(const std::string name, const unsigned char* data, size_t size); //FileIo or stdout
+        //direct: written to name as it's produced rather than collected and written whole by closeOutput
+        FILE* openOutput(const std::string name, bool direct = false);
+        bool writesOverInput(const std::string name) const; //name is this file under another path (a passed descriptor)
+        bool closeOutput(FILE* output_file);
+        void discardOutput(FILE* output_file);
+        bool flushSink();
+        void removeSinkOutput();
+        bool readWhole();
+        bool cacheKind(CarrierKind &kind) const;
+        bool caching(size_t bytes) const;
+        std::shared_ptr<const DecodedCarrier> cacheLookup(CarrierKind kind);
+        void cachePixels(CarrierKind kind);
+        const std::vector<unsigned char>& pixelBytes() const;
+        const std::vector<unsigned char>& fileBytes() const;
+        void ownPixels();
+        void ownFile();
+        bool writeWhole(const std::string name);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,63 @@
+#include "jobcontext.hpp"
+
+static int64_t steadyNanoseconds(std::chrono::steady_clock::time_point point){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(point.time_since_epoch()).count();
+}
+
+JobContext::JobContext(std::shared_ptr<JobContext> parent)
+    :   parent(parent)
+{
+}
+
+void JobContext::cancel(){
+    cancel_requested = true;
+}
+
+void JobContext::setDeadline(std::chrono::steady_clock::time_point deadline){
+    //0 is taken to mean no deadline, a deadline at the clock's epoch has long passed anyway
+    int64_t nanoseconds = steadyNanoseconds(deadline);
+    deadline_ns = nanoseconds == 0 ? 1 : nanoseconds;
+}
+
+void JobContext::setTimeout(double seconds){
+    if (seconds <= 0){
+        deadline_ns = 0;
+        return;
+    }
+    setDeadline(std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds)));
+}
+
+void JobContext::setProgress(std::function<void(MetricPhase phase, uint64_t done, uint64_t total)> progress){
+    this->progress = progress;
+}
+
+bool JobContext::pastDeadline() const{
+    int64_t deadline = deadline_ns.load(std::memory_order_relaxed);
+    return deadline != 0 && steadyNanoseconds(std::chrono::steady_clock::now()) >= deadline;
+}
+
+bool JobContext::cancelled() const{
+    if (cancel_requested.load(std::memory_order_relaxed) || pastDeadline()) return true;
+    return parent && parent->cancelled();
+}
+
+std::string JobContext::reason() const{
+    if (cancel_requested.load()) return "cancelled";
+    if (pastDeadline()) return "deadline exceeded";
+    return parent ? parent->reason() : "";
+}
+
+bool JobContext::checkpoint(MetricPhase phase, uint64_t done, uint64_t total){
+    if (cancelled()) return false;
+    if (!progress || total == 0) return true;
+    //a stage running on several threads reports from whichever gets here, the others skip it
+    std::unique_lock<std::mutex> guard(progress_lock, std::try_to_lock);
+    if (!guard.owns_lock()) return true;
+    bool new_phase = !reported || phase != last_phase;
+    if (!new_phase && (done <= last_done || (done < total && done - last_done < total / 100))) return true;
+    last_phase = phase;
+    last_done = done;
+    reported = true;
+    progress(phase, done, total);
+    return true;
+}
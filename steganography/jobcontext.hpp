@@ -0,0 +1,44 @@
+#ifndef JOBCONTEXT_H
+#define JOBCONTEXT_H
+
+#include <string>
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include "metrics.hpp"
+
+//deadline, cancellation and progress of one job, shared by whoever submitted it and the code running it
+//the codec stages and embed/extract loops call checkpoint() every row or block row and give up
+//(freeing what they hold and failing) as soon as it returns false
+class JobContext{
+    public:
+        JobContext(std::shared_ptr<JobContext> parent = nullptr); //cancelling parent cancels this too
+        void cancel();
+        void setDeadline(std::chrono::steady_clock::time_point deadline);
+        void setTimeout(double seconds); //deadline that many seconds from now, 0 clears it
+        //done and total are bytes: decoded carrier bytes for codec stages, payload bytes for embed/extract
+        //set before the job starts
+        //calls are serialized, but may come from any thread the stage runs on
+        void setProgress(std::function<void(MetricPhase phase, uint64_t done, uint64_t total)> progress);
+
+        bool cancelled() const; //cancelled, past the deadline, or the parent is
+        std::string reason() const; //"cancelled" or "deadline exceeded", empty while the job may go on
+        //false once the job should stop; progress is reported at most once per percent of a stage,
+        //and not at all while total is 0 (not known yet)
+        bool checkpoint(MetricPhase phase, uint64_t done, uint64_t total);
+    private:
+        std::shared_ptr<JobContext> parent;
+        std::atomic<bool> cancel_requested{false};
+        std::atomic<int64_t> deadline_ns{0}; //steady clock, 0 means none
+        std::function<void(MetricPhase, uint64_t, uint64_t)> progress;
+        std::mutex progress_lock;
+        MetricPhase last_phase = MetricPhase::FILE_READ;
+        uint64_t last_done = 0;
+        bool reported = false;
+        bool pastDeadline() const;
+};
+
+#endif
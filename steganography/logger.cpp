@@ -0,0 +1,178 @@
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include "logger.hpp"
+
+//first-error slot of the ErrorCapture alive on this thread, if any
+static thread_local std::string* captured_error = nullptr;
+
+Logger::ErrorCapture::ErrorCapture(std::string* first_error)
+    :   previous(captured_error)
+{
+    captured_error = first_error;
+}
+
+Logger::ErrorCapture::~ErrorCapture(){
+    captured_error = previous;
+}
+
+Logger::Logger(){
+    for (size_t i = 0; i < RING_SIZE; ++i) ring[i].sequence.store(i, std::memory_order_relaxed);
+    LogLevel initial = LogLevel::INFO;
+    const char* setting = getenv("STEGASAUR_LOG");
+    if (setting) parseLevel(setting, initial);
+    level = (int)initial;
+    sink = std::thread(&Logger::sinkLoop, this);
+}
+
+Logger& Logger::instance(){
+    static Logger* shared = [](){
+        Logger* logger = new Logger();
+        std::atexit([](){ instance().stop(); });
+        return logger;
+    }();
+    return *shared;
+}
+
+void Logger::stop(){
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (stopping) return;
+        stopping = true;
+    }
+    wake.notify_one();
+    if (sink.joinable()) sink.join();
+}
+
+bool Logger::parseLevel(const std::string name, LogLevel &level){
+    if (name == "debug") level = LogLevel::DEBUG;
+    else if (name == "info") level = LogLevel::INFO;
+    else if (name == "warn") level = LogLevel::WARN;
+    else if (name == "error") level = LogLevel::ERROR;
+    else if (name == "off") level = LogLevel::OFF;
+    else return false;
+    return true;
+}
+
+bool Logger::enabled(LogLevel level) const{
+    if (level == LogLevel::ERROR && captured_error) return true;
+    return shown(level);
+}
+
+bool Logger::shown(LogLevel level) const{
+    return level != LogLevel::OFF && (int)level >= this->level.load(std::memory_order_relaxed);
+}
+
+void Logger::setLevel(LogLevel level){
+    this->level = (int)level;
+}
+
+LogLevel Logger::getLevel() const{
+    return (LogLevel)level.load();
+}
+
+void Logger::setStderrOnly(bool enabled){
+    stderr_only = enabled;
+}
+
+//bounded multi-producer queue: a slot is free for position pos when its sequence is pos,
+//and holds a line for the sink once its sequence is pos + 1
+bool Logger::tryPush(LogLevel level, std::string &line){
+    size_t pos = head.load(std::memory_order_relaxed);
+    while (true){
+        Slot &slot = ring[pos & (RING_SIZE - 1)];
+        size_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if (sequence == pos){
+            if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                slot.level = level;
+                slot.line.swap(line);
+                slot.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (sequence < pos) return false; //full, the sink hasn't freed this slot yet
+        else pos = head.load(std::memory_order_relaxed);
+    }
+}
+
+void Logger::write(LogLevel level, std::string line){
+    if (level == LogLevel::ERROR && captured_error && captured_error->empty()) *captured_error = line;
+    if (!shown(level)) return;
+    if (stopping.load(std::memory_order_acquire)){
+        line += '\n';
+        fwrite(line.data(), 1, line.size(), level >= LogLevel::WARN || stderr_only ? stderr : stdout);
+        return;
+    }
+    while (!tryPush(level, line)){
+        wakeSink();
+        std::this_thread::yield();
+    }
+    //pairs with the fence in sinkLoop: either the sink sees this line before sleeping or we see it asleep
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load(std::memory_order_relaxed)) wakeSink();
+}
+
+void Logger::wakeSink(){
+    std::lock_guard<std::mutex> guard(lock);
+    wake.notify_one();
+}
+
+void Logger::flush(){
+    size_t target = head.load();
+    wakeSink();
+    std::unique_lock<std::mutex> guard(lock);
+    drained.wait(guard, [&](){ return written.load() >= target; });
+}
+
+//writes every published line, one fwrite per stream per pass instead of a flush per line
+bool Logger::drain(){
+    std::string out, err;
+    size_t count = 0;
+    while (true){
+        Slot &slot = ring[tail & (RING_SIZE - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != tail + 1) break;
+        std::string &target = slot.level >= LogLevel::WARN || stderr_only ? err : out;
+        target += slot.line;
+        target += '\n';
+        slot.line.clear();
+        slot.sequence.store(tail + RING_SIZE, std::memory_order_release);
+        ++tail;
+        ++count;
+    }
+    if (count == 0) return false;
+    if (!out.empty()){
+        fwrite(out.data(), 1, out.size(), stdout);
+        fflush(stdout);
+    }
+    if (!err.empty()){
+        fwrite(err.data(), 1, err.size(), stderr);
+        fflush(stderr);
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        written += count;
+    }
+    drained.notify_all();
+    return true;
+}
+
+void Logger::sinkLoop(){
+    while (true){
+        if (drain()) continue;
+        std::unique_lock<std::mutex> guard(lock);
+        if (stopping){
+            guard.unlock();
+            //a producer may have claimed a slot but not published it yet
+            while (written.load() < head.load()){
+                if (!drain()) std::this_thread::yield();
+            }
+            return;
+        }
+        sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (ring[tail & (RING_SIZE - 1)].sequence.load(std::memory_order_acquire) != tail + 1){
+            wake.wait_for(guard, std::chrono::milliseconds(100));
+        }
+        sleeping.store(false, std::memory_order_relaxed);
+    }
+}
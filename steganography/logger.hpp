@@ -0,0 +1,86 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <string>
+#include <sstream>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+
+enum class LogLevel{ DEBUG, INFO, WARN, ERROR, OFF };
+
+//diagnostics for Handler/Encoder/Decoder and the engines
+//callers only format the line and drop it into a lock-free ring, a background thread writes it out
+//so no job waits on the console and lines from different workers never interleave
+//DEBUG/INFO go to stdout, WARN/ERROR to stderr; level is INFO unless STEGASAUR_LOG=debug|info|warn|error|off
+//usage: LOG_INFO("Console: Encoder ready"); LOG_ERROR("Error: Could not read " << path);
+#define STEGA_LOG(level, ...) do{ \
+    if (Logger::instance().enabled(level)){ \
+        std::ostringstream log_line; \
+        log_line << __VA_ARGS__; \
+        Logger::instance().write(level, log_line.str()); \
+    } \
+}while(0)
+#define LOG_DEBUG(...) STEGA_LOG(LogLevel::DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) STEGA_LOG(LogLevel::INFO, __VA_ARGS__)
+#define LOG_WARN(...) STEGA_LOG(LogLevel::WARN, __VA_ARGS__)
+#define LOG_ERROR(...) STEGA_LOG(LogLevel::ERROR, __VA_ARGS__)
+
+class Logger{
+    public:
+        Logger(const Logger&) = delete;
+        Logger& operator=(const Logger&) = delete;
+        //never destroyed so other static destructors can still log, the sink is stopped at exit instead
+        static Logger& instance();
+        static bool parseLevel(const std::string name, LogLevel &level);
+
+        bool enabled(LogLevel level) const;
+        void setLevel(LogLevel level);
+        LogLevel getLevel() const;
+        //every level goes to stderr, keeping stdout for data when output is piped (demo --encode/--decode to "-")
+        void setStderrOnly(bool enabled);
+        //queues one line, newline is added by the sink; waits for room if the ring is full, never drops
+        void write(LogLevel level, std::string line);
+        //blocks until everything queued so far has been written, e.g. before prompting on the console
+        void flush();
+        //writes whatever is still queued and stops the sink, later lines are written synchronously
+        void stop();
+        //while alive, the first ERROR line logged on this thread is also kept in *first_error,
+        //even with the level filtering errors out; Engine uses it to say why a job failed
+        class ErrorCapture{
+            public:
+                ErrorCapture(std::string* first_error);
+                ~ErrorCapture();
+                ErrorCapture(const ErrorCapture&) = delete;
+                ErrorCapture& operator=(const ErrorCapture&) = delete;
+            private:
+                std::string* previous;
+        };
+    private:
+        Logger();
+        static const size_t RING_SIZE = 4096; //power of two
+        struct Slot{
+            std::atomic<size_t> sequence;
+            LogLevel level;
+            std::string line;
+        };
+        Slot ring[RING_SIZE];
+        std::atomic<size_t> head{0}; //next position producers claim
+        size_t tail = 0; //next position the sink reads, sink thread only
+        std::atomic<size_t> written{0}; //lines the sink has written out
+        std::atomic<int> level;
+        std::atomic<bool> stderr_only{false};
+        std::atomic<bool> sleeping{false}, stopping{false};
+        std::mutex lock;
+        std::condition_variable wake, drained;
+        std::thread sink;
+        bool shown(LogLevel level) const; //passes the level filter
+        bool tryPush(LogLevel level, std::string &line);
+        bool drain();
+        void sinkLoop();
+        void wakeSink();
+};
+
+#endif
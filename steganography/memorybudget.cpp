@@ -0,0 +1,121 @@
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include "memorybudget.hpp"
+#include "bufferpool.hpp"
+#include "carriercache.hpp"
+
+static size_t mibSetting(const char* name){
+    const char* setting = getenv(name);
+    if (!setting) return 0;
+    char* end = nullptr;
+    unsigned long long mib = strtoull(setting, &end, 10);
+    return end != setting && *end == '\0' ? (size_t)mib << 20 : 0;
+}
+
+MemoryBudget::MemoryBudget(){
+    process_budget = mibSetting("STEGASAUR_MEMORY_BUDGET");
+    job_budget = mibSetting("STEGASAUR_JOB_MEMORY");
+}
+
+MemoryBudget& MemoryBudget::instance(){
+    static MemoryBudget shared;
+    return shared;
+}
+
+bool MemoryBudget::limited() const{
+    std::lock_guard<std::mutex> guard(lock);
+    return process_budget > 0 || job_budget > 0;
+}
+
+void MemoryBudget::setProcessBudget(size_t bytes){
+    std::lock_guard<std::mutex> guard(lock);
+    process_budget = bytes;
+}
+
+size_t MemoryBudget::getProcessBudget() const{
+    std::lock_guard<std::mutex> guard(lock);
+    return process_budget;
+}
+
+void MemoryBudget::setJobBudget(size_t bytes){
+    std::lock_guard<std::mutex> guard(lock);
+    job_budget = bytes;
+}
+
+size_t MemoryBudget::getJobBudget() const{
+    std::lock_guard<std::mutex> guard(lock);
+    return job_budget;
+}
+
+size_t MemoryBudget::getJobLimit() const{
+    std::lock_guard<std::mutex> guard(lock);
+    if (process_budget == 0) return job_budget;
+    if (job_budget == 0) return process_budget;
+    return std::min(process_budget, job_budget);
+}
+
+//caller holds lock; cached carriers stay resident, so they count against the budget too
+bool MemoryBudget::fits(size_t bytes) const{
+    if (process_budget == 0 || running == 0) return true;
+    return reserved + bytes + CarrierCache::instance().getCachedBytes() <= process_budget;
+}
+
+//caller holds lock
+void MemoryBudget::admitted(size_t bytes){
+    reserved += bytes;
+    running++;
+}
+
+//idle pooled buffers are resident as well, whatever doesn't fit next to the running jobs is freed
+static void trimPool(size_t process_budget, size_t reserved){
+    if (process_budget == 0) return;
+    size_t used = reserved + CarrierCache::instance().getCachedBytes();
+    BufferPool::trim(used < process_budget ? process_budget - used : 0);
+}
+
+void MemoryBudget::acquire(size_t bytes, std::function<void()> start){
+    size_t budget, now_reserved;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        //first come first served, a small job doesn't overtake a large one that is already waiting
+        if (!waiting.empty() || !fits(bytes)){
+            waiting.push_back(Waiter{bytes, start});
+            return;
+        }
+        admitted(bytes);
+        budget = process_budget;
+        now_reserved = reserved;
+    }
+    trimPool(budget, now_reserved);
+    start();
+}
+
+void MemoryBudget::release(size_t bytes){
+    std::vector<std::function<void()>> starting;
+    size_t budget, now_reserved;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        reserved -= std::min(bytes, reserved);
+        if (running > 0) running--;
+        while (!waiting.empty() && fits(waiting.front().bytes)){
+            admitted(waiting.front().bytes);
+            starting.push_back(std::move(waiting.front().start));
+            waiting.pop_front();
+        }
+        budget = process_budget;
+        now_reserved = reserved;
+    }
+    if (!starting.empty()) trimPool(budget, now_reserved);
+    for (std::function<void()> &start : starting) start();
+}
+
+size_t MemoryBudget::getReservedBytes() const{
+    std::lock_guard<std::mutex> guard(lock);
+    return reserved;
+}
+
+size_t MemoryBudget::getWaitingJobs() const{
+    std::lock_guard<std::mutex> guard(lock);
+    return waiting.size();
+}
@@ -0,0 +1,50 @@
+#ifndef MEMORYBUDGET_H
+#define MEMORYBUDGET_H
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <cstddef>
+
+//caps what concurrent jobs may hold so a few large carriers can't run a worker out of memory
+//process budget: bytes every running job's estimated footprint plus CarrierCache may add up to,
+//jobs that don't fit wait in submission order until enough is released
+//job budget: footprint above which a job takes its streaming path instead, where it has one
+//both are off (0) unless STEGASAUR_MEMORY_BUDGET / STEGASAUR_JOB_MEMORY=<MiB> or the setters say otherwise
+class MemoryBudget{
+    public:
+        MemoryBudget(const MemoryBudget&) = delete;
+        MemoryBudget& operator=(const MemoryBudget&) = delete;
+        static MemoryBudget& instance();
+
+        //true when either budget is set, jobs only need their footprint estimated then
+        bool limited() const;
+        void setProcessBudget(size_t bytes);
+        size_t getProcessBudget() const;
+        void setJobBudget(size_t bytes);
+        size_t getJobBudget() const;
+        //largest footprint a job may have before it should stream: the smaller of the two budgets that are set
+        size_t getJobLimit() const;
+
+        //runs start once bytes fit, right away on this thread or later on whichever thread releases enough
+        //a job bigger than the whole budget still runs, once nothing else is
+        void acquire(size_t bytes, std::function<void()> start);
+        void release(size_t bytes);
+        size_t getReservedBytes() const;
+        size_t getWaitingJobs() const;
+    private:
+        MemoryBudget();
+        struct Waiter{
+            size_t bytes;
+            std::function<void()> start;
+        };
+        mutable std::mutex lock;
+        std::deque<Waiter> waiting;
+        size_t reserved = 0;
+        size_t running = 0;
+        size_t process_budget = 0, job_budget = 0;
+        bool fits(size_t bytes) const;
+        void admitted(size_t bytes);
+};
+
+#endif
@@ -0,0 +1,135 @@
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include "metrics.hpp"
+
+static const int PHASE_COUNT = (int)MetricPhase::FILE_WRITE + 1;
+
+struct PhaseTotals{
+    std::atomic<uint64_t> calls{0}, nanoseconds{0}, max_nanoseconds{0};
+    std::atomic<uint64_t> bytes{0}, carrier_bytes{0}, peak_buffer_bytes{0};
+};
+static PhaseTotals totals[PHASE_COUNT];
+
+static void storeMax(std::atomic<uint64_t> &target, uint64_t value){
+    uint64_t current = target.load(std::memory_order_relaxed);
+    while (value > current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed)){}
+}
+
+bool Metrics::compiledIn(){
+#ifdef STEGASAUR_METRICS
+    return true;
+#else
+    return false;
+#endif
+}
+
+std::string Metrics::phaseName(MetricPhase phase){
+    static const char* names[PHASE_COUNT] = {"file_read", "codec_decode", "payload_build", "embed", "extract", "codec_encode", "file_write"};
+    return names[(int)phase];
+}
+
+void Metrics::record(MetricPhase phase, double seconds, uint64_t bytes, uint64_t carrier_bytes, uint64_t buffer_bytes){
+    PhaseTotals &phase_totals = totals[(int)phase];
+    uint64_t nanoseconds = seconds > 0 ? (uint64_t)(seconds * 1e9) : 0;
+    phase_totals.calls.fetch_add(1, std::memory_order_relaxed);
+    phase_totals.nanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+    phase_totals.bytes.fetch_add(bytes, std::memory_order_relaxed);
+    phase_totals.carrier_bytes.fetch_add(carrier_bytes, std::memory_order_relaxed);
+    storeMax(phase_totals.max_nanoseconds, nanoseconds);
+    storeMax(phase_totals.peak_buffer_bytes, buffer_bytes);
+}
+
+void Metrics::reset(){
+    for (PhaseTotals &phase_totals : totals){
+        phase_totals.calls = 0;
+        phase_totals.nanoseconds = 0;
+        phase_totals.max_nanoseconds = 0;
+        phase_totals.bytes = 0;
+        phase_totals.carrier_bytes = 0;
+        phase_totals.peak_buffer_bytes = 0;
+    }
+}
+
+std::string Metrics::exportJsonLines(){
+    std::ostringstream out;
+    for (int p = 0; p < PHASE_COUNT; ++p){
+        const PhaseTotals &phase_totals = totals[p];
+        out << "{\"phase\":\"" << phaseName((MetricPhase)p) << "\",\"calls\":" << phase_totals.calls.load()
+            << ",\"seconds\":" << phase_totals.nanoseconds.load() / 1e9
+            << ",\"max_seconds\":" << phase_totals.max_nanoseconds.load() / 1e9
+            << ",\"bytes\":" << phase_totals.bytes.load() << ",\"carrier_bytes\":" << phase_totals.carrier_bytes.load()
+            << ",\"peak_buffer_bytes\":" << phase_totals.peak_buffer_bytes.load() << "}\n";
+    }
+    return out.str();
+}
+
+std::string Metrics::exportPrometheus(){
+    struct Family{ const char* name; const char* type; const char* help; };
+    static const Family families[] = {
+        {"stegasaur_phase_calls_total", "counter", "Times each phase ran."},
+        {"stegasaur_phase_seconds_total", "counter", "Wall time spent in each phase."},
+        {"stegasaur_phase_max_seconds", "gauge", "Longest single run of each phase."},
+        {"stegasaur_phase_bytes_total", "counter", "Input bytes each phase processed."},
+        {"stegasaur_phase_carrier_bytes_total", "counter", "Carrier sample bytes each phase read or wrote."},
+        {"stegasaur_phase_peak_buffer_bytes", "gauge", "Largest buffer each phase held."},
+    };
+    std::ostringstream out;
+    for (int f = 0; f < 6; ++f){
+        out << "# HELP " << families[f].name << " " << families[f].help << "\n";
+        out << "# TYPE " << families[f].name << " " << families[f].type << "\n";
+        for (int p = 0; p < PHASE_COUNT; ++p){
+            const PhaseTotals &phase_totals = totals[p];
+            out << families[f].name << "{phase=\"" << phaseName((MetricPhase)p) << "\"} ";
+            switch (f){
+                case 0: out << phase_totals.calls.load(); break;
+                case 1: out << phase_totals.nanoseconds.load() / 1e9; break;
+                case 2: out << phase_totals.max_nanoseconds.load() / 1e9; break;
+                case 3: out << phase_totals.bytes.load(); break;
+                case 4: out << phase_totals.carrier_bytes.load(); break;
+                case 5: out << phase_totals.peak_buffer_bytes.load(); break;
+            }
+            out << "\n";
+        }
+    }
+    return out.str();
+}
+
+bool Metrics::writeFile(const std::string path){
+    bool prometheus = path.size() >= 5 && (path.compare(path.size() - 5, 5, ".prom") == 0 || path.compare(path.size() - 4, 4, ".txt") == 0);
+    std::ofstream output(path);
+    if (!output){
+        std::cerr << "Error: Could not write metrics to " << path << std::endl;
+        return false;
+    }
+    output << (prometheus ? exportPrometheus() : exportJsonLines());
+    return (bool)output;
+}
+
+MetricScope::MetricScope(MetricPhase phase)
+    :   phase(phase),
+        start(std::chrono::steady_clock::now())
+{
+}
+MetricScope::~MetricScope(){
+    end();
+}
+void MetricScope::setPhase(MetricPhase phase){
+    this->phase = phase;
+}
+void MetricScope::addBytes(uint64_t bytes){
+    this->bytes += bytes;
+}
+void MetricScope::addCarrierBytes(uint64_t bytes){
+    carrier_bytes += bytes;
+}
+void MetricScope::noteBuffer(size_t bytes){
+    if (bytes > buffer_bytes) buffer_bytes = bytes;
+}
+void MetricScope::end(){
+    if (ended) return;
+    ended = true;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    Metrics::record(phase, seconds, bytes, carrier_bytes, buffer_bytes);
+}
@@ -0,0 +1,56 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+//per-phase timers and counters for the hot paths, compiled in with -DSTEGASAUR_METRICS
+//without it STEGA_METRIC(...) expands to nothing, so instrumented code costs nothing
+//usage: STEGA_METRIC(MetricScope metric(MetricPhase::EMBED)); ... STEGA_METRIC(metric.addBytes(n));
+#ifdef STEGASAUR_METRICS
+#define STEGA_METRIC(...) __VA_ARGS__
+#else
+#define STEGA_METRIC(...)
+#endif
+
+enum class MetricPhase{ FILE_READ, CODEC_DECODE, PAYLOAD_BUILD, EMBED, EXTRACT, CODEC_ENCODE, FILE_WRITE };
+
+//process-wide totals per phase, lock-free so workers never wait on each other to record
+//bytes: input the phase processed, carrier bytes: carrier samples it read or wrote,
+//peak buffer: largest buffer it held
+class Metrics{
+    public:
+        static bool compiledIn();
+        static void record(MetricPhase phase, double seconds, uint64_t bytes, uint64_t carrier_bytes, uint64_t buffer_bytes);
+        static void reset();
+        //one json object per phase and line
+        static std::string exportJsonLines();
+        //prometheus text exposition format, stegasaur_phase_* families labelled by phase
+        static std::string exportPrometheus();
+        //.prom/.txt get the prometheus dump, anything else json lines
+        static bool writeFile(const std::string path);
+        static std::string phaseName(MetricPhase phase);
+};
+
+//times its scope and records into Metrics when it ends (or at end(), for scopes that must stop early)
+class MetricScope{
+    public:
+        MetricScope(MetricPhase phase);
+        ~MetricScope();
+        MetricScope(const MetricScope&) = delete;
+        MetricScope& operator=(const MetricScope&) = delete;
+        void setPhase(MetricPhase phase);
+        void addBytes(uint64_t bytes);
+        void addCarrierBytes(uint64_t bytes);
+        void noteBuffer(size_t bytes);
+        void end();
+    private:
+        MetricPhase phase;
+        std::chrono::steady_clock::time_point start;
+        uint64_t bytes = 0, carrier_bytes = 0, buffer_bytes = 0;
+        bool ended = false;
+};
+
+#endif
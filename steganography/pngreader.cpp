@@ -0,0 +1,247 @@
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <vector>
+#include <zlib.h>
+#include "pngreader.hpp"
+#include "jobcontext.hpp"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static const unsigned char PNG_SIGNATURE[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+//same as libpng's default user limits, anything bigger goes to libpng and fails there
+static const uint32_t MAX_DIMENSION = 1000000;
+
+static uint32_t getUint32(const unsigned char* in){
+    return ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) | ((uint32_t)in[2] << 8) | (uint32_t)in[3];
+}
+
+//crc of a chunk's type and data, compared against the 4 bytes that follow them
+static bool chunkCrcOk(const unsigned char* type, uint32_t length){
+    return crc32(crc32(0L, Z_NULL, 0), type, length + 4) == getUint32(type + 4 + length);
+}
+
+//feeds consecutive IDAT chunks to inflate, checking each chunk's crc on the way
+struct IdatStream{
+    z_stream stream;
+    const unsigned char* data;
+    size_t size, pos;
+    bool nextChunk(){
+        if (pos + 12 > size) return false;
+        uint32_t length = getUint32(data + pos);
+        const unsigned char* type = data + pos + 4;
+        if (length > size - pos - 12 || memcmp(type, "IDAT", 4) != 0 || !chunkCrcOk(type, length)) return false;
+        stream.next_in = const_cast<Bytef*>(type + 4);
+        stream.avail_in = length;
+        pos += 12 + length;
+        return true;
+    }
+    bool inflateInto(unsigned char* out, size_t count){
+        stream.next_out = out;
+        stream.avail_out = (uInt)count;
+        while (stream.avail_out > 0){
+            if (stream.avail_in == 0 && !nextChunk()) return false;
+            int status = inflate(&stream, Z_NO_FLUSH);
+            if (status == Z_STREAM_END) return stream.avail_out == 0;
+            if (status != Z_OK && status != Z_BUF_ERROR) return false;
+        }
+        return true;
+    }
+};
+
+#if !defined(__SSE2__)
+static unsigned char paeth(int a, int b, int c){
+    int p = a + b - c;
+    int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc) return (unsigned char)a;
+    if (pb <= pc) return (unsigned char)b;
+    return (unsigned char)c;
+}
+#else
+//one 3 or 4 byte pixel in the low lanes, never touches bytes past the pixel
+static inline __m128i loadPixel(const unsigned char* p, int bpp){
+    uint32_t value = 0;
+    memcpy(&value, p, bpp);
+    return _mm_cvtsi32_si128((int)value);
+}
+static inline void storePixel(unsigned char* p, __m128i pixel, int bpp){
+    uint32_t value = (uint32_t)_mm_cvtsi128_si32(pixel);
+    memcpy(p, &value, bpp);
+}
+static inline __m128i selectBytes(__m128i mask, __m128i if_set, __m128i if_clear){
+    return _mm_or_si128(_mm_and_si128(mask, if_set), _mm_andnot_si128(mask, if_clear));
+}
+static inline __m128i absInt16(__m128i x){
+    __m128i negative = _mm_cmplt_epi16(x, _mm_setzero_si128());
+    return _mm_sub_epi16(_mm_xor_si128(x, negative), negative);
+}
+#endif
+
+//each pass rebuilds row in place from its filtered bytes, prior is the previous reconstructed row
+//Sub/Average/Paeth depend on the pixel to the left, so SSE2 runs them one pixel per step
+static void unfilterSub(unsigned char* row, size_t row_bytes, int bpp){
+#if defined(__SSE2__)
+    __m128i left = _mm_setzero_si128();
+    for (size_t i = 0; i < row_bytes; i += bpp){
+        left = _mm_add_epi8(left, loadPixel(row + i, bpp));
+        storePixel(row + i, left, bpp);
+    }
+#else
+    for (size_t i = bpp; i < row_bytes; ++i) row[i] += row[i - bpp];
+#endif
+}
+
+static void unfilterUp(unsigned char* row, const unsigned char* prior, size_t row_bytes){
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= row_bytes; i += 16){
+        __m128i sum = _mm_add_epi8(_mm_loadu_si128((const __m128i*)(row + i)), _mm_loadu_si128((const __m128i*)(prior + i)));
+        _mm_storeu_si128((__m128i*)(row + i), sum);
+    }
+#endif
+    for (; i < row_bytes; ++i) row[i] += prior[i];
+}
+
+static void unfilterAverage(unsigned char* row, const unsigned char* prior, size_t row_bytes, int bpp){
+#if defined(__SSE2__)
+    //_mm_avg_epu8 rounds up, taking the low bit of a^b back off gives png's floor((a+b)/2)
+    const __m128i one = _mm_set1_epi8(1);
+    __m128i left = _mm_setzero_si128();
+    for (size_t i = 0; i < row_bytes; i += bpp){
+        __m128i up = loadPixel(prior + i, bpp);
+        __m128i average = _mm_sub_epi8(_mm_avg_epu8(left, up), _mm_and_si128(_mm_xor_si128(left, up), one));
+        left = _mm_add_epi8(loadPixel(row + i, bpp), average);
+        storePixel(row + i, left, bpp);
+    }
+#else
+    for (int i = 0; i < bpp; ++i) row[i] += prior[i] >> 1;
+    for (size_t i = bpp; i < row_bytes; ++i) row[i] += (row[i - bpp] + prior[i]) >> 1;
+#endif
+}
+
+static void unfilterPaeth(unsigned char* row, const unsigned char* prior, size_t row_bytes, int bpp){
+#if defined(__SSE2__)
+    //widened to 16 bits so the predictor distances can't overflow
+    const __m128i zero = _mm_setzero_si128();
+    __m128i left = zero, upper_left = zero;
+    for (size_t i = 0; i < row_bytes; i += bpp){
+        __m128i up = _mm_unpacklo_epi8(loadPixel(prior + i, bpp), zero);
+        __m128i current = _mm_unpacklo_epi8(loadPixel(row + i, bpp), zero);
+        __m128i pa = _mm_sub_epi16(up, upper_left);
+        __m128i pb = _mm_sub_epi16(left, upper_left);
+        __m128i pc = absInt16(_mm_add_epi16(pa, pb));
+        pa = absInt16(pa);
+        pb = absInt16(pb);
+        __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+        __m128i predictor = selectBytes(_mm_cmpeq_epi16(smallest, pa), left,
+                            selectBytes(_mm_cmpeq_epi16(smallest, pb), up, upper_left));
+        left = _mm_and_si128(_mm_add_epi16(current, predictor), _mm_set1_epi16(0xFF));
+        upper_left = up;
+        storePixel(row + i, _mm_packus_epi16(left, left), bpp);
+    }
+#else
+    for (int i = 0; i < bpp; ++i) row[i] += prior[i];
+    for (size_t i = bpp; i < row_bytes; ++i) row[i] += paeth(row[i - bpp], prior[i], prior[i - bpp]);
+#endif
+}
+
+static bool unfilterRow(unsigned char filter, unsigned char* row, const unsigned char* prior, size_t row_bytes, int bpp){
+    switch (filter){
+        case 0: return true;
+        case 1: unfilterSub(row, row_bytes, bpp); return true;
+        case 2: unfilterUp(row, prior, row_bytes); return true;
+        case 3: unfilterAverage(row, prior, row_bytes, bpp); return true;
+        case 4: unfilterPaeth(row, prior, row_bytes, bpp); return true;
+    }
+    return false;
+}
+
+bool PngReader::open(const unsigned char* data, size_t size){
+    this->data = nullptr;
+    if (!data || size < 8 + 25 || memcmp(data, PNG_SIGNATURE, 8) != 0) return false;
+    const unsigned char* ihdr = data + 8;
+    if (getUint32(ihdr) != 13 || memcmp(ihdr + 4, "IHDR", 4) != 0 || !chunkCrcOk(ihdr + 4, 13)) return false;
+    uint32_t png_width = getUint32(ihdr + 8), png_height = getUint32(ihdr + 12);
+    unsigned char bit_depth = ihdr[16], color_type = ihdr[17];
+    if (png_width == 0 || png_height == 0 || png_width > MAX_DIMENSION || png_height > MAX_DIMENSION) return false;
+    //compression, filter method and interlace must all be 0
+    if (bit_depth != 8 || (color_type != 2 && color_type != 6) || ihdr[18] != 0 || ihdr[19] != 0 || ihdr[20] != 0) return false;
+
+    //walk to the first IDAT, a tRNS needs alpha expansion and an unknown critical chunk needs libpng's verdict
+    size_t pos = 8 + 25;
+    while (pos + 12 <= size){
+        uint32_t length = getUint32(data + pos);
+        const unsigned char* type = data + pos + 4;
+        if (length > size - pos - 12) return false;
+        if (memcmp(type, "IDAT", 4) == 0){
+            this->data = data;
+            this->size = size;
+            first_idat = pos;
+            width = (int)png_width;
+            height = (int)png_height;
+            channels = color_type == 6 ? 4 : 3;
+            return true;
+        }
+        if (memcmp(type, "tRNS", 4) == 0) return false;
+        if (!(type[0] & 0x20) && memcmp(type, "PLTE", 4) != 0) return false;
+        pos += 12 + length;
+    }
+    return false;
+}
+
+int PngReader::getWidth() const{
+    return width;
+}
+int PngReader::getHeight() const{
+    return height;
+}
+int PngReader::getChannels() const{
+    return channels;
+}
+
+void PngReader::setJobContext(JobContext* context){
+    this->context = context;
+}
+
+bool PngReader::read(unsigned char* pixels, int out_channels){
+    if (!data || !pixels || (out_channels != channels && !(channels == 3 && out_channels == 4))) return false;
+    size_t row_bytes = (size_t)width * channels;
+    bool widen = out_channels != channels;
+    //rows that keep their layout are inflated and unfiltered right where they end up
+    //widened rows go through two scratch rows, since the filters work on the source layout
+    std::vector<unsigned char> scratch(widen ? row_bytes * 2 : 0);
+    std::vector<unsigned char> zero_row(row_bytes, 0);
+
+    IdatStream idat;
+    memset(&idat.stream, 0, sizeof(idat.stream));
+    idat.data = data;
+    idat.size = size;
+    idat.pos = first_idat;
+    if (inflateInit(&idat.stream) != Z_OK) return false;
+    bool success = true;
+    const unsigned char* prior = zero_row.data();
+    size_t total = row_bytes * height;
+    for (int y = 0; y < height && success; ++y){
+        if (context && !context->checkpoint(MetricPhase::CODEC_DECODE, row_bytes * y, total)){
+            success = false;
+            break;
+        }
+        unsigned char* row = widen ? &scratch[(y & 1) * row_bytes] : pixels + (size_t)y * row_bytes;
+        unsigned char filter = 0;
+        success = idat.inflateInto(&filter, 1) && idat.inflateInto(row, row_bytes) &&
+                  unfilterRow(filter, row, prior, row_bytes, channels);
+        if (success && widen){
+            unsigned char* out = pixels + (size_t)y * width * 4;
+            for (int x = 0; x < width; ++x){
+                out[x * 4] = row[x * 3];
+                out[x * 4 + 1] = row[x * 3 + 1];
+                out[x * 4 + 2] = row[x * 3 + 2];
+                out[x * 4 + 3] = 0xFF;
+            }
+        }
+        prior = row;
+    }
+    inflateEnd(&idat.stream);
+    return success;
+}
@@ -0,0 +1,33 @@
+#ifndef PNGREADER_H
+#define PNGREADER_H
+
+#include <cstddef>
+
+class JobContext;
+
+//fast path png decoder for the common carrier: 8-bit rgb/rgba, not interlaced, no tRNS
+//IDAT is inflated straight into the caller's buffer a row at a time and unfiltered in place
+//(SSE2 kernels where available), skipping libpng's transform pipeline
+//open() refuses anything else so the caller can fall back to libpng
+class PngReader{
+    public:
+        //parses the header of an in-memory png, true if the fast path can decode it
+        bool open(const unsigned char* data, size_t size);
+        int getWidth() const;
+        int getHeight() const;
+        int getChannels() const; //3 or 4
+        //decodes into pixels, width*height*out_channels bytes
+        //out_channels 4 on an rgb image adds opaque alpha, otherwise it must match getChannels()
+        //false on corrupt data (bad crc, truncated or broken zlib stream)
+        bool read(unsigned char* pixels, int out_channels);
+        //checked every row, read() stops and fails once it's cancelled
+        void setJobContext(JobContext* context);
+    private:
+        const unsigned char* data = nullptr;
+        size_t size = 0;
+        size_t first_idat = 0; //offset of the first IDAT chunk's length field
+        int width = 0, height = 0, channels = 0;
+        JobContext* context = nullptr;
+};
+
+#endif
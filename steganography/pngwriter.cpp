@@ -0,0 +1,316 @@
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <zlib.h>
+#include "pngwriter.hpp"
+#include "threadpool.hpp"
+#include "bufferpool.hpp"
+#include "logger.hpp"
+#include "jobcontext.hpp"
+
+//uncompressed bytes per deflate block, big enough that the dictionary restart costs little
+static const size_t BLOCK_SIZE = 256 * 1024;
+static const size_t WINDOW_SIZE = 32 * 1024;
+static const int FILTER_ROWS = 64; //rows per filtering task
+static const size_t IDAT_SIZE = 1 << 20;
+//AUTO filter sampling: up to SAMPLE_RUNS runs of SAMPLE_RUN consecutive rows
+static const int SAMPLE_RUNS = 4;
+static const int SAMPLE_RUN = 8;
+
+//shared by every writer in the process, separate from the engine pools so waiting on it can't deadlock
+static ThreadPool& compressionPool(){
+    static ThreadPool pool([](){
+        unsigned int hardware = std::thread::hardware_concurrency();
+        return hardware == 0 ? 1u : hardware;
+    }());
+    return pool;
+}
+
+//runs body(0..count-1) across the pool, the calling thread takes index 0
+static bool parallelFor(size_t count, std::function<bool(size_t)> body){
+    bool success = true;
+    std::mutex lock;
+    std::condition_variable done;
+    size_t left = count;
+    auto run = [&](size_t index){
+        bool ok = false;
+        try { ok = body(index); }
+        catch (const std::exception &e){ LOG_ERROR("Error: png writer task failed: " << e.what()); }
+        std::lock_guard<std::mutex> guard(lock);
+        if (!ok) success = false;
+        if (--left == 0) done.notify_all();
+    };
+    for (size_t i = 1; i < count; ++i) compressionPool().submit([&run, i](){ run(i); });
+    if (count > 0) run(0);
+    std::unique_lock<std::mutex> guard(lock);
+    done.wait(guard, [&left](){ return left == 0; });
+    return success;
+}
+
+static void putUint32(unsigned char* out, uint32_t value){
+    out[0] = (unsigned char)(value >> 24);
+    out[1] = (unsigned char)(value >> 16);
+    out[2] = (unsigned char)(value >> 8);
+    out[3] = (unsigned char)value;
+}
+
+static bool writeChunk(FILE* output, const char* type, const unsigned char* data, size_t size){
+    unsigned char header[8];
+    putUint32(header, (uint32_t)size);
+    memcpy(header + 4, type, 4);
+    unsigned long crc = crc32(0L, header + 4, 4);
+    if (size > 0) crc = crc32(crc, data, (uInt)size);
+    unsigned char trailer[4];
+    putUint32(trailer, (uint32_t)crc);
+    return fwrite(header, 1, 8, output) == 8 &&
+           (size == 0 || fwrite(data, 1, size, output) == size) &&
+           fwrite(trailer, 1, 4, output) == 4;
+}
+
+static unsigned char paeth(int a, int b, int c){
+    int p = a + b - c;
+    int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc) return (unsigned char)a;
+    if (pb <= pc) return (unsigned char)b;
+    return (unsigned char)c;
+}
+
+PngWriter::PngWriter(int width, int height, int channels, int bit_depth)
+    :   width(width), height(height), channels(channels), bit_depth(bit_depth),
+        level(Z_BEST_COMPRESSION), strategy(Z_FILTERED), //libpng's default once rows are filtered
+        filter(PngFilter::ADAPTIVE)
+{
+    pixel_bytes = (size_t)channels * (bit_depth / 8);
+    row_bytes = (size_t)width * pixel_bytes;
+}
+
+void PngWriter::setCompression(int level, int strategy){
+    this->level = level;
+    this->strategy = strategy;
+}
+
+void PngWriter::setFilter(PngFilter filter){
+    this->filter = filter;
+}
+
+PngFilter PngWriter::getFilter() const{
+    return filter;
+}
+
+//one png filter type (0 none .. 4 paeth) over a row
+void PngWriter::applyFilter(int type, const unsigned char* row, const unsigned char* prior, unsigned char* out) const{
+    for (size_t i = 0; i < row_bytes; ++i){
+        int a = i >= pixel_bytes ? row[i - pixel_bytes] : 0;
+        int b = prior[i];
+        int c = i >= pixel_bytes ? prior[i - pixel_bytes] : 0;
+        int predicted = 0;
+        if (type == 1) predicted = a;
+        else if (type == 2) predicted = b;
+        else if (type == 3) predicted = (a + b) >> 1;
+        else if (type == 4) predicted = paeth(a, b, c);
+        out[i] = (unsigned char)(row[i] - predicted);
+    }
+}
+
+//ADAPTIVE is the choice libpng makes by default: try all five filters, keep the one with the smallest sum of |byte|
+//the fixed filters skip that search entirely
+void PngWriter::filterRows(const unsigned char* pixels, unsigned char* filtered, int first, int last, PngFilter mode) const{
+    std::vector<unsigned char> candidates[5];
+    std::vector<unsigned char> zero_row(row_bytes, 0);
+    if (mode == PngFilter::ADAPTIVE){
+        for (int f = 0; f < 5; ++f) candidates[f].resize(row_bytes);
+    }
+    for (int y = first; y < last; ++y){
+        const unsigned char* row = pixels + (size_t)y * row_bytes;
+        const unsigned char* prior = y > 0 ? row - row_bytes : zero_row.data();
+        unsigned char* out = filtered + (size_t)(y - first) * (row_bytes + 1);
+        if (mode != PngFilter::ADAPTIVE){
+            out[0] = (unsigned char)mode;
+            applyFilter((int)mode, row, prior, out + 1);
+            continue;
+        }
+        int best = 0;
+        unsigned long best_sum = (unsigned long)-1;
+        for (int f = 0; f < 5; ++f){
+            applyFilter(f, row, prior, candidates[f].data());
+            unsigned long sum = 0;
+            for (size_t i = 0; i < row_bytes; ++i){
+                signed char value = (signed char)candidates[f][i];
+                sum += value < 0 ? -value : value;
+            }
+            if (sum < best_sum){
+                best_sum = sum;
+                best = f;
+            }
+        }
+        out[0] = (unsigned char)best;
+        memcpy(out + 1, candidates[best].data(), row_bytes);
+    }
+}
+
+//AUTO: filter a few runs of rows every way and keep whichever deflates smallest at the configured level
+PngFilter PngWriter::sampleFilter(const unsigned char* pixels) const{
+    const PngFilter modes[] = {PngFilter::NONE, PngFilter::SUB, PngFilter::UP, PngFilter::AVERAGE, PngFilter::PAETH, PngFilter::ADAPTIVE};
+    int run = height < SAMPLE_RUN ? height : SAMPLE_RUN;
+    int runs = height / run < SAMPLE_RUNS ? height / run : SAMPLE_RUNS;
+    std::vector<unsigned char> sample((size_t)run * (row_bytes + 1));
+    std::vector<unsigned char> compressed;
+    PngFilter best = PngFilter::ADAPTIVE;
+    unsigned long best_size = (unsigned long)-1;
+    for (PngFilter mode : modes){
+        z_stream z;
+        memset(&z, 0, sizeof(z));
+        if (deflateInit2(&z, level, Z_DEFLATED, 15, 8, strategy) != Z_OK) return PngFilter::ADAPTIVE;
+        compressed.resize(deflateBound(&z, (uLong)(sample.size() * runs)));
+        z.next_out = compressed.data();
+        z.avail_out = (uInt)compressed.size();
+        for (int r = 0; r < runs; ++r){
+            //runs spread evenly over the image
+            int first = (int)((long long)r * (height - run) / (runs > 1 ? runs - 1 : 1));
+            filterRows(pixels, sample.data(), first, first + run, mode);
+            z.next_in = sample.data();
+            z.avail_in = (uInt)sample.size();
+            deflate(&z, r + 1 == runs ? Z_FINISH : Z_NO_FLUSH);
+        }
+        if (z.total_out < best_size){
+            best_size = z.total_out;
+            best = mode;
+        }
+        deflateEnd(&z);
+    }
+    return best;
+}
+
+//raw deflate of stream[start, end), ends on a byte boundary (sync flush) unless it's the last block
+bool PngWriter::deflateBlock(const unsigned char* stream, size_t start, size_t end, bool last,
+                             std::vector<unsigned char> &out, unsigned long &adler) const{
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if (deflateInit2(&z, level, Z_DEFLATED, -15, 9, strategy) != Z_OK) return false;
+    if (start > 0){
+        size_t dictionary = start < WINDOW_SIZE ? start : WINDOW_SIZE;
+        deflateSetDictionary(&z, stream + start - dictionary, (uInt)dictionary);
+    }
+    size_t length = end - start;
+    BufferPool::resize(out, deflateBound(&z, (uLong)length) + 16);
+    z.next_in = const_cast<unsigned char*>(stream + start);
+    z.avail_in = (uInt)length;
+    z.next_out = out.data();
+    z.avail_out = (uInt)out.size();
+    int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+    int status = deflate(&z, flush);
+    //deflateBound covers the whole block, a second round only happens if the flush marker didn't fit
+    while ((last && status != Z_STREAM_END) || (!last && z.avail_out == 0)){
+        if (status != Z_OK && status != Z_BUF_ERROR){
+            deflateEnd(&z);
+            return false;
+        }
+        size_t used = out.size() - z.avail_out;
+        out.resize(out.size() * 2);
+        z.next_out = out.data() + used;
+        z.avail_out = (uInt)(out.size() - used);
+        status = deflate(&z, flush);
+    }
+    out.resize(out.size() - z.avail_out);
+    deflateEnd(&z);
+    adler = adler32(1L, stream + start, (uInt)length);
+    return true;
+}
+
+void PngWriter::setJobContext(JobContext* context){
+    this->context = context;
+}
+
+bool PngWriter::write(FILE* output, const unsigned char* pixels, size_t size){
+    if (channels < 1 || channels > 4 || (bit_depth != 8 && bit_depth != 16)){
+        LOG_ERROR("Error: png writer can't write " << channels << " channels at " << bit_depth << " bits");
+        return false;
+    }
+    if (width <= 0 || height <= 0 || size != row_bytes * height){
+        LOG_ERROR("Error: png writer got " << size << " bytes for a " << width << "x" << height << " image");
+        return false;
+    }
+    static const unsigned char color_types[] = {0, 0, 4, 2, 6};
+    unsigned char ihdr[13];
+    putUint32(ihdr, (uint32_t)width);
+    putUint32(ihdr + 4, (uint32_t)height);
+    ihdr[8] = (unsigned char)bit_depth;
+    ihdr[9] = color_types[channels];
+    ihdr[10] = 0; //deflate
+    ihdr[11] = 0; //adaptive filtering
+    ihdr[12] = 0; //not interlaced
+    static const unsigned char signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    if (fwrite(signature, 1, 8, output) != 8 || !writeChunk(output, "IHDR", ihdr, sizeof(ihdr))) return false;
+
+    //filter, every row range only reads the raw rows so they run independently
+    //the scratch buffers are image-sized, so they come from and go back to the pool
+    if (filter == PngFilter::AUTO) filter = sampleFilter(pixels);
+    size_t stream_size = (row_bytes + 1) * height;
+    std::vector<unsigned char> filtered = BufferPool::take(stream_size);
+    size_t row_tasks = (height + FILTER_ROWS - 1) / FILTER_ROWS;
+    bool filtered_all = parallelFor(row_tasks, [&](size_t task){
+        if (context && context->cancelled()) return false;
+        int first = (int)(task * FILTER_ROWS);
+        int last = first + FILTER_ROWS < height ? first + FILTER_ROWS : height;
+        filterRows(pixels, filtered.data() + (size_t)first * (row_bytes + 1), first, last, filter);
+        return true;
+    });
+    if (!filtered_all){
+        BufferPool::give(filtered);
+        return false;
+    }
+
+    //deflate blocks against the already filtered stream
+    size_t blocks = (stream_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    std::vector<std::vector<unsigned char>> compressed(blocks);
+    std::vector<unsigned long> adlers(blocks);
+    std::atomic<size_t> deflated_bytes{0};
+    bool deflated = parallelFor(blocks, [&](size_t block){
+        if (context && !context->checkpoint(MetricPhase::CODEC_ENCODE, deflated_bytes.load(), stream_size)) return false;
+        size_t start = block * BLOCK_SIZE;
+        size_t end = start + BLOCK_SIZE < stream_size ? start + BLOCK_SIZE : stream_size;
+        if (!deflateBlock(filtered.data(), start, end, block + 1 == blocks, compressed[block], adlers[block])) return false;
+        deflated_bytes += end - start;
+        return true;
+    });
+    BufferPool::give(filtered);
+    if (!deflated){
+        for (std::vector<unsigned char> &block : compressed) BufferPool::give(block);
+        if (!context || !context->cancelled()) LOG_ERROR("Error: png writer failed to deflate image data");
+        return false;
+    }
+
+    //zlib header, FLEVEL only informs decoders of the level used
+    unsigned char header[2];
+    header[0] = 0x78;
+    int flevel = level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+    header[1] = (unsigned char)(flevel << 6);
+    header[1] += 31 - ((header[0] * 256 + header[1]) % 31);
+    unsigned long adler = adlers[0];
+    for (size_t block = 1; block < blocks; ++block){
+        size_t length = (block + 1 == blocks ? stream_size : (block + 1) * BLOCK_SIZE) - block * BLOCK_SIZE;
+        adler = adler32_combine(adler, adlers[block], (z_off_t)length);
+    }
+    unsigned char trailer[4];
+    putUint32(trailer, (uint32_t)adler);
+
+    //gather into IDAT chunks of about IDAT_SIZE, chunk boundaries don't matter to decoders
+    std::vector<unsigned char> idat = BufferPool::take(IDAT_SIZE + 2 * BLOCK_SIZE);
+    idat.assign(header, header + 2);
+    for (size_t block = 0; block < blocks; ++block){
+        idat.insert(idat.end(), compressed[block].begin(), compressed[block].end());
+        BufferPool::give(compressed[block]);
+        if (block + 1 == blocks) idat.insert(idat.end(), trailer, trailer + 4);
+        if (idat.size() >= IDAT_SIZE || block + 1 == blocks){
+            if (!writeChunk(output, "IDAT", idat.data(), idat.size())) return false;
+            idat.clear();
+        }
+    }
+    BufferPool::give(idat);
+    return writeChunk(output, "IEND", NULL, 0);
+}
@@ -0,0 +1,43 @@
+#ifndef PNGWRITER_H
+#define PNGWRITER_H
+
+#include <cstdio>
+#include <cstddef>
+#include <vector>
+
+class JobContext;
+
+//NONE..PAETH use that filter type on every row
+//ADAPTIVE picks per row by smallest sum of |byte| (libpng's default)
+//AUTO tries all of the above on sampled rows and keeps the one that deflates smallest
+enum class PngFilter{ NONE = 0, SUB = 1, UP = 2, AVERAGE = 3, PAETH = 4, ADAPTIVE, AUTO };
+
+//png encoder that filters and deflates on every core
+//scanlines are filtered in row ranges, the filtered stream is cut into blocks that are deflated
+//concurrently, each primed with the previous block's last 32K as a preset dictionary, and the
+//blocks are joined into one standard zlib stream (pigz-style)
+class PngWriter{
+    public:
+        //channels 1 gray, 2 gray+alpha, 3 rgb, 4 rgba; bit_depth 8 or 16 (16-bit samples big endian)
+        PngWriter(int width, int height, int channels, int bit_depth = 8);
+        void setCompression(int level, int strategy);
+        void setFilter(PngFilter filter);
+        PngFilter getFilter() const; //after write(), AUTO has been replaced by the filter it chose
+        //checked before every filter task and deflate block, write() gives up once it's cancelled
+        void setJobContext(JobContext* context);
+        bool write(FILE* output, const unsigned char* pixels, size_t size);
+    private:
+        int width, height, channels, bit_depth;
+        int level, strategy;
+        PngFilter filter;
+        JobContext* context = nullptr;
+        size_t row_bytes, pixel_bytes;
+        void applyFilter(int type, const unsigned char* row, const unsigned char* prior, unsigned char* out) const;
+        //filters rows [first, last) into filtered, which starts at row first
+        void filterRows(const unsigned char* pixels, unsigned char* filtered, int first, int last, PngFilter mode) const;
+        PngFilter sampleFilter(const unsigned char* pixels) const;
+        bool deflateBlock(const unsigned char* stream, size_t start, size_t end, bool last,
+                          std::vector<unsigned char> &out, unsigned long &adler) const;
+};
+
+#endif
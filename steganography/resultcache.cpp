@@ -0,0 +1,231 @@
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "resultcache.hpp"
+#include "carriercache.hpp"
+#include "logger.hpp"
+
+#if defined(__linux__) && __has_include(<linux/fs.h>)
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+static const size_t HASH_CHUNK = 1 << 20; //file bytes read and hashed at a time
+static const char* FORMAT_VERSION = "stegasaur-result-1"; //bump when the same inputs would encode differently
+
+//xxh64's rounds: four lanes over 32-byte stripes, then the tail
+static const uint64_t PRIME1 = 0x9E3779B185EBCA87ULL, PRIME2 = 0xC2B2AE3D27D4EB4FULL, PRIME3 = 0x165667B19E3779F9ULL,
+                      PRIME4 = 0x85EBCA77C2B2AE63ULL, PRIME5 = 0x27D4EB2F165667C5ULL;
+
+static uint64_t rotl(uint64_t value, int bits){
+    return (value << bits) | (value >> (64 - bits));
+}
+static uint64_t read64(const unsigned char* bytes){
+    uint64_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+static uint32_t read32(const unsigned char* bytes){
+    uint32_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+static uint64_t hashRound(uint64_t acc, uint64_t lane){
+    return rotl(acc + lane * PRIME2, 31) * PRIME1;
+}
+static uint64_t mergeRound(uint64_t acc, uint64_t lane){
+    return (acc ^ hashRound(0, lane)) * PRIME1 + PRIME4;
+}
+
+uint64_t ResultCache::hash(const unsigned char* data, size_t size, uint64_t seed){
+    const unsigned char* pos = data;
+    const unsigned char* end = data + size;
+    uint64_t h;
+    if (size >= 32){
+        uint64_t v1 = seed + PRIME1 + PRIME2, v2 = seed + PRIME2, v3 = seed, v4 = seed - PRIME1;
+        for (; pos + 32 <= end; pos += 32){
+            v1 = hashRound(v1, read64(pos));
+            v2 = hashRound(v2, read64(pos + 8));
+            v3 = hashRound(v3, read64(pos + 16));
+            v4 = hashRound(v4, read64(pos + 24));
+        }
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = mergeRound(mergeRound(mergeRound(mergeRound(h, v1), v2), v3), v4);
+    }
+    else h = seed + PRIME5;
+    h += size;
+    for (; pos + 8 <= end; pos += 8) h = rotl(h ^ hashRound(0, read64(pos)), 27) * PRIME1 + PRIME4;
+    for (; pos + 4 <= end; pos += 4) h = rotl(h ^ (uint64_t)read32(pos) * PRIME1, 23) * PRIME2 + PRIME3;
+    for (; pos < end; ++pos) h = rotl(h ^ *pos * PRIME5, 11) * PRIME1;
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+ResultCache::ResultCache(){
+    const char* setting = getenv("STEGASAUR_RESULT_CACHE");
+    if (setting && *setting) setDirectory(setting);
+}
+
+ResultCache& ResultCache::instance(){
+    static ResultCache shared;
+    return shared;
+}
+
+bool ResultCache::enabled() const{
+    std::lock_guard<std::mutex> guard(lock);
+    return !directory.empty();
+}
+
+bool ResultCache::setDirectory(const std::string name){
+    struct stat info;
+    if (!name.empty() && mkdir(name.c_str(), 0755) != 0 && (stat(name.c_str(), &info) != 0 || !S_ISDIR(info.st_mode))){
+        LOG_ERROR("Error: Can't use " << name << " as the result cache: " << strerror(errno));
+        return false;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    directory = name;
+    return true;
+}
+
+std::string ResultCache::getDirectory() const{
+    std::lock_guard<std::mutex> guard(lock);
+    return directory;
+}
+
+//the file's contents hashed HASH_CHUNK at a time, each chunk seeded with the hash so far
+bool ResultCache::hashFile(const std::string path, uint64_t &hash){
+    CarrierKey identity = CarrierCache::keyFor(path);
+    if (!identity.valid) return false;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto found = file_hashes.find(path);
+        if (found != file_hashes.end() && found->second.size == identity.size && found->second.mtime_ns == identity.mtime_ns){
+            hash = found->second.hash;
+            return true;
+        }
+    }
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    std::vector<unsigned char> chunk(HASH_CHUNK);
+    uint64_t content = 0, total = 0;
+    while (true){
+        ssize_t got = read(fd, chunk.data(), chunk.size());
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0){
+            close(fd);
+            return false;
+        }
+        if (got == 0) break;
+        content = ResultCache::hash(chunk.data(), (size_t)got, content);
+        total += (uint64_t)got;
+    }
+    close(fd);
+    //changed while it was read, hash it again next time
+    if (total != identity.size) return false;
+    std::lock_guard<std::mutex> guard(lock);
+    file_hashes[path] = FileHash{identity.size, identity.mtime_ns, content};
+    hash = content;
+    return true;
+}
+
+ResultKey ResultCache::keyFor(const std::string secret, const std::string carrier, const std::string settings, const std::string ext){
+    ResultKey key;
+    uint64_t secret_hash = 0, carrier_hash = 0;
+    if (!enabled() || !hashFile(secret, secret_hash) || !hashFile(carrier, carrier_hash)) return key;
+    std::string identity = std::string(FORMAT_VERSION) + "|" + settings + "|" + ext + "|";
+    identity.append(reinterpret_cast<const char*>(&secret_hash), sizeof(secret_hash));
+    identity.append(reinterpret_cast<const char*>(&carrier_hash), sizeof(carrier_hash));
+    key.hash = ResultCache::hash(reinterpret_cast<const unsigned char*>(identity.data()), identity.size());
+    key.ext = ext;
+    key.valid = true;
+    return key;
+}
+
+std::string ResultCache::entryPath(const ResultKey &key) const{
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx", (unsigned long long)key.hash);
+    std::lock_guard<std::mutex> guard(lock);
+    return directory + "/" + name + key.ext;
+}
+
+//puts a copy of from at to through a temporary name next to it, so to is replaced whole or not at all
+//always its own inode, created with mode: a reflink where the filesystem supports one, the bytes copied otherwise
+static bool copyFile(const std::string from, const std::string to, mode_t mode){
+    //already the same file, there's nothing to copy and renaming over it would lose it
+    struct stat from_info, to_info;
+    if (stat(from.c_str(), &from_info) == 0 && stat(to.c_str(), &to_info) == 0 &&
+        from_info.st_dev == to_info.st_dev && from_info.st_ino == to_info.st_ino){
+        return true;
+    }
+    static std::atomic<unsigned long> counter{0};
+    std::string temporary = to + ".tmp-" + std::to_string(getpid()) + "-" + std::to_string(counter++);
+    int source = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+    if (source < 0) return false;
+    int target = open(temporary.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode);
+    if (target < 0){
+        close(source);
+        return false;
+    }
+    bool copied = false;
+#ifdef FICLONE
+    copied = ioctl(target, FICLONE, source) == 0;
+#endif
+    if (!copied){
+        std::vector<unsigned char> chunk(HASH_CHUNK);
+        copied = true;
+        while (copied){
+            ssize_t got = read(source, chunk.data(), chunk.size());
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0){
+                copied = got == 0;
+                break;
+            }
+            for (ssize_t done = 0; done < got && copied;){
+                ssize_t wrote = write(target, chunk.data() + done, (size_t)(got - done));
+                if (wrote < 0 && errno == EINTR) continue;
+                copied = wrote > 0;
+                if (copied) done += wrote;
+            }
+        }
+    }
+    close(source);
+    if (close(target) != 0) copied = false;
+    if (!copied || rename(temporary.c_str(), to.c_str()) != 0){
+        unlink(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool ResultCache::fetch(const ResultKey &key, const std::string output){
+    if (!key.valid || !enabled()) return false;
+    std::string entry = entryPath(key);
+    struct stat info;
+    if (stat(entry.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) return false;
+    if (!copyFile(entry, output, 0644)){
+        LOG_DEBUG("Console: Result cache entry " << entry << " couldn't be copied to " << output << ": " << strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void ResultCache::store(const ResultKey &key, const std::string output){
+    if (!key.valid || !enabled()) return;
+    std::string entry = entryPath(key);
+    struct stat info;
+    if (stat(entry.c_str(), &info) == 0) return;
+    if (!copyFile(output, entry, 0444)){
+        LOG_DEBUG("Console: " << output << " couldn't be added to the result cache: " << strerror(errno));
+    }
+}
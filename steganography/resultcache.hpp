@@ -0,0 +1,56 @@
+#ifndef RESULTCACHE_H
+#define RESULTCACHE_H
+
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+//identity of an encode's output: a hash of the secret's and carrier's contents and every setting that changes the output
+struct ResultKey{
+    uint64_t hash = 0;
+    std::string ext; //output extension, the entry keeps it
+    bool valid = false; //false when an input couldn't be hashed (missing, or an fd:<n> name), nothing is cached for it
+};
+
+//on-disk cache of encoded outputs, so an encode repeated with the same inputs and settings isn't decoded again
+//off unless STEGASAUR_RESULT_CACHE=<directory> or setDirectory() names one; entries are never evicted, delete them to clear it
+//only deterministic encodes are cached, see Encoder::setDeterministic
+//entries and outputs never share an inode: a hit is reflinked to the output where the filesystem can and
+//copied otherwise, and a stored output is copied in the same way, so writing over an output never changes the cache
+class ResultCache{
+    public:
+        ResultCache(const ResultCache&) = delete;
+        ResultCache& operator=(const ResultCache&) = delete;
+        static ResultCache& instance();
+
+        bool enabled() const;
+        //created if it doesn't exist, false if it can't be; empty turns the cache off
+        bool setDirectory(const std::string directory);
+        std::string getDirectory() const;
+        //fast 64-bit content hash, not cryptographic
+        static uint64_t hash(const unsigned char* data, size_t size, uint64_t seed = 0);
+
+        //file contents are hashed once per path, size and modification time (see CarrierCache::keyFor)
+        //settings is everything else the output depends on, ext the output's extension
+        ResultKey keyFor(const std::string secret, const std::string carrier, const std::string settings, const std::string ext);
+        //copies the cached output for key to output, replacing it; false on a miss
+        bool fetch(const ResultKey &key, const std::string output);
+        //adds a copy of a finished output under key, an entry already there is kept
+        void store(const ResultKey &key, const std::string output);
+    private:
+        ResultCache();
+        struct FileHash{
+            uint64_t size = 0;
+            int64_t mtime_ns = 0;
+            uint64_t hash = 0;
+        };
+        mutable std::mutex lock;
+        std::string directory;
+        std::unordered_map<std::string, FileHash> file_hashes;
+        bool hashFile(const std::string path, uint64_t &hash);
+        std::string entryPath(const ResultKey &key) const;
+};
+
+#endif
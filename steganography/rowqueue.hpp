@@ -0,0 +1,65 @@
+#ifndef ROWQUEUE_H
+#define ROWQUEUE_H
+
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <cstddef>
+
+//bounded single-producer single-consumer queue, lock free
+//used to hand scanlines between the decode, embed and encode threads of a pipelined job
+//push/pop wait while the queue is full/empty and give up once abort is set
+template <typename T>
+class RowQueue{
+    public:
+        explicit RowQueue(size_t capacity){
+            size_t size = 1;
+            while (size < capacity) size <<= 1;
+            slots.resize(size);
+            mask = size - 1;
+        }
+        RowQueue(const RowQueue&) = delete;
+        RowQueue& operator=(const RowQueue&) = delete;
+
+        bool tryPush(const T &value){
+            size_t tail = write_index.load(std::memory_order_relaxed);
+            if (tail - read_index.load(std::memory_order_acquire) == slots.size()) return false;
+            slots[tail & mask] = value;
+            write_index.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+        bool tryPop(T &value){
+            size_t head = read_index.load(std::memory_order_relaxed);
+            if (head == write_index.load(std::memory_order_acquire)) return false;
+            value = slots[head & mask];
+            read_index.store(head + 1, std::memory_order_release);
+            return true;
+        }
+        bool push(const T &value, const std::atomic<bool> &abort){
+            for (unsigned int spins = 0; !tryPush(value); ++spins){
+                if (abort.load(std::memory_order_relaxed)) return false;
+                backoff(spins);
+            }
+            return true;
+        }
+        bool pop(T &value, const std::atomic<bool> &abort){
+            for (unsigned int spins = 0; !tryPop(value); ++spins){
+                if (abort.load(std::memory_order_relaxed)) return false;
+                backoff(spins);
+            }
+            return true;
+        }
+    private:
+        std::vector<T> slots;
+        size_t mask = 0;
+        //separate cache lines so producer and consumer don't share one
+        alignas(64) std::atomic<size_t> write_index{0};
+        alignas(64) std::atomic<size_t> read_index{0};
+        static void backoff(unsigned int spins){
+            //stages run at similar speeds, so a short spin usually beats sleeping
+            if (spins < 64) return;
+            std::this_thread::yield();
+        }
+};
+
+#endif
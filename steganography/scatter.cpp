@@ -0,0 +1,84 @@
+#include <string>
+#include <cstdint>
+#include <utility>
+#include "scatter.hpp"
+
+//splitmix64's finalizer, a cheap well-mixed round function
+static uint64_t mix(uint64_t value){
+    value ^= value >> 30;
+    value *= 0xBF58476D1CE4E5B9ULL;
+    value ^= value >> 27;
+    value *= 0x94D049BB133111EBULL;
+    value ^= value >> 31;
+    return value;
+}
+
+ScatterOrder::ScatterOrder(const std::string key, uint64_t size)
+    :   domain_size(size)
+{
+    //fnv-1a of the key seeds the round keys
+    uint64_t seed = 0xCBF29CE484222325ULL;
+    for (unsigned char c : key){
+        seed ^= c;
+        seed *= 0x100000001B3ULL;
+    }
+    for (int r = 0; r < ROUNDS; ++r){
+        seed += 0x9E3779B97F4A7C15ULL;
+        round_keys[r] = mix(seed);
+    }
+    //the domain (2^bits) covers size with at least two bits, so each half has one
+    int bits = 2;
+    while (bits < 64 && ((uint64_t)1 << bits) < size) ++bits;
+    left_bits = bits / 2;
+    right_bits = bits - left_bits;
+}
+
+static uint64_t lowBits(uint64_t value, int bits){
+    return bits >= 64 ? value : value & (((uint64_t)1 << bits) - 1);
+}
+
+uint64_t ScatterOrder::round(int r, uint64_t half, int bits) const{
+    return lowBits(mix(half ^ round_keys[r]), bits);
+}
+
+//ROUNDS is even, so the halves are back to their starting widths at the end
+uint64_t ScatterOrder::forward(uint64_t value) const{
+    int left_width = left_bits, right_width = right_bits;
+    uint64_t left = value >> right_width, right = lowBits(value, right_width);
+    for (int r = 0; r < ROUNDS; ++r){
+        uint64_t next = left ^ round(r, right, left_width);
+        left = right;
+        right = next;
+        std::swap(left_width, right_width);
+    }
+    return (left << right_width) | right;
+}
+
+uint64_t ScatterOrder::backward(uint64_t value) const{
+    int left_width = left_bits, right_width = right_bits;
+    uint64_t left = value >> right_width, right = lowBits(value, right_width);
+    for (int r = ROUNDS - 1; r >= 0; --r){
+        uint64_t previous = right ^ round(r, left, right_width);
+        right = left;
+        left = previous;
+        std::swap(left_width, right_width);
+    }
+    return (left << right_width) | right;
+}
+
+//the domain is under twice size, so the walk back into range takes two steps at most on average
+uint64_t ScatterOrder::at(uint64_t index) const{
+    uint64_t position = forward(index);
+    while (position >= domain_size) position = forward(position);
+    return position;
+}
+
+uint64_t ScatterOrder::indexOf(uint64_t position) const{
+    uint64_t index = backward(position);
+    while (index >= domain_size) index = backward(index);
+    return index;
+}
+
+uint64_t ScatterOrder::size() const{
+    return domain_size;
+}
@@ -0,0 +1,28 @@
+#ifndef SCATTER_H
+#define SCATTER_H
+
+#include <string>
+#include <cstdint>
+
+//keyed pseudo-random permutation of [0, size): with a scatter key payload bit i goes to carrier position at(i)
+//instead of position i, so the payload is spread over the whole carrier rather than its first rows
+//a Feistel network over the smallest power of two covering size, cycle-walked back into range:
+//each index is mapped (or inverted) on its own in O(1) expected, nothing the size of the carrier is built
+class ScatterOrder{
+    public:
+        ScatterOrder(const std::string key, uint64_t size);
+        //both need index/position below size
+        uint64_t at(uint64_t index) const; //carrier position of payload bit index
+        uint64_t indexOf(uint64_t position) const; //inverse of at()
+        uint64_t size() const;
+    private:
+        static const int ROUNDS = 4;
+        uint64_t domain_size;
+        int left_bits = 1, right_bits = 1; //an odd bit count leaves the halves one bit apart, they swap every round
+        uint64_t round_keys[ROUNDS];
+        uint64_t round(int r, uint64_t half, int bits) const;
+        uint64_t forward(uint64_t value) const;
+        uint64_t backward(uint64_t value) const;
+};
+
+#endif
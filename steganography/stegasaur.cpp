@@ -0,0 +1,184 @@
+#include <string>
+#include <vector>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <cstdlib>
+#include "stegasaur.h"
+#include "handler.hpp"
+#include "encoder.hpp"
+#include "decoder.hpp"
+#include "logger.hpp"
+
+struct stega_context{
+    std::string last_error;
+    std::vector<unsigned char> pending_output; //output that did not fit the caller's buffer
+};
+
+static stega_status fail(stega_context* context, stega_status status, const std::string message){
+    context->last_error = message;
+    return status;
+}
+
+//sniffed from the buffer's first bytes, the name only matters for formats without a signature
+static bool supportedCarrier(const Handler &carrier){
+    return carrier.getCodec() != nullptr;
+}
+
+//copy output to the caller, or keep it for stega_take_output if it doesn't fit
+static stega_status deliver(stega_context* context, std::vector<unsigned char> &output,
+                            unsigned char* out, size_t out_capacity, size_t* out_size){
+    *out_size = output.size();
+    if (output.size() > out_capacity || (!out && !output.empty())){
+        context->pending_output.swap(output);
+        return fail(context, STEGA_ERR_BUFFER_TOO_SMALL, "Output buffer too small, " + std::to_string(*out_size) + " bytes needed");
+    }
+    if (!output.empty()) memcpy(out, output.data(), output.size());
+    context->pending_output.clear();
+    return STEGA_OK;
+}
+
+extern "C" {
+
+uint32_t stega_abi_version(void){
+    return STEGA_ABI_VERSION;
+}
+
+//the host owns stdout, and the demo's progress lines mean nothing to it: stderr only, warnings and up
+//unless STEGASAUR_LOG says otherwise; done once, before the first context does any work
+static void configureLogging(){
+    static std::once_flag configured;
+    std::call_once(configured, [](){
+        Logger::instance().setStderrOnly(true);
+        if (!getenv("STEGASAUR_LOG")) Logger::instance().setLevel(LogLevel::WARN);
+    });
+}
+
+stega_status stega_set_log_level(stega_log_level level){
+    if (level < STEGA_LOG_DEBUG || level > STEGA_LOG_OFF) return STEGA_ERR_INVALID_ARGUMENT;
+    configureLogging();
+    static const LogLevel levels[] = {LogLevel::DEBUG, LogLevel::INFO, LogLevel::WARN, LogLevel::ERROR, LogLevel::OFF};
+    Logger::instance().setLevel(levels[level]);
+    return STEGA_OK;
+}
+
+stega_context* stega_context_create(void){
+    configureLogging();
+    try {
+        return new stega_context();
+    }
+    catch (...){
+        return NULL;
+    }
+}
+
+void stega_context_destroy(stega_context* context){
+    delete context;
+}
+
+const char* stega_last_error(const stega_context* context){
+    if (!context) return "No context";
+    return context->last_error.c_str();
+}
+
+stega_status stega_probe(stega_context* context,
+                         const unsigned char* carrier, size_t carrier_size, const char* carrier_name,
+                         stega_probe_info* info){
+    if (!context) return STEGA_ERR_INVALID_ARGUMENT;
+    if (!carrier || carrier_size == 0 || !carrier_name || !info){
+        return fail(context, STEGA_ERR_INVALID_ARGUMENT, "Carrier buffer, name and info are required");
+    }
+    try {
+        Decoder decoder(carrier_name, carrier, carrier_size);
+        decoder.setNativePng(false); //stega_encode writes rgba8
+        Handler sniffed(carrier_name, carrier, carrier_size);
+        std::string ext = sniffed.getExt();
+        if (!supportedCarrier(sniffed)) return fail(context, STEGA_ERR_UNSUPPORTED_FORMAT, "Unsupported carrier " + std::string(carrier_name));
+        if (!decoder.openEncodedFile()) return fail(context, STEGA_ERR_READ, "Could not read carrier " + std::string(carrier_name));
+        memset(info, 0, sizeof(*info));
+        strncpy(info->format, ext.c_str(), sizeof(info->format) - 1);
+        info->capacity = decoder.getCapacity();
+        return STEGA_OK;
+    }
+    catch (const std::exception &e){
+        return fail(context, STEGA_ERR_INTERNAL, e.what());
+    }
+}
+
+stega_status stega_capacity(stega_context* context,
+                            const unsigned char* carrier, size_t carrier_size, const char* carrier_name,
+                            size_t* capacity){
+    if (!context) return STEGA_ERR_INVALID_ARGUMENT;
+    if (!capacity) return fail(context, STEGA_ERR_INVALID_ARGUMENT, "capacity is required");
+    stega_probe_info info;
+    stega_status status = stega_probe(context, carrier, carrier_size, carrier_name, &info);
+    if (status == STEGA_OK) *capacity = info.capacity;
+    return status;
+}
+
+stega_status stega_encode(stega_context* context,
+                          const unsigned char* secret, size_t secret_size, const char* secret_name,
+                          const unsigned char* carrier, size_t carrier_size, const char* carrier_name,
+                          unsigned char* out, size_t out_capacity, size_t* out_size){
+    if (!context) return STEGA_ERR_INVALID_ARGUMENT;
+    if (!secret || secret_size == 0 || !secret_name || !carrier || carrier_size == 0 || !carrier_name || !out_size){
+        return fail(context, STEGA_ERR_INVALID_ARGUMENT, "Secret, carrier, their names and out_size are required");
+    }
+    try {
+        Handler sniffed(carrier_name, carrier, carrier_size);
+        std::string carrier_ext = sniffed.getExt();
+        if (!supportedCarrier(sniffed)) return fail(context, STEGA_ERR_UNSUPPORTED_FORMAT, "Unsupported carrier " + std::string(carrier_name));
+
+        std::vector<unsigned char> output;
+        Encoder encoder(secret_name, secret, secret_size, carrier_name, carrier, carrier_size);
+        encoder.setMemoryOutput(&output);
+        if (!encoder.openFiles()) return fail(context, STEGA_ERR_READ, "Could not read secret or carrier");
+        if (!encoder.embed()) return fail(context, STEGA_ERR_CAPACITY, "Secret does not fit in " + std::string(carrier_name));
+        //the name only has to carry the extension, nothing is written to disk
+        if (!encoder.write(std::string("stegasaur") + carrier_ext)) return fail(context, STEGA_ERR_WRITE, "Could not encode output");
+        return deliver(context, output, out, out_capacity, out_size);
+    }
+    catch (const std::exception &e){
+        return fail(context, STEGA_ERR_INTERNAL, e.what());
+    }
+}
+
+stega_status stega_decode(stega_context* context,
+                          const unsigned char* encoded, size_t encoded_size, const char* encoded_name,
+                          unsigned char* out, size_t out_capacity, size_t* out_size,
+                          char* ext, size_t ext_capacity){
+    if (!context) return STEGA_ERR_INVALID_ARGUMENT;
+    if (!encoded || encoded_size == 0 || !encoded_name || !out_size){
+        return fail(context, STEGA_ERR_INVALID_ARGUMENT, "Encoded buffer, name and out_size are required");
+    }
+    try {
+        if (!supportedCarrier(Handler(encoded_name, encoded, encoded_size))){
+            return fail(context, STEGA_ERR_UNSUPPORTED_FORMAT, "Unsupported carrier " + std::string(encoded_name));
+        }
+        std::vector<unsigned char> output;
+        Decoder decoder(encoded_name, encoded, encoded_size);
+        decoder.setMemoryOutput(&output);
+        if (!decoder.openEncodedFile()) return fail(context, STEGA_ERR_READ, "Could not read " + std::string(encoded_name));
+        if (!decoder.extract()) return fail(context, STEGA_ERR_NO_PAYLOAD, "No StegaSaur payload in " + std::string(encoded_name));
+        if (!decoder.write("stegasaur")) return fail(context, STEGA_ERR_WRITE, "Could not write extracted secret");
+        std::string secret_ext = decoder.getSecretExt();
+        if (ext && ext_capacity > 0){
+            if (secret_ext.size() >= ext_capacity) return fail(context, STEGA_ERR_INVALID_ARGUMENT, "ext buffer too small");
+            memcpy(ext, secret_ext.c_str(), secret_ext.size() + 1);
+        }
+        return deliver(context, output, out, out_capacity, out_size);
+    }
+    catch (const std::exception &e){
+        return fail(context, STEGA_ERR_INTERNAL, e.what());
+    }
+}
+
+stega_status stega_take_output(stega_context* context, unsigned char* out, size_t out_capacity, size_t* out_size){
+    if (!context) return STEGA_ERR_INVALID_ARGUMENT;
+    if (!out_size) return fail(context, STEGA_ERR_INVALID_ARGUMENT, "out_size is required");
+    std::vector<unsigned char> output;
+    output.swap(context->pending_output);
+    return deliver(context, output, out, out_capacity, out_size);
+}
+
+}
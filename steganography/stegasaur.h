@@ -0,0 +1,105 @@
+/*
+ * StegaSaur C ABI
+ *
+ * Stable C interface to the encoder/decoder for in-process use. Everything works on
+ * caller-owned memory buffers; no files are read or written. CMakeLists.txt builds it
+ * as the shared library target stegasaur (libstegasaur.so.1):
+ *   cmake -S . -B build && cmake --build build --target stegasaur
+ *
+ * Versioning: STEGA_ABI_VERSION is bumped on any incompatible change. Check
+ * stega_abi_version() at runtime against the header you compiled with.
+ *
+ * Carrier formats are sniffed from the buffer's first bytes. Names passed alongside
+ * buffers ("secret.txt", "carrier.png") only decide for secrets and headerless formats
+ * (.pcm/.raw), exactly like a file name would.
+ *
+ * A stega_context holds the last error message and any output that did not fit the
+ * caller's buffer. Contexts are not thread-safe; use one per thread.
+ *
+ * Diagnostics go to stderr, never stdout, and only warnings and errors by default
+ * (STEGASAUR_LOG=debug|info|warn|error|off overrides that); see stega_set_log_level.
+ */
+#ifndef STEGASAUR_H
+#define STEGASAUR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(_WIN32)
+#define STEGA_API __declspec(dllexport)
+#else
+#define STEGA_API __attribute__((visibility("default")))
+#endif
+
+#define STEGA_ABI_VERSION 1
+
+typedef struct stega_context stega_context;
+
+typedef enum stega_status{
+    STEGA_OK = 0,
+    STEGA_ERR_INVALID_ARGUMENT = 1,
+    STEGA_ERR_UNSUPPORTED_FORMAT = 2,
+    STEGA_ERR_READ = 3,             /* carrier or secret could not be parsed */
+    STEGA_ERR_CAPACITY = 4,         /* secret does not fit in the carrier */
+    STEGA_ERR_NO_PAYLOAD = 5,       /* nothing encoded by StegaSaur was found */
+    STEGA_ERR_WRITE = 6,
+    STEGA_ERR_BUFFER_TOO_SMALL = 7, /* *out_size holds the size needed, see stega_take_output */
+    STEGA_ERR_INTERNAL = 8
+} stega_status;
+
+typedef enum stega_log_level{
+    STEGA_LOG_DEBUG = 0,
+    STEGA_LOG_INFO = 1,
+    STEGA_LOG_WARN = 2,  /* the default */
+    STEGA_LOG_ERROR = 3,
+    STEGA_LOG_OFF = 4
+} stega_log_level;
+
+typedef struct stega_probe_info{
+    char format[8];  /* carrier extension, e.g. ".png" */
+    size_t capacity; /* payload bytes (header included) the carrier can hold */
+} stega_probe_info;
+
+STEGA_API uint32_t stega_abi_version(void);
+
+/* process-wide: lines below level are dropped, the rest are written to stderr */
+STEGA_API stega_status stega_set_log_level(stega_log_level level);
+
+STEGA_API stega_context* stega_context_create(void);
+STEGA_API void stega_context_destroy(stega_context* context);
+/* message for the last failed call on this context, never NULL */
+STEGA_API const char* stega_last_error(const stega_context* context);
+
+STEGA_API stega_status stega_probe(stega_context* context,
+                                   const unsigned char* carrier, size_t carrier_size, const char* carrier_name,
+                                   stega_probe_info* info);
+
+STEGA_API stega_status stega_capacity(stega_context* context,
+                                      const unsigned char* carrier, size_t carrier_size, const char* carrier_name,
+                                      size_t* capacity);
+
+/* writes the encoded carrier (same format as carrier_name) into out */
+STEGA_API stega_status stega_encode(stega_context* context,
+                                    const unsigned char* secret, size_t secret_size, const char* secret_name,
+                                    const unsigned char* carrier, size_t carrier_size, const char* carrier_name,
+                                    unsigned char* out, size_t out_capacity, size_t* out_size);
+
+/* writes the extracted secret into out and its extension (e.g. ".txt") into ext */
+STEGA_API stega_status stega_decode(stega_context* context,
+                                    const unsigned char* encoded, size_t encoded_size, const char* encoded_name,
+                                    unsigned char* out, size_t out_capacity, size_t* out_size,
+                                    char* ext, size_t ext_capacity);
+
+/* after STEGA_ERR_BUFFER_TOO_SMALL, copies the held output without redoing the work */
+STEGA_API stega_status stega_take_output(stega_context* context,
+                                         unsigned char* out, size_t out_capacity, size_t* out_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
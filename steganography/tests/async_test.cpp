@@ -0,0 +1,114 @@
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
+#include <future>
+#include <atomic>
+#include <unistd.h>
+#include "async.hpp"
+#include "memorybudget.hpp"
+#include "jobcontext.hpp"
+#include "check.hpp"
+
+//AsyncRuntime end to end: spawned encode/decode round trips, cancellation between stages,
+//and admission through MemoryBudget; files go to the working directory, ctest runs this in the build tree
+
+static void writeBytes(const std::string path, const std::vector<unsigned char> &bytes){
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(bytes.data()), (std::streamsize)bytes.size());
+}
+
+static std::vector<unsigned char> readBytes(const std::string path){
+    std::ifstream file(path, std::ios::binary);
+    return std::vector<unsigned char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static std::vector<unsigned char> makePgm(int width, int height){
+    std::string header = "P5\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+    std::vector<unsigned char> bytes(header.begin(), header.end());
+    uint32_t seed = 6;
+    for (int i = 0; i < width * height; ++i){
+        seed = seed * 1664525u + 1013904223u;
+        bytes.push_back((unsigned char)(seed >> 24));
+    }
+    return bytes;
+}
+
+static EngineResult runJob(AsyncRuntime &runtime, const EngineJob job){
+    std::promise<EngineResult> done;
+    std::future<EngineResult> result = done.get_future();
+    runtime.spawn(job, [&done](const EngineResult &finished){ done.set_value(finished); });
+    return result.get();
+}
+
+static EngineJob encodeJob(const std::string output){
+    EngineJob job;
+    job.type = JobType::ENCODE;
+    job.secret = "async_test_secret.txt";
+    job.carrier = "async_test.pgm";
+    job.output = output;
+    return job;
+}
+
+static EngineJob decodeJob(const std::string encoded, const std::string output){
+    EngineJob job;
+    job.type = JobType::DECODE;
+    job.encoded = encoded;
+    job.output = output;
+    return job;
+}
+
+int main(){
+    writeBytes("async_test_secret.txt", std::vector<unsigned char>(300, 's'));
+    writeBytes("async_test.pgm", makePgm(160, 120));
+    AsyncRuntime runtime(2, 2);
+
+    //the encode's output gets the carrier's extension, the decode's the secret's
+    EngineResult encoded = runJob(runtime, encodeJob("async_test_out"));
+    CHECK(encoded.success);
+    CHECK(encoded.output == "async_test_out.pgm");
+    CHECK(encoded.format == ".pgm");
+    CHECK(encoded.estimated_bytes == 0);
+    EngineResult decoded = runJob(runtime, decodeJob(encoded.output, "async_test_secret_out"));
+    CHECK(decoded.success);
+    CHECK(decoded.output == "async_test_secret_out.txt");
+    CHECK(readBytes(decoded.output) == readBytes("async_test_secret.txt"));
+
+    //the key is needed to find a scattered payload
+    EngineJob keyed = encodeJob("async_test_keyed");
+    keyed.scatter_key = "key";
+    CHECK(runJob(runtime, keyed).success);
+    CHECK(!runJob(runtime, decodeJob("async_test_keyed.pgm", "async_test_nokey")).success);
+    EngineJob keyed_decode = decodeJob("async_test_keyed.pgm", "async_test_keyed_secret");
+    keyed_decode.scatter_key = "key";
+    CHECK(runJob(runtime, keyed_decode).success);
+
+    //stopped before it starts: reported as stopped, and no output is left behind
+    EngineJob cancelled = encodeJob("async_test_cancelled");
+    cancelled.context = std::make_shared<JobContext>();
+    cancelled.context->cancel();
+    EngineResult stopped = runJob(runtime, cancelled);
+    CHECK(!stopped.success);
+    CHECK(stopped.error == JobError::STOPPED);
+    CHECK(stopped.stopped == "cancelled");
+    CHECK(access("async_test_cancelled.pgm", F_OK) != 0);
+
+    //a budget smaller than one job still runs every job, one at a time, and gives everything back
+    MemoryBudget::instance().setProcessBudget(1);
+    std::atomic<int> succeeded{0}, estimated{0};
+    {
+        AsyncRuntime budgeted(4, 4);
+        for (int i = 0; i < 6; ++i){
+            budgeted.spawn(encodeJob("async_test_budget" + std::to_string(i)), [&](const EngineResult &result){
+                if (result.success) succeeded++;
+                if (result.estimated_bytes > 0) estimated++;
+            });
+        }
+    }
+    CHECK(succeeded == 6);
+    CHECK(estimated == 6);
+    CHECK(MemoryBudget::instance().getReservedBytes() == 0);
+    CHECK(MemoryBudget::instance().getWaitingJobs() == 0);
+    MemoryBudget::instance().setProcessBudget(0);
+    return checkFailures();
+}
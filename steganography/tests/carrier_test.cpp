@@ -0,0 +1,157 @@
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
+#include <cstdint>
+#include "encoder.hpp"
+#include "decoder.hpp"
+#include "handler.hpp"
+#include "check.hpp"
+
+//round trips a secret through each uncompressed carrier format (bmp, ppm, pgm, headerless pcm),
+//from files and from memory, sequential and scattered, whole and streamed
+//files are written to the working directory, ctest runs this in the build tree
+
+static std::vector<unsigned char> noise(size_t size, uint32_t seed){
+    std::vector<unsigned char> bytes(size);
+    for (unsigned char &byte : bytes){
+        seed = seed * 1664525u + 1013904223u;
+        byte = (unsigned char)(seed >> 24);
+    }
+    return bytes;
+}
+
+static void writeBytes(const std::string path, const std::vector<unsigned char> &bytes){
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(bytes.data()), (std::streamsize)bytes.size());
+}
+
+static std::vector<unsigned char> readBytes(const std::string path){
+    std::ifstream file(path, std::ios::binary);
+    return std::vector<unsigned char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static void putLe(std::vector<unsigned char> &bytes, size_t at, uint32_t value, int size){
+    for (int i = 0; i < size; ++i) bytes[at + i] = (unsigned char)(value >> (8 * i));
+}
+
+//24-bit bottom-up bmp, rows padded to 4 bytes
+static std::vector<unsigned char> makeBmp(int width, int height){
+    size_t stride = ((size_t)width * 3 + 3) / 4 * 4;
+    std::vector<unsigned char> bytes(54, 0);
+    bytes[0] = 'B';
+    bytes[1] = 'M';
+    putLe(bytes, 2, (uint32_t)(54 + stride * height), 4);
+    putLe(bytes, 10, 54, 4);
+    putLe(bytes, 14, 40, 4);
+    putLe(bytes, 18, (uint32_t)width, 4);
+    putLe(bytes, 22, (uint32_t)height, 4);
+    putLe(bytes, 26, 1, 2);
+    putLe(bytes, 28, 24, 2);
+    std::vector<unsigned char> pixels = noise(stride * height, 1);
+    bytes.insert(bytes.end(), pixels.begin(), pixels.end());
+    return bytes;
+}
+
+//binary P6 (ppm) or P5 (pgm) with a comment in the header
+static std::vector<unsigned char> makePnm(bool color, int width, int height){
+    std::string header = std::string(color ? "P6" : "P5") + "\n# carrier_test\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+    std::vector<unsigned char> bytes(header.begin(), header.end());
+    std::vector<unsigned char> samples = noise((size_t)width * height * (color ? 3 : 1), 2);
+    bytes.insert(bytes.end(), samples.begin(), samples.end());
+    return bytes;
+}
+
+//encode from files, check the carrier file is untouched and the output differs from it only in lsbs, decode again
+static void fileRoundTrip(const std::string carrier, const std::string secret, const std::string key, bool streamed){
+    std::vector<unsigned char> carrier_before = readBytes(carrier);
+    std::string tag = carrier + (key.empty() ? "" : "_keyed") + (streamed ? "_streamed" : "");
+    std::string output = Handler::resolveOutputPath(carrier, tag + "_out");
+    Encoder encoder(secret, carrier);
+    encoder.setScatterKey(key);
+    encoder.setPipelined(streamed);
+    CHECK(encoder.openFiles());
+    CHECK(encoder.embed());
+    CHECK(encoder.write(output));
+    //embedding writes into a copy-on-write mapping, never into the carrier itself
+    CHECK(readBytes(carrier) == carrier_before);
+    std::vector<unsigned char> encoded = readBytes(output);
+    CHECK(encoded.size() == carrier_before.size());
+    CHECK(encoded != carrier_before);
+    //only lsbs change, so headers and padding come through as they were
+    bool lsbs_only = encoded.size() == carrier_before.size();
+    for (size_t i = 0; lsbs_only && i < encoded.size(); ++i) lsbs_only = (encoded[i] ^ carrier_before[i]) <= 1;
+    CHECK(lsbs_only);
+
+    Decoder decoder(output);
+    decoder.setScatterKey(key);
+    decoder.setStreamed(streamed);
+    CHECK(decoder.openEncodedFile());
+    CHECK(decoder.extract());
+    CHECK(decoder.getSecretExt() == ".txt");
+    CHECK(decoder.write(tag + "_secret"));
+    CHECK(readBytes(tag + "_secret.txt") == readBytes(secret));
+
+    //the wrong key finds no payload
+    if (!key.empty()){
+        Decoder wrong(output);
+        wrong.setScatterKey(key + "x");
+        CHECK(!(wrong.openEncodedFile() && wrong.extract()));
+    }
+}
+
+//same through the in-memory constructors, nothing touches the disk
+static void memoryRoundTrip(const std::string carrier_name, const std::vector<unsigned char> &carrier, const std::vector<unsigned char> &secret){
+    std::vector<unsigned char> encoded;
+    Encoder encoder("secret.txt", secret.data(), secret.size(), carrier_name, carrier.data(), carrier.size());
+    encoder.setMemoryOutput(&encoded);
+    CHECK(encoder.openFiles());
+    CHECK(encoder.embed());
+    CHECK(encoder.write(carrier_name));
+    CHECK(encoded.size() == carrier.size());
+
+    std::vector<unsigned char> decoded;
+    Decoder decoder(carrier_name, encoded.data(), encoded.size());
+    decoder.setMemoryOutput(&decoded);
+    CHECK(decoder.openEncodedFile());
+    CHECK(decoder.extract());
+    CHECK(decoder.write("secret"));
+    CHECK(decoded == secret);
+}
+
+//a secret that can't fit fails cleanly instead of writing a partial output
+static void tooLarge(const std::string carrier, const std::string big_secret){
+    Encoder encoder(big_secret, carrier);
+    bool encoded = encoder.openFiles() && encoder.embed() && encoder.write(carrier + "_big_out");
+    CHECK(!encoded);
+}
+
+int main(){
+    std::vector<unsigned char> secret_text = noise(700, 3);
+    for (unsigned char &byte : secret_text) byte = (unsigned char)('a' + byte % 26);
+    writeBytes("carrier_test_secret.txt", secret_text);
+    writeBytes("carrier_test_big.txt", std::vector<unsigned char>(200000, 'x'));
+
+    //odd widths, so bmp rows carry padding and ppm/pgm rows don't line up with anything
+    std::vector<std::pair<std::string, std::vector<unsigned char>>> carriers = {
+        {"carrier_test.bmp", makeBmp(101, 67)},
+        {"carrier_test.ppm", makePnm(true, 99, 71)},
+        {"carrier_test.pgm", makePnm(false, 131, 97)},
+        {"carrier_test.pcm", noise(40000, 4)},
+    };
+    for (auto &carrier : carriers){
+        writeBytes(carrier.first, carrier.second);
+        fileRoundTrip(carrier.first, "carrier_test_secret.txt", "", false);
+        fileRoundTrip(carrier.first, "carrier_test_secret.txt", "scatter key", false);
+        memoryRoundTrip(carrier.first, carrier.second, secret_text);
+        tooLarge(carrier.first, "carrier_test_big.txt");
+    }
+    //pcm is also copied through a chunk at a time when pipelined/streamed, see Handler::streamSamples
+    fileRoundTrip("carrier_test.pcm", "carrier_test_secret.txt", "", true);
+
+    //the format comes from the content: a bmp under another name is still a bmp
+    writeBytes("carrier_test_bmp.ppm", carriers[0].second);
+    Handler renamed("carrier_test_bmp.ppm");
+    CHECK(renamed.getExt() == ".bmp");
+    return checkFailures();
+}
@@ -0,0 +1,21 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <iostream>
+
+//minimal assertions for the CTest programs in this directory: a failed CHECK is reported and counted,
+//the test's main returns checkFailures() so ctest sees it fail without the rest being skipped
+inline int& checkFailures(){
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)){ \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed" << std::endl; \
+            checkFailures()++; \
+        } \
+    } while (0)
+
+#endif
@@ -0,0 +1,129 @@
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
+#include <filesystem>
+#include <sys/stat.h>
+#include "engine.hpp"
+#include "resultcache.hpp"
+#include "check.hpp"
+
+//ResultCache through Engine: a repeated encode is a hit, a changed input or setting is a miss,
+//and writing over an output never reaches the cache; files go to the working directory
+
+static void writeBytes(const std::string path, const std::vector<unsigned char> &bytes){
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(bytes.data()), (std::streamsize)bytes.size());
+}
+
+static void writeText(const std::string path, const std::string text){
+    writeBytes(path, std::vector<unsigned char>(text.begin(), text.end()));
+}
+
+static std::vector<unsigned char> readBytes(const std::string path){
+    std::ifstream file(path, std::ios::binary);
+    return std::vector<unsigned char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static std::string readText(const std::string path){
+    std::vector<unsigned char> bytes = readBytes(path);
+    return std::string(bytes.begin(), bytes.end());
+}
+
+static std::vector<unsigned char> makePpm(int width, int height){
+    std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+    std::vector<unsigned char> bytes(header.begin(), header.end());
+    uint32_t seed = 7;
+    for (int i = 0; i < width * height * 3; ++i){
+        seed = seed * 1664525u + 1013904223u;
+        bytes.push_back((unsigned char)(seed >> 24));
+    }
+    return bytes;
+}
+
+static EngineResult encode(Engine &engine, const std::string secret, const std::string output, const std::string key = ""){
+    EngineJob job;
+    job.type = JobType::ENCODE;
+    job.secret = secret;
+    job.carrier = "resultcache_test.ppm";
+    job.output = output;
+    job.scatter_key = key;
+    return engine.submit(job).get();
+}
+
+static std::string decode(Engine &engine, const std::string encoded, const std::string key = ""){
+    EngineJob job;
+    job.type = JobType::DECODE;
+    job.encoded = encoded;
+    job.output = encoded + "_secret";
+    job.scatter_key = key;
+    EngineResult result = engine.submit(job).get();
+    return result.success ? readText(result.output) : "";
+}
+
+static bool sameInode(const std::string a, const std::string b){
+    struct stat first, second;
+    return stat(a.c_str(), &first) == 0 && stat(b.c_str(), &second) == 0 &&
+           first.st_dev == second.st_dev && first.st_ino == second.st_ino;
+}
+
+int main(){
+    //entries from an earlier run would turn the first encode into a hit
+    std::filesystem::remove_all("resultcache_test_entries");
+    ResultCache &cache = ResultCache::instance();
+    CHECK(cache.setDirectory("resultcache_test_entries"));
+    CHECK(cache.enabled());
+    writeBytes("resultcache_test.ppm", makePpm(96, 64));
+    std::string secret = "resultcache_test_secret.txt";
+    writeText(secret, "first secret");
+    Engine engine(2);
+
+    //miss: encoded, then stored
+    EngineResult first = encode(engine, secret, "resultcache_test_a");
+    CHECK(first.success);
+    CHECK(!first.cached);
+    CHECK(decode(engine, first.output) == "first secret");
+
+    //hit: the same bytes without decoding anything, in a file of its own
+    EngineResult second = encode(engine, secret, "resultcache_test_b");
+    CHECK(second.success);
+    CHECK(second.cached);
+    CHECK(readBytes(second.output) == readBytes(first.output));
+    CHECK(!sameInode(first.output, second.output));
+
+    //writing over an output leaves the entry alone, the next hit is still the real encode
+    std::vector<unsigned char> expected = readBytes(first.output);
+    writeText(first.output, "overwritten");
+    writeText(second.output, "overwritten too");
+    EngineResult third = encode(engine, secret, "resultcache_test_c");
+    CHECK(third.cached);
+    CHECK(readBytes(third.output) == expected);
+    CHECK(decode(engine, third.output) == "first secret");
+
+    //a hit replaces an existing output instead of writing into it
+    EngineResult again = encode(engine, secret, "resultcache_test_c");
+    CHECK(again.cached);
+    CHECK(readBytes(again.output) == expected);
+
+    //another setting is another key
+    EngineResult keyed = encode(engine, secret, "resultcache_test_keyed", "key");
+    CHECK(keyed.success);
+    CHECK(!keyed.cached);
+    CHECK(decode(engine, keyed.output, "key") == "first secret");
+
+    //rewritten secret: its contents are hashed again, so it misses and encodes the new secret
+    writeText(secret, "second secret, longer");
+    EngineResult rewritten = encode(engine, secret, "resultcache_test_d");
+    CHECK(rewritten.success);
+    CHECK(!rewritten.cached);
+    CHECK(decode(engine, rewritten.output) == "second secret, longer");
+    CHECK(encode(engine, secret, "resultcache_test_e").cached);
+
+    //an input that can't be hashed is never looked up
+    ResultKey missing = cache.keyFor("resultcache_test_missing.txt", "resultcache_test.ppm", "", ".ppm");
+    CHECK(!missing.valid);
+    CHECK(!cache.fetch(missing, "resultcache_test_f.ppm"));
+
+    cache.setDirectory("");
+    return checkFailures();
+}
@@ -0,0 +1,54 @@
+#include <vector>
+#include <cstdint>
+#include "scatter.hpp"
+#include "check.hpp"
+
+//at() must be a bijection on [0, size) and indexOf() its inverse, or a scattered payload can't be found again
+static void checkPermutation(const std::string key, uint64_t size){
+    ScatterOrder order(key, size);
+    CHECK(order.size() == size);
+    std::vector<bool> seen(size, false);
+    for (uint64_t i = 0; i < size; ++i){
+        uint64_t position = order.at(i);
+        CHECK(position < size);
+        if (position >= size) return;
+        CHECK(!seen[position]);
+        seen[position] = true;
+        CHECK(order.indexOf(position) == i);
+    }
+}
+
+int main(){
+    //odd and even bit counts, a power of two, and sizes just past one (the most cycle walking)
+    for (uint64_t size : {1ull, 2ull, 3ull, 7ull, 8ull, 9ull, 255ull, 256ull, 257ull, 1000ull, 4097ull, 65536ull, 100003ull}){
+        checkPermutation("key", size);
+    }
+    checkPermutation("", 1000);
+    checkPermutation("a much longer key with spaces and punctuation!", 12345);
+
+    //same key and size, same order; another key, another order
+    ScatterOrder first("key", 100000), again("key", 100000), other("kez", 100000);
+    int same = 0, moved = 0;
+    for (uint64_t i = 0; i < 1000; ++i){
+        if (first.at(i) == again.at(i)) same++;
+        if (first.at(i) != other.at(i)) moved++;
+    }
+    CHECK(same == 1000);
+    CHECK(moved > 990);
+
+    //spread over the whole carrier: the first payload bits don't all land in its first part
+    uint64_t highest = 0;
+    for (uint64_t i = 0; i < 64; ++i){
+        if (first.at(i) > highest) highest = first.at(i);
+    }
+    CHECK(highest > 50000);
+
+    //large sizes map in range and invert without building anything
+    ScatterOrder large("key", (1ull << 40) + 12345);
+    for (uint64_t i = 0; i < 100000; i += 997){
+        uint64_t position = large.at(i * 1000003);
+        CHECK(position < large.size());
+        CHECK(large.indexOf(position) == i * 1000003);
+    }
+    return checkFailures();
+}
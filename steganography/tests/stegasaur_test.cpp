@@ -0,0 +1,94 @@
+#include <string>
+#include <vector>
+#include <cstring>
+#include <csignal>
+#include "stegasaur.h"
+#include "check.hpp"
+
+//the C ABI as a host sees it: linked against libstegasaur.so and nothing but stegasaur.h
+
+static void hostSigbus(int){}
+
+//binary ppm: the format is sniffed from the header, whatever the name says
+static std::vector<unsigned char> makePpm(int width, int height){
+    std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+    std::vector<unsigned char> bytes(header.begin(), header.end());
+    uint32_t seed = 5;
+    for (int i = 0; i < width * height * 3; ++i){
+        seed = seed * 1664525u + 1013904223u;
+        bytes.push_back((unsigned char)(seed >> 24));
+    }
+    return bytes;
+}
+
+int main(){
+    CHECK(stega_abi_version() == STEGA_ABI_VERSION);
+    stega_set_log_level(STEGA_LOG_OFF);
+    //the library only borrows SIGBUS around mapped files, which memory buffers never are
+    signal(SIGBUS, hostSigbus);
+
+    stega_context* context = stega_context_create();
+    CHECK(context != NULL);
+    std::string secret = "the quick brown fox jumps over the lazy dog";
+    const unsigned char* secret_bytes = reinterpret_cast<const unsigned char*>(secret.data());
+    std::vector<unsigned char> carrier = makePpm(64, 48);
+
+    stega_probe_info info;
+    CHECK(stega_probe(context, carrier.data(), carrier.size(), "carrier.bin", &info) == STEGA_OK);
+    CHECK(std::string(info.format) == ".ppm");
+    CHECK(info.capacity == 64 * 48 * 3 / 8);
+    size_t capacity = 0;
+    CHECK(stega_capacity(context, carrier.data(), carrier.size(), "carrier.bin", &capacity) == STEGA_OK);
+    CHECK(capacity == info.capacity);
+
+    //no buffer: the size needed comes back and the output is held for stega_take_output
+    size_t encoded_size = 0;
+    CHECK(stega_encode(context, secret_bytes, secret.size(), "secret.txt", carrier.data(), carrier.size(), "carrier.ppm",
+                       NULL, 0, &encoded_size) == STEGA_ERR_BUFFER_TOO_SMALL);
+    CHECK(encoded_size == carrier.size());
+    CHECK(strlen(stega_last_error(context)) > 0);
+    std::vector<unsigned char> encoded(encoded_size);
+    size_t taken = 0;
+    CHECK(stega_take_output(context, encoded.data(), encoded.size(), &taken) == STEGA_OK);
+    CHECK(taken == encoded_size);
+    CHECK(encoded != carrier);
+
+    //taken once, after that there's nothing held
+    CHECK(stega_take_output(context, encoded.data(), encoded.size(), &taken) == STEGA_OK);
+    CHECK(taken == 0);
+
+    //a buffer that's big enough gets the same bytes straight away
+    std::vector<unsigned char> direct(carrier.size() + 100);
+    size_t direct_size = 0;
+    CHECK(stega_encode(context, secret_bytes, secret.size(), "secret.txt", carrier.data(), carrier.size(), "carrier.ppm",
+                       direct.data(), direct.size(), &direct_size) == STEGA_OK);
+    CHECK(direct_size == encoded_size);
+
+    std::vector<unsigned char> decoded(secret.size() + 64);
+    size_t decoded_size = 0;
+    char ext[16] = {0};
+    CHECK(stega_decode(context, encoded.data(), encoded.size(), "encoded.ppm", decoded.data(), decoded.size(), &decoded_size,
+                       ext, sizeof(ext)) == STEGA_OK);
+    CHECK(std::string(ext) == ".txt");
+    CHECK(std::string(reinterpret_cast<const char*>(decoded.data()), decoded_size) == secret);
+
+    //failures come back as statuses with a message, never as an exit
+    CHECK(stega_decode(context, carrier.data(), carrier.size(), "carrier.ppm", decoded.data(), decoded.size(), &decoded_size,
+                       ext, sizeof(ext)) == STEGA_ERR_NO_PAYLOAD);
+    CHECK(strlen(stega_last_error(context)) > 0);
+    std::vector<unsigned char> big(carrier.size(), 'x');
+    CHECK(stega_encode(context, big.data(), big.size(), "big.txt", carrier.data(), carrier.size(), "carrier.ppm",
+                       direct.data(), direct.size(), &direct_size) == STEGA_ERR_CAPACITY);
+    const unsigned char text[] = "not a carrier";
+    CHECK(stega_encode(context, secret_bytes, secret.size(), "secret.txt", text, sizeof(text), "carrier.xyz",
+                       direct.data(), direct.size(), &direct_size) == STEGA_ERR_UNSUPPORTED_FORMAT);
+    CHECK(stega_encode(context, NULL, 0, "secret.txt", carrier.data(), carrier.size(), "carrier.ppm",
+                       direct.data(), direct.size(), &direct_size) == STEGA_ERR_INVALID_ARGUMENT);
+    CHECK(stega_probe(NULL, carrier.data(), carrier.size(), "carrier.ppm", &info) == STEGA_ERR_INVALID_ARGUMENT);
+
+    struct sigaction now;
+    sigaction(SIGBUS, NULL, &now);
+    CHECK(now.sa_handler == hostSigbus);
+    stega_context_destroy(context);
+    return checkFailures();
+}
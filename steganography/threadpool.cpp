@@ -0,0 +1,98 @@
+#include "threadpool.hpp"
+#include "logger.hpp"
+
+//which pool/worker the current thread belongs to, so submit() can push locally
+static thread_local ThreadPool* current_pool = nullptr;
+static thread_local unsigned int current_index = 0;
+
+ThreadPool::ThreadPool(unsigned int workers){
+    if (workers == 0) workers = 1;
+    for (unsigned int i = 0; i < workers; ++i){
+        queues.emplace_back(new WorkQueue());
+    }
+    for (unsigned int i = 0; i < workers; ++i){
+        threads.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool(){
+    {
+        std::lock_guard<std::mutex> guard(sleep_lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &t : threads) t.join();
+}
+
+void ThreadPool::submit(std::function<void()> task){
+    unsigned int index;
+    if (current_pool == this){
+        index = current_index;
+    }
+    else {
+        index = next_queue.fetch_add(1) % queues.size();
+    }
+    //count the task before it becomes visible so pending never underflows
+    //taking sleep_lock orders this against a worker checking pending before it sleeps
+    {
+        std::lock_guard<std::mutex> guard(sleep_lock);
+        pending.fetch_add(1);
+    }
+    {
+        std::lock_guard<std::mutex> guard(queues[index]->lock);
+        queues[index]->tasks.push_back(std::move(task));
+    }
+    wake.notify_one();
+}
+
+bool ThreadPool::popTask(unsigned int index, std::function<void()> &task){
+    //own queue first, newest task (LIFO)
+    {
+        std::lock_guard<std::mutex> guard(queues[index]->lock);
+        if (!queues[index]->tasks.empty()){
+            task = std::move(queues[index]->tasks.back());
+            queues[index]->tasks.pop_back();
+            return true;
+        }
+    }
+    //then steal the oldest task (FIFO) from the other workers
+    for (size_t i = 1; i < queues.size(); ++i){
+        WorkQueue &victim = *queues[(index + i) % queues.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tasks.empty()){
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::workerLoop(unsigned int index){
+    current_pool = this;
+    current_index = index;
+    std::function<void()> task;
+    while (true){
+        if (popTask(index, task)){
+            pending.fetch_sub(1);
+            try {
+                task();
+            }
+            catch (const std::exception &e){
+                LOG_ERROR("Error: Worker task threw: " << e.what());
+            }
+            catch (...){
+                LOG_ERROR("Error: Worker task threw an unknown exception");
+            }
+            task = nullptr;
+            continue;
+        }
+        std::unique_lock<std::mutex> guard(sleep_lock);
+        wake.wait(guard, [this](){ return pending.load() > 0 || stopping; });
+        if (stopping && pending.load() == 0) return;
+    }
+}
+
+unsigned int ThreadPool::getWorkerCount() const{
+    return static_cast<unsigned int>(threads.size());
+}
@@ -0,0 +1,40 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <memory>
+
+//work-stealing thread pool
+//each worker owns a deque: it pops its own newest task, idle workers steal the oldest task from others
+//tasks submitted from inside a worker go to that worker's deque so a job's next stage stays cache-warm
+class ThreadPool{
+    public:
+        ThreadPool(unsigned int workers);
+        ~ThreadPool(); //finishes every queued task before joining
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+        void submit(std::function<void()> task);
+        unsigned int getWorkerCount() const;
+    private:
+        struct WorkQueue{
+            std::mutex lock;
+            std::deque<std::function<void()>> tasks;
+        };
+        std::vector<std::unique_ptr<WorkQueue>> queues;
+        std::vector<std::thread> threads;
+        std::mutex sleep_lock;
+        std::condition_variable wake;
+        std::atomic<size_t> pending{0};
+        std::atomic<unsigned int> next_queue{0};
+        bool stopping = false;
+        bool popTask(unsigned int index, std::function<void()> &task);
+        void workerLoop(unsigned int index);
+};
+
+#endif
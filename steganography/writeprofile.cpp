@@ -0,0 +1,49 @@
+#include <zlib.h>
+#include "writeprofile.hpp"
+
+WriteSettings writeSettings(WriteProfile profile){
+    switch (profile){
+        case WriteProfile::FAST:
+            //one cheap filter and a fast run-length deflate
+            return WriteSettings{1, Z_RLE, PngFilter::UP, false};
+        case WriteProfile::BALANCED:
+            return WriteSettings{6, Z_FILTERED, PngFilter::ADAPTIVE, true};
+        case WriteProfile::AUTO:
+            return WriteSettings{6, Z_FILTERED, PngFilter::AUTO, true};
+        case WriteProfile::SMALLEST:
+        default:
+            return WriteSettings{Z_BEST_COMPRESSION, Z_FILTERED, PngFilter::ADAPTIVE, true};
+    }
+}
+
+std::string profileName(WriteProfile profile){
+    switch (profile){
+        case WriteProfile::FAST: return "fast";
+        case WriteProfile::BALANCED: return "balanced";
+        case WriteProfile::AUTO: return "auto";
+        case WriteProfile::SMALLEST:
+        default: return "smallest";
+    }
+}
+
+bool parseWriteProfile(const std::string name, WriteProfile &profile){
+    if (name == "fast") profile = WriteProfile::FAST;
+    else if (name == "balanced") profile = WriteProfile::BALANCED;
+    else if (name == "smallest") profile = WriteProfile::SMALLEST;
+    else if (name == "auto") profile = WriteProfile::AUTO;
+    else return false;
+    return true;
+}
+
+std::string filterName(PngFilter filter){
+    switch (filter){
+        case PngFilter::NONE: return "none";
+        case PngFilter::SUB: return "sub";
+        case PngFilter::UP: return "up";
+        case PngFilter::AVERAGE: return "average";
+        case PngFilter::PAETH: return "paeth";
+        case PngFilter::ADAPTIVE: return "adaptive";
+        case PngFilter::AUTO:
+        default: return "auto";
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef WRITEPROFILE_H
+#define WRITEPROFILE_H
+
+#include <string>
+#include "pngwriter.hpp"
+
+//speed/size trade-off for encoded outputs
+//fast: interactive use, smallest: archival (the default, what StegaSaur always wrote)
+//auto: balanced compression with the png filter picked by sampling rows
+enum class WriteProfile{ FAST, BALANCED, SMALLEST, AUTO };
+
+struct WriteSettings{
+    int zlib_level;
+    int zlib_strategy;
+    PngFilter png_filter;
+    bool jpeg_optimize; //optimized huffman tables, lossless so embedded coefficients are untouched
+};
+
+WriteSettings writeSettings(WriteProfile profile);
+std::string profileName(WriteProfile profile);
+bool parseWriteProfile(const std::string name, WriteProfile &profile);
+std::string filterName(PngFilter filter);
+
+#endif